@@ -0,0 +1,122 @@
+#include "AllocationCounter.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// Replacing the global allocation functions is the only way to see allocations made inside the STL,
+// so everything below just counts and then does what the default versions would
+
+namespace
+{
+	std::atomic<unsigned long long> s_totalAllocations{ 0 };
+	unsigned long long s_frameStartAllocations = 0;
+	unsigned long long s_lastFrameAllocations = 0;
+
+	void* CountedAllocate(size_t size)
+	{
+		s_totalAllocations.fetch_add(1, std::memory_order_relaxed);
+
+		if (size == 0) size = 1;
+		return std::malloc(size);
+	}
+
+	void* CountedAllocateAligned(size_t size, size_t alignment)
+	{
+		s_totalAllocations.fetch_add(1, std::memory_order_relaxed);
+
+		if (size == 0) size = 1;
+#ifdef _MSC_VER
+		return _aligned_malloc(size, alignment);
+#else
+		return std::aligned_alloc(alignment, (size + alignment - 1) & ~(alignment - 1));
+#endif
+	}
+
+	void FreeAligned(void* memory)
+	{
+#ifdef _MSC_VER
+		_aligned_free(memory);
+#else
+		std::free(memory);
+#endif
+	}
+}
+
+namespace AllocationCounter
+{
+	unsigned long long GetTotalAllocations()
+	{
+		return s_totalAllocations.load(std::memory_order_relaxed);
+	}
+
+	void EndFrame()
+	{
+		unsigned long long total = GetTotalAllocations();
+		s_lastFrameAllocations = total - s_frameStartAllocations;
+		s_frameStartAllocations = total;
+	}
+
+	unsigned long long GetLastFrameAllocations()
+	{
+		return s_lastFrameAllocations;
+	}
+}
+
+void* operator new(size_t size)
+{
+	void* memory = CountedAllocate(size);
+	if (memory == nullptr) throw std::bad_alloc();
+	return memory;
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+	return CountedAllocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+	return CountedAllocate(size);
+}
+
+void* operator new(size_t size, std::align_val_t alignment)
+{
+	void* memory = CountedAllocateAligned(size, static_cast<size_t>(alignment));
+	if (memory == nullptr) throw std::bad_alloc();
+	return memory;
+}
+
+void* operator new[](size_t size, std::align_val_t alignment)
+{
+	return operator new(size, alignment);
+}
+
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	return CountedAllocateAligned(size, static_cast<size_t>(alignment));
+}
+
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	return CountedAllocateAligned(size, static_cast<size_t>(alignment));
+}
+
+void operator delete(void* memory) noexcept { std::free(memory); }
+void operator delete[](void* memory) noexcept { std::free(memory); }
+void operator delete(void* memory, size_t) noexcept { std::free(memory); }
+void operator delete[](void* memory, size_t) noexcept { std::free(memory); }
+void operator delete(void* memory, const std::nothrow_t&) noexcept { std::free(memory); }
+void operator delete[](void* memory, const std::nothrow_t&) noexcept { std::free(memory); }
+
+void operator delete(void* memory, std::align_val_t) noexcept { FreeAligned(memory); }
+void operator delete[](void* memory, std::align_val_t) noexcept { FreeAligned(memory); }
+void operator delete(void* memory, size_t, std::align_val_t) noexcept { FreeAligned(memory); }
+void operator delete[](void* memory, size_t, std::align_val_t) noexcept { FreeAligned(memory); }
+void operator delete(void* memory, std::align_val_t, const std::nothrow_t&) noexcept { FreeAligned(memory); }
+void operator delete[](void* memory, std::align_val_t, const std::nothrow_t&) noexcept { FreeAligned(memory); }
@@ -0,0 +1,15 @@
+// Counts heap allocations made through operator new so the per frame allocation rate can be shown in ImGui
+
+#pragma once
+
+namespace AllocationCounter
+{
+	/// Every operator new call since startup, from any thread.
+	unsigned long long GetTotalAllocations();
+
+	/// Marks the end of a frame, called once per frame by the render thread.
+	void EndFrame();
+
+	/// How many allocations happened between the last two EndFrame calls.
+	unsigned long long GetLastFrameAllocations();
+}
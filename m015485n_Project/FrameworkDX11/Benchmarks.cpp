@@ -0,0 +1,2993 @@
+#include "Benchmarks.h"
+
+#include <windows.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <climits>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <thread>
+
+#include "ClusteredLights.h"
+#include "CommandListRecorder.h"
+#include "ConstantRingBuffer.h"
+#include "DynamicAabbTree.h"
+#include "FrustumCuller.h"
+#include "GBufferEncoding.h"
+#include "GameObject.h"
+#include "JobSystem.h"
+#include "LightBuffer.h"
+#include "MeshBvh.h"
+#include "ObjectPool.h"
+#include "OcclusionCuller.h"
+#include "RenderGraph.h"
+#include "RenderQueue.h"
+#include "Scene.h"
+#include "SceneFile.h"
+#include "ShaderPermutations.h"
+#include "StateTrackingContext.h"
+#include "StressTest.h"
+
+namespace
+{
+	const char* RESULTS_FILE_NAME = "benchmark_results.txt";
+
+	typedef std::chrono::steady_clock Clock;
+
+	double MillisecondsSince(Clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+
+	GameObject* CreateBenchmarkObject(std::mt19937& random)
+	{
+		std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+		GameObject* object = new GameObject(XMFLOAT3(position(random), position(random), position(random)), XMFLOAT3(0, 0, 0), XMFLOAT3(1, 1, 1), "Benchmark Object", MeshData(), nullptr, nullptr, nullptr);
+		object->m_autoRotateY = true;
+		return object;
+	}
+
+	// ----- object-pool -----
+	// Spawns 100k objects, churns half of them a few times so the heap gets fragmented the way a long
+	// running scene would, then times updating every object. Once with separately new'd objects behind
+	// a vector of pointers (how the scene used to store them) and once with the pool.
+
+	constexpr size_t POOL_OBJECT_COUNT = 100000;
+	constexpr int POOL_CHURN_ROUNDS = 4;
+	constexpr int POOL_UPDATE_PASSES = 20;
+
+	void RunObjectPoolBenchmark(BenchmarkReport& report)
+	{
+		const float deltaTime = 1.0f / 60.0f;
+
+		// Pointer per object
+		{
+			std::mt19937 random(1234);
+			std::vector<GameObject*> objects;
+			objects.reserve(POOL_OBJECT_COUNT);
+
+			auto start = Clock::now();
+			for (size_t i = 0; i < POOL_OBJECT_COUNT; ++i) objects.push_back(CreateBenchmarkObject(random));
+			report.Add("heap_spawn", MillisecondsSince(start) * 1000000.0 / POOL_OBJECT_COUNT, "ns/object");
+
+			start = Clock::now();
+			size_t churned = 0;
+			for (int round = 0; round < POOL_CHURN_ROUNDS; ++round)
+			{
+				const size_t victims = objects.size() / 2;
+				for (size_t i = 0; i < victims; ++i)
+				{
+					size_t victim = random() % objects.size();
+					delete objects[victim];
+					objects[victim] = objects.back();
+					objects.pop_back();
+					++churned;
+				}
+				while (objects.size() < POOL_OBJECT_COUNT) objects.push_back(CreateBenchmarkObject(random));
+			}
+			report.Add("heap_despawn_respawn", MillisecondsSince(start) * 1000000.0 / churned, "ns/object");
+
+			start = Clock::now();
+			for (int pass = 0; pass < POOL_UPDATE_PASSES; ++pass)
+			{
+				for (GameObject* object : objects) object->Update(deltaTime);
+			}
+			double updateMs = MillisecondsSince(start) / POOL_UPDATE_PASSES;
+			report.Add("heap_update_pass", updateMs, "ms");
+			report.Add("heap_update_throughput", POOL_OBJECT_COUNT / updateMs / 1000.0, "Mobjects/s");
+
+			for (GameObject* object : objects) delete object;
+		}
+
+		// Pooled
+		{
+			std::mt19937 random(1234);
+			ObjectPool<GameObject> pool;
+			std::vector<PoolHandle> handles;
+			handles.reserve(POOL_OBJECT_COUNT);
+
+			std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+			auto spawn = [&]()
+				{
+					PoolHandle handle = pool.Create(XMFLOAT3(position(random), position(random), position(random)), XMFLOAT3(0, 0, 0), XMFLOAT3(1, 1, 1), "Benchmark Object", MeshData(), nullptr, nullptr, nullptr);
+					pool.Get(handle)->m_autoRotateY = true;
+					handles.push_back(handle);
+				};
+
+			auto start = Clock::now();
+			for (size_t i = 0; i < POOL_OBJECT_COUNT; ++i) spawn();
+			report.Add("pool_spawn", MillisecondsSince(start) * 1000000.0 / POOL_OBJECT_COUNT, "ns/object");
+
+			start = Clock::now();
+			size_t churned = 0;
+			size_t staleHandlesResolved = 0;
+			for (int round = 0; round < POOL_CHURN_ROUNDS; ++round)
+			{
+				const size_t victims = handles.size() / 2;
+				for (size_t i = 0; i < victims; ++i)
+				{
+					size_t victim = random() % handles.size();
+					PoolHandle stale = handles[victim];
+					pool.Destroy(stale);
+					if (pool.Get(stale) != nullptr) ++staleHandlesResolved;
+
+					handles[victim] = handles.back();
+					handles.pop_back();
+					++churned;
+				}
+				while (handles.size() < POOL_OBJECT_COUNT) spawn();
+			}
+			report.Add("pool_despawn_respawn", MillisecondsSince(start) * 1000000.0 / churned, "ns/object");
+
+			report.Check("destroyed handles resolve to nullptr", staleHandlesResolved == 0);
+			report.Check("live count matches", pool.Size() == POOL_OBJECT_COUNT);
+
+			start = Clock::now();
+			for (int pass = 0; pass < POOL_UPDATE_PASSES; ++pass)
+			{
+				pool.ForEach([&](GameObject& object) { object.Update(deltaTime); });
+			}
+			double updateMs = MillisecondsSince(start) / POOL_UPDATE_PASSES;
+			report.Add("pool_update_pass", updateMs, "ms");
+			report.Add("pool_update_throughput", POOL_OBJECT_COUNT / updateMs / 1000.0, "Mobjects/s");
+		}
+	}
+
+	// ----- rotation -----
+	// Rotations used to be stored as Euler angles, rebuilt into three matrices every update and converted back
+	// from the gizmo's quaternion on every edit. LegacyEulerTransform is that old path kept here for comparison.
+
+	constexpr int ROTATION_GIZMO_EDITS = 5000;
+	constexpr size_t ROTATION_OBJECT_COUNT = 100000;
+	constexpr int ROTATION_UPDATE_PASSES = 20;
+
+	struct LegacyEulerTransform
+	{
+		XMFLOAT3	Position;
+		XMFLOAT3	Rotation;
+		XMFLOAT3	Scale;
+		XMFLOAT4X4	World;
+
+		void Update(float deltaTime, float speed)
+		{
+			Rotation.x += speed * deltaTime;
+			Rotation.y += speed * deltaTime;
+			Rotation.z += speed * deltaTime;
+
+			XMMATRIX rotation = XMMatrixRotationX(XMConvertToRadians(Rotation.x)) * XMMatrixRotationY(XMConvertToRadians(Rotation.y)) * XMMatrixRotationZ(XMConvertToRadians(Rotation.z));
+			XMStoreFloat4x4(&World, XMMatrixScaling(Scale.x, Scale.y, Scale.z) * rotation * XMMatrixTranslation(Position.x, Position.y, Position.z));
+		}
+
+		void SetTransform(XMMATRIX transform)
+		{
+			XMVECTOR scaleVector, rotationQuatVector, translationVector;
+			XMMatrixDecompose(&scaleVector, &rotationQuatVector, &translationVector, transform);
+
+			XMFLOAT4 q;
+			XMStoreFloat4(&q, rotationQuatVector);
+			XMStoreFloat3(&Scale, scaleVector);
+			XMStoreFloat3(&Position, translationVector);
+
+			float t2 = 2.0f * (q.w * q.y - q.z * q.x);
+			t2 = (std::max)(-1.0f, (std::min)(1.0f, t2));
+			Rotation.x = XMConvertToDegrees(atan2f(2.0f * (q.w * q.x + q.y * q.z), 1.0f - 2.0f * (q.x * q.x + q.y * q.y)));
+			Rotation.y = XMConvertToDegrees(asinf(t2));
+			Rotation.z = XMConvertToDegrees(atan2f(2.0f * (q.w * q.z + q.x * q.y), 1.0f - 2.0f * (q.y * q.y + q.z * q.z)));
+		}
+	};
+
+	float MaxDifference(const XMFLOAT4X4& a, const XMFLOAT4X4& b)
+	{
+		float difference = 0.0f;
+		for (int row = 0; row < 4; ++row)
+		{
+			for (int column = 0; column < 4; ++column) difference = (std::max)(difference, fabsf(a.m[row][column] - b.m[row][column]));
+		}
+		return difference;
+	}
+
+	void RunRotationBenchmark(BenchmarkReport& report)
+	{
+		const XMFLOAT3 position(12.0f, -3.0f, 40.0f);
+		const XMFLOAT3 eulerDegrees(37.0f, -58.0f, 112.0f);
+		const XMFLOAT3 scale(2.0f, 0.5f, 1.5f);
+
+		// Hand the gizmo's matrix straight back every frame without moving it, the object shouldn't drift
+		{
+			GameObject object(position, eulerDegrees, scale, "Benchmark Object", MeshData(), nullptr, nullptr, nullptr);
+			object.Update(0.0f);
+			const XMFLOAT4X4 original = *object.GetTransform();
+
+			float worstError = 0.0f;
+			for (int edit = 0; edit < ROTATION_GIZMO_EDITS; ++edit)
+			{
+				object.SetTransform(XMLoadFloat4x4(object.GetTransform()));
+				object.Update(0.0f);
+				worstError = (std::max)(worstError, MaxDifference(original, *object.GetTransform()));
+			}
+			report.Add("quaternion_gizmo_drift", worstError, "max abs matrix error");
+			report.Check("repeated gizmo edits keep the transform", worstError < 1e-4f);
+
+			LegacyEulerTransform legacy{ position, eulerDegrees, scale };
+			legacy.Update(0.0f, 0.0f);
+			const XMFLOAT4X4 legacyOriginal = legacy.World;
+
+			float legacyWorstError = 0.0f;
+			for (int edit = 0; edit < ROTATION_GIZMO_EDITS; ++edit)
+			{
+				legacy.SetTransform(XMLoadFloat4x4(&legacy.World));
+				legacy.Update(0.0f, 0.0f);
+				legacyWorstError = (std::max)(legacyWorstError, MaxDifference(legacyOriginal, legacy.World));
+			}
+			report.Add("euler_gizmo_drift", legacyWorstError, "max abs matrix error");
+		}
+
+		// The Euler values shown in the UI should survive a round trip through the quaternion
+		{
+			float worstDegrees = 0.0f;
+			for (float x = -170.0f; x <= 170.0f; x += 17.0f)
+			{
+				for (float y = -85.0f; y <= 85.0f; y += 17.0f)
+				{
+					for (float z = -170.0f; z <= 170.0f; z += 17.0f)
+					{
+						XMFLOAT3 back = IRenderable::QuaternionToEulerDegrees(IRenderable::EulerDegreesToQuaternion(XMFLOAT3(x, y, z)));
+						worstDegrees = (std::max)({ worstDegrees, fabsf(back.x - x), fabsf(back.y - y), fabsf(back.z - z) });
+					}
+				}
+			}
+			report.Add("euler_round_trip_error", worstDegrees, "degrees");
+			report.Check("Euler angles round trip through the quaternion", worstDegrees < 0.01f);
+		}
+
+		// Per object update cost with all three auto rotate axes on
+		const float deltaTime = 1.0f / 60.0f;
+		{
+			ObjectPool<GameObject> pool;
+			for (size_t i = 0; i < ROTATION_OBJECT_COUNT; ++i)
+			{
+				GameObject* object = pool.Get(pool.Create(position, eulerDegrees, scale, "Benchmark Object", MeshData(), nullptr, nullptr, nullptr));
+				object->m_autoRotateX = object->m_autoRotateY = object->m_autoRotateZ = true;
+			}
+
+			auto start = Clock::now();
+			for (int pass = 0; pass < ROTATION_UPDATE_PASSES; ++pass)
+			{
+				pool.ForEach([&](GameObject& object) { object.Update(deltaTime); });
+			}
+			report.Add("quaternion_update", MillisecondsSince(start) * 1000000.0 / (ROTATION_OBJECT_COUNT * ROTATION_UPDATE_PASSES), "ns/object");
+		}
+		{
+			std::vector<LegacyEulerTransform> objects(ROTATION_OBJECT_COUNT, LegacyEulerTransform{ position, eulerDegrees, scale });
+
+			auto start = Clock::now();
+			for (int pass = 0; pass < ROTATION_UPDATE_PASSES; ++pass)
+			{
+				for (LegacyEulerTransform& object : objects) object.Update(deltaTime, 50.0f);
+			}
+			report.Add("euler_update", MillisecondsSince(start) * 1000000.0 / (ROTATION_OBJECT_COUNT * ROTATION_UPDATE_PASSES), "ns/object");
+		}
+	}
+
+	// ----- scene-file -----
+	// Writes a 100k object scene, checks everything comes back out of the mapped file unchanged and that a
+	// scene loaded from it saves back to the same bytes, then times mapping the file and loading the scene.
+
+	constexpr uint32_t SCENE_FILE_OBJECT_COUNT = 100000;
+	constexpr uint32_t SCENE_FILE_LIGHT_COUNT = 8;
+	constexpr int SCENE_FILE_MATERIAL_COUNT = 16;
+	const wchar_t* SCENE_FILE_NAME = L"benchmark.scene";
+	const wchar_t* SCENE_FILE_RESAVE_NAME = L"benchmark_resaved.scene";
+
+	SceneFile::SceneData CreateBenchmarkSceneData()
+	{
+		std::mt19937 random(1234);
+		std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+		std::uniform_real_distribution<float> angle(-180.0f, 180.0f);
+
+		SceneFile::SceneData scene;
+
+		std::vector<_Material> materials(SCENE_FILE_MATERIAL_COUNT);
+		for (_Material& material : materials)
+		{
+			material.Diffuse = XMFLOAT4(unit(random), unit(random), unit(random), 1.0f);
+			material.SpecularPower = 32.0f;
+		}
+
+		const uint32_t name = scene.AddString("Benchmark Object");
+		scene.Objects.reserve(SCENE_FILE_OBJECT_COUNT);
+		for (uint32_t i = 0; i < SCENE_FILE_OBJECT_COUNT; ++i)
+		{
+			SceneFile::ObjectRecord record = {};
+			record.Position = XMFLOAT3(position(random), position(random), position(random));
+			record.Rotation = IRenderable::EulerDegreesToQuaternion(XMFLOAT3(angle(random), angle(random), angle(random)));
+			record.Scale = XMFLOAT3(1.0f + unit(random), 1.0f + unit(random), 1.0f + unit(random));
+			record.OriginalPosition = record.Position;
+			record.OriginalRotation = record.Rotation;
+			record.OriginalScale = record.Scale;
+			record.Material = materials[random() % materials.size()];
+			record.OriginalMaterial = record.Material;
+			record.AutoRotationSpeed = 1.0f;
+			record.Flags = (i % 2 == 0) ? static_cast<uint32_t>(SceneFile::OBJECT_AUTO_ROTATE_Y) : 0u;
+			record.Name = name;
+			record.Model = SceneFile::NO_STRING;
+			record.Texture = SceneFile::NO_STRING;
+			record.NormalMap = SceneFile::NO_STRING;
+			record.PixelShader = SceneFile::NO_STRING;
+			scene.Objects.push_back(record);
+		}
+
+		scene.Lights.resize(SCENE_FILE_LIGHT_COUNT);
+		for (Light& light : scene.Lights)
+		{
+			light = {};
+			light.Position = XMFLOAT4(position(random), position(random), position(random), 1.0f);
+			light.Color = XMFLOAT4(unit(random), unit(random), unit(random), 1.0f);
+			light.ConstantAttenuation = 1.0f;
+			light.Enabled = 1;
+		}
+
+		scene.SplinePoints = { XMFLOAT4(0, 0, 0, 0), XMFLOAT4(0, 0, 5, 0), XMFLOAT4(5, 0, 5, 0), XMFLOAT4(0, 0, 0, 0) };
+		scene.SplineDuration = 3.0f;
+
+		return scene;
+	}
+
+	bool FilesMatch(const wchar_t* a, const wchar_t* b)
+	{
+		std::ifstream fileA(std::filesystem::path(a), std::ios::binary);
+		std::ifstream fileB(std::filesystem::path(b), std::ios::binary);
+		std::vector<char> bytesA((std::istreambuf_iterator<char>(fileA)), std::istreambuf_iterator<char>());
+		std::vector<char> bytesB((std::istreambuf_iterator<char>(fileB)), std::istreambuf_iterator<char>());
+		return !bytesA.empty() && bytesA == bytesB;
+	}
+
+	void RunSceneFileBenchmark(BenchmarkReport& report)
+	{
+		const SceneFile::SceneData scene = CreateBenchmarkSceneData();
+
+		auto start = Clock::now();
+		bool written = SceneFile::Write(SCENE_FILE_NAME, scene);
+		report.Add("write", MillisecondsSince(start), "ms");
+		report.Check("scene file written", written);
+		if (!written) return;
+
+		// Everything read back out of the mapping should match what went in
+		{
+			SceneFile::MappedFile file;
+			start = Clock::now();
+			bool opened = file.Open(SCENE_FILE_NAME);
+			report.Add("map_and_validate", MillisecondsSince(start), "ms");
+			report.Check("scene file maps and validates", opened);
+
+			if (opened)
+			{
+				const SceneFile::Header& header = file.GetHeader();
+				report.Check("counts match", header.ObjectCount == scene.Objects.size() && header.LightCount == scene.Lights.size()
+					&& header.SplinePointCount == scene.SplinePoints.size() && header.StringCount == scene.Strings.size());
+				report.Check("objects match", memcmp(file.GetObjects(), scene.Objects.data(), sizeof(SceneFile::ObjectRecord) * scene.Objects.size()) == 0);
+				report.Check("lights match", memcmp(file.GetLights(), scene.Lights.data(), sizeof(Light) * scene.Lights.size()) == 0);
+				report.Check("spline points match", memcmp(file.GetSplinePoints(), scene.SplinePoints.data(), sizeof(XMFLOAT4) * scene.SplinePoints.size()) == 0);
+
+				bool stringsMatch = true;
+				for (uint32_t i = 0; i < header.StringCount; ++i) stringsMatch &= file.GetString(i) == scene.Strings[i];
+				report.Check("strings match", stringsMatch);
+			}
+		}
+
+		// A scene without a device only has the CPU side, which is all the file holds
+		{
+			Scene loaded;
+			start = Clock::now();
+			bool loadedOk = loaded.LoadFromFile(SCENE_FILE_NAME);
+			double loadMs = MillisecondsSince(start);
+			report.Add("scene_load", loadMs, "ms");
+			report.Add("scene_load_per_object", loadMs * 1000000.0 / SCENE_FILE_OBJECT_COUNT, "ns/object");
+			report.Check("scene loads", loadedOk);
+			report.Check("loaded object count matches", loaded.m_gameObjects.Size() == SCENE_FILE_OBJECT_COUNT);
+			report.Check("loaded light count matches", loaded.GetLights().size() == SCENE_FILE_LIGHT_COUNT);
+
+			start = Clock::now();
+			bool resaved = loaded.SaveToFile(SCENE_FILE_RESAVE_NAME);
+			report.Add("scene_save", MillisecondsSince(start), "ms");
+			report.Check("saving the loaded scene gives the same file", resaved && FilesMatch(SCENE_FILE_NAME, SCENE_FILE_RESAVE_NAME));
+		}
+
+		DeleteFileW(SCENE_FILE_NAME);
+		DeleteFileW(SCENE_FILE_RESAVE_NAME);
+	}
+
+	// ----- stress -----
+	// The headless half of "-stress": checks the same seed builds the same scene, then runs the CPU phases
+	// for a short flight and writes the usual stress reports next to the benchmark results.
+
+	void RunStressBenchmark(BenchmarkReport& report)
+	{
+		StressTest::Settings settings;
+		settings.WarmupFrames = 30;
+		settings.FrameCount = 300;
+		settings.ReportName = L"benchmark_stress";
+
+		auto collectTransforms = [&settings]()
+			{
+				Scene scene;
+				scene.InitHeadless(1280, 720);
+				scene.CreateStressScene(settings);
+
+				std::vector<XMFLOAT4X4> transforms;
+				scene.m_gameObjects.ForEach([&](GameObject& object)
+					{
+						object.Update(0.0f);
+						transforms.push_back(*object.GetTransform());
+					});
+				scene.CleanUp();
+				return transforms;
+			};
+
+		std::vector<XMFLOAT4X4> first = collectTransforms();
+		std::vector<XMFLOAT4X4> second = collectTransforms();
+		report.Check("same seed spawns the same scene", first.size() == settings.ObjectCount
+			&& memcmp(first.data(), second.data(), sizeof(XMFLOAT4X4) * first.size()) == 0);
+
+		auto start = Clock::now();
+		report.Check("headless run writes its reports", StressTest::RunHeadless(settings));
+		report.Add("headless_run", MillisecondsSince(start), "ms");
+		report.Add("objects", settings.ObjectCount, "objects");
+
+		StressTest::Settings parsed;
+		report.Check("-pipelined is read from the command line", StressTest::ParseCommandLine(L"-stress -pipelined -objects 50000", parsed)
+			&& parsed.Pipelined && parsed.ObjectCount == 50000);
+		report.Check("parallel submission is on unless -serial-submission", parsed.ParallelSubmission
+			&& StressTest::ParseCommandLine(L"-stress -serial-submission", parsed) && !parsed.ParallelSubmission);
+
+		// Only rendered frames have a latency, it is summarised the same way as the phases
+		StressTest::Settings latencySettings;
+		latencySettings.WarmupFrames = 1;
+		latencySettings.FrameCount = 4;
+		StressTest::Recorder recorder(latencySettings);
+		for (int frame = 0; frame < 5; ++frame) recorder.EndFrame(1.0f, 10.0f * frame);
+		const StressTest::Recorder::Summary latency = recorder.SummariseLatency();
+		report.Check("latency is summarised per measured frame", latency.Mean == 25.0f && latency.P95 == 40.0f && latency.Max == 40.0f);
+	}
+
+	// ----- culling -----
+	// 100k random boxes around a camera, culled four at a time and checked box by box against
+	// DirectX::BoundingFrustum built from the same view and projection.
+
+	constexpr size_t CULLING_BOX_COUNT = 100000;
+	constexpr int CULLING_PASSES = 20;
+
+	void RunCullingBenchmark(BenchmarkReport& report)
+	{
+		// The same projection the scene camera uses
+		XMMATRIX view = XMMatrixLookToLH(XMVectorSet(0.0f, 3.0f, -10.0f, 1.0f), XMVectorSet(0.3f, -0.2f, 1.0f, 0.0f), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+		XMMATRIX projection = XMMatrixPerspectiveFovLH(XMConvertToRadians(90.0f), 1280.0f / 720.0f, 0.01f, 100.0f);
+
+		std::mt19937 random(1234);
+		std::uniform_real_distribution<float> position(-150.0f, 150.0f);
+		std::uniform_real_distribution<float> extent(0.1f, 3.0f);
+
+		std::vector<BoundingBox> boxes(CULLING_BOX_COUNT);
+		for (BoundingBox& box : boxes)
+		{
+			box.Center = XMFLOAT3(position(random), position(random), position(random));
+			box.Extents = XMFLOAT3(extent(random), extent(random), extent(random));
+		}
+
+		FrustumCuller culler;
+		culler.Reserve(CULLING_BOX_COUNT);
+		auto start = Clock::now();
+		for (const BoundingBox& box : boxes) culler.Add(box);
+		report.Add("fill", MillisecondsSince(start) * 1000000.0 / CULLING_BOX_COUNT, "ns/box");
+
+		const CullingFrustum frustum = CullingFrustum::FromViewProjection(view * projection);
+		std::vector<UINT> visible;
+		visible.reserve(CULLING_BOX_COUNT);
+
+		start = Clock::now();
+		for (int pass = 0; pass < CULLING_PASSES; ++pass) culler.Cull(frustum, visible);
+		double batchedMs = MillisecondsSince(start) / CULLING_PASSES;
+		report.Add("batched_cull", batchedMs, "ms");
+		report.Add("batched_cull_per_box", batchedMs * 1000000.0 / CULLING_BOX_COUNT, "ns/box");
+		report.Add("visible", static_cast<double>(visible.size()), "boxes");
+
+		BoundingFrustum reference(projection);
+		reference.Transform(reference, XMMatrixInverse(nullptr, view));
+
+		std::vector<char> referenceVisible(CULLING_BOX_COUNT, 0);
+		start = Clock::now();
+		for (int pass = 0; pass < CULLING_PASSES; ++pass)
+		{
+			for (size_t i = 0; i < CULLING_BOX_COUNT; ++i) referenceVisible[i] = reference.Contains(boxes[i]) != DISJOINT;
+		}
+		double referenceMs = MillisecondsSince(start) / CULLING_PASSES;
+		report.Add("bounding_frustum_cull", referenceMs, "ms");
+		report.Add("bounding_frustum_cull_per_box", referenceMs * 1000000.0 / CULLING_BOX_COUNT, "ns/box");
+
+		std::vector<char> scalarVisible(CULLING_BOX_COUNT, 0);
+		start = Clock::now();
+		for (int pass = 0; pass < CULLING_PASSES; ++pass)
+		{
+			for (size_t i = 0; i < CULLING_BOX_COUNT; ++i) scalarVisible[i] = frustum.IsVisible(boxes[i]);
+		}
+		report.Add("scalar_cull_per_box", MillisecondsSince(start) / CULLING_PASSES * 1000000.0 / CULLING_BOX_COUNT, "ns/box");
+
+		std::vector<char> batchedVisible(CULLING_BOX_COUNT, 0);
+		bool ordered = true;
+		for (size_t i = 0; i < visible.size(); ++i)
+		{
+			batchedVisible[visible[i]] = 1;
+			if (i > 0 && visible[i] <= visible[i - 1]) ordered = false;
+		}
+		report.Check("visible list is in order", ordered);
+
+		// The planes come out of the matrix here and out of slopes in BoundingFrustum, so a box sitting right
+		// on a plane can round either way. Anything more than that is a real disagreement
+		size_t referenceMismatches = 0;
+		size_t scalarMismatches = 0;
+		for (size_t i = 0; i < CULLING_BOX_COUNT; ++i)
+		{
+			if (batchedVisible[i] != referenceVisible[i]) ++referenceMismatches;
+			if (batchedVisible[i] != scalarVisible[i]) ++scalarMismatches;
+		}
+		report.Add("bounding_frustum_mismatches", static_cast<double>(referenceMismatches), "boxes");
+		report.Check("matches BoundingFrustum", referenceMismatches <= CULLING_BOX_COUNT / 10000);
+		report.Check("matches the single box test", scalarMismatches <= CULLING_BOX_COUNT / 10000);
+		report.Check("some boxes are culled and some kept", !visible.empty() && visible.size() < CULLING_BOX_COUNT);
+	}
+
+	// ----- bvh -----
+	// The dynamic AABB tree at 1k to 1M boxes: frustum, ray and overlap queries timed against brute force
+	// loops, and checked against them after building and again after moving and churning the boxes.
+
+	constexpr UINT BVH_QUERY_COUNT = 200;
+
+	// Each size is checked against a brute force scan of the same boxes before it is timed, then again after the
+	// boxes have been moved and some destroyed and recreated
+	void RunBvhSize(BenchmarkReport& report, UINT count)
+	{
+		const std::string suffix = "_" + std::to_string(count);
+
+		// The field grows with the count so the density, and the number of boxes in view, stays about the same
+		const float fieldSize = 150.0f * std::cbrt(count / 100000.0f);
+
+		std::mt19937 random(count);
+		std::uniform_real_distribution<float> position(-fieldSize, fieldSize);
+		std::uniform_real_distribution<float> extent(0.1f, 3.0f);
+		std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+		auto randomBox = [&]()
+			{
+				BoundingBox box;
+				box.Center = XMFLOAT3(position(random), position(random), position(random));
+				box.Extents = XMFLOAT3(extent(random), extent(random), extent(random));
+				return box;
+			};
+
+		std::vector<BoundingBox> boxes(count);
+		for (BoundingBox& box : boxes) box = randomBox();
+
+		DynamicAabbTree tree;
+		std::vector<int> proxies(count);
+		auto start = Clock::now();
+		for (UINT i = 0; i < count; ++i) proxies[i] = tree.CreateProxy(boxes[i], i);
+		report.Add("build" + suffix, MillisecondsSince(start) * 1000000.0 / count, "ns/box");
+		report.Add("height" + suffix, tree.GetHeight(), "levels");
+		report.Add("area_ratio" + suffix, tree.GetAreaRatio(), "");
+
+		XMMATRIX view = XMMatrixLookToLH(XMVectorSet(0.0f, 3.0f, -10.0f, 1.0f), XMVectorSet(0.3f, -0.2f, 1.0f, 0.0f), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+		XMMATRIX projection = XMMatrixPerspectiveFovLH(XMConvertToRadians(90.0f), 1280.0f / 720.0f, 0.01f, 100.0f);
+		const CullingFrustum frustum = CullingFrustum::FromViewProjection(view * projection);
+
+		std::vector<std::pair<XMFLOAT3, XMFLOAT3>> rays(BVH_QUERY_COUNT);
+		for (auto& [origin, direction] : rays)
+		{
+			origin = XMFLOAT3(position(random), position(random), position(random));
+			XMStoreFloat3(&direction, XMVector3Normalize(XMVectorSet(unit(random), unit(random), unit(random), 0.0f)));
+		}
+
+		std::vector<BoundingBox> overlapBoxes(BVH_QUERY_COUNT);
+		for (BoundingBox& box : overlapBoxes)
+		{
+			box = randomBox();
+			box.Extents = XMFLOAT3(5.0f, 5.0f, 5.0f);
+		}
+
+		// Brute force answers to all three queries, and whether the tree agrees with them
+		auto checkQueries = [&](const std::string& when)
+			{
+				std::vector<UINT> expected;
+				std::vector<UINT> found;
+
+				for (UINT i = 0; i < count; ++i)
+				{
+					if (proxies[i] != DynamicAabbTree::NULL_NODE && frustum.IsVisible(boxes[i])) expected.push_back(i);
+				}
+				tree.QueryFrustum(frustum, [&](uint32_t index) { found.push_back(index); });
+				std::sort(found.begin(), found.end());
+				const bool frustumMatches = found == expected;
+
+				bool overlapMatches = true;
+				for (const BoundingBox& query : overlapBoxes)
+				{
+					expected.clear();
+					found.clear();
+					for (UINT i = 0; i < count; ++i)
+					{
+						if (proxies[i] != DynamicAabbTree::NULL_NODE && boxes[i].Intersects(query)) expected.push_back(i);
+					}
+					tree.QueryOverlap(query, [&](uint32_t index) { found.push_back(index); return true; });
+					std::sort(found.begin(), found.end());
+					if (found != expected) overlapMatches = false;
+				}
+
+				// Compared by distance, a ray starting inside several boxes hits them all at 0
+				bool rayMatches = true;
+				for (const auto& [origin, direction] : rays)
+				{
+					float expectedDistance = FLT_MAX;
+					for (UINT i = 0; i < count; ++i)
+					{
+						float distance;
+						if (proxies[i] != DynamicAabbTree::NULL_NODE && boxes[i].Intersects(XMLoadFloat3(&origin), XMLoadFloat3(&direction), distance)) expectedDistance = (std::min)(expectedDistance, distance);
+					}
+
+					float foundDistance = FLT_MAX;
+					tree.RayCast(origin, direction, FLT_MAX, [&](uint32_t, float entry) { foundDistance = (std::min)(foundDistance, entry); return foundDistance; });
+
+					if (fabsf(foundDistance - expectedDistance) > 0.001f * (1.0f + expectedDistance)) rayMatches = false;
+				}
+
+				report.Check("frustum query matches brute force " + when + suffix, frustumMatches);
+				report.Check("overlap queries match brute force " + when + suffix, overlapMatches);
+				report.Check("ray casts match brute force " + when + suffix, rayMatches);
+				report.Check("tree is valid " + when + suffix, tree.Validate());
+			};
+
+		checkQueries("after building");
+
+		// Timings, tree first then the same work done by brute force
+		std::vector<UINT> visible;
+		visible.reserve(count);
+		DynamicAabbTree::QueryStats frustumStats;
+		start = Clock::now();
+		for (int pass = 0; pass < CULLING_PASSES; ++pass)
+		{
+			visible.clear();
+			frustumStats = tree.QueryFrustum(frustum, [&](uint32_t index) { visible.push_back(index); });
+		}
+		report.Add("tree_frustum" + suffix, MillisecondsSince(start) / CULLING_PASSES, "ms");
+		report.Add("tree_frustum_nodes_visited" + suffix, frustumStats.NodesVisited, "nodes");
+		report.Add("visible" + suffix, static_cast<double>(visible.size()), "boxes");
+
+		start = Clock::now();
+		for (int pass = 0; pass < CULLING_PASSES; ++pass)
+		{
+			visible.clear();
+			for (UINT i = 0; i < count; ++i)
+			{
+				if (frustum.IsVisible(boxes[i])) visible.push_back(i);
+			}
+		}
+		report.Add("brute_frustum" + suffix, MillisecondsSince(start) / CULLING_PASSES, "ms");
+
+		UINT rayNodesVisited = 0;
+		float sink = 0.0f;
+		start = Clock::now();
+		for (const auto& [origin, direction] : rays)
+		{
+			float nearest = FLT_MAX;
+			rayNodesVisited += tree.RayCast(origin, direction, FLT_MAX, [&](uint32_t, float entry) { nearest = (std::min)(nearest, entry); return nearest; }).NodesVisited;
+			sink += nearest;
+		}
+		report.Add("tree_ray" + suffix, MillisecondsSince(start) * 1000.0 / BVH_QUERY_COUNT, "us/ray");
+		report.Add("tree_ray_nodes_visited" + suffix, static_cast<double>(rayNodesVisited) / BVH_QUERY_COUNT, "nodes/ray");
+
+		start = Clock::now();
+		for (const auto& [origin, direction] : rays)
+		{
+			float nearest = FLT_MAX;
+			for (const BoundingBox& box : boxes)
+			{
+				float distance;
+				if (box.Intersects(XMLoadFloat3(&origin), XMLoadFloat3(&direction), distance)) nearest = (std::min)(nearest, distance);
+			}
+			sink += nearest;
+		}
+		report.Add("brute_ray" + suffix, MillisecondsSince(start) * 1000.0 / BVH_QUERY_COUNT, "us/ray");
+
+		UINT overlapResults = 0;
+		start = Clock::now();
+		for (const BoundingBox& query : overlapBoxes)
+		{
+			overlapResults += tree.QueryOverlap(query, [](uint32_t) { return true; }).Results;
+		}
+		report.Add("tree_overlap" + suffix, MillisecondsSince(start) * 1000.0 / BVH_QUERY_COUNT, "us/query");
+
+		start = Clock::now();
+		for (const BoundingBox& query : overlapBoxes)
+		{
+			for (const BoundingBox& box : boxes) overlapResults += box.Intersects(query) ? 1 : 0;
+		}
+		report.Add("brute_overlap" + suffix, MillisecondsSince(start) * 1000.0 / BVH_QUERY_COUNT, "us/query");
+
+		// Stops the brute force loops being optimised away
+		report.Add("checksum" + suffix, static_cast<double>(sink) + overlapResults, "");
+
+		// Every box drifts a little, most stay inside their fattened boxes and are only refitted
+		std::uniform_real_distribution<float> drift(-0.2f, 0.2f);
+		UINT reinserted = 0;
+		start = Clock::now();
+		for (UINT i = 0; i < count; ++i)
+		{
+			boxes[i].Center.x += drift(random);
+			boxes[i].Center.y += drift(random);
+			boxes[i].Center.z += drift(random);
+			if (tree.MoveProxy(proxies[i], boxes[i])) ++reinserted;
+		}
+		report.Add("move" + suffix, MillisecondsSince(start) * 1000000.0 / count, "ns/box");
+		report.Add("reinserted" + suffix, 100.0 * reinserted / count, "%");
+
+		// A tenth destroyed, and half of those created again somewhere else
+		for (UINT i = 0; i < count; i += 10)
+		{
+			tree.DestroyProxy(proxies[i]);
+			proxies[i] = DynamicAabbTree::NULL_NODE;
+		}
+		for (UINT i = 0; i < count; i += 20)
+		{
+			boxes[i] = randomBox();
+			proxies[i] = tree.CreateProxy(boxes[i], i);
+		}
+		report.Check("proxy count after churn" + suffix, tree.GetProxyCount() == count - (count + 9) / 10 + (count + 19) / 20);
+
+		checkQueries("after moving");
+	}
+
+	void RunBvhBenchmark(BenchmarkReport& report)
+	{
+		for (UINT count : { 1000u, 10000u, 100000u, 1000000u }) RunBvhSize(report, count);
+	}
+
+	// ----- occlusion -----
+	// A wall of occluders across the middle of the view with 100k boxes scattered in front of, behind and around it.
+	// Boxes that can be seen past the wall must never be culled, the ones well behind it should all go, and the
+	// buffer has to come out the same however many threads rasterize it.
+
+	constexpr UINT OCCLUSION_BOX_COUNT = 100000;
+	constexpr int OCCLUSION_PASSES = 20;
+
+	void RunOcclusionBenchmark(BenchmarkReport& report)
+	{
+		// A unit cube, front faces clockwise like the scene's meshes
+		OccluderMesh cube;
+		for (int corner = 0; corner < 8; ++corner)
+		{
+			cube.Positions.push_back(XMFLOAT3(corner & 1 ? 1.0f : -1.0f, corner & 2 ? 1.0f : -1.0f, corner & 4 ? 1.0f : -1.0f));
+		}
+		cube.Indices = { 0,2,1, 1,2,3, 4,5,6, 5,7,6, 0,1,4, 1,5,4, 2,6,3, 3,6,7, 0,4,2, 2,4,6, 1,3,5, 3,7,5 };
+
+		XMMATRIX view = XMMatrixLookToLH(XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f), XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+		XMMATRIX projection = XMMatrixPerspectiveFovLH(XMConvertToRadians(90.0f), 1280.0f / 720.0f, 0.01f, 100.0f);
+		XMMATRIX viewProjection = view * projection;
+
+		// An 8 x 8 grid of panels 10 in front of the camera, overlapping a little so there are no cracks between them
+		constexpr float WALL_DISTANCE = 10.0f;
+		constexpr float PANEL_HALF_SIZE = 1.05f;
+		constexpr float WALL_HALF_SIZE = 7.0f + PANEL_HALF_SIZE;
+		std::vector<XMMATRIX> panels;
+		for (int y = 0; y < 8; ++y)
+		{
+			for (int x = 0; x < 8; ++x)
+			{
+				panels.push_back(XMMatrixScaling(PANEL_HALF_SIZE, PANEL_HALF_SIZE, 0.1f) * XMMatrixTranslation(-7.0f + x * 2.0f, -7.0f + y * 2.0f, WALL_DISTANCE));
+			}
+		}
+
+		std::mt19937 random(1234);
+		std::uniform_real_distribution<float> across(-30.0f, 30.0f);
+		std::uniform_real_distribution<float> depth(1.0f, 90.0f);
+		std::uniform_real_distribution<float> extent(0.1f, 1.0f);
+
+		std::vector<BoundingBox> boxes(OCCLUSION_BOX_COUNT);
+		for (BoundingBox& box : boxes)
+		{
+			box.Center = XMFLOAT3(across(random), across(random), depth(random));
+			box.Extents = XMFLOAT3(extent(random), extent(random), extent(random));
+		}
+
+		// Only boxes in the frustum reach the occlusion test
+		const CullingFrustum frustum = CullingFrustum::FromViewProjection(viewProjection);
+		std::vector<UINT> inFrustum;
+		for (UINT i = 0; i < OCCLUSION_BOX_COUNT; ++i)
+		{
+			if (frustum.IsVisible(boxes[i])) inFrustum.push_back(i);
+		}
+
+		OcclusionCuller culler;
+		auto rasterize = [&]()
+			{
+				culler.BeginFrame(viewProjection);
+				for (FXMMATRIX panel : panels) culler.AddOccluder(cube, panel);
+				culler.Rasterize();
+			};
+
+		rasterize();
+		std::vector<float> threadedDepth(culler.GetDepth(), culler.GetDepth() + OcclusionCuller::WIDTH * OcclusionCuller::HEIGHT);
+
+		JobSystem& jobs = JobSystem::Get();
+		const unsigned int workerCount = jobs.GetWorkerCount();
+		jobs.SetWorkerCount(0);
+		rasterize();
+		jobs.SetWorkerCount(workerCount);
+		report.Check("same buffer on one thread as on all of them", memcmp(threadedDepth.data(), culler.GetDepth(), threadedDepth.size() * sizeof(float)) == 0);
+
+		std::vector<UINT> visible;
+		double rasterizeMs = 0.0;
+		double testMs = 0.0;
+		for (int pass = 0; pass < OCCLUSION_PASSES; ++pass)
+		{
+			auto start = Clock::now();
+			rasterize();
+			rasterizeMs += MillisecondsSince(start);
+
+			visible = inFrustum;
+			start = Clock::now();
+			culler.Cull(boxes, visible);
+			testMs += MillisecondsSince(start);
+		}
+		report.Add("occluder_triangles", culler.GetStats().Triangles, "triangles");
+		report.Add("rasterize", rasterizeMs / OCCLUSION_PASSES, "ms");
+		report.Add("test", testMs / OCCLUSION_PASSES, "ms");
+		report.Add("test_per_box", testMs / OCCLUSION_PASSES * 1000000.0 / inFrustum.size(), "ns/box");
+		report.Add("in_frustum", static_cast<double>(inFrustum.size()), "boxes");
+		report.Add("occlusion_culled", static_cast<double>(inFrustum.size() - visible.size()), "boxes");
+		report.Add("cull_rate", 100.0 * (inFrustum.size() - visible.size()) / inFrustum.size(), "%");
+
+		// Which boxes the wall really hides, worked out from where their corners are. A pixel of slack either side of
+		// the wall's edge for the ones that are neither clearly hidden nor clearly seen
+		const float pixelSize = 2.0f * WALL_DISTANCE / (XMVectorGetX(projection.r[0]) * OcclusionCuller::WIDTH);
+		size_t wrongfullyCulled = 0;
+		size_t hiddenBehindWall = 0;
+		size_t hiddenAndCulled = 0;
+		std::vector<char> kept(OCCLUSION_BOX_COUNT, 0);
+		for (UINT index : visible) kept[index] = 1;
+
+		for (UINT index : inFrustum)
+		{
+			XMFLOAT3 corners[BoundingBox::CORNER_COUNT];
+			boxes[index].GetCorners(corners);
+
+			bool anyVisible = false;
+			bool allWellHidden = true;
+			for (const XMFLOAT3& corner : corners)
+			{
+				// Where the line from the camera to the corner crosses the wall's front face
+				const float frontFace = WALL_DISTANCE - 0.1f;
+				float crossX = corner.x / corner.z * frontFace;
+				float crossY = corner.y / corner.z * frontFace;
+				bool behind = corner.z > frontFace;
+				if (!behind || fabsf(crossX) > WALL_HALF_SIZE + pixelSize || fabsf(crossY) > WALL_HALF_SIZE + pixelSize) anyVisible = true;
+				if (corner.z < frontFace + 0.05f || fabsf(crossX) > WALL_HALF_SIZE - pixelSize || fabsf(crossY) > WALL_HALF_SIZE - pixelSize) allWellHidden = false;
+			}
+
+			if (anyVisible && !kept[index]) ++wrongfullyCulled;
+			if (allWellHidden)
+			{
+				++hiddenBehindWall;
+				if (!kept[index]) ++hiddenAndCulled;
+			}
+		}
+		report.Check("nothing that can be seen is culled", wrongfullyCulled == 0);
+		report.Check("everything well behind the wall is culled", hiddenBehindWall > 0 && hiddenAndCulled == hiddenBehindWall);
+
+		BoundingBox inFront;
+		inFront.Center = XMFLOAT3(0.0f, 0.0f, 5.0f);
+		inFront.Extents = XMFLOAT3(0.5f, 0.5f, 0.5f);
+		BoundingBox straddlingNearPlane;
+		straddlingNearPlane.Center = XMFLOAT3(0.0f, 0.0f, 0.0f);
+		straddlingNearPlane.Extents = XMFLOAT3(1.0f, 1.0f, 1.0f);
+		report.Check("boxes in front of the wall or round the camera are kept", culler.IsVisible(inFront) && culler.IsVisible(straddlingNearPlane));
+
+		// The budget stops adding occluders rather than going over
+		culler.BeginFrame(viewProjection);
+		UINT added = 0;
+		while (culler.AddOccluder(cube, panels[0])) ++added;
+		report.Check("triangle budget is kept to", added == OcclusionCuller::TRIANGLE_BUDGET / 12);
+	}
+
+	// ----- picking -----
+	// Checks the triangle test on its own and the mesh tree against a loop over every triangle, then times picks
+	// against one mesh about the size of Camera.obj (17k triangles) and through a scene of 100k of them.
+
+	constexpr UINT PICK_SLICES = 128;
+	constexpr UINT PICK_STACKS = 66;
+	constexpr UINT PICK_CHECK_RAYS = 2000;
+	constexpr UINT PICK_TIMED_RAYS = 20000;
+	constexpr UINT PICK_SCENE_OBJECT_COUNT = 100000;
+	constexpr UINT PICK_SCENE_CHECK_RAYS = 200;
+
+	// A lumpy sphere, so rays can pass in and out of it several times. The rows at the poles have triangles with
+	// no area, which the triangle test has to skip
+	OccluderMesh CreatePickingMesh()
+	{
+		OccluderMesh mesh;
+		for (UINT stack = 0; stack <= PICK_STACKS; ++stack)
+		{
+			float polar = XM_PI * stack / PICK_STACKS;
+			for (UINT slice = 0; slice <= PICK_SLICES; ++slice)
+			{
+				float azimuth = XM_2PI * slice / PICK_SLICES;
+				float radius = 1.0f + 0.15f * sinf(azimuth * 7.0f) * sinf(polar * 5.0f);
+				mesh.Positions.push_back(XMFLOAT3(radius * sinf(polar) * cosf(azimuth), radius * cosf(polar), radius * sinf(polar) * sinf(azimuth)));
+			}
+		}
+
+		const UINT rowLength = PICK_SLICES + 1;
+		for (UINT stack = 0; stack < PICK_STACKS; ++stack)
+		{
+			for (UINT slice = 0; slice < PICK_SLICES; ++slice)
+			{
+				UINT corner = stack * rowLength + slice;
+				mesh.Indices.insert(mesh.Indices.end(), { corner, corner + 1, corner + rowLength, corner + 1, corner + rowLength + 1, corner + rowLength });
+			}
+		}
+		return mesh;
+	}
+
+	bool BruteForceRayCast(const OccluderMesh& mesh, const XMFLOAT3& origin, const XMFLOAT3& direction, float maxDistance, MeshBvh::Hit& hit)
+	{
+		bool found = false;
+		for (UINT triangle = 0; triangle < mesh.Indices.size() / 3; ++triangle)
+		{
+			float u, v;
+			float distance = MeshBvh::IntersectTriangle(origin, direction, mesh.Positions[mesh.Indices[triangle * 3]], mesh.Positions[mesh.Indices[triangle * 3 + 1]], mesh.Positions[mesh.Indices[triangle * 3 + 2]], &u, &v);
+			if (distance < 0.0f || distance >= maxDistance) continue;
+
+			maxDistance = distance;
+			hit.Distance = distance;
+			hit.Triangle = triangle;
+			hit.U = u;
+			hit.V = v;
+			found = true;
+		}
+		return found;
+	}
+
+	void RunPickingBenchmark(BenchmarkReport& report)
+	{
+		// One triangle in the z = 2 plane
+		{
+			const XMFLOAT3 v0(0.0f, 0.0f, 2.0f), v1(1.0f, 0.0f, 2.0f), v2(0.0f, 1.0f, 2.0f);
+			float u = -1.0f, v = -1.0f;
+			float distance = MeshBvh::IntersectTriangle(XMFLOAT3(0.25f, 0.5f, 0.0f), XMFLOAT3(0.0f, 0.0f, 1.0f), v0, v1, v2, &u, &v);
+			report.Check("ray through a triangle hits it at the right place", fabsf(distance - 2.0f) < 1e-5f && fabsf(u - 0.25f) < 1e-5f && fabsf(v - 0.5f) < 1e-5f);
+
+			report.Check("back faces are hit too", fabsf(MeshBvh::IntersectTriangle(XMFLOAT3(0.25f, 0.25f, 4.0f), XMFLOAT3(0.0f, 0.0f, -0.5f), v0, v1, v2) - 4.0f) < 1e-5f);
+			report.Check("ray past the triangle's edge misses", MeshBvh::IntersectTriangle(XMFLOAT3(0.6f, 0.6f, 0.0f), XMFLOAT3(0.0f, 0.0f, 1.0f), v0, v1, v2) < 0.0f);
+			report.Check("ray along the triangle's plane misses", MeshBvh::IntersectTriangle(XMFLOAT3(-1.0f, 0.25f, 2.0f), XMFLOAT3(1.0f, 0.0f, 0.0f), v0, v1, v2) < 0.0f);
+			report.Check("triangle behind the ray misses", MeshBvh::IntersectTriangle(XMFLOAT3(0.25f, 0.25f, 3.0f), XMFLOAT3(0.0f, 0.0f, 1.0f), v0, v1, v2) < 0.0f);
+
+			MeshBvh::Hit hit;
+			MeshBvh empty({}, {});
+			report.Check("empty mesh is never hit", !empty.RayCast(XMFLOAT3(0.0f, 0.0f, 0.0f), XMFLOAT3(0.0f, 0.0f, 1.0f), FLT_MAX, hit));
+		}
+
+		const OccluderMesh mesh = CreatePickingMesh();
+		const UINT triangleCount = static_cast<UINT>(mesh.Indices.size() / 3);
+		report.Add("mesh_triangles", triangleCount, "triangles");
+
+		auto start = Clock::now();
+		const MeshBvh bvh(mesh.Positions, mesh.Indices);
+		report.Add("mesh_build", MillisecondsSince(start), "ms");
+		report.Add("mesh_nodes", bvh.GetNodeCount(), "nodes");
+		report.Add("mesh_depth", bvh.GetDepth(), "levels");
+
+		// Rays from outside aimed at the mesh, most hit and some graze past. A few start inside it
+		std::mt19937 random(4242);
+		std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+		auto randomRay = [&](float originDistance, float spread)
+			{
+				XMVECTOR origin = XMVectorScale(XMVector3Normalize(XMVectorSet(unit(random), unit(random), unit(random), 0.0f)), originDistance);
+				XMVECTOR target = XMVectorSet(unit(random) * spread, unit(random) * spread, unit(random) * spread, 0.0f);
+				std::pair<XMFLOAT3, XMFLOAT3> ray;
+				XMStoreFloat3(&ray.first, origin);
+				XMStoreFloat3(&ray.second, XMVector3Normalize(XMVectorSubtract(target, origin)));
+				return ray;
+			};
+
+		std::vector<std::pair<XMFLOAT3, XMFLOAT3>> rays;
+		for (UINT i = 0; i < PICK_CHECK_RAYS; ++i) rays.push_back(randomRay(i % 10 == 0 ? 0.5f : 4.0f, 1.3f));
+
+		UINT hits = 0;
+		bool hitsMatch = true;
+		bool limitKept = true;
+		for (const auto& [origin, direction] : rays)
+		{
+			MeshBvh::Hit expected, found;
+			bool expectedHit = BruteForceRayCast(mesh, origin, direction, FLT_MAX, expected);
+			bool foundHit = bvh.RayCast(origin, direction, FLT_MAX, found);
+			if (expectedHit != foundHit) hitsMatch = false;
+			if (!expectedHit || !foundHit) continue;
+			++hits;
+
+			// Compared by distance, a ray through a shared edge hits both triangles at once
+			if (fabsf(found.Distance - expected.Distance) > 1e-5f * (1.0f + expected.Distance)) hitsMatch = false;
+
+			// Nothing is hit that isn't nearer than the limit
+			if (bvh.RayCast(origin, direction, expected.Distance * 0.999f, found)) limitKept = false;
+		}
+		report.Check("mesh tree finds the same nearest hits as testing every triangle", hitsMatch);
+		report.Check("mesh tree ignores hits past the max distance", limitKept);
+		report.Check("most check rays hit the mesh", hits > PICK_CHECK_RAYS / 2);
+
+		// Timed rays, the tree then every triangle for comparison
+		rays.clear();
+		for (UINT i = 0; i < PICK_TIMED_RAYS; ++i) rays.push_back(randomRay(4.0f, 1.3f));
+
+		float sink = 0.0f;
+		UINT nodesVisited = 0;
+		start = Clock::now();
+		for (const auto& [origin, direction] : rays)
+		{
+			MeshBvh::Hit hit;
+			UINT visited = 0;
+			if (bvh.RayCast(origin, direction, FLT_MAX, hit, &visited)) sink += hit.Distance;
+			nodesVisited += visited;
+		}
+		double meshMs = MillisecondsSince(start);
+		report.Add("mesh_ray", meshMs * 1000.0 / PICK_TIMED_RAYS, "us/ray");
+		report.Add("mesh_rays_per_second", PICK_TIMED_RAYS / meshMs * 1000.0, "rays/s");
+		report.Add("mesh_ray_nodes_visited", static_cast<double>(nodesVisited) / PICK_TIMED_RAYS, "nodes/ray");
+
+		const UINT bruteRays = PICK_TIMED_RAYS / 100;
+		start = Clock::now();
+		for (UINT i = 0; i < bruteRays; ++i)
+		{
+			MeshBvh::Hit hit;
+			if (BruteForceRayCast(mesh, rays[i].first, rays[i].second, FLT_MAX, hit)) sink += hit.Distance;
+		}
+		report.Add("brute_mesh_ray", MillisecondsSince(start) * 1000.0 / bruteRays, "us/ray");
+
+		// A big scene of the same mesh, picked through the object tree then each mesh's tree
+		Scene scene;
+		scene.InitHeadless(1280, 720);
+
+		MeshData meshData;
+		BoundingBox::CreateFromPoints(meshData.Bounds, mesh.Positions.size(), mesh.Positions.data(), sizeof(XMFLOAT3));
+		meshData.PickingBvh = std::make_shared<MeshBvh>(mesh.Positions, mesh.Indices);
+
+		std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+		std::uniform_real_distribution<float> angle(0.0f, 360.0f);
+		std::uniform_real_distribution<float> scale(0.5f, 2.0f);
+		for (UINT i = 0; i < PICK_SCENE_OBJECT_COUNT; ++i)
+		{
+			scene.m_gameObjects.Create(XMFLOAT3(position(random), position(random), position(random)), XMFLOAT3(angle(random), angle(random), angle(random)),
+				XMFLOAT3(scale(random), scale(random), scale(random)), "Picking Object", meshData, nullptr, nullptr, nullptr);
+		}
+		scene.m_gameObjects.ForEach([](GameObject& object) { object.Update(0.0f); });
+
+		RenderSnapshot snapshot;
+		scene.BuildSnapshot(snapshot);
+
+		auto sceneRay = [&]()
+			{
+				std::pair<XMFLOAT3, XMFLOAT3> ray;
+				ray.first = XMFLOAT3(position(random), position(random), position(random));
+				XMStoreFloat3(&ray.second, XMVector3Normalize(XMVectorSet(unit(random), unit(random), unit(random), 0.0f)));
+				return ray;
+			};
+
+		// Brute force pick, every object whose box the ray goes through tested against its mesh
+		bool picksMatch = true;
+		UINT scenePicks = 0;
+		for (UINT i = 0; i < PICK_SCENE_CHECK_RAYS; ++i)
+		{
+			auto [origin, direction] = sceneRay();
+
+			float expectedDistance = FLT_MAX;
+			scene.m_gameObjects.ForEach([&](GameObject& object)
+				{
+					float boxDistance;
+					if (!object.GetWorldBounds().Intersects(XMLoadFloat3(&origin), XMLoadFloat3(&direction), boxDistance)) return;
+
+					XMMATRIX inverseWorld = XMMatrixInverse(nullptr, XMLoadFloat4x4(object.GetTransform()));
+					XMFLOAT3 localOrigin, localDirection;
+					XMStoreFloat3(&localOrigin, XMVector3TransformCoord(XMLoadFloat3(&origin), inverseWorld));
+					XMStoreFloat3(&localDirection, XMVector3TransformNormal(XMLoadFloat3(&direction), inverseWorld));
+
+					MeshBvh::Hit hit;
+					if (BruteForceRayCast(mesh, localOrigin, localDirection, expectedDistance, hit)) expectedDistance = hit.Distance;
+				});
+
+			float foundDistance = FLT_MAX;
+			GameObjectHandle picked = scene.PickObject(origin, direction, &foundDistance);
+			if (picked.IsNull() != (expectedDistance == FLT_MAX)) picksMatch = false;
+			if (picked.IsNull() || expectedDistance == FLT_MAX) continue;
+
+			++scenePicks;
+			if (fabsf(foundDistance - expectedDistance) > 1e-4f * (1.0f + expectedDistance)) picksMatch = false;
+		}
+		report.Check("scene picks match testing every object's triangles", picksMatch);
+		report.Check("some scene check rays hit an object", scenePicks > 0);
+
+		rays.clear();
+		for (UINT i = 0; i < PICK_TIMED_RAYS; ++i) rays.push_back(sceneRay());
+
+		double slowestMs = 0.0;
+		start = Clock::now();
+		for (const auto& [origin, direction] : rays)
+		{
+			auto pickStart = Clock::now();
+			float distance;
+			if (!scene.PickObject(origin, direction, &distance).IsNull()) sink += distance;
+			slowestMs = (std::max)(slowestMs, MillisecondsSince(pickStart));
+		}
+		double sceneMs = MillisecondsSince(start);
+		report.Add("scene_pick", sceneMs * 1000.0 / PICK_TIMED_RAYS, "us/pick");
+		report.Add("scene_picks_per_second", PICK_TIMED_RAYS / sceneMs * 1000.0, "picks/s");
+		report.Add("scene_slowest_pick", slowestMs * 1000.0, "us");
+		report.Check("picks take under a millisecond on average", sceneMs / PICK_TIMED_RAYS < 1.0);
+
+		report.Add("checksum", sink, "");
+		scene.CleanUp();
+	}
+
+	// ----- clusters -----
+	// Thousands of point and spot lights scattered through and round the view, put into the light clusters. Every
+	// point a light can reach has to land in a cluster that lists it, every listed light has to touch its cluster, and
+	// the lists have to come out the same however many threads build them.
+
+	constexpr UINT CLUSTER_LIGHT_COUNTS[] = { 256, 1024, 4096 };
+	constexpr UINT CLUSTER_CHECK_SAMPLES = 16;
+	constexpr int CLUSTER_PASSES = 20;
+
+	std::vector<Light> MakeClusterLights(UINT count, std::mt19937& random)
+	{
+		std::uniform_real_distribution<float> across(-60.0f, 60.0f);
+		std::uniform_real_distribution<float> depth(-5.0f, 110.0f);
+		std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+		std::uniform_real_distribution<float> colour(0.1f, 1.0f);
+		std::uniform_real_distribution<float> linear(0.1f, 1.0f);
+		std::uniform_real_distribution<float> quadratic(0.5f, 4.0f);
+		std::uniform_real_distribution<float> cone(0.3f, 0.95f);
+
+		std::vector<Light> lights(count);
+		for (UINT i = 0; i < count; ++i)
+		{
+			Light& light = lights[i];
+			light.Enabled = i % 17 != 0;
+			light.LightType = i % 3 == 0 ? SpotLight : PointLight;
+			light.Position = XMFLOAT4(across(random), across(random), depth(random), 1.0f);
+			XMStoreFloat4(&light.Direction, XMVector3Normalize(XMVectorSet(unit(random), unit(random), unit(random), 0.0f)));
+			light.Color = XMFLOAT4(colour(random), colour(random), colour(random), 1.0f);
+			light.SpotAngle = cone(random);
+			light.ConstantAttenuation = 1.0f;
+			light.LinearAttenuation = linear(random);
+			light.QuadraticAttenuation = quadratic(random);
+		}
+		return lights;
+	}
+
+	// A random point a point or spot light reaches, false when the one picked is outside a spot light's cone
+	bool SampleLitPoint(const Light& light, float range, std::mt19937& random, XMVECTOR& point)
+	{
+		std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+		std::uniform_real_distribution<float> fraction(0.0f, 1.0f);
+
+		XMVECTOR direction = XMVector3Normalize(XMVectorSet(unit(random), unit(random), unit(random), 0.0f));
+		if (light.LightType == SpotLight)
+		{
+			// Bend the sample into the cone, the shader only lights where this cosine is above SpotAngle
+			direction = XMVector3Normalize(XMVectorMultiplyAdd(XMLoadFloat4(&light.Direction), XMVectorReplicate(2.0f), direction));
+			if (XMVectorGetX(XMVector3Dot(direction, XMLoadFloat4(&light.Direction))) <= light.SpotAngle) return false;
+		}
+
+		point = XMVectorSetW(XMVectorMultiplyAdd(direction, XMVectorReplicate(range * fraction(random) * 0.999f), XMLoadFloat4(&light.Position)), 1.0f);
+		return true;
+	}
+
+	void RunClustersBenchmark(BenchmarkReport& report)
+	{
+		// Ranges, the attenuation at the range is the cutoff for the light's brightest channel
+		Light light;
+		light.LightType = PointLight;
+		light.Color = XMFLOAT4(0.5f, 2.0f, 1.0f, 1.0f);
+		light.ConstantAttenuation = 1.0f;
+		light.LinearAttenuation = 0.5f;
+		light.QuadraticAttenuation = 0.25f;
+		float range = LightClusterGrid::ComputeLightRange(light);
+		float attenuation = 1.0f / (light.ConstantAttenuation + light.LinearAttenuation * range + light.QuadraticAttenuation * range * range);
+		report.Check("light range is where the brightest channel reaches the cutoff", fabsf(attenuation * 2.0f - LightClusterGrid::DEFAULT_CUTOFF) < 1e-6f);
+
+		light.QuadraticAttenuation = 0.0f;
+		range = LightClusterGrid::ComputeLightRange(light);
+		attenuation = 1.0f / (light.ConstantAttenuation + light.LinearAttenuation * range);
+		report.Check("linear only light range reaches the cutoff", fabsf(attenuation * 2.0f - LightClusterGrid::DEFAULT_CUTOFF) < 1e-6f);
+
+		light.LinearAttenuation = 0.0f;
+		report.Check("light that never falls off has no range limit", LightClusterGrid::ComputeLightRange(light) == FLT_MAX);
+		light.ConstantAttenuation = 1000.0f;
+		report.Check("light that is never bright enough has no range", LightClusterGrid::ComputeLightRange(light) == 0.0f);
+
+		XMMATRIX view = XMMatrixLookToLH(XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f), XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+		XMMATRIX projection = XMMatrixPerspectiveFovLH(XMConvertToRadians(60.0f), 1280.0f / 720.0f, 0.1f, 100.0f);
+		XMMATRIX viewProjection = view * projection;
+
+		std::mt19937 random(1234);
+		std::vector<Light> lights = MakeClusterLights(CLUSTER_LIGHT_COUNTS[1], random);
+
+		// A directional light and one that never falls off go in the global list, a disabled one nowhere
+		lights[0].Enabled = 1;
+		lights[0].LightType = DirectionalLight;
+		lights[1].Enabled = 1;
+		lights[1].LightType = PointLight;
+		lights[1].LinearAttenuation = 0.0f;
+		lights[1].QuadraticAttenuation = 0.0f;
+		lights[2].Enabled = 0;
+
+		LightClusterGrid grid;
+		grid.Build(lights, view, projection);
+		const std::vector<LightClusterRange>& ranges = grid.GetRanges();
+		const std::vector<UINT>& indices = grid.GetLightIndices();
+		const UINT globalCount = grid.GetGlobalLightCount();
+
+		report.Check("directional and unbounded lights are global", globalCount == 2 && indices[0] == 0 && indices[1] == 1);
+		report.Check("disabled lights are never listed", std::find(indices.begin(), indices.end(), 2u) == indices.end() &&
+			std::none_of(indices.begin(), indices.end(), [&](UINT index) { return !lights[index].Enabled; }));
+
+		// Lists are packed behind the global lights, and every listed light's sphere touches its cluster
+		bool packed = true;
+		bool touching = true;
+		UINT offset = globalCount;
+		for (UINT cluster = 0; cluster < LightClusterGrid::CLUSTER_COUNT; ++cluster)
+		{
+			if (ranges[cluster].Offset != offset) packed = false;
+			offset += ranges[cluster].Count;
+
+			BoundingBox bounds = grid.GetClusterBounds(cluster);
+			for (UINT i = 0; i < ranges[cluster].Count && i + ranges[cluster].Offset < indices.size(); ++i)
+			{
+				BoundingSphere sphere;
+				if (!grid.GetLightSphere(indices[ranges[cluster].Offset + i], sphere) || !bounds.Intersects(sphere)) touching = false;
+			}
+		}
+		report.Check("cluster lists are packed one after another", packed && offset == indices.size());
+		report.Check("every listed light touches its cluster", touching);
+
+		// Points each light reaches, projected the way the pixel shader does and looked up in their cluster
+		UINT samplesInView = 0;
+		UINT samplesMissed = 0;
+		for (UINT index = 0; index < lights.size(); ++index)
+		{
+			const Light& sampled = lights[index];
+			if (!sampled.Enabled || sampled.LightType == DirectionalLight) continue;
+
+			const float lightRange = LightClusterGrid::ComputeLightRange(sampled);
+			if (lightRange == FLT_MAX) continue;
+
+			for (UINT sample = 0; sample < CLUSTER_CHECK_SAMPLES; ++sample)
+			{
+				XMVECTOR world;
+				if (!SampleLitPoint(sampled, lightRange, random, world)) continue;
+
+				XMVECTOR viewPoint = XMVector3TransformCoord(world, view);
+				XMVECTOR clip = XMVector4Transform(world, viewProjection);
+				const float w = XMVectorGetW(clip);
+				const float ndcX = XMVectorGetX(clip) / w;
+				const float ndcY = XMVectorGetY(clip) / w;
+				const float ndcZ = XMVectorGetZ(clip) / w;
+				if (w <= 0.0f || fabsf(ndcX) > 1.0f || fabsf(ndcY) > 1.0f || ndcZ < 0.0f || ndcZ > 1.0f) continue;
+				++samplesInView;
+
+				const LightClusterRange& cluster = ranges[grid.GetClusterIndex(ndcX, ndcY, XMVectorGetZ(viewPoint))];
+				auto listBegin = indices.begin() + cluster.Offset;
+				if (!std::binary_search(listBegin, listBegin + cluster.Count, index)) ++samplesMissed;
+			}
+		}
+		report.Check("most light samples are in view", samplesInView > lights.size());
+		report.Check("every point a light reaches is in a cluster that lists it", samplesMissed == 0);
+
+		// Turning clustering off puts every lit light in the global list
+		grid.Build(lights, view, projection, false);
+		const UINT unclusteredCount = grid.GetGlobalLightCount();
+		report.Check("unclustered build lights everything everywhere", unclusteredCount == grid.GetStats().Lights &&
+			std::all_of(grid.GetRanges().begin(), grid.GetRanges().end(), [](const LightClusterRange& range) { return range.Count == 0; }));
+
+		// The same lists on one thread and on all of them
+		const UINT workers = JobSystem::Get().GetWorkerCount();
+		grid.Build(lights, view, projection);
+		std::vector<UINT> threadedIndices = grid.GetLightIndices();
+		JobSystem::Get().SetWorkerCount(0);
+		grid.Build(lights, view, projection);
+		const bool sameSingleThreaded = grid.GetLightIndices() == threadedIndices;
+		JobSystem::Get().SetWorkerCount(workers);
+		report.Check("lists are the same on one thread and many", sameSingleThreaded);
+
+		// The scene only uploads lights that are on and reach into the view. A light it drops must not reach any
+		// point inside the frustum
+		Scene scene;
+		scene.InitHeadless(1280, 720);
+		scene.GetLights() = MakeClusterLights(CLUSTER_LIGHT_COUNTS[1], random);
+		scene.GetLights()[0].Enabled = 1;
+		scene.GetLights()[0].LightType = DirectionalLight;
+
+		RenderSnapshot snapshot;
+		scene.BuildSnapshot(snapshot);
+		CullingFrustum frustum = CullingFrustum::FromViewProjection(XMLoadFloat4x4(&snapshot.View) * XMLoadFloat4x4(&snapshot.Projection));
+
+		UINT enabledCount = 0;
+		UINT uploaded = 0;
+		bool droppedOutOfView = true;
+		bool rangesFilled = true;
+		for (const Light& sceneLight : scene.GetLights())
+		{
+			if (!sceneLight.Enabled) continue;
+			++enabledCount;
+
+			const float lightRange = sceneLight.LightType == DirectionalLight ? FLT_MAX : LightClusterGrid::ComputeLightRange(sceneLight);
+			const bool kept = uploaded < snapshot.Lights.size() && memcmp(&snapshot.Lights[uploaded].Position, &sceneLight.Position, sizeof(XMFLOAT4)) == 0;
+			if (kept)
+			{
+				if (snapshot.Lights[uploaded].Range != lightRange) rangesFilled = false;
+				++uploaded;
+				continue;
+			}
+
+			for (UINT sample = 0; sample < CLUSTER_CHECK_SAMPLES; ++sample)
+			{
+				XMVECTOR world;
+				if (!SampleLitPoint(sceneLight, lightRange, random, world)) continue;
+
+				BoundingBox point;
+				XMStoreFloat3(&point.Center, world);
+				point.Extents = XMFLOAT3(0.0f, 0.0f, 0.0f);
+				if (frustum.IsVisible(point)) droppedOutOfView = false;
+			}
+		}
+		report.Check("uploaded lights are the enabled ones in view, in order", uploaded == snapshot.Lights.size() && uploaded < enabledCount && snapshot.Lights[0].LightType == DirectionalLight);
+		report.Check("uploaded lights have their range filled in", rangesFilled);
+		report.Check("no light that reaches into the view is dropped", droppedOutOfView);
+		report.Add("scene_lights_uploaded", uploaded, "lights");
+		report.Add("scene_lights_enabled", enabledCount, "lights");
+		scene.CleanUp();
+
+		// Timings, and how many lights a pixel loops over compared with all of them
+		for (UINT count : CLUSTER_LIGHT_COUNTS)
+		{
+			std::vector<Light> timedLights = MakeClusterLights(count, random);
+			auto start = Clock::now();
+			for (int pass = 0; pass < CLUSTER_PASSES; ++pass) grid.Build(timedLights, view, projection);
+			const std::string name = "build_" + std::to_string(count) + "_lights";
+			report.Add(name, MillisecondsSince(start) / CLUSTER_PASSES, "ms");
+
+			const LightClusterGrid::Stats& stats = grid.GetStats();
+			report.Add(name + "_lights_per_cluster", static_cast<double>(stats.Indices - stats.GlobalLights) / LightClusterGrid::CLUSTER_COUNT + stats.GlobalLights, "lights");
+			report.Add(name + "_max_cluster_lights", stats.MaxClusterLights, "lights");
+			report.Add(name + "_enabled_lights", stats.Lights, "lights");
+		}
+	}
+
+	// ----- light-buffer -----
+	// Lights added a few at a time up to 10k with others moving in between, staged into the light buffer. A copy of
+	// what the GPU would hold, written only where the buffer says things changed, has to match the lights every frame.
+
+	constexpr UINT LIGHT_BUFFER_LIGHT_COUNT = 10000;
+	constexpr UINT LIGHT_BUFFER_LIGHTS_PER_FRAME = 97;
+	constexpr int LIGHT_BUFFER_PASSES = 200;
+
+	void RunLightBufferBenchmark(BenchmarkReport& report)
+	{
+		std::mt19937 random(1234);
+		std::vector<Light> allLights = MakeClusterLights(LIGHT_BUFFER_LIGHT_COUNT, random);
+		std::uniform_real_distribution<float> step(-0.5f, 0.5f);
+
+		LightBuffer buffer;
+		std::vector<Light> lights;
+		std::vector<Light> gpu;
+
+		// Writes what the buffer says changed into the GPU copy, and checks it now matches
+		bool rangesValid = true;
+		auto upload = [&]()
+			{
+				UINT written = 0;
+				if (buffer.Stage(lights))
+				{
+					gpu = buffer.GetContents();
+					written = buffer.GetCapacity();
+				}
+				else
+				{
+					UINT end = 0;
+					for (const LightRange& range : buffer.GetChangedRanges())
+					{
+						if (range.Count == 0 || range.First < end || range.First + range.Count > lights.size()) rangesValid = false;
+						end = range.First + range.Count;
+						std::copy(buffer.GetContents().begin() + range.First, buffer.GetContents().begin() + end, gpu.begin() + range.First);
+						written += range.Count;
+					}
+				}
+				return written;
+			};
+		auto matches = [&]()
+			{
+				return gpu.size() >= lights.size() && (lights.empty() || memcmp(gpu.data(), lights.data(), sizeof(Light) * lights.size()) == 0);
+			};
+
+		// Grow to 10k, moving a light already in the buffer every frame
+		bool alwaysMatched = true;
+		UINT frames = 0;
+		auto start = Clock::now();
+		while (lights.size() < LIGHT_BUFFER_LIGHT_COUNT)
+		{
+			const size_t count = (std::min)(lights.size() + LIGHT_BUFFER_LIGHTS_PER_FRAME, static_cast<size_t>(LIGHT_BUFFER_LIGHT_COUNT));
+			if (!lights.empty()) lights[random() % lights.size()].Position.x += step(random);
+			lights.insert(lights.end(), allLights.begin() + lights.size(), allLights.begin() + count);
+
+			upload();
+			if (!matches()) alwaysMatched = false;
+			++frames;
+		}
+		report.Add("grow_to_10k_lights", MillisecondsSince(start), "ms");
+
+		UINT expectedCapacity = 64;
+		UINT expectedGrows = 1;
+		while (expectedCapacity < LIGHT_BUFFER_LIGHT_COUNT)
+		{
+			expectedCapacity *= 2;
+			++expectedGrows;
+		}
+		report.Check("buffer matches the lights every frame while growing to 10k", alwaysMatched && rangesValid);
+		report.Check("capacity doubles to fit 10k lights", buffer.GetCapacity() == expectedCapacity && buffer.GetGrowCount() <= expectedGrows);
+		report.Add("grow_frames", frames, "frames");
+		report.Add("grow_count", buffer.GetGrowCount(), "grows");
+		report.Add("capacity", buffer.GetCapacity(), "lights");
+
+		// Nothing changed writes nothing, one light moving writes one light
+		report.Check("unchanged lights write nothing", upload() == 0);
+		lights[4].Position.x += 1.0f;
+		report.Check("one moved light writes one light", upload() == 1 && matches());
+
+		// Lights going out of view shift the ones after them down, from there on everything is rewritten
+		lights.erase(lights.begin() + 5000);
+		const UINT shiftWritten = upload();
+		report.Check("removing a light rewrites only the lights after it", shiftWritten == LIGHT_BUFFER_LIGHT_COUNT - 1 - 5000 && matches());
+
+		// Scattered changes end up in one write rather than a thousand
+		for (size_t i = 0; i < lights.size(); i += 10) lights[i].Color.x *= 0.5f;
+		upload();
+		report.Check("scattered changes are merged", buffer.GetChangedRanges().size() == 1 && matches() && rangesValid);
+
+		// Fewer lights never shrinks the buffer
+		lights.resize(100);
+		report.Check("fewer lights keep the buffer", upload() == 0 && buffer.GetCapacity() == expectedCapacity && matches());
+		lights = std::vector<Light>(allLights.begin(), allLights.end() - 1);
+		upload();
+
+		// Timings at 10k lights
+		start = Clock::now();
+		for (int pass = 0; pass < LIGHT_BUFFER_PASSES; ++pass) buffer.Stage(lights);
+		report.Add("stage_10k_unchanged", MillisecondsSince(start) * 1000.0 / LIGHT_BUFFER_PASSES, "us");
+
+		start = Clock::now();
+		for (int pass = 0; pass < LIGHT_BUFFER_PASSES; ++pass)
+		{
+			lights[pass * 37 % lights.size()].Position.y += 0.01f;
+			buffer.Stage(lights);
+		}
+		report.Add("stage_10k_one_moved", MillisecondsSince(start) * 1000.0 / LIGHT_BUFFER_PASSES, "us");
+
+		start = Clock::now();
+		for (int pass = 0; pass < LIGHT_BUFFER_PASSES; ++pass)
+		{
+			for (Light& light : lights) light.Position.y += 0.01f;
+			buffer.Stage(lights);
+		}
+		report.Add("stage_10k_all_moved", MillisecondsSince(start) * 1000.0 / LIGHT_BUFFER_PASSES, "us");
+	}
+
+	// ----- render-graph -----
+	// Graphs of mock passes and textures, compiled without a device. The frame's own graph has to drop the render
+	// texture pass nothing samples and a blur chain has to fit in half the textures. Random graphs are checked for
+	// passes dropped that something needed, textures shared by passes alive at the same time, and shader resources or
+	// render targets still bound when the texture behind them is drawn to or sampled.
+
+	constexpr UINT RENDER_GRAPH_RANDOM_GRAPHS = 300;
+	constexpr UINT RENDER_GRAPH_RANDOM_PASSES = 40;
+	constexpr int RENDER_GRAPH_COMPILE_PASSES = 1000;
+
+	// What a random graph was told, kept separately so the compiled result can be checked against it
+	struct MockRenderPass
+	{
+		std::vector<std::pair<RenderGraph::ResourceId, UINT>>	Reads;
+		std::vector<std::pair<RenderGraph::ResourceId, bool>>	Writes;
+	};
+
+	struct MockRenderGraph
+	{
+		RenderGraph						Graph;
+		std::vector<MockRenderPass>		Passes;
+		std::vector<bool>				Imported;
+		std::vector<RenderTargetDesc>	Descs;
+	};
+
+	void BuildRandomRenderGraph(MockRenderGraph& mock, std::mt19937& random)
+	{
+		const RenderTargetDesc descs[] =
+		{
+			{ 1280, 720, DXGI_FORMAT_R32G32B32A32_FLOAT },
+			{ 1280, 720, DXGI_FORMAT_R8G8B8A8_UNORM },
+			{ 640, 360, DXGI_FORMAT_R32G32B32A32_FLOAT }
+		};
+
+		std::vector<RenderGraph::ResourceId> written;
+		for (int i = 0; i < 2; ++i)
+		{
+			mock.Graph.ImportTexture("Output", nullptr, nullptr);
+			mock.Imported.push_back(true);
+			mock.Descs.push_back({});
+		}
+
+		std::uniform_real_distribution<float> chance(0.0f, 1.0f);
+		for (UINT p = 0; p < RENDER_GRAPH_RANDOM_PASSES; ++p)
+		{
+			MockRenderPass pass;
+			const RenderGraph::PassId id = mock.Graph.AddPass("Pass", nullptr);
+
+			// Up to three distinct slots, reading textures something has already written
+			for (UINT slot = 0; slot < 3 && !written.empty(); ++slot)
+			{
+				if (chance(random) < 0.5f) continue;
+				const RenderGraph::ResourceId resource = written[random() % written.size()];
+				mock.Graph.Read(id, resource, slot);
+				pass.Reads.push_back({ resource, slot });
+			}
+
+			const UINT writeCount = 1 + random() % 2;
+			for (UINT w = 0; w < writeCount; ++w)
+			{
+				RenderGraph::ResourceId resource;
+				const float roll = chance(random);
+				if (roll < 0.08f)
+				{
+					resource = random() % 2;
+				}
+				else if (roll < 0.25f && !written.empty())
+				{
+					resource = written[random() % written.size()];
+				}
+				else
+				{
+					const RenderTargetDesc& desc = descs[random() % 3];
+					resource = mock.Graph.CreateTexture("Texture", desc);
+					mock.Imported.push_back(false);
+					mock.Descs.push_back(desc);
+				}
+
+				// A pass can't sample what it draws to
+				bool sampled = false;
+				for (const auto& read : pass.Reads) sampled |= read.first == resource;
+				for (const auto& write : pass.Writes) sampled |= write.first == resource;
+				if (sampled) continue;
+
+				const bool clear = chance(random) < 0.7f;
+				mock.Graph.Write(id, resource, clear);
+				pass.Writes.push_back({ resource, clear });
+				if (!mock.Imported[resource]) written.push_back(resource);
+			}
+
+			mock.Passes.push_back(pass);
+		}
+	}
+
+	void RunRenderGraphBenchmark(BenchmarkReport& report)
+	{
+		const RenderTargetDesc hdr = { 1280, 720, DXGI_FORMAT_R32G32B32A32_FLOAT };
+		const RenderTargetDesc packedHdr = { 1280, 720, DXGI_FORMAT_R11G11B10_FLOAT };
+		const double megabyte = 1024.0 * 1024.0;
+
+		// The frame as the renderer declares it
+		{
+			RenderGraph graph;
+			const RenderGraph::ResourceId scene = graph.CreateTexture("Scene", packedHdr);
+			const RenderGraph::ResourceId renderTexture = graph.CreateTexture("Render Texture", packedHdr);
+			const RenderGraph::ResourceId history = graph.ImportTexture("Render Texture History", nullptr, nullptr);
+			const RenderGraph::ResourceId backBuffer = graph.ImportTexture("Back Buffer", nullptr, nullptr);
+			const RenderGraph::ResourceId depth = graph.ImportDepth("Depth", nullptr);
+
+			const RenderGraph::PassId scenePass = graph.AddPass("Scene", nullptr);
+			graph.Read(scenePass, history, 0);
+			graph.Write(scenePass, scene);
+			graph.WriteDepth(scenePass, depth);
+
+			const RenderGraph::PassId renderTexturePass = graph.AddPass("Render Texture", nullptr);
+			graph.Read(renderTexturePass, history, 0);
+			graph.Write(renderTexturePass, renderTexture);
+			graph.WriteDepth(renderTexturePass, depth);
+
+			const RenderGraph::PassId copyPass = graph.AddPass("Copy To History", nullptr);
+			graph.Read(copyPass, scene, 0);
+			graph.Write(copyPass, history);
+
+			const RenderGraph::PassId presentPass = graph.AddPass("Present", nullptr);
+			graph.Read(presentPass, scene, 0);
+			graph.Write(presentPass, backBuffer);
+
+			const bool compiled = graph.Compile();
+			const std::vector<RenderGraph::CompiledPass>& order = graph.GetExecutionOrder();
+			report.Check("frame graph compiles", compiled);
+			report.Check("render texture pass nothing samples is culled", compiled && graph.IsPassCulled(renderTexturePass) && order.size() == 3 &&
+				order[0].Pass == scenePass && order[1].Pass == copyPass && order[2].Pass == presentPass);
+
+			const std::vector<UINT> slotZero = { 0 };
+			report.Check("history is unbound before the copy draws to it", order.size() == 3 && order[0].UnbindSlots == slotZero);
+			report.Check("scene stays bound between the copy and present", order.size() == 3 && order[1].UnbindSlots.empty());
+			report.Check("scene is unbound once the frame is done", order.size() == 3 && order[2].UnbindSlots == slotZero && !order[2].UnbindRenderTargets);
+			report.Check("packed scene colour is a quarter of the size", graph.GetStats().TransientBytes == packedHdr.GetSize() && 4 * packedHdr.GetSize() == hdr.GetSize());
+			report.Add("frame_transient_memory", graph.GetStats().TransientBytes / megabyte, "MB");
+			report.Add("frame_transient_memory_rgba32f", hdr.GetSize() / megabyte, "MB");
+		}
+
+		// Bright pass, four blurs each reading the last, then a composite with the scene
+		{
+			RenderGraph graph;
+			const RenderGraph::ResourceId scene = graph.CreateTexture("Scene", hdr);
+			const RenderGraph::ResourceId backBuffer = graph.ImportTexture("Back Buffer", nullptr, nullptr);
+
+			RenderGraph::PassId pass = graph.AddPass("Scene", nullptr);
+			graph.Write(pass, scene);
+
+			RenderGraph::ResourceId previous = scene;
+			for (int i = 0; i < 5; ++i)
+			{
+				const RenderGraph::ResourceId blurred = graph.CreateTexture(i == 0 ? "Bright" : "Blur", hdr);
+				pass = graph.AddPass(i == 0 ? "Bright" : "Blur", nullptr);
+				graph.Read(pass, previous, 0);
+				graph.Write(pass, blurred);
+				previous = blurred;
+			}
+
+			pass = graph.AddPass("Composite", nullptr);
+			graph.Read(pass, scene, 0);
+			graph.Read(pass, previous, 1);
+			graph.Write(pass, backBuffer);
+
+			graph.Compile();
+			const RenderGraph::Stats& stats = graph.GetStats();
+			report.Check("blur chain ping-pongs between two textures", stats.TransientTextures == 6 && stats.PhysicalTextures == 3 &&
+				stats.AliasedBytes == 3 * hdr.GetSize() && stats.TransientBytes == 6 * hdr.GetSize());
+			report.Add("blur_chain_transient_memory", stats.TransientBytes / megabyte, "MB");
+			report.Add("blur_chain_aliased_memory", stats.AliasedBytes / megabyte, "MB");
+		}
+
+		// Reading a graph texture before anything writes it can't work
+		{
+			RenderGraph graph;
+			const RenderGraph::ResourceId unwritten = graph.CreateTexture("Unwritten", hdr);
+			const RenderGraph::PassId pass = graph.AddPass("Reader", nullptr);
+			graph.Read(pass, unwritten, 0);
+			graph.Write(pass, graph.ImportTexture("Back Buffer", nullptr, nullptr));
+			report.Check("reading an unwritten texture fails to compile", !graph.Compile() && !graph.GetError().empty());
+		}
+
+		// A pass that draws to nothing still has the last pass's targets bound when it samples them
+		{
+			RenderGraph graph;
+			const RenderGraph::ResourceId target = graph.CreateTexture("Target", hdr);
+			const RenderGraph::PassId draw = graph.AddPass("Draw", nullptr);
+			graph.Write(draw, target);
+			const RenderGraph::PassId readBack = graph.AddPass("Read Back", nullptr);
+			graph.Read(readBack, target, 0);
+			graph.SetSideEffects(readBack);
+
+			graph.Compile();
+			const std::vector<RenderGraph::CompiledPass>& order = graph.GetExecutionOrder();
+			report.Check("render targets are unbound before a pass samples them", order.size() == 2 && order[0].UnbindRenderTargets && !order[1].UnbindRenderTargets);
+		}
+
+		// Random graphs, checked against what they were told
+		std::mt19937 random(1234);
+		bool allCompiled = true;
+		bool neededKept = true;
+		bool culledUnneeded = true;
+		bool aliasesDisjoint = true;
+		bool noHazards = true;
+		UINT culledPasses = 0;
+		uint64_t transientBytes = 0;
+		uint64_t aliasedBytes = 0;
+
+		for (UINT g = 0; g < RENDER_GRAPH_RANDOM_GRAPHS; ++g)
+		{
+			MockRenderGraph mock;
+			BuildRandomRenderGraph(mock, random);
+			RenderGraph& graph = mock.Graph;
+			if (!graph.Compile())
+			{
+				allCompiled = false;
+				continue;
+			}
+
+			const UINT passCount = static_cast<UINT>(mock.Passes.size());
+			auto lastWriter = [&mock](RenderGraph::ResourceId resource, UINT before)
+				{
+					for (UINT p = before; p-- > 0;)
+					{
+						for (const auto& write : mock.Passes[p].Writes)
+						{
+							if (write.first == resource) return p;
+						}
+					}
+					return UINT_MAX;
+				};
+
+			// Kept passes are the ones writing outputs plus, going backwards, whoever wrote what a kept pass needs
+			std::vector<bool> needed(passCount, false);
+			for (UINT p = passCount; p-- > 0;)
+			{
+				for (const auto& write : mock.Passes[p].Writes) needed[p] = needed[p] || mock.Imported[write.first];
+			}
+			for (UINT p = passCount; p-- > 0;)
+			{
+				if (!needed[p]) continue;
+				for (const auto& read : mock.Passes[p].Reads)
+				{
+					const UINT writer = lastWriter(read.first, p);
+					if (writer != UINT_MAX) needed[writer] = true;
+				}
+				for (const auto& write : mock.Passes[p].Writes)
+				{
+					const UINT writer = write.second ? UINT_MAX : lastWriter(write.first, p);
+					if (writer != UINT_MAX) needed[writer] = true;
+				}
+			}
+			for (UINT p = 0; p < passCount; ++p)
+			{
+				if (needed[p] && graph.IsPassCulled(p)) neededKept = false;
+				if (!needed[p] && !graph.IsPassCulled(p)) culledUnneeded = false;
+			}
+
+			// Lifetimes in execution order, two textures sharing memory must match and never be alive together
+			const std::vector<RenderGraph::CompiledPass>& order = graph.GetExecutionOrder();
+			const UINT resourceCount = graph.GetResourceCount();
+			std::vector<UINT> firstUse(resourceCount, UINT_MAX);
+			std::vector<UINT> lastUse(resourceCount, 0);
+			for (UINT position = 0; position < order.size(); ++position)
+			{
+				const MockRenderPass& pass = mock.Passes[order[position].Pass];
+				auto use = [&](RenderGraph::ResourceId resource)
+					{
+						firstUse[resource] = (std::min)(firstUse[resource], position);
+						lastUse[resource] = (std::max)(lastUse[resource], position);
+					};
+				for (const auto& read : pass.Reads) use(read.first);
+				for (const auto& write : pass.Writes) use(write.first);
+			}
+
+			for (UINT a = 0; a < resourceCount; ++a)
+			{
+				if (mock.Imported[a] || firstUse[a] == UINT_MAX) continue;
+				if (graph.GetPhysicalTexture(a) == RenderGraph::INVALID_ID || graph.GetPhysicalTextures()[graph.GetPhysicalTexture(a)] != mock.Descs[a])
+				{
+					aliasesDisjoint = false;
+					continue;
+				}
+
+				for (UINT b = a + 1; b < resourceCount; ++b)
+				{
+					if (mock.Imported[b] || firstUse[b] == UINT_MAX || graph.GetPhysicalTexture(a) != graph.GetPhysicalTexture(b)) continue;
+					if (firstUse[a] <= lastUse[b] && firstUse[b] <= lastUse[a]) aliasesDisjoint = false;
+				}
+			}
+
+			// Plays the frame back. A slot still holding a texture that gets drawn to, or a target still bound when
+			// it is sampled, is a hazard D3D would fix up behind our back by unbinding it
+			auto key = [&](RenderGraph::ResourceId resource) { return mock.Imported[resource] ? resource : 1000000 + graph.GetPhysicalTexture(resource); };
+			std::vector<UINT> boundSlots(3, UINT_MAX);
+			std::vector<UINT> boundTargets;
+			for (const RenderGraph::CompiledPass& compiled : order)
+			{
+				const MockRenderPass& pass = mock.Passes[compiled.Pass];
+				if (!pass.Writes.empty()) boundTargets.clear();
+				for (const auto& write : pass.Writes)
+				{
+					for (UINT bound : boundSlots) noHazards = noHazards && bound != key(write.first);
+					boundTargets.push_back(key(write.first));
+				}
+				for (const auto& read : pass.Reads)
+				{
+					noHazards = noHazards && std::find(boundTargets.begin(), boundTargets.end(), key(read.first)) == boundTargets.end();
+					boundSlots[read.second] = key(read.first);
+				}
+				for (UINT slot : compiled.UnbindSlots) boundSlots[slot] = UINT_MAX;
+				if (compiled.UnbindRenderTargets) boundTargets.clear();
+			}
+			for (UINT bound : boundSlots) noHazards = noHazards && bound == UINT_MAX;
+
+			culledPasses += graph.GetStats().CulledPasses;
+			transientBytes += graph.GetStats().TransientBytes;
+			aliasedBytes += graph.GetStats().AliasedBytes;
+		}
+
+		report.Check("random graphs compile", allCompiled);
+		report.Check("passes something needs are never culled", neededKept);
+		report.Check("passes nothing needs are always culled", culledUnneeded);
+		report.Check("shared textures match and are never alive together", aliasesDisjoint);
+		report.Check("nothing is drawn to while bound or sampled while a target, and everything is unbound at the end", noHazards);
+		report.Add("random_culled_passes", static_cast<double>(culledPasses) / RENDER_GRAPH_RANDOM_GRAPHS, "passes/graph");
+		report.Add("random_transient_memory", transientBytes / megabyte / RENDER_GRAPH_RANDOM_GRAPHS, "MB/graph");
+		report.Add("random_aliased_memory", aliasedBytes / megabyte / RENDER_GRAPH_RANDOM_GRAPHS, "MB/graph");
+
+		// Compiling is done once at start up, but should still be cheap enough to redo when the window resizes
+		MockRenderGraph mock;
+		BuildRandomRenderGraph(mock, random);
+		auto start = Clock::now();
+		for (int pass = 0; pass < RENDER_GRAPH_COMPILE_PASSES; ++pass) mock.Graph.Compile();
+		report.Add("compile_40_passes", MillisecondsSince(start) * 1000.0 / RENDER_GRAPH_COMPILE_PASSES, "us");
+	}
+
+	// ----- gbuffer -----
+	// Random surfaces packed the way the G-buffer pass writes them and unpacked the way the lighting pass reads them,
+	// every value has to come back within half a step of what went in. The deferred frame's graph is compiled too, to
+	// check what it costs and that the G-buffer and depth are unbound before the next frame draws to them.
+
+	constexpr UINT GBUFFER_SURFACES = 200000;
+
+	// Angle between two vectors in degrees, from the cross product as acos loses everything near 0
+	double AngleBetween(const XMFLOAT3& a, const XMFLOAT3& b)
+	{
+		const double crossX = static_cast<double>(a.y) * b.z - static_cast<double>(a.z) * b.y;
+		const double crossY = static_cast<double>(a.z) * b.x - static_cast<double>(a.x) * b.z;
+		const double crossZ = static_cast<double>(a.x) * b.y - static_cast<double>(a.y) * b.x;
+		const double dot = static_cast<double>(a.x) * b.x + static_cast<double>(a.y) * b.y + static_cast<double>(a.z) * b.z;
+		return atan2(sqrt(crossX * crossX + crossY * crossY + crossZ * crossZ), dot) * 180.0 / XM_PI;
+	}
+
+	void RunGBufferBenchmark(BenchmarkReport& report)
+	{
+		std::mt19937 random(1234);
+		std::normal_distribution<float> gaussian(0.0f, 1.0f);
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+		// The axes, the equator where the fold starts and the corners of the folded square are the awkward cases
+		std::vector<XMFLOAT3> normals =
+		{
+			{ 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 },
+			{ 0.70710678f, 0.70710678f, 0 }, { -0.70710678f, 0.70710678f, 0 }, { 0.70710678f, 0, -0.70710678f }, { 0, -0.70710678f, -0.70710678f }
+		};
+		while (normals.size() < GBUFFER_SURFACES)
+		{
+			XMFLOAT3 normal(gaussian(random), gaussian(random), gaussian(random));
+			XMStoreFloat3(&normal, XMVector3Normalize(XMLoadFloat3(&normal)));
+			normals.push_back(normal);
+		}
+
+		std::vector<GBufferEncoding::Surface> surfaces(normals.size());
+		for (size_t i = 0; i < surfaces.size(); ++i)
+		{
+			GBufferEncoding::Surface& surface = surfaces[i];
+			surface.Albedo = XMFLOAT3(unit(random), unit(random), unit(random));
+			surface.SpecularPower = exp2f(unit(random) * GBufferEncoding::SPECULAR_POWER_LOG2_RANGE);
+			surface.Normal = normals[i];
+			surface.SpecularIntensity = unit(random);
+			surface.Lit = (i & 1) == 0;
+		}
+
+		// Octahedral mapping alone, before anything is rounded
+		double maxMappingError = 0.0;
+		for (const XMFLOAT3& normal : normals)
+		{
+			const XMFLOAT2 encoded = GBufferEncoding::EncodeNormal(normal);
+			if (encoded.x < 0.0f || encoded.x > 1.0f || encoded.y < 0.0f || encoded.y > 1.0f) maxMappingError = 180.0;
+			maxMappingError = (std::max)(maxMappingError, AngleBetween(normal, GBufferEncoding::DecodeNormal(encoded)));
+		}
+		report.Check("octahedral mapping round trips", maxMappingError < 0.01);
+
+		// Rounded into the targets and back
+		const float albedoStep = 1.0f / 255.0f;
+		const float intensityStep = 1.0f / 1023.0f;
+		const float powerStep = exp2f(GBufferEncoding::SPECULAR_POWER_LOG2_RANGE / 255.0f) - 1.0f;
+		double maxNormalError = 0.0;
+		double sumNormalError = 0.0;
+		float maxAlbedoError = 0.0f;
+		float maxPowerError = 0.0f;
+		float maxIntensityError = 0.0f;
+		bool litKept = true;
+		for (const GBufferEncoding::Surface& surface : surfaces)
+		{
+			const GBufferEncoding::Surface unpacked = GBufferEncoding::Unpack(GBufferEncoding::Pack(surface));
+
+			const double normalError = AngleBetween(surface.Normal, unpacked.Normal);
+			maxNormalError = (std::max)(maxNormalError, normalError);
+			sumNormalError += normalError;
+
+			maxAlbedoError = (std::max)({ maxAlbedoError, fabsf(unpacked.Albedo.x - surface.Albedo.x), fabsf(unpacked.Albedo.y - surface.Albedo.y), fabsf(unpacked.Albedo.z - surface.Albedo.z) });
+			maxPowerError = (std::max)(maxPowerError, fabsf(unpacked.SpecularPower - surface.SpecularPower) / surface.SpecularPower);
+			maxIntensityError = (std::max)(maxIntensityError, fabsf(unpacked.SpecularIntensity - surface.SpecularIntensity));
+			litKept = litKept && unpacked.Lit == surface.Lit;
+		}
+		report.Check("albedo comes back within half a step", maxAlbedoError <= albedoStep * 0.5f + 1e-6f);
+		report.Check("specular power comes back within half a step", maxPowerError <= powerStep * 0.5f + 1e-4f);
+		report.Check("specular intensity comes back within half a step", maxIntensityError <= intensityStep * 0.5f + 1e-6f);
+		report.Check("normals come back within a third of a degree", maxNormalError < 1.0 / 3.0);
+		report.Check("lit flag comes back", litKept);
+
+		GBufferEncoding::Surface outside;
+		outside.SpecularPower = 5000.0f;
+		const float clampedPower = GBufferEncoding::Unpack(GBufferEncoding::Pack(outside)).SpecularPower;
+		outside.SpecularPower = 0.0f;
+		report.Check("specular power out of range is clamped", fabsf(clampedPower - 1024.0f) < 0.01f && fabsf(GBufferEncoding::Unpack(GBufferEncoding::Pack(outside)).SpecularPower - 1.0f) < 0.01f);
+
+		report.Add("normal_error_max", maxNormalError, "degrees");
+		report.Add("normal_error_mean", sumNormalError / surfaces.size(), "degrees");
+		report.Add("specular_power_error_max", maxPowerError * 100.0, "%");
+
+		// What packing costs on the CPU, the shader does the same sums
+		uint32_t checksum = 0;
+		auto start = Clock::now();
+		for (const GBufferEncoding::Surface& surface : surfaces)
+		{
+			const GBufferEncoding::PackedSurface packed = GBufferEncoding::Pack(surface);
+			checksum += packed.Albedo ^ packed.Normal;
+		}
+		report.Add("pack", MillisecondsSince(start) * 1000000.0 / surfaces.size(), "ns/surface");
+		report.Add("pack_checksum", checksum, "");
+
+		// The deferred frame as the renderer declares it
+		const RenderTargetDesc colour = { 1280, 720, DXGI_FORMAT_R11G11B10_FLOAT };
+		const RenderTargetDesc albedoDesc = { 1280, 720, DXGI_FORMAT_R8G8B8A8_UNORM };
+		const RenderTargetDesc normalDesc = { 1280, 720, DXGI_FORMAT_R10G10B10A2_UNORM };
+		RenderGraph graph;
+		const RenderGraph::ResourceId scene = graph.CreateTexture("Scene", colour);
+		const RenderGraph::ResourceId renderTexture = graph.CreateTexture("Render Texture", colour);
+		const RenderGraph::ResourceId history = graph.ImportTexture("Render Texture History", nullptr, nullptr);
+		const RenderGraph::ResourceId backBuffer = graph.ImportTexture("Back Buffer", nullptr, nullptr);
+		const RenderGraph::ResourceId depth = graph.ImportDepth("Depth", nullptr, nullptr);
+		const RenderGraph::ResourceId albedo = graph.CreateTexture("G-Buffer Albedo", albedoDesc);
+		const RenderGraph::ResourceId normal = graph.CreateTexture("G-Buffer Normal", normalDesc);
+
+		const RenderGraph::PassId gbufferPass = graph.AddPass("G-Buffer", nullptr);
+		graph.Read(gbufferPass, history, 0);
+		graph.Write(gbufferPass, scene);
+		graph.Write(gbufferPass, albedo);
+		graph.Write(gbufferPass, normal, true, GBufferEncoding::CLEAR_NORMAL);
+		graph.WriteDepth(gbufferPass, depth);
+
+		const RenderGraph::PassId lightingPass = graph.AddPass("Deferred Lighting", nullptr);
+		graph.Read(lightingPass, albedo, 6);
+		graph.Read(lightingPass, normal, 7);
+		graph.Read(lightingPass, depth, 8);
+		graph.Write(lightingPass, scene, false);
+
+		const RenderGraph::PassId renderTexturePass = graph.AddPass("Render Texture", nullptr);
+		graph.Read(renderTexturePass, history, 0);
+		graph.Write(renderTexturePass, renderTexture);
+		graph.WriteDepth(renderTexturePass, depth);
+
+		const RenderGraph::PassId copyPass = graph.AddPass("Copy To History", nullptr);
+		graph.Read(copyPass, scene, 0);
+		graph.Write(copyPass, history);
+
+		const RenderGraph::PassId presentPass = graph.AddPass("Present", nullptr);
+		graph.Read(presentPass, scene, 0);
+		graph.Write(presentPass, backBuffer);
+
+		const bool compiled = graph.Compile();
+		const std::vector<RenderGraph::CompiledPass>& order = graph.GetExecutionOrder();
+		report.Check("deferred frame graph compiles", compiled);
+		report.Check("deferred frame keeps the G-buffer and lighting passes", compiled && graph.IsPassCulled(renderTexturePass) && order.size() == 4 &&
+			order[0].Pass == gbufferPass && order[1].Pass == lightingPass && order[2].Pass == copyPass && order[3].Pass == presentPass);
+
+		std::vector<UINT> lightingUnbinds = order.size() == 4 ? order[1].UnbindSlots : std::vector<UINT>();
+		std::sort(lightingUnbinds.begin(), lightingUnbinds.end());
+		report.Check("G-buffer and depth are unbound after lighting", lightingUnbinds == std::vector<UINT>({ 6, 7, 8 }));
+
+		// Pixels nothing draws to have to read back as unlit, or the lighting pass runs every light over the background
+		const float* normalClear = graph.GetClearColour(gbufferPass, normal);
+		const float* sceneClear = graph.GetClearColour(gbufferPass, scene);
+		report.Check("G-buffer normal is cleared to unlit", normalClear != nullptr && normalClear[3] < 0.5f && sceneClear != nullptr && sceneClear[3] == 1.0f);
+
+		const uint64_t pixels = static_cast<uint64_t>(colour.Width) * colour.Height;
+		report.Check("G-buffer adds 8 bytes a pixel", graph.GetStats().TransientBytes == colour.GetSize() + pixels * GBufferEncoding::BYTES_PER_PIXEL);
+
+		// Against storing position, normal, colour and specular as they are: RGBA32F, RGBA16F, RGBA8 and RGBA8
+		const double megabyte = 1024.0 * 1024.0;
+		report.Add("gbuffer_memory", pixels * GBufferEncoding::BYTES_PER_PIXEL / megabyte, "MB");
+		report.Add("gbuffer_memory_unpacked", pixels * (16 + 8 + 4 + 4) / megabyte, "MB");
+	}
+
+	// ----- render-queue -----
+	// 100k visible items made from 300 models, each a mesh with its own shader, texture and normal map out of a
+	// handful of shaders and a couple of hundred textures, in 500 materials and a tenth of them blended. Checks the
+	// queue holds every draw once in key order with each pass's opaque draws before its transparent ones back to
+	// front, and that sorting cuts the binds between draws. Times building the queue and the radix sort against
+	// std::sort on the same keys.
+
+	constexpr UINT QUEUE_ITEMS = 100000;
+	constexpr int QUEUE_PASSES = 20;
+
+	// Never dereferenced, the queue only compares and numbers them
+	template <typename T>
+	T* FakePointer(UINT index)
+	{
+		return reinterpret_cast<T*>(static_cast<uintptr_t>(index + 1) * 256);
+	}
+
+	float ViewDepth(const RenderSnapshot& snapshot, UINT item)
+	{
+		const XMFLOAT4X4& world = snapshot.RenderItems[item].World;
+		const XMFLOAT4X4& view = snapshot.View;
+		return world._41 * view._13 + world._42 * view._23 + world._43 * view._33 + view._43;
+	}
+
+	// Fills the snapshot with QUEUE_ITEMS visible items in front of a camera at the origin
+	void CreateQueueItems(RenderSnapshot& snapshot, std::mt19937& random)
+	{
+		std::uniform_int_distribution<UINT> shader(0, 7);
+		std::uniform_int_distribution<UINT> texture(0, 199);
+		std::uniform_int_distribution<UINT> normalMap(0, 49);
+		std::uniform_int_distribution<UINT> material(0, 499);
+		std::uniform_int_distribution<UINT> model(0, 299);
+		std::uniform_int_distribution<UINT> percent(0, 99);
+		std::uniform_real_distribution<float> across(-50.0f, 50.0f);
+		std::uniform_real_distribution<float> ahead(0.5f, 100.0f);
+
+		XMStoreFloat4x4(&snapshot.View, XMMatrixIdentity());
+		XMStoreFloat4x4(&snapshot.Projection, XMMatrixPerspectiveFovLH(XM_PIDIV4, 16.0f / 9.0f, 0.01f, 100.0f));
+
+		struct Model
+		{
+			UINT	Shader;
+			UINT	Texture;
+			UINT	NormalMap;
+		};
+		std::vector<Model> models(model.max() + 1);
+		for (Model& entry : models) entry = { shader(random), texture(random), percent(random) < 50 ? UINT_MAX : normalMap(random) };
+
+		snapshot.RenderItems.resize(QUEUE_ITEMS);
+		for (UINT i = 0; i < QUEUE_ITEMS; ++i)
+		{
+			RenderItem& item = snapshot.RenderItems[i];
+			XMStoreFloat4x4(&item.World, XMMatrixIdentity());
+			item.World._41 = across(random);
+			item.World._42 = across(random);
+			item.World._43 = ahead(random);
+			item.MaterialIndex = material(random);
+
+			const UINT pass = percent(random);
+			item.PassMask = pass < 90 ? RENDER_PASS_SCENE : pass < 95 ? RENDER_PASS_RENDER_TEXTURE : RENDER_PASS_SCENE | RENDER_PASS_RENDER_TEXTURE;
+			item.States = PipelineStateIds();
+			item.States.Blend = percent(random) < 10 ? 1 : 0;
+
+			const UINT modelIndex = model(random);
+			const Model& source = models[modelIndex];
+			item.PixelShader = FakePointer<ID3D11PixelShader>(source.Shader);
+			item.Texture = FakePointer<ID3D11ShaderResourceView>(source.Texture);
+			item.NormalMap = source.NormalMap == UINT_MAX ? nullptr : FakePointer<ID3D11ShaderResourceView>(1000 + source.NormalMap);
+			item.VertexBuffer = FakePointer<ID3D11Buffer>(modelIndex * 2);
+			item.IndexBuffer = FakePointer<ID3D11Buffer>(modelIndex * 2 + 1);
+			snapshot.VisibleItems.push_back(i);
+		}
+	}
+
+	void RunRenderQueueBenchmark(BenchmarkReport& report)
+	{
+		std::mt19937 random(4321);
+		RenderSnapshot snapshot;
+		CreateQueueItems(snapshot, random);
+
+		RenderQueue queue;
+		queue.Build(snapshot);
+		const std::vector<SortedDraw>& draws = snapshot.DrawQueue;
+
+		report.Check("keys are in order", std::is_sorted(draws.begin(), draws.end(), [](const SortedDraw& a, const SortedDraw& b) { return a.Key < b.Key; }));
+
+		std::vector<UINT> seen(QUEUE_ITEMS, 0);
+		bool passesMatch = true;
+		for (const SortedDraw& draw : draws)
+		{
+			const UINT pass = RenderQueue::GetPass(draw.Key);
+			passesMatch = passesMatch && (snapshot.RenderItems[draw.Item].PassMask & (1u << pass)) != 0 && !(seen[draw.Item] & (1u << pass));
+			seen[draw.Item] |= 1u << pass;
+		}
+		bool everyDraw = passesMatch;
+		for (UINT i = 0; i < QUEUE_ITEMS; ++i) everyDraw = everyDraw && seen[i] == snapshot.RenderItems[i].PassMask;
+		report.Check("every item is in each of its passes once", everyDraw);
+
+		// Opaque then transparent in each pass, and a transparent draw is never more than a depth bucket in front
+		// of the one after it
+		bool opaqueFirst = true;
+		bool backToFront = true;
+		UINT transparentDraws = 0;
+		for (UINT pass = 0; pass < RenderQueue::PASS_COUNT; ++pass)
+		{
+			const auto [first, last] = RenderQueue::FindPass(draws, pass);
+			bool transparentSeen = false;
+			for (size_t i = first; i < last; ++i)
+			{
+				opaqueFirst = opaqueFirst && RenderQueue::GetPass(draws[i].Key) == pass;
+				const bool transparent = snapshot.RenderItems[draws[i].Item].States.Blend != 0;
+				opaqueFirst = opaqueFirst && (transparent || !transparentSeen);
+				if (transparent && transparentSeen) backToFront = backToFront && ViewDepth(snapshot, draws[i].Item) <= ViewDepth(snapshot, draws[i - 1].Item) * 1.02f;
+				transparentSeen = transparentSeen || transparent;
+				transparentDraws += transparent ? 1 : 0;
+			}
+		}
+		report.Check("opaque draws come before transparent ones", opaqueFirst);
+		report.Check("transparent draws go back to front", backToFront && transparentDraws > 0);
+
+		const RenderQueue::Stats stats = queue.GetStats();
+		report.Check("sorting cuts rebinds", stats.Sorted.Shaders * 10 < stats.Unsorted.Shaders && stats.Sorted.Textures * 4 < stats.Unsorted.Textures && stats.Sorted.Buffers * 4 < stats.Unsorted.Buffers);
+		report.Add("draws", stats.Draws, "");
+		report.Add("shader_binds_unsorted", stats.Unsorted.Shaders, "");
+		report.Add("shader_binds_sorted", stats.Sorted.Shaders, "");
+		report.Add("texture_binds_unsorted", stats.Unsorted.Textures, "");
+		report.Add("texture_binds_sorted", stats.Sorted.Textures, "");
+		report.Add("buffer_binds_unsorted", stats.Unsorted.Buffers, "");
+		report.Add("buffer_binds_sorted", stats.Sorted.Buffers, "");
+
+		// Turned off, each pass keeps the visible order
+		queue.Build(snapshot, false);
+		bool visibleOrder = true;
+		for (UINT pass = 0; pass < RenderQueue::PASS_COUNT; ++pass)
+		{
+			size_t next = RenderQueue::FindPass(draws, pass).first;
+			for (UINT index : snapshot.VisibleItems)
+			{
+				if (!(snapshot.RenderItems[index].PassMask & (1u << pass))) continue;
+				visibleOrder = visibleOrder && next < draws.size() && draws[next++].Item == index;
+			}
+		}
+		report.Check("unsorted queue keeps the visible order", visibleOrder);
+
+		// The radix sort against std::stable_sort on keys with plenty of ties
+		queue.Build(snapshot);
+		std::vector<SortedDraw> shuffled = draws;
+		std::shuffle(shuffled.begin(), shuffled.end(), random);
+		for (SortedDraw& draw : shuffled) draw.Key &= ~0xFFull;
+
+		std::vector<SortedDraw> radixSorted = shuffled;
+		std::vector<SortedDraw> scratch;
+		RenderQueue::RadixSort(radixSorted, scratch);
+		std::vector<SortedDraw> stableSorted = shuffled;
+		std::stable_sort(stableSorted.begin(), stableSorted.end(), [](const SortedDraw& a, const SortedDraw& b) { return a.Key < b.Key; });
+		report.Check("radix sort matches std::stable_sort", std::equal(radixSorted.begin(), radixSorted.end(), stableSorted.begin(),
+			[](const SortedDraw& a, const SortedDraw& b) { return a.Key == b.Key && a.Item == b.Item; }));
+
+		auto start = Clock::now();
+		for (int pass = 0; pass < QUEUE_PASSES; ++pass) queue.Build(snapshot);
+		report.Add("build", MillisecondsSince(start) / QUEUE_PASSES, "ms");
+
+		double radixMs = 0.0;
+		double stdMs = 0.0;
+		for (int pass = 0; pass < QUEUE_PASSES; ++pass)
+		{
+			radixSorted = shuffled;
+			start = Clock::now();
+			RenderQueue::RadixSort(radixSorted, scratch);
+			radixMs += MillisecondsSince(start);
+
+			stableSorted = shuffled;
+			start = Clock::now();
+			std::sort(stableSorted.begin(), stableSorted.end(), [](const SortedDraw& a, const SortedDraw& b) { return a.Key < b.Key; });
+			stdMs += MillisecondsSince(start);
+		}
+		report.Add("radix_sort", radixMs / QUEUE_PASSES, "ms");
+		report.Add("std_sort", stdMs / QUEUE_PASSES, "ms");
+	}
+
+	// ----- state-filter -----
+	// The render-queue items bound through the state filter the way the scene binds them, in the order they are
+	// visible and in queue order. What gets through has to be exactly the changes between consecutive draws the queue
+	// counts, more means binds it should have dropped and fewer means binds it dropped that were needed. The filter
+	// runs without a device, only counting, and is timed per call.
+
+	constexpr UINT BINDS_PER_DRAW = 10;
+
+	void BindPasses(StateTrackingContext& context, const RenderSnapshot& snapshot, bool sorted)
+	{
+		for (UINT pass = 0; pass < RenderQueue::PASS_COUNT; ++pass)
+		{
+			// Each pass starts with nothing known, as the queue's counts do
+			context.Invalidate();
+			if (sorted)
+			{
+				const auto [first, last] = RenderQueue::FindPass(snapshot.DrawQueue, pass);
+				for (size_t i = first; i < last; ++i) IRenderable::Bind(context, snapshot.RenderItems[snapshot.DrawQueue[i].Item]);
+				continue;
+			}
+
+			for (UINT index : snapshot.VisibleItems)
+			{
+				if (snapshot.RenderItems[index].PassMask & (1u << pass)) IRenderable::Bind(context, snapshot.RenderItems[index]);
+			}
+		}
+	}
+
+	void RunStateFilterBenchmark(BenchmarkReport& report)
+	{
+		std::mt19937 random(4321);
+		RenderSnapshot snapshot;
+		CreateQueueItems(snapshot, random);
+
+		RenderQueue queue;
+		queue.Build(snapshot);
+		const RenderQueue::Stats queueStats = queue.GetStats();
+
+		StateTrackingContext context;
+		context.Init(nullptr);
+		auto issued = [&context](StateTrackingContext::CallType type) { return context.GetCounts(type).Issued; };
+		auto matchesQueue = [&](const RenderQueue::RebindCounts& rebinds)
+			{
+				const StateTrackingContext::CallCounts total = context.GetTotalCounts();
+				return issued(StateTrackingContext::CALL_SHADER) == rebinds.Shaders &&
+					issued(StateTrackingContext::CALL_SHADER_RESOURCE) == rebinds.Textures &&
+					issued(StateTrackingContext::CALL_VERTEX_BUFFER) + issued(StateTrackingContext::CALL_INDEX_BUFFER) == rebinds.Buffers &&
+					total.Issued + total.Elided == static_cast<uint64_t>(queueStats.Draws) * BINDS_PER_DRAW;
+			};
+
+		BindPasses(context, snapshot, false);
+		const StateTrackingContext::CallCounts unsorted = context.GetTotalCounts();
+		report.Check("visible order lets through exactly the changes", matchesQueue(queueStats.Unsorted));
+
+		context.ResetCounts();
+		BindPasses(context, snapshot, true);
+		const StateTrackingContext::CallCounts sorted = context.GetTotalCounts();
+		report.Check("queue order lets through exactly the changes", matchesQueue(queueStats.Sorted));
+
+		report.Add("calls", static_cast<double>(sorted.Issued + sorted.Elided), "");
+		report.Add("issued_unsorted", static_cast<double>(unsorted.Issued), "");
+		report.Add("issued_sorted", static_cast<double>(sorted.Issued), "");
+
+		// Forgetting: after Invalidate, after new render targets for the shader resources, and past the tracked slots
+		ID3D11ShaderResourceView* view = FakePointer<ID3D11ShaderResourceView>(0);
+		ID3D11RenderTargetView* target = FakePointer<ID3D11RenderTargetView>(1);
+		context.ResetCounts();
+		context.PSSetShaderResource(0, view);
+		context.PSSetShaderResource(0, view);
+		const bool repeatDropped = issued(StateTrackingContext::CALL_SHADER_RESOURCE) == 1;
+		context.Invalidate();
+		context.PSSetShaderResource(0, view);
+		const bool invalidateForgets = issued(StateTrackingContext::CALL_SHADER_RESOURCE) == 2;
+		context.OMSetRenderTargets(1, &target, nullptr);
+		context.PSSetShaderResource(0, view);
+		context.OMSetRenderTargets(1, &target, nullptr);
+		context.PSSetShaderResource(0, view);
+		const bool targetsForget = issued(StateTrackingContext::CALL_SHADER_RESOURCE) == 3 && issued(StateTrackingContext::CALL_RENDER_TARGETS) == 1;
+		context.PSSetShaderResource(StateTrackingContext::SHADER_RESOURCE_SLOTS, view);
+		context.PSSetShaderResource(StateTrackingContext::SHADER_RESOURCE_SLOTS, view);
+		const bool untrackedIssued = issued(StateTrackingContext::CALL_SHADER_RESOURCE) == 5;
+		report.Check("a repeated bind is dropped", repeatDropped);
+		report.Check("invalidate forgets what is bound", invalidateForgets);
+		report.Check("new render targets forget the shader resources", targetsForget);
+		report.Check("slots past the tracked ones always go through", untrackedIssued);
+
+		auto start = Clock::now();
+		for (int pass = 0; pass < QUEUE_PASSES; ++pass) BindPasses(context, snapshot, true);
+		report.Add("filter", MillisecondsSince(start) * 1000000.0 / (static_cast<double>(QUEUE_PASSES) * queueStats.Draws * BINDS_PER_DRAW), "ns/call");
+	}
+
+	// ----- instancing -----
+	// 10k cubes on a grid sharing a mesh, shader and texture in a handful of materials, submitted one draw each and
+	// then instanced. Without a device the draws go to a counting state filter and each upload is a copy into a
+	// staging buffer, so this times the CPU side of submission and counts the calls and bytes the GPU would get.
+	// Checks the cubes go in one batch, the instance rows match their draws, and that batches over the mixed
+	// render-queue items cover the queue in order with nothing in a batch that can't share its draw.
+
+	constexpr UINT INSTANCED_CUBES = 10000;
+	constexpr int INSTANCING_FRAMES = 50;
+
+	void CreateCubeItems(RenderSnapshot& snapshot)
+	{
+		XMStoreFloat4x4(&snapshot.View, XMMatrixIdentity());
+		XMStoreFloat4x4(&snapshot.Projection, XMMatrixPerspectiveFovLH(XM_PIDIV4, 16.0f / 9.0f, 0.01f, 100.0f));
+
+		snapshot.RenderItems.resize(INSTANCED_CUBES);
+		for (UINT i = 0; i < INSTANCED_CUBES; ++i)
+		{
+			RenderItem& item = snapshot.RenderItems[i];
+			XMStoreFloat4x4(&item.World, XMMatrixIdentity());
+			item.World._41 = static_cast<float>(i % 100) - 50.0f;
+			item.World._42 = static_cast<float>(i / 100) - 50.0f;
+			item.World._43 = 10.0f + static_cast<float>(i % 7);
+			item.MaterialIndex = i % 5;
+			item.PassMask = RENDER_PASS_SCENE;
+			item.States = PipelineStateIds();
+
+			item.PixelShader = FakePointer<ID3D11PixelShader>(0);
+			item.Texture = FakePointer<ID3D11ShaderResourceView>(1);
+			item.NormalMap = nullptr;
+			item.VertexBuffer = FakePointer<ID3D11Buffer>(2);
+			item.IndexBuffer = FakePointer<ID3D11Buffer>(3);
+			item.VBStride = sizeof(SimpleVertex);
+			item.VBOffset = 0;
+			item.VertexCount = 36;
+			snapshot.VisibleItems.push_back(i);
+		}
+	}
+
+	// Each batch in one pass with everything in it able to share the first draw's binds, the batches one after
+	// another over the whole queue
+	bool BatchesCoverQueue(const RenderSnapshot& snapshot)
+	{
+		UINT next = 0;
+		for (const DrawBatch& batch : snapshot.DrawBatches)
+		{
+			if (batch.First != next || batch.Count == 0) return false;
+
+			const SortedDraw& first = snapshot.DrawQueue[batch.First];
+			for (UINT i = batch.First; i < batch.First + batch.Count; ++i)
+			{
+				const SortedDraw& draw = snapshot.DrawQueue[i];
+				if (RenderQueue::GetPass(draw.Key) != RenderQueue::GetPass(first.Key)) return false;
+				if (!RenderQueue::CanInstance(snapshot.RenderItems[draw.Item], snapshot.RenderItems[first.Item])) return false;
+			}
+			next += batch.Count;
+		}
+		return next == snapshot.DrawQueue.size();
+	}
+
+	// What Scene::Draw does for a pass, with the object constants copied into staging. Returns the draw calls
+	UINT SubmitPass(StateTrackingContext& context, const RenderSnapshot& snapshot, std::vector<ObjectConstantBuffer>& staging)
+	{
+		const auto [first, last] = RenderQueue::FindPass(snapshot.DrawQueue, 0);
+		context.Invalidate();
+
+		if (!snapshot.Instanced)
+		{
+			for (size_t draw = first; draw < last; ++draw)
+			{
+				const RenderItem& item = snapshot.RenderItems[snapshot.DrawQueue[draw].Item];
+				IRenderable::FillObjectConstants(item, staging[draw - first]);
+				context.VSSetConstantBuffer1(Scene::OBJECT_CONSTANT_SLOT, FakePointer<ID3D11Buffer>(101), static_cast<UINT>(draw - first) * ConstantRingBuffer::SLOT_CONSTANTS, ConstantRingBuffer::SLOT_CONSTANTS);
+				IRenderable::Bind(context, item);
+			}
+			return static_cast<UINT>(last - first);
+		}
+
+		context.IASetVertexBuffer(InstanceBuffer::VERTEX_SLOT, FakePointer<ID3D11Buffer>(100), sizeof(InstanceData), 0);
+		const auto [firstBatch, lastBatch] = RenderQueue::FindBatches(snapshot.DrawBatches, first, last);
+		for (size_t batch = firstBatch; batch < lastBatch; ++batch)
+		{
+			IRenderable::Bind(context, snapshot.RenderItems[snapshot.DrawQueue[snapshot.DrawBatches[batch].First].Item]);
+		}
+		return static_cast<UINT>(lastBatch - firstBatch);
+	}
+
+	void RunInstancingBenchmark(BenchmarkReport& report)
+	{
+		RenderSnapshot snapshot;
+		CreateCubeItems(snapshot);
+
+		RenderQueue queue;
+		queue.Build(snapshot, true, true);
+		report.Check("cubes sharing a mesh and shader are one batch", snapshot.DrawBatches.size() == 1 && snapshot.DrawBatches[0].Count == INSTANCED_CUBES);
+
+		bool rowsMatch = snapshot.Instances.size() == snapshot.DrawQueue.size();
+		for (size_t i = 0; rowsMatch && i < snapshot.Instances.size(); ++i)
+		{
+			const RenderItem& item = snapshot.RenderItems[snapshot.DrawQueue[i].Item];
+			rowsMatch = memcmp(&snapshot.Instances[i].World, &item.World, sizeof(XMFLOAT4X4)) == 0 && snapshot.Instances[i].MaterialIndex == item.MaterialIndex;
+		}
+		report.Check("instance rows match their draws", rowsMatch);
+
+		// A cube with its own rasterizer state can't join the others, wherever it sorts to
+		snapshot.RenderItems[INSTANCED_CUBES / 2].States.Rasterizer = 1;
+		queue.Build(snapshot, true, true);
+		report.Check("a different state breaks the batch", snapshot.DrawBatches.size() >= 2 && snapshot.DrawBatches.size() <= 3 && BatchesCoverQueue(snapshot));
+		snapshot.RenderItems[INSTANCED_CUBES / 2].States.Rasterizer = 0;
+
+		StateTrackingContext context;
+		context.Init(nullptr);
+		std::vector<ObjectConstantBuffer> staging(INSTANCED_CUBES);
+
+		// Building the queue is part of each frame, instancing also writes the instance rows
+		UINT drawCalls[2] = {};
+		uint64_t issued[2] = {};
+		float milliseconds[2] = {};
+		for (int instanced = 0; instanced < 2; ++instanced)
+		{
+			context.ResetCounts();
+			auto start = Clock::now();
+			for (int frame = 0; frame < INSTANCING_FRAMES; ++frame)
+			{
+				queue.Build(snapshot, true, instanced != 0);
+				drawCalls[instanced] = SubmitPass(context, snapshot, staging);
+			}
+			milliseconds[instanced] = MillisecondsSince(start) / INSTANCING_FRAMES;
+			issued[instanced] = context.GetTotalCounts().Issued / INSTANCING_FRAMES;
+		}
+
+		report.Add("draw_calls_individual", drawCalls[0], "");
+		report.Add("draw_calls_instanced", drawCalls[1], "");
+		report.Add("binds_individual", static_cast<double>(issued[0]), "");
+		report.Add("binds_instanced", static_cast<double>(issued[1]), "");
+		report.Add("upload_individual", static_cast<double>(sizeof(FrameConstantBuffer) + sizeof(ObjectConstantBuffer) * INSTANCED_CUBES) / 1024.0, "KB");
+		report.Add("upload_instanced", static_cast<double>(sizeof(FrameConstantBuffer) + sizeof(InstanceData) * INSTANCED_CUBES) / 1024.0, "KB");
+		report.Add("submit_individual", milliseconds[0], "ms");
+		report.Add("submit_instanced", milliseconds[1], "ms");
+
+		// The mixed items from render-queue, instancing has to keep every draw where the sort put it
+		std::mt19937 random(4321);
+		RenderSnapshot mixed;
+		CreateQueueItems(mixed, random);
+		queue.Build(mixed, true, true);
+		report.Check("batches cover a mixed queue in order", BatchesCoverQueue(mixed) && mixed.DrawBatches.size() < mixed.DrawQueue.size());
+		report.Add("mixed_draws", static_cast<double>(mixed.DrawQueue.size()), "");
+		report.Add("mixed_batches", static_cast<double>(mixed.DrawBatches.size()), "");
+	}
+
+	// ----- constant-ring -----
+	// The render-queue items' object constants written into ring slots the way Scene::Draw writes them, against every
+	// draw writing the camera and its own constants together. Reports the bytes a frame uploads each way and times
+	// filling them. Checks the ring never hands out a slot twice before it starts over and only starts over when it
+	// is full, and that the camera's view matrix is only rebuilt once it moves.
+
+	constexpr UINT RING_SLOTS = 4096;
+	constexpr int RING_FRAMES = 200;
+	constexpr int VIEW_MATRIX_CALLS = 1000000;
+
+	// The buffer every draw used to write
+	struct UnsplitConstants
+	{
+		FrameConstantBuffer		Frame;
+		ObjectConstantBuffer	Object;
+	};
+
+	void RunConstantRingBenchmark(BenchmarkReport& report)
+	{
+		// Three passes a frame of anything up to half the ring each, so it starts over every frame or two
+		ConstantRingBuffer ring;
+		ring.Init(nullptr, RING_SLOTS);
+		std::mt19937 random(99);
+		std::uniform_int_distribution<UINT> passDraws(1, RING_SLOTS / 2);
+
+		// Which map wrote each slot since the ring last started over
+		std::vector<UINT> writer(RING_SLOTS, 0);
+		bool neverTwice = true;
+		bool onlyWhenFull = true;
+		bool inOrder = true;
+		UINT next = RING_SLOTS;
+		UINT maps = 0;
+		UINT restarts = 0;
+		for (int frame = 0; frame < RING_FRAMES; ++frame)
+		{
+			for (int pass = 0; pass < 3; ++pass)
+			{
+				const UINT count = passDraws(random);
+				UINT firstSlot = 0;
+				const bool restart = ring.Allocate(count, firstSlot);
+				onlyWhenFull = onlyWhenFull && restart == (next + count > RING_SLOTS);
+				if (restart)
+				{
+					std::fill(writer.begin(), writer.end(), 0);
+					next = 0;
+					++restarts;
+				}
+
+				inOrder = inOrder && firstSlot == next && firstSlot + count <= RING_SLOTS;
+				++maps;
+				for (UINT slot = firstSlot; slot < firstSlot + count && slot < RING_SLOTS; ++slot)
+				{
+					neverTwice = neverTwice && writer[slot] == 0;
+					writer[slot] = maps;
+				}
+				next = firstSlot + count;
+			}
+		}
+		report.Check("slots follow on from the last map", inOrder);
+		report.Check("no slot is handed out twice before starting over", neverTwice);
+		report.Check("the ring only starts over when it is full", onlyWhenFull && restarts == ring.GetWrapCount());
+		report.Check("slots are whole steps of the offset binding", ConstantRingBuffer::SLOT_CONSTANTS % 16 == 0 && sizeof(ObjectConstantBuffer) <= ConstantRingBuffer::SLOT_SIZE);
+		report.Add("ring_restarts", restarts, "");
+
+		std::mt19937 itemRandom(4321);
+		RenderSnapshot snapshot;
+		CreateQueueItems(snapshot, itemRandom);
+		RenderQueue queue;
+		queue.Build(snapshot);
+		const UINT draws = static_cast<UINT>(snapshot.DrawQueue.size());
+
+		ObjectConstantBuffer constants;
+		const RenderItem& firstItem = snapshot.RenderItems[snapshot.DrawQueue[0].Item];
+		IRenderable::FillObjectConstants(firstItem, constants);
+		XMFLOAT4X4 world;
+		XMStoreFloat4x4(&world, XMMatrixTranspose(constants.mWorld));
+		report.Check("object constants hold the item's world and material", memcmp(&world, &firstItem.World, sizeof(XMFLOAT4X4)) == 0 && constants.MaterialIndex == firstItem.MaterialIndex);
+
+		const double unsplitBytes = static_cast<double>(draws) * UNSPLIT_CONSTANT_BUFFER_SIZE;
+		const double splitBytes = sizeof(FrameConstantBuffer) + static_cast<double>(draws) * sizeof(ObjectConstantBuffer);
+		report.Check("splitting more than halves the upload", splitBytes * 2.0 < unsplitBytes);
+		report.Add("draws", draws, "");
+		report.Add("upload_unsplit", unsplitBytes / 1024.0, "KB/frame");
+		report.Add("upload_split", splitBytes / 1024.0, "KB/frame");
+
+		// Filling the constants, each draw's unsplit copy against the camera once and a slot per draw
+		std::vector<UnsplitConstants> unsplit(draws);
+		auto start = Clock::now();
+		for (int frame = 0; frame < QUEUE_PASSES; ++frame)
+		{
+			for (UINT draw = 0; draw < draws; ++draw)
+			{
+				UnsplitConstants& cb = unsplit[draw];
+				cb.Frame.mView = XMMatrixTranspose(XMLoadFloat4x4(&snapshot.View));
+				cb.Frame.mProjection = XMMatrixTranspose(XMLoadFloat4x4(&snapshot.Projection));
+				IRenderable::FillObjectConstants(snapshot.RenderItems[snapshot.DrawQueue[draw].Item], cb.Object);
+			}
+		}
+		report.Add("fill_unsplit", MillisecondsSince(start) / QUEUE_PASSES, "ms");
+		unsplit = std::vector<UnsplitConstants>();
+
+		std::vector<BYTE> slots(static_cast<size_t>(draws) * ConstantRingBuffer::SLOT_SIZE);
+		FrameConstantBuffer frame;
+		start = Clock::now();
+		for (int pass = 0; pass < QUEUE_PASSES; ++pass)
+		{
+			frame.mView = XMMatrixTranspose(XMLoadFloat4x4(&snapshot.View));
+			frame.mProjection = XMMatrixTranspose(XMLoadFloat4x4(&snapshot.Projection));
+			for (UINT draw = 0; draw < draws; ++draw)
+			{
+				IRenderable::FillObjectConstants(snapshot.RenderItems[snapshot.DrawQueue[draw].Item], constants);
+				memcpy(slots.data() + static_cast<size_t>(draw) * ConstantRingBuffer::SLOT_SIZE, &constants, sizeof(ObjectConstantBuffer));
+			}
+		}
+		report.Add("fill_split", MillisecondsSince(start) / QUEUE_PASSES, "ms");
+
+		// Asking twice gives the same matrix, and moving gives the one a camera starting there would have
+		Camera camera(XMFLOAT3(0, 3, 4.5f), XMFLOAT3(0, -0.65f, -1), XMFLOAT3(0, 1, 0), 1280, 720);
+		const XMFLOAT4X4 view = camera.GetViewMatrixFloat4x4();
+		const XMFLOAT4X4 viewAgain = camera.GetViewMatrixFloat4x4();
+		camera.SetPosition(XMFLOAT3(1, 3, 4.5f));
+		const XMFLOAT4X4 viewMoved = camera.GetViewMatrixFloat4x4();
+		Camera moved(XMFLOAT3(1, 3, 4.5f), XMFLOAT3(0, -0.65f, -1), XMFLOAT3(0, 1, 0), 1280, 720);
+		const XMFLOAT4X4 viewExpected = moved.GetViewMatrixFloat4x4();
+		report.Check("the view matrix follows the camera", memcmp(&view, &viewAgain, sizeof(XMFLOAT4X4)) == 0 &&
+			memcmp(&viewMoved, &viewExpected, sizeof(XMFLOAT4X4)) == 0 && memcmp(&view, &viewMoved, sizeof(XMFLOAT4X4)) != 0);
+
+		float sink = 0.0f;
+		start = Clock::now();
+		for (int call = 0; call < VIEW_MATRIX_CALLS; ++call) sink += XMVectorGetX(camera.GetViewMatrix().r[3]);
+		report.Add("view_matrix", MillisecondsSince(start) * 1000000.0 / VIEW_MATRIX_CALLS + (sink == 1.0f ? 1e-9 : 0.0), "ns/call");
+	}
+
+	// ----- command-lists -----
+	// The render-queue items recorded the way Scene::Draw records them, serially onto one context and split over the
+	// job system's threads into lists. A stand-in for the deferred contexts records into contexts with no device
+	// behind them, so this times the CPU side of recording only, not the driver's. The driver's side is measured by
+	// the stress test's draw phase, with and without "-serial-submission". Checks every draw is recorded
+	// once, each list gets a contiguous run, the lists are played in order once all are finished, each list starts
+	// with what the immediate context had bound, and passes too short to split go straight to the immediate context.
+
+	constexpr int SUBMIT_FRAMES = 20;
+
+	// Records into contexts with no device, noting which thread recorded each list and the order they were played
+	class CountingListTarget : public ICommandListTarget<StateTrackingContext>
+	{
+	public:
+		bool Prepare(StateTrackingContext& immediate, UINT listCount) override
+		{
+			if (Refuse) return false;
+
+			m_immediate = &immediate;
+			Lists.resize(listCount);
+			Threads.assign(listCount, std::thread::id());
+			Executed.clear();
+			m_finished = 0;
+			return true;
+		}
+
+		StateTrackingContext& BeginList(UINT list) override
+		{
+			Threads[list] = std::this_thread::get_id();
+			Lists[list].Init(nullptr);
+			Lists[list].Inherit(*m_immediate);
+			return Lists[list];
+		}
+
+		void FinishList(UINT) override { ++m_finished; }
+
+		void ExecuteList(UINT list) override
+		{
+			AllFinishedFirst = AllFinishedFirst && m_finished == Lists.size();
+			Executed.push_back(list);
+			m_immediate->AddCounts(Lists[list]);
+		}
+
+		bool								Refuse = false;
+		bool								AllFinishedFirst = true;
+		std::vector<StateTrackingContext>	Lists;
+		std::vector<std::thread::id>		Threads;
+		std::vector<UINT>					Executed;
+
+	private:
+		StateTrackingContext*				m_immediate = nullptr;
+		std::atomic<size_t>					m_finished{ 0 };
+	};
+
+	// Scene::Draw's constants and binds for the draws [begin, end) of the pass starting at first
+	void RecordDraws(StateTrackingContext& context, const RenderSnapshot& snapshot, size_t first, size_t begin, size_t end, std::vector<UINT>& recorded)
+	{
+		for (size_t draw = first + begin; draw < first + end; ++draw)
+		{
+			const UINT slot = static_cast<UINT>(draw - first);
+			context.VSSetConstantBuffer1(Scene::OBJECT_CONSTANT_SLOT, FakePointer<ID3D11Buffer>(101), slot * ConstantRingBuffer::SLOT_CONSTANTS, ConstantRingBuffer::SLOT_CONSTANTS);
+			IRenderable::Bind(context, snapshot.RenderItems[snapshot.DrawQueue[draw].Item]);
+			++recorded[slot];
+		}
+	}
+
+	void FillConstants(const RenderSnapshot& snapshot, size_t first, size_t begin, size_t end, std::vector<BYTE>& slots)
+	{
+		ObjectConstantBuffer constants;
+		for (size_t draw = first + begin; draw < first + end; ++draw)
+		{
+			IRenderable::FillObjectConstants(snapshot.RenderItems[snapshot.DrawQueue[draw].Item], constants);
+			memcpy(slots.data() + (draw - first) * ConstantRingBuffer::SLOT_SIZE, &constants, sizeof(ObjectConstantBuffer));
+		}
+	}
+
+	void RunCommandListBenchmark(BenchmarkReport& report)
+	{
+		std::mt19937 random(4321);
+		RenderSnapshot snapshot;
+		CreateQueueItems(snapshot, random);
+		RenderQueue queue;
+		queue.Build(snapshot);
+
+		const auto [first, last] = RenderQueue::FindPass(snapshot.DrawQueue, 0);
+		const size_t drawCount = last - first;
+		std::vector<UINT> recorded(drawCount, 0);
+		std::vector<BYTE> slots(drawCount * ConstantRingBuffer::SLOT_SIZE);
+
+		// What the render graph and the renderer bind before the scene draws
+		StateTrackingContext immediate;
+		immediate.Init(nullptr);
+		auto bindPass = [&]()
+			{
+				ID3D11RenderTargetView* target = FakePointer<ID3D11RenderTargetView>(200);
+				immediate.Invalidate();
+				immediate.OMSetRenderTargets(1, &target, FakePointer<ID3D11DepthStencilView>(201));
+				immediate.VSSetShader(FakePointer<ID3D11VertexShader>(202));
+				immediate.IASetInputLayout(FakePointer<ID3D11InputLayout>(203));
+				immediate.VSSetConstantBuffer(Scene::FRAME_CONSTANT_SLOT, FakePointer<ID3D11Buffer>(204));
+				immediate.PSSetConstantBuffer(Scene::FRAME_CONSTANT_SLOT, FakePointer<ID3D11Buffer>(204));
+			};
+
+		// At least a few lists even on a machine with fewer cores, the timings below use what it has
+		const UINT workers = JobSystem::Get().GetWorkerCount();
+		JobSystem::Get().SetWorkerCount(std::max(workers, 3u));
+
+		CountingListTarget target;
+		auto record = [&](StateTrackingContext& context, size_t begin, size_t end) { RecordDraws(context, snapshot, first, begin, end, recorded); };
+		bindPass();
+		const UINT listCount = CommandListRecorder::Record(&target, immediate, drawCount, record);
+		const bool finishedBeforePlayed = target.Executed.empty();
+		CommandListRecorder::Execute(&target, listCount);
+
+		const UINT maxLists = JobSystem::Get().GetWorkerCount() + 1;
+		report.Check("a long pass is split into a list per thread", listCount == maxLists);
+		report.Check("every draw is recorded once", std::all_of(recorded.begin(), recorded.end(), [](UINT count) { return count == 1; }));
+
+		bool contiguous = true;
+		size_t expectedBegin = 0;
+		for (UINT list = 0; list < listCount; ++list)
+		{
+			const auto [begin, end] = CommandListRecorder::GetListRange(drawCount, listCount, list);
+			contiguous = contiguous && begin == expectedBegin && end > begin;
+			expectedBegin = end;
+		}
+		report.Check("lists are contiguous runs covering the pass", contiguous && expectedBegin == (listCount > 0 ? drawCount : 0));
+
+		bool inOrder = target.Executed.size() == listCount;
+		for (UINT list = 0; inOrder && list < listCount; ++list) inOrder = target.Executed[list] == list;
+		report.Check("lists are played in order once all are finished", finishedBeforePlayed && inOrder && target.AllFinishedFirst);
+
+		// Each list has the pass's shader and frame constants from the start, so binding them again is dropped
+		bool inherited = listCount > 0;
+		for (StateTrackingContext& list : target.Lists)
+		{
+			const uint64_t elided = list.GetCounts(StateTrackingContext::CALL_SHADER).Elided;
+			list.VSSetShader(FakePointer<ID3D11VertexShader>(202));
+			inherited = inherited && list.GetCounts(StateTrackingContext::CALL_SHADER).Elided == elided + 1;
+		}
+		report.Check("lists start with what the immediate context had bound", inherited);
+
+		std::sort(target.Threads.begin(), target.Threads.end());
+		const size_t threads = std::unique(target.Threads.begin(), target.Threads.end()) - target.Threads.begin();
+		report.Add("lists", listCount, "");
+		report.Add("threads_used", static_cast<double>(threads), "");
+
+		// Too short, no target, or a target that can't take the lists, all record straight onto immediate
+		std::fill(recorded.begin(), recorded.end(), 0);
+		const size_t shortCount = CommandListRecorder::MIN_DRAWS_PER_LIST;
+		const bool shortSerial = CommandListRecorder::Record(&target, immediate, shortCount, record) == 0;
+		const bool noTargetSerial = CommandListRecorder::Record(nullptr, immediate, drawCount, record) == 0;
+		target.Refuse = true;
+		const bool refusedSerial = CommandListRecorder::Record(&target, immediate, drawCount, record) == 0;
+		target.Refuse = false;
+		report.Check("short passes and missing lists draw on the immediate context", shortSerial && noTargetSerial && refusedSerial &&
+			std::all_of(recorded.begin(), recorded.begin() + shortCount, [](UINT count) { return count == 3; }) &&
+			std::all_of(recorded.begin() + shortCount, recorded.end(), [](UINT count) { return count == 2; }));
+		JobSystem::Get().SetWorkerCount(workers);
+
+		// The constants filled and the pass recorded, on one thread and split over all of them
+		double milliseconds[2] = {};
+		uint64_t issued[2] = {};
+		for (int parallel = 0; parallel < 2; ++parallel)
+		{
+			ICommandListTarget<StateTrackingContext>* lists = parallel ? &target : nullptr;
+			immediate.ResetCounts();
+			auto start = Clock::now();
+			for (int frame = 0; frame < SUBMIT_FRAMES; ++frame)
+			{
+				bindPass();
+				auto fill = [&](size_t begin, size_t end) { FillConstants(snapshot, first, begin, end, slots); };
+				if (parallel) JobSystem::Get().ParallelFor(drawCount, 1024, fill);
+				else fill(0, drawCount);
+
+				CommandListRecorder::Execute(lists, CommandListRecorder::Record(lists, immediate, drawCount, record));
+			}
+			milliseconds[parallel] = MillisecondsSince(start) / SUBMIT_FRAMES;
+			issued[parallel] = immediate.GetTotalCounts().Issued / SUBMIT_FRAMES;
+		}
+
+		report.Add("draws", static_cast<double>(drawCount), "");
+		report.Add("binds_serial", static_cast<double>(issued[0]), "");
+		report.Add("binds_parallel", static_cast<double>(issued[1]), "");
+		report.Add("submit_serial", milliseconds[0], "ms");
+		report.Add("submit_parallel", milliseconds[1], "ms");
+		report.Add("speedup", milliseconds[0] / milliseconds[1], "x");
+	}
+
+	// ----- shader-permutations -----
+	// The renderer's material driven shaders compiled without a device, so like the renderer this needs shader.fx
+	// next to the executable. A scratch cache directory is used, emptied first so the first pass really compiles
+
+	const wchar_t* SHADER_CACHE_DIRECTORY = L"BenchmarkShaderCache";
+
+	struct PermutedShaders
+	{
+		UINT	Lit = 0;
+		UINT	Unlit = 0;
+	};
+
+	bool AddRendererShaders(ShaderPermutations& permutations, PermutedShaders& shaders)
+	{
+		return SUCCEEDED(permutations.AddShader("PS", "PSGBuffer", SHADER_FEATURE_TEXTURE | SHADER_FEATURE_NORMAL_MAP, shaders.Lit))
+			&& SUCCEEDED(permutations.AddShader("PSTextureUnLit", "PSGBufferTextureUnLit", SHADER_FEATURE_TEXTURE, shaders.Unlit));
+	}
+
+	// Every variant of both, summing how long they took to load and whether all came from the cache
+	bool LoadAllVariants(ShaderPermutations& permutations, const PermutedShaders& shaders, float& loadMs, bool& fromCache)
+	{
+		loadMs = 0.0f;
+		fromCache = true;
+		for (UINT shader : { shaders.Lit, shaders.Unlit })
+		{
+			for (UINT features = 0; features <= SHADER_FEATURES_ALL; ++features)
+			{
+				if (permutations.GetVariant(shader, features) == nullptr) return false;
+			}
+		}
+
+		for (UINT i = 0; i < permutations.GetVariantCount(); ++i)
+		{
+			loadMs += permutations.GetVariantAt(i).LoadMs;
+			fromCache = fromCache && permutations.GetVariantAt(i).FromCache;
+		}
+		return true;
+	}
+
+	void RunShaderPermutationsBenchmark(BenchmarkReport& report)
+	{
+		std::error_code error;
+		std::filesystem::remove_all(SHADER_CACHE_DIRECTORY, error);
+
+		ShaderPermutations& permutations = ShaderPermutations::Get();
+		permutations.Init(nullptr, L"shader.fx", SHADER_CACHE_DIRECTORY);
+
+		PermutedShaders shaders;
+		const bool added = AddRendererShaders(permutations, shaders);
+		report.Check("shaders compile with every feature on", added);
+		if (!added)
+		{
+			permutations.Clear();
+			return;
+		}
+		report.Check("adding a shader compiles only the variant with every feature on", permutations.GetVariantCount() == 2);
+		report.Add("possible_variants", permutations.GetPossibleVariantCount(), "");
+
+		bool featuresMatch = true;
+		for (UINT features = 0; features <= SHADER_FEATURES_ALL; ++features)
+		{
+			_Material material;
+			material.UseTexture = (features & SHADER_FEATURE_TEXTURE) != 0;
+			material.UseNormalMap = (features & SHADER_FEATURE_NORMAL_MAP) != 0;
+			featuresMatch = featuresMatch && ShaderPermutations::GetFeatures(material) == features;
+		}
+		report.Check("material flags map to features", featuresMatch);
+
+		// The unlit shader doesn't read the normal map, a material with one shares the plain variant
+		const ShaderPermutations::Variant* unlitPlain = permutations.GetVariant(shaders.Unlit, SHADER_FEATURE_NORMAL_MAP);
+		report.Check("features a shader doesn't read are ignored", unlitPlain != nullptr && unlitPlain->Features == 0 && permutations.GetVariantCount() == 3);
+
+		float compileMs = 0.0f;
+		bool compiledFromCache = false;
+		const bool compiled = LoadAllVariants(permutations, shaders, compileMs, compiledFromCache);
+		report.Check("every variant compiles", compiled && !compiledFromCache);
+		report.Check("only the variants asked for are compiled", permutations.GetVariantCount() == permutations.GetPossibleVariantCount());
+
+		const ShaderPermutations::Variant* litPlain = permutations.GetVariant(shaders.Lit, 0);
+		const ShaderPermutations::Variant* litAll = permutations.GetVariant(shaders.Lit, SHADER_FEATURES_ALL);
+		const UINT variantCount = permutations.GetVariantCount();
+		report.Check("asking again doesn't compile again", litPlain == permutations.GetVariant(shaders.Lit, 0) && permutations.GetVariantCount() == variantCount);
+		report.Check("the variant without features runs fewer instructions", litPlain != nullptr && litAll != nullptr && litPlain->Instructions < litAll->Instructions);
+
+		for (UINT i = 0; i < permutations.GetVariantCount(); ++i)
+		{
+			const ShaderPermutations::Variant& variant = permutations.GetVariantAt(i);
+			const std::string name = std::string(permutations.GetEntryPoint(variant.Shader)) + "_" + std::to_string(variant.Features);
+			report.Add(name + "_instructions", variant.Instructions, "");
+			report.Add(name + "_gbuffer_instructions", variant.GBufferInstructions, "");
+		}
+
+		// The next run reads the bytecode back instead
+		permutations.Init(nullptr, L"shader.fx", SHADER_CACHE_DIRECTORY);
+		float cachedMs = 0.0f;
+		bool cached = false;
+		const bool reloaded = AddRendererShaders(permutations, shaders) && LoadAllVariants(permutations, shaders, cachedMs, cached);
+		report.Check("a second run reads every variant from the cache", reloaded && cached);
+		report.Add("compile_all", compileMs, "ms");
+		report.Add("load_all_cached", cachedMs, "ms");
+
+		// Four shaders reading both features fill the budget, a fifth is caught when it is added
+		permutations.Init(nullptr, L"shader.fx", SHADER_CACHE_DIRECTORY);
+		UINT shader = 0;
+		bool withinBudget = true;
+		for (UINT i = 0; i < ShaderPermutations::VARIANT_BUDGET >> SHADER_FEATURE_COUNT; ++i)
+		{
+			withinBudget = withinBudget && SUCCEEDED(permutations.AddShader("PS", nullptr, SHADER_FEATURES_ALL, shader));
+		}
+		const UINT shadersAdded = permutations.GetVariantCount();
+		report.Check("a shader past the variant budget is refused", withinBudget && permutations.AddShader("PS", nullptr, SHADER_FEATURES_ALL, shader) == ShaderPermutations::E_OVER_BUDGET
+			&& permutations.GetPossibleVariantCount() == ShaderPermutations::VARIANT_BUDGET && permutations.GetVariantCount() == shadersAdded);
+
+		permutations.Clear();
+		std::filesystem::remove_all(SHADER_CACHE_DIRECTORY, error);
+	}
+
+	struct Benchmark
+	{
+		const wchar_t*	Name;
+		void			(*Run)(BenchmarkReport& report);
+	};
+
+	const Benchmark BENCHMARKS[] =
+	{
+		{ L"object-pool", RunObjectPoolBenchmark },
+		{ L"rotation", RunRotationBenchmark },
+		{ L"scene-file", RunSceneFileBenchmark },
+		{ L"stress", RunStressBenchmark },
+		{ L"culling", RunCullingBenchmark },
+		{ L"bvh", RunBvhBenchmark },
+		{ L"occlusion", RunOcclusionBenchmark },
+		{ L"picking", RunPickingBenchmark },
+		{ L"clusters", RunClustersBenchmark },
+		{ L"light-buffer", RunLightBufferBenchmark },
+		{ L"render-graph", RunRenderGraphBenchmark },
+		{ L"gbuffer", RunGBufferBenchmark },
+		{ L"render-queue", RunRenderQueueBenchmark },
+		{ L"state-filter", RunStateFilterBenchmark },
+		{ L"instancing", RunInstancingBenchmark },
+		{ L"constant-ring", RunConstantRingBenchmark },
+		{ L"command-lists", RunCommandListBenchmark },
+		{ L"shader-permutations", RunShaderPermutationsBenchmark },
+	};
+
+	std::string Narrow(const std::wstring& text)
+	{
+		std::string narrow;
+		for (wchar_t c : text) narrow.push_back(static_cast<char>(c));
+		return narrow;
+	}
+}
+
+void BenchmarkReport::Add(const std::string& metric, double value, const std::string& unit)
+{
+	m_entries.push_back({ metric, value, unit });
+}
+
+void BenchmarkReport::Check(const std::string& name, bool passed)
+{
+	m_entries.push_back({ "check: " + name, passed ? 1.0 : 0.0, passed ? "pass" : "FAIL" });
+	if (!passed) ++m_failedChecks;
+}
+
+void BenchmarkReport::Write(const std::string& fileName) const
+{
+	std::ostringstream text;
+	text << "[" << m_benchmarkName << "]\n";
+	for (const Entry& entry : m_entries)
+	{
+		text << "  " << entry.Metric << " = " << entry.Value << " " << entry.Unit << "\n";
+	}
+
+	std::ofstream file(fileName, std::ios::app);
+	file << text.str();
+
+	OutputDebugStringA(text.str().c_str());
+}
+
+namespace Benchmarks
+{
+	bool RunFromCommandLine(const wchar_t* commandLine, int& exitCode)
+	{
+		if (commandLine == nullptr) return false;
+
+		std::wistringstream arguments(commandLine);
+		std::wstring argument;
+		std::wstring requested;
+		bool benchmarkMode = false;
+
+		while (arguments >> argument)
+		{
+			if (argument == L"-benchmark")
+			{
+				benchmarkMode = true;
+				if (!(arguments >> requested)) requested = L"all";
+			}
+		}
+
+		if (!benchmarkMode) return false;
+
+		exitCode = 0;
+		bool found = false;
+		for (const Benchmark& benchmark : BENCHMARKS)
+		{
+			if (requested != L"all" && requested != benchmark.Name) continue;
+
+			found = true;
+			BenchmarkReport report(Narrow(benchmark.Name));
+			benchmark.Run(report);
+			report.Write(RESULTS_FILE_NAME);
+
+			if (!report.AllChecksPassed()) exitCode = 1;
+		}
+
+		if (!found)
+		{
+			MessageBox(nullptr, L"Unknown benchmark name.", L"Error", MB_OK);
+			exitCode = 1;
+		}
+
+		return true;
+	}
+}
@@ -0,0 +1,44 @@
+// Command line benchmarks, run with "-benchmark <name>" instead of opening the renderer window
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+/// <summary>
+/// Collects the numbers a benchmark produces and writes them out once it has finished.
+/// </summary>
+class BenchmarkReport
+{
+public:
+	explicit BenchmarkReport(const std::string& benchmarkName) : m_benchmarkName(benchmarkName) {}
+
+	void Add(const std::string& metric, double value, const std::string& unit);
+
+	/// Records a correctness check alongside the timings, a failed check fails the whole run.
+	void Check(const std::string& name, bool passed);
+
+	bool AllChecksPassed() const { return m_failedChecks == 0; }
+
+	/// Appends the results to the text file and the debugger output.
+	void Write(const std::string& fileName) const;
+
+private:
+	struct Entry
+	{
+		std::string	Metric;
+		double		Value;
+		std::string	Unit;
+	};
+
+	std::string			m_benchmarkName;
+	std::vector<Entry>	m_entries;
+	int					m_failedChecks = 0;
+};
+
+namespace Benchmarks
+{
+	/// Runs the benchmark named on the command line (or all of them for "-benchmark all").
+	/// @return True if the command line asked for a benchmark, in which case the app should exit.
+	bool RunFromCommandLine(const wchar_t* commandLine, int& exitCode);
+}
@@ -6,6 +6,7 @@
 #include <windows.h>
 #include <windowsx.h>
 #include  <vector>
+#include <cstring>
 using namespace DirectX;
 #pragma endregion
 
@@ -78,6 +79,25 @@ public:
 	{
 		return m_projectionMatrix;
 	}
+
+	/// Builds the world space ray through a point on the screen, for picking.
+	/// @param x, y The point in pixels from the top left of the view.
+	/// @param width, height The size of the view in pixels.
+	/// @param origin Set to where the ray meets the near plane.
+	/// @param direction Set to the ray's normalised direction.
+	void GetPickRay(float x, float y, float width, float height, XMFLOAT3& origin, XMFLOAT3& direction)
+	{
+		// Back through the projection and view, from the point on the near plane to the one on the far plane
+		XMMATRIX inverseViewProjection = XMMatrixInverse(nullptr, XMMatrixMultiply(GetViewMatrix(), GetProjectionMatrix()));
+		float ndcX = x / width * 2.0f - 1.0f;
+		float ndcY = 1.0f - y / height * 2.0f;
+
+		XMVECTOR nearPoint = XMVector3TransformCoord(XMVectorSet(ndcX, ndcY, 0.0f, 1.0f), inverseViewProjection);
+		XMVECTOR farPoint = XMVector3TransformCoord(XMVectorSet(ndcX, ndcY, 1.0f, 1.0f), inverseViewProjection);
+
+		XMStoreFloat3(&origin, nearPoint);
+		XMStoreFloat3(&direction, XMVector3Normalize(XMVectorSubtract(farPoint, nearPoint)));
+	}
 #pragma endregion
 
 #pragma region Camera Movement
@@ -240,7 +260,7 @@ public:
 	/// <param name="deltaTime">The change in time.</param>
 	/// <param name="controlPoints">The points along the spline.</param>
 	/// <param name="duration">The length of the spline animation.</param>
-	void CameraSplineAnimation(float deltaTime, std::vector<XMVECTOR> controlPoints, float duration)
+	void CameraSplineAnimation(float deltaTime, const std::vector<XMVECTOR>& controlPoints, float duration)
 	{
 		m_splineTransition += deltaTime / duration;
 
@@ -363,6 +383,14 @@ private:
 	/// </summary>
 	void UpdateViewMatrix() const
 	{
+		// Everything moving the camera writes these directly, so comparing them is the one reliable way to know it moved
+		if (m_viewValid && memcmp(&m_viewPosition, &position, sizeof(XMFLOAT3)) == 0 && memcmp(&m_viewLookDir, &lookDir, sizeof(XMFLOAT3)) == 0 &&
+			memcmp(&m_viewUp, &up, sizeof(XMFLOAT3)) == 0) return;
+		m_viewPosition = position;
+		m_viewLookDir = lookDir;
+		m_viewUp = up;
+		m_viewValid = true;
+
 		// Calculate the look-at point based on the position and look direction
 		XMVECTOR posVec = XMLoadFloat3(&position);
 		XMVECTOR lookDirVec = XMLoadFloat3(&lookDir);
@@ -384,6 +412,12 @@ private:
 	XMFLOAT3 originalLookDir;
 	XMFLOAT3 originalUp;
 	mutable XMFLOAT4X4 viewMatrix;
+
+	// What viewMatrix was last built from, it is only built again once one of them changes
+	mutable XMFLOAT3 m_viewPosition;
+	mutable XMFLOAT3 m_viewLookDir;
+	mutable XMFLOAT3 m_viewUp;
+	mutable bool m_viewValid = false;
 	mutable XMFLOAT4X4 m_projectionMatrix;
 
 #pragma endregion
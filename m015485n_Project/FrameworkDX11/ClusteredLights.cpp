@@ -0,0 +1,455 @@
+#include "ClusteredLights.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+
+#include "JobSystem.h"
+
+namespace
+{
+	// Cluster boxes are grown by this much so a point on the edge between two clusters is inside both, whichever
+	// way the rounding goes
+	constexpr float CLUSTER_BOUNDS_EPSILON = 1e-4f;
+
+	// The index buffer never shrinks below this
+	constexpr UINT MIN_INDEX_CAPACITY = 1024;
+
+	typedef std::chrono::steady_clock Clock;
+
+	float MillisecondsSince(Clock::time_point start)
+	{
+		return std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+	}
+
+	UINT ClampCell(float cell, UINT count)
+	{
+		if (!(cell > 0.0f)) return 0;
+		return (std::min)(static_cast<UINT>(cell), count - 1);
+	}
+}
+
+float LightClusterGrid::ComputeLightRange(const Light& light, float cutoff)
+{
+	// Diffuse and specular are both at most the light's colour times its attenuation
+	const float brightest = (std::max)((std::max)(light.Color.x, light.Color.y), light.Color.z);
+	if (brightest <= 0.0f) return 0.0f;
+
+	// Past the range the attenuation's denominator, constant + linear * d + quadratic * d^2, is above this
+	const float target = brightest / cutoff;
+	const float constant = light.ConstantAttenuation;
+	const float linear = light.LinearAttenuation;
+	const float quadratic = light.QuadraticAttenuation;
+
+	if (constant >= target) return 0.0f;
+	if (quadratic > 0.0f) return (-linear + sqrtf(linear * linear + 4.0f * quadratic * (target - constant))) / (2.0f * quadratic);
+	if (linear > 0.0f) return (target - constant) / linear;
+	return FLT_MAX;
+}
+
+void LightClusterGrid::Build(const std::vector<Light>& lights, FXMMATRIX view, CXMMATRIX projection, bool clustered)
+{
+	auto start = Clock::now();
+	m_stats = Stats();
+
+	// Everything about the frustum comes out of a left handed perspective matrix
+	XMFLOAT4X4 p;
+	XMStoreFloat4x4(&p, projection);
+	const float tanHalfFovX = 1.0f / p._11;
+	const float tanHalfFovY = 1.0f / p._22;
+	const float nearZ = -p._43 / p._33;
+	const float farZ = p._43 / (1.0f - p._33);
+	if (tanHalfFovX != m_tanHalfFovX || tanHalfFovY != m_tanHalfFovY || nearZ != m_nearZ || farZ != m_farZ)
+	{
+		UpdateClusterBounds(tanHalfFovX, tanHalfFovY, nearZ, farZ);
+	}
+
+	m_lightIndices.clear();
+	m_clusteredLights.clear();
+	m_lightToClustered.assign(lights.size(), -1);
+	for (std::vector<UINT>& sliceLights : m_sliceLights) sliceLights.clear();
+
+	for (UINT i = 0; i < lights.size(); ++i)
+	{
+		const Light& light = lights[i];
+		if (!light.Enabled) continue;
+		++m_stats.Lights;
+
+		if (light.LightType == DirectionalLight)
+		{
+			m_lightIndices.push_back(i);
+			continue;
+		}
+
+		const float range = ComputeLightRange(light);
+		if (range <= 0.0f) continue;
+
+		if (!clustered || range == FLT_MAX)
+		{
+			m_lightIndices.push_back(i);
+			continue;
+		}
+
+		ClusteredLight bounded;
+		if (!BoundLight(light, range, view, bounded)) continue;
+
+		bounded.Light = i;
+		m_lightToClustered[i] = static_cast<int>(m_clusteredLights.size());
+		for (UINT slice = bounded.MinZ; slice <= bounded.MaxZ; ++slice) m_sliceLights[slice].push_back(static_cast<UINT>(m_clusteredLights.size()));
+		m_clusteredLights.push_back(bounded);
+	}
+
+	m_globalLightCount = static_cast<UINT>(m_lightIndices.size());
+	m_stats.GlobalLights = m_globalLightCount;
+	m_stats.ClusteredLights = static_cast<UINT>(m_clusteredLights.size());
+
+	// Every slice is independent, each one only writes its own clusters' lists
+	JobSystem::Get().ParallelFor(CLUSTERS_Z, 1, [this](size_t begin, size_t end)
+		{
+			for (size_t slice = begin; slice < end; ++slice) FillSlice(static_cast<UINT>(slice));
+		});
+
+	// Pack the lists one after another behind the global lights
+	m_ranges.resize(CLUSTER_COUNT);
+	UINT offset = m_globalLightCount;
+	for (UINT cluster = 0; cluster < CLUSTER_COUNT; ++cluster)
+	{
+		const UINT count = static_cast<UINT>(m_clusterLists[cluster].size());
+		m_ranges[cluster] = { offset, count };
+		offset += count;
+		m_stats.MaxClusterLights = (std::max)(m_stats.MaxClusterLights, count);
+	}
+
+	m_lightIndices.resize(offset);
+	JobSystem::Get().ParallelFor(CLUSTERS_Z, 1, [this](size_t begin, size_t end)
+		{
+			for (UINT cluster = static_cast<UINT>(begin) * CLUSTERS_X * CLUSTERS_Y; cluster < end * CLUSTERS_X * CLUSTERS_Y; ++cluster)
+			{
+				std::copy(m_clusterLists[cluster].begin(), m_clusterLists[cluster].end(), m_lightIndices.begin() + m_ranges[cluster].Offset);
+			}
+		});
+
+	m_stats.Indices = static_cast<UINT>(m_lightIndices.size());
+	m_stats.BuildMs = MillisecondsSince(start);
+}
+
+UINT LightClusterGrid::GetClusterIndex(float ndcX, float ndcY, float viewDepth) const
+{
+	UINT x = ClampCell((ndcX + 1.0f) * 0.5f * CLUSTERS_X, CLUSTERS_X);
+	UINT y = ClampCell((1.0f - ndcY) * 0.5f * CLUSTERS_Y, CLUSTERS_Y);
+	UINT z = ClampCell(log2f(viewDepth) * m_depthScale + m_depthBias, CLUSTERS_Z);
+	return x + (y + z * CLUSTERS_Y) * CLUSTERS_X;
+}
+
+BoundingBox LightClusterGrid::GetClusterBounds(UINT cluster) const
+{
+	BoundingBox box;
+	box.Center = XMFLOAT3((m_clusterMinX[cluster] + m_clusterMaxX[cluster]) * 0.5f, (m_clusterMinY[cluster] + m_clusterMaxY[cluster]) * 0.5f, (m_clusterMinZ[cluster] + m_clusterMaxZ[cluster]) * 0.5f);
+	box.Extents = XMFLOAT3((m_clusterMaxX[cluster] - m_clusterMinX[cluster]) * 0.5f, (m_clusterMaxY[cluster] - m_clusterMinY[cluster]) * 0.5f, (m_clusterMaxZ[cluster] - m_clusterMinZ[cluster]) * 0.5f);
+	return box;
+}
+
+bool LightClusterGrid::GetLightSphere(UINT light, BoundingSphere& sphere) const
+{
+	if (light >= m_lightToClustered.size() || m_lightToClustered[light] < 0) return false;
+
+	const XMFLOAT4& bounds = m_clusteredLights[m_lightToClustered[light]].Sphere;
+	sphere.Center = XMFLOAT3(bounds.x, bounds.y, bounds.z);
+	sphere.Radius = bounds.w;
+	return true;
+}
+
+void LightClusterGrid::UpdateClusterBounds(float tanHalfFovX, float tanHalfFovY, float nearZ, float farZ)
+{
+	m_tanHalfFovX = tanHalfFovX;
+	m_tanHalfFovY = tanHalfFovY;
+	m_nearZ = nearZ;
+	m_farZ = farZ;
+
+	// Slice k starts at near * (far / near)^(k / CLUSTERS_Z)
+	m_depthScale = CLUSTERS_Z / log2f(farZ / nearZ);
+	m_depthBias = -log2f(nearZ) * m_depthScale;
+
+	for (std::vector<float>* bounds : { &m_clusterMinX, &m_clusterMaxX, &m_clusterMinY, &m_clusterMaxY, &m_clusterMinZ, &m_clusterMaxZ })
+	{
+		bounds->resize(CLUSTER_COUNT);
+	}
+
+	for (UINT z = 0; z < CLUSTERS_Z; ++z)
+	{
+		const float sliceNear = nearZ * powf(farZ / nearZ, static_cast<float>(z) / CLUSTERS_Z) * (1.0f - CLUSTER_BOUNDS_EPSILON);
+		const float sliceFar = nearZ * powf(farZ / nearZ, static_cast<float>(z + 1) / CLUSTERS_Z) * (1.0f + CLUSTER_BOUNDS_EPSILON);
+
+		for (UINT y = 0; y < CLUSTERS_Y; ++y)
+		{
+			// Rows count down from the top of the screen
+			const float top = (1.0f - 2.0f * y / CLUSTERS_Y + CLUSTER_BOUNDS_EPSILON) * tanHalfFovY;
+			const float bottom = (1.0f - 2.0f * (y + 1) / CLUSTERS_Y - CLUSTER_BOUNDS_EPSILON) * tanHalfFovY;
+
+			for (UINT x = 0; x < CLUSTERS_X; ++x)
+			{
+				const float left = (-1.0f + 2.0f * x / CLUSTERS_X - CLUSTER_BOUNDS_EPSILON) * tanHalfFovX;
+				const float right = (-1.0f + 2.0f * (x + 1) / CLUSTERS_X + CLUSTER_BOUNDS_EPSILON) * tanHalfFovX;
+
+				// The cluster's sides are planes through the eye, so each extreme is at the near or far end
+				const UINT cluster = x + (y + z * CLUSTERS_Y) * CLUSTERS_X;
+				m_clusterMinX[cluster] = (std::min)(left * sliceNear, left * sliceFar);
+				m_clusterMaxX[cluster] = (std::max)(right * sliceNear, right * sliceFar);
+				m_clusterMinY[cluster] = (std::min)(bottom * sliceNear, bottom * sliceFar);
+				m_clusterMaxY[cluster] = (std::max)(top * sliceNear, top * sliceFar);
+				m_clusterMinZ[cluster] = sliceNear;
+				m_clusterMaxZ[cluster] = sliceFar;
+			}
+		}
+	}
+}
+
+bool LightClusterGrid::ComputeLightBounds(const Light& light, float range, BoundingSphere& bounds)
+{
+	XMVECTOR center = XMLoadFloat4(&light.Position);
+	float radius = range;
+
+	// A spot light only lights the part of the sphere inside its cone, the shader compares SpotAngle with the
+	// cosine of the angle off the light's direction
+	if (light.LightType == SpotLight)
+	{
+		const float cosine = light.SpotAngle;
+		if (cosine >= 1.0f) return false;
+
+		XMVECTOR direction = XMVectorSetW(XMLoadFloat4(&light.Direction), 0.0f);
+		if (cosine > 0.0f && XMVectorGetX(XMVector3LengthSq(direction)) > 0.0f)
+		{
+			direction = XMVector3Normalize(direction);
+			const float sine = sqrtf(1.0f - cosine * cosine);
+
+			// Wide cones are bounded round the circle at the end, narrow ones by a sphere through the tip
+			float offset;
+			if (cosine < XM_1DIVSQRT2)
+			{
+				offset = range * cosine;
+				radius = range * sine;
+			}
+			else
+			{
+				offset = range / (2.0f * cosine);
+				radius = offset;
+			}
+			center = XMVectorMultiplyAdd(direction, XMVectorReplicate(offset), center);
+		}
+	}
+
+	XMStoreFloat3(&bounds.Center, center);
+	bounds.Radius = radius;
+	return true;
+}
+
+bool LightClusterGrid::BoundLight(const Light& light, float range, FXMMATRIX view, ClusteredLight& bounded) const
+{
+	BoundingSphere bounds;
+	if (!ComputeLightBounds(light, range, bounds)) return false;
+
+	const float radius = bounds.Radius;
+	XMFLOAT3 viewCenter;
+	XMStoreFloat3(&viewCenter, XMVector3TransformCoord(XMVectorSetW(XMLoadFloat3(&bounds.Center), 1.0f), view));
+	bounded.Sphere = XMFLOAT4(viewCenter.x, viewCenter.y, viewCenter.z, radius);
+
+	if (viewCenter.z + radius < m_nearZ || viewCenter.z - radius > m_farZ) return false;
+
+	const float minZ = (std::max)(viewCenter.z - radius, m_nearZ);
+	const float maxZ = (std::min)(viewCenter.z + radius, m_farZ);
+
+	// Screen bounds of the sphere's box between those depths. x / z only gets bigger or smaller towards the box's
+	// corners, so the extremes are at one of them
+	float minNdcX = FLT_MAX, maxNdcX = -FLT_MAX;
+	float minNdcY = FLT_MAX, maxNdcY = -FLT_MAX;
+	for (float z : { minZ, maxZ })
+	{
+		for (float side : { -radius, radius })
+		{
+			const float ndcX = (viewCenter.x + side) / (z * m_tanHalfFovX);
+			const float ndcY = (viewCenter.y + side) / (z * m_tanHalfFovY);
+			minNdcX = (std::min)(minNdcX, ndcX);
+			maxNdcX = (std::max)(maxNdcX, ndcX);
+			minNdcY = (std::min)(minNdcY, ndcY);
+			maxNdcY = (std::max)(maxNdcY, ndcY);
+		}
+	}
+
+	if (maxNdcX < -1.0f || minNdcX > 1.0f || maxNdcY < -1.0f || minNdcY > 1.0f) return false;
+
+	// The same sums GetClusterIndex does, so any point of the light lands in a cluster inside these
+	bounded.MinX = ClampCell((minNdcX + 1.0f) * 0.5f * CLUSTERS_X, CLUSTERS_X);
+	bounded.MaxX = ClampCell((maxNdcX + 1.0f) * 0.5f * CLUSTERS_X, CLUSTERS_X);
+	bounded.MinY = ClampCell((1.0f - maxNdcY) * 0.5f * CLUSTERS_Y, CLUSTERS_Y);
+	bounded.MaxY = ClampCell((1.0f - minNdcY) * 0.5f * CLUSTERS_Y, CLUSTERS_Y);
+	bounded.MinZ = ClampCell(log2f(minZ) * m_depthScale + m_depthBias, CLUSTERS_Z);
+	bounded.MaxZ = ClampCell(log2f(maxZ) * m_depthScale + m_depthBias, CLUSTERS_Z);
+	return true;
+}
+
+void LightClusterGrid::FillSlice(UINT slice)
+{
+	const UINT sliceStart = slice * CLUSTERS_X * CLUSTERS_Y;
+	for (UINT cluster = sliceStart; cluster < sliceStart + CLUSTERS_X * CLUSTERS_Y; ++cluster) m_clusterLists[cluster].clear();
+
+	const XMVECTOR zero = XMVectorZero();
+
+	// Lights are walked in order, so every cluster's list comes out sorted
+	for (UINT clusteredIndex : m_sliceLights[slice])
+	{
+		const ClusteredLight& light = m_clusteredLights[clusteredIndex];
+		const XMVECTOR centerX = XMVectorReplicate(light.Sphere.x);
+		const XMVECTOR centerY = XMVectorReplicate(light.Sphere.y);
+		const XMVECTOR centerZ = XMVectorReplicate(light.Sphere.z);
+		const XMVECTOR radiusSquared = XMVectorReplicate(light.Sphere.w * light.Sphere.w);
+
+		for (UINT y = light.MinY; y <= light.MaxY; ++y)
+		{
+			const UINT rowStart = sliceStart + y * CLUSTERS_X;
+
+			// Four clusters of the row at a time, squared distance from the sphere's centre to each box
+			for (UINT x = light.MinX & ~3u; x <= light.MaxX; x += 4)
+			{
+				const UINT first = rowStart + x;
+				XMVECTOR dx = XMVectorMax(XMVectorMax(XMVectorSubtract(XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&m_clusterMinX[first])), centerX),
+					XMVectorSubtract(centerX, XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&m_clusterMaxX[first])))), zero);
+				XMVECTOR dy = XMVectorMax(XMVectorMax(XMVectorSubtract(XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&m_clusterMinY[first])), centerY),
+					XMVectorSubtract(centerY, XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&m_clusterMaxY[first])))), zero);
+				XMVECTOR dz = XMVectorMax(XMVectorMax(XMVectorSubtract(XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&m_clusterMinZ[first])), centerZ),
+					XMVectorSubtract(centerZ, XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&m_clusterMaxZ[first])))), zero);
+
+				XMVECTOR distanceSquared = XMVectorMultiplyAdd(dx, dx, XMVectorMultiplyAdd(dy, dy, XMVectorMultiply(dz, dz)));
+
+				XMUINT4 touching;
+				XMStoreUInt4(&touching, XMVectorLessOrEqual(distanceSquared, radiusSquared));
+				const UINT lanes[4] = { touching.x, touching.y, touching.z, touching.w };
+				for (UINT lane = 0; lane < 4; ++lane)
+				{
+					if (lanes[lane] && x + lane >= light.MinX && x + lane <= light.MaxX) m_clusterLists[first + lane].push_back(light.Light);
+				}
+			}
+		}
+	}
+}
+
+HRESULT LightClusterBuffer::Apply(ID3D11Device* device, ID3D11DeviceContext* context, const std::vector<LightClusterRange>& ranges, const std::vector<UINT>& lightIndices)
+{
+	if (ranges.size() != LightClusterGrid::CLUSTER_COUNT) return E_INVALIDARG;
+
+	HRESULT hr = S_OK;
+	if (m_rangeBuffer == nullptr)
+	{
+		hr = CreateRangeBuffer(device);
+		if (FAILED(hr)) return hr;
+	}
+
+	if (lightIndices.size() > m_indexCapacity || m_indexBuffer == nullptr)
+	{
+		hr = GrowIndexBuffer(device, static_cast<UINT>(lightIndices.size()));
+		if (FAILED(hr)) return hr;
+	}
+
+	context->UpdateSubresource(m_rangeBuffer.Get(), 0, nullptr, ranges.data(), 0, 0);
+
+	// Only the part of the index buffer this frame uses
+	if (!lightIndices.empty())
+	{
+		D3D11_BOX box = {};
+		box.right = static_cast<UINT>(sizeof(UINT) * lightIndices.size());
+		box.bottom = 1;
+		box.back = 1;
+		context->UpdateSubresource(m_indexBuffer.Get(), 0, &box, lightIndices.data(), 0, 0);
+	}
+
+	return S_OK;
+}
+
+void LightClusterBuffer::Bind(StateTrackingContext& context) const
+{
+	context.PSSetShaderResource(RANGES_SHADER_SLOT, m_rangeView.Get());
+	context.PSSetShaderResource(INDICES_SHADER_SLOT, m_indexView.Get());
+}
+
+void LightClusterBuffer::Clear()
+{
+	m_rangeBuffer.Reset();
+	m_rangeView.Reset();
+	m_indexBuffer.Reset();
+	m_indexView.Reset();
+	m_indexCapacity = 0;
+}
+
+HRESULT LightClusterBuffer::CreateRangeBuffer(ID3D11Device* device)
+{
+	D3D11_BUFFER_DESC sbDesc = {};
+	sbDesc.Usage = D3D11_USAGE_DEFAULT;
+	sbDesc.ByteWidth = sizeof(LightClusterRange) * LightClusterGrid::CLUSTER_COUNT;
+	sbDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+	sbDesc.CPUAccessFlags = 0;
+	sbDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+	sbDesc.StructureByteStride = sizeof(LightClusterRange);
+
+	HRESULT hr = device->CreateBuffer(&sbDesc, nullptr, &m_rangeBuffer);
+	if (FAILED(hr))
+	{
+		MessageBox(nullptr, L"Failed to create the light cluster buffer.", L"Error", MB_OK);
+		return hr;
+	}
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+	srvDesc.Buffer.FirstElement = 0;
+	srvDesc.Buffer.NumElements = LightClusterGrid::CLUSTER_COUNT;
+
+	hr = device->CreateShaderResourceView(m_rangeBuffer.Get(), &srvDesc, &m_rangeView);
+	if (FAILED(hr))
+	{
+		MessageBox(nullptr, L"Failed to create the light cluster buffer view.", L"Error", MB_OK);
+		m_rangeBuffer.Reset();
+		return hr;
+	}
+
+	return S_OK;
+}
+
+HRESULT LightClusterBuffer::GrowIndexBuffer(ID3D11Device* device, UINT indexCount)
+{
+	UINT capacity = (std::max)(m_indexCapacity, MIN_INDEX_CAPACITY);
+	while (capacity < indexCount) capacity *= 2;
+
+	D3D11_BUFFER_DESC sbDesc = {};
+	sbDesc.Usage = D3D11_USAGE_DEFAULT;
+	sbDesc.ByteWidth = sizeof(UINT) * capacity;
+	sbDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+	sbDesc.CPUAccessFlags = 0;
+	sbDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+	sbDesc.StructureByteStride = sizeof(UINT);
+
+	m_indexBuffer.Reset();
+	m_indexView.Reset();
+	m_indexCapacity = 0;
+
+	HRESULT hr = device->CreateBuffer(&sbDesc, nullptr, &m_indexBuffer);
+	if (FAILED(hr))
+	{
+		MessageBox(nullptr, L"Failed to create the light index buffer.", L"Error", MB_OK);
+		return hr;
+	}
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+	srvDesc.Buffer.FirstElement = 0;
+	srvDesc.Buffer.NumElements = capacity;
+
+	hr = device->CreateShaderResourceView(m_indexBuffer.Get(), &srvDesc, &m_indexView);
+	if (FAILED(hr))
+	{
+		MessageBox(nullptr, L"Failed to create the light index buffer view.", L"Error", MB_OK);
+		m_indexBuffer.Reset();
+		return hr;
+	}
+
+	m_indexCapacity = capacity;
+	return S_OK;
+}
@@ -0,0 +1,161 @@
+// Splits the view into a grid of clusters and lists the lights that reach each one, so a pixel only loops over the lights near it
+
+#pragma once
+
+#include <windows.h>
+#include <d3d11_1.h>
+#include <wrl/client.h>
+#include <DirectXMath.h>
+#include <vector>
+
+#include "structures.h"
+#include "StateTrackingContext.h"
+
+using namespace DirectX;
+
+/// <summary>
+/// Where a cluster's lights are in the index list, read by the pixel shader as a uint2.
+/// </summary>
+struct LightClusterRange
+{
+	UINT	Offset;
+	UINT	Count;
+};
+
+/// <summary>
+/// CPU side of clustered lighting. The view frustum is cut into CLUSTERS_X by CLUSTERS_Y tiles on screen and
+/// CLUSTERS_Z slices in depth, the slices spaced exponentially so near clusters are as deep as they are wide.
+/// Point and spot lights get a bounding sphere from how far their attenuation reaches (and their cone for spot
+/// lights) and are added to every cluster whose box the sphere touches. Lights that reach everywhere, directional
+/// ones and ones that never fall off, go at the front of the index list and are applied to every pixel.
+///
+/// Lights are binned into depth slices first, then each slice is filled on its own job, testing four clusters of a
+/// row at once. Pure CPU code so it can run on the simulation thread and in the benchmarks.
+/// </summary>
+class LightClusterGrid
+{
+public:
+	static constexpr UINT CLUSTERS_X = 16;
+	static constexpr UINT CLUSTERS_Y = 9;
+	static constexpr UINT CLUSTERS_Z = 24;
+	static constexpr UINT CLUSTER_COUNT = CLUSTERS_X * CLUSTERS_Y * CLUSTERS_Z;
+
+	// A light is treated as reaching no further than where its brightest channel drops under this, about one
+	// step of an 8 bit colour
+	static constexpr float DEFAULT_CUTOFF = 1.0f / 256.0f;
+
+	/// How far a point or spot light reaches before its attenuation takes it under cutoff.
+	/// @return FLT_MAX for lights that never fall off far enough, 0 for ones that never get bright enough.
+	static float	ComputeLightRange(const Light& light, float cutoff = DEFAULT_CUTOFF);
+
+	/// World space sphere round everything a point or spot light reaches within range, tight round a spot light's cone.
+	/// @return False for a spot light whose cone is closed, which lights nothing.
+	static bool		ComputeLightBounds(const Light& light, float range, BoundingSphere& bounds);
+
+	/// Rebuilds every cluster's list for lights seen through view and a perspective projection.
+	/// @param clustered False puts every enabled light in the global list, for comparing against no culling.
+	void	Build(const std::vector<Light>& lights, FXMMATRIX view, CXMMATRIX projection, bool clustered = true);
+
+	/// CLUSTER_COUNT ranges into the index list, x fastest, then y from the top of the screen, then depth.
+	const std::vector<LightClusterRange>&	GetRanges() const { return m_ranges; }
+
+	/// Indexes into the light list. The first GetGlobalLightCount are lit everywhere, the ranges point past them.
+	const std::vector<UINT>&				GetLightIndices() const { return m_lightIndices; }
+	UINT									GetGlobalLightCount() const { return m_globalLightCount; }
+
+	/// The cluster a point falls in, the same sum the pixel shader does.
+	/// @param ndcX, ndcY The point's position on screen, -1 to 1 with y up.
+	/// @param viewDepth Distance in front of the camera.
+	UINT	GetClusterIndex(float ndcX, float ndcY, float viewDepth) const;
+
+	/// Depth slice = log2(viewDepth) * scale + bias, for the shader constants.
+	float	GetDepthScale() const { return m_depthScale; }
+	float	GetDepthBias() const { return m_depthBias; }
+
+	/// A cluster's view space bounding box, the light spheres are tested against these.
+	BoundingBox	GetClusterBounds(UINT cluster) const;
+
+	/// The view space sphere used for a light in the last Build, false if it was global or skipped.
+	bool	GetLightSphere(UINT light, BoundingSphere& sphere) const;
+
+	struct Stats
+	{
+		UINT	Lights = 0;
+		UINT	GlobalLights = 0;
+		UINT	ClusteredLights = 0;
+		UINT	Indices = 0;
+		UINT	MaxClusterLights = 0;
+		float	BuildMs = 0.0f;
+	};
+
+	const Stats&	GetStats() const { return m_stats; }
+
+private:
+	// A light that goes into the clusters, with the clusters its sphere's bounds cover
+	struct ClusteredLight
+	{
+		XMFLOAT4	Sphere;
+		UINT		Light;
+		UINT		MinX, MaxX;
+		UINT		MinY, MaxY;
+		UINT		MinZ, MaxZ;
+	};
+
+	void	UpdateClusterBounds(float tanHalfFovX, float tanHalfFovY, float nearZ, float farZ);
+	bool	BoundLight(const Light& light, float range, FXMMATRIX view, ClusteredLight& bounded) const;
+	void	FillSlice(UINT slice);
+
+	// The projection the cluster boxes were made for, they are only rebuilt when it changes
+	float	m_tanHalfFovX = 0.0f;
+	float	m_tanHalfFovY = 0.0f;
+	float	m_nearZ = 0.0f;
+	float	m_farZ = 0.0f;
+	float	m_depthScale = 0.0f;
+	float	m_depthBias = 0.0f;
+
+	// Cluster boxes laid out a slice row at a time, one array per component so four can be loaded at once
+	std::vector<float>	m_clusterMinX, m_clusterMaxX;
+	std::vector<float>	m_clusterMinY, m_clusterMaxY;
+	std::vector<float>	m_clusterMinZ, m_clusterMaxZ;
+
+	// Scratch reused every build: the bounded lights, which of them touch each slice, and each slice's lists
+	std::vector<ClusteredLight>				m_clusteredLights;
+	std::vector<int>						m_lightToClustered;
+	std::vector<UINT>						m_sliceLights[CLUSTERS_Z];
+	std::vector<UINT>						m_clusterLists[CLUSTER_COUNT];
+
+	std::vector<LightClusterRange>			m_ranges;
+	std::vector<UINT>						m_lightIndices;
+	UINT									m_globalLightCount = 0;
+	Stats									m_stats;
+};
+
+/// <summary>
+/// Render side of clustered lighting, the ranges and index list in structured buffers at t4 and t5. The index
+/// buffer is only recreated when a frame needs more entries than it holds.
+/// </summary>
+class LightClusterBuffer
+{
+public:
+	static constexpr UINT RANGES_SHADER_SLOT = 4;
+	static constexpr UINT INDICES_SHADER_SLOT = 5;
+
+	HRESULT	Apply(ID3D11Device* device, ID3D11DeviceContext* context, const std::vector<LightClusterRange>& ranges, const std::vector<UINT>& lightIndices);
+
+	/// Binds both buffers to the pixel shader.
+	void	Bind(StateTrackingContext& context) const;
+
+	UINT	GetIndexCapacity() const { return m_indexCapacity; }
+
+	void	Clear();
+
+private:
+	HRESULT	CreateRangeBuffer(ID3D11Device* device);
+	HRESULT	GrowIndexBuffer(ID3D11Device* device, UINT indexCount);
+
+	Microsoft::WRL::ComPtr<ID3D11Buffer>				m_rangeBuffer;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>	m_rangeView;
+	Microsoft::WRL::ComPtr<ID3D11Buffer>				m_indexBuffer;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>	m_indexView;
+	UINT												m_indexCapacity = 0;
+};
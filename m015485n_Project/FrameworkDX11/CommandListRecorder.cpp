@@ -0,0 +1,14 @@
+#include "CommandListRecorder.h"
+
+#include <algorithm>
+
+unsigned int CommandListRecorder::GetListCount(size_t count, unsigned int maxLists, size_t minDrawsPerList)
+{
+	const size_t lists = minDrawsPerList > 0 ? count / minDrawsPerList : count;
+	return static_cast<unsigned int>(std::max<size_t>(1, std::min<size_t>(lists, maxLists)));
+}
+
+std::pair<size_t, size_t> CommandListRecorder::GetListRange(size_t count, unsigned int listCount, unsigned int list)
+{
+	return { count * list / listCount, count * (list + 1) / listCount };
+}
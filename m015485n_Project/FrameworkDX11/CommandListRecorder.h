@@ -0,0 +1,102 @@
+// Records a pass's draws on several threads into command lists that are played back in order on the render thread.
+// Nothing here includes D3D, what a list is recorded through is a template parameter, so the splitting builds and
+// can be checked against a mock context on any platform
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <utility>
+
+#include "JobSystem.h"
+
+/// <summary>
+/// Where CommandListRecorder records to. Context is what draws are recorded through, DeferredContextPool records into
+/// D3D deferred contexts through StateTrackingContext, anything else can stand in for it to check and time the split
+/// without a device.
+/// </summary>
+template<class Context>
+class ICommandListTarget
+{
+public:
+	/// Records the draws [begin, end) into context.
+	typedef std::function<void(Context& context, size_t begin, size_t end)> RecordJob;
+
+	// Named through the class so Record only works Context out from the immediate context, nullptr and lambdas
+	// can't say what it is
+	typedef ICommandListTarget Target;
+
+	virtual ~ICommandListTarget() = default;
+
+	/// Called on the render thread before any list is recorded.
+	/// @param immediate What the lists start with bound, and what they are played on.
+	/// @return False if listCount lists can't be recorded, the draws then go straight to immediate.
+	virtual bool	Prepare(Context& immediate, unsigned int listCount) = 0;
+
+	/// Called on the thread recording list, which has it to itself until FinishList.
+	virtual Context&	BeginList(unsigned int list) = 0;
+	virtual void		FinishList(unsigned int list) = 0;
+
+	/// Called on the render thread once every list is finished, in list order.
+	virtual void	ExecuteList(unsigned int list) = 0;
+};
+
+/// <summary>
+/// Splits [0, count) into contiguous ranges, one list each, and records them with the job system. The ranges are in
+/// order and played back in order, so the draws reach the GPU in the order the queue sorted them whatever thread
+/// recorded them. A pass too short to be worth splitting is recorded on the immediate context as before.
+/// </summary>
+class CommandListRecorder
+{
+public:
+	/// A command list costs about as much to start and play as drawing this many serially
+	static constexpr size_t MIN_DRAWS_PER_LIST = 512;
+
+	/// How many lists count draws are split into, at most maxLists. 1 means they aren't worth splitting.
+	static unsigned int	GetListCount(size_t count, unsigned int maxLists, size_t minDrawsPerList = MIN_DRAWS_PER_LIST);
+
+	/// The [begin, end) list records out of listCount.
+	static std::pair<size_t, size_t>	GetListRange(size_t count, unsigned int listCount, unsigned int list);
+
+	/// Records [0, count) split over one list per thread the job system has. With no target, or one the split
+	/// doesn't suit, record runs once over everything on immediate.
+	/// @return The lists recorded, to hand to Execute once anything they read is ready. 0 if it went to immediate.
+	template<class Context>
+	static unsigned int	Record(typename ICommandListTarget<Context>::Target* target, Context& immediate, size_t count,
+		const typename ICommandListTarget<Context>::RecordJob& record, size_t minDrawsPerList = MIN_DRAWS_PER_LIST);
+
+	/// Plays the lists Record recorded, in order.
+	template<class Context>
+	static void	Execute(ICommandListTarget<Context>* target, unsigned int listCount);
+};
+
+template<class Context>
+unsigned int CommandListRecorder::Record(typename ICommandListTarget<Context>::Target* target, Context& immediate, size_t count,
+	const typename ICommandListTarget<Context>::RecordJob& record, size_t minDrawsPerList)
+{
+	// The thread calling ParallelFor records a list too
+	const unsigned int listCount = GetListCount(count, JobSystem::Get().GetWorkerCount() + 1, minDrawsPerList);
+	if (target == nullptr || listCount < 2 || !target->Prepare(immediate, listCount))
+	{
+		record(immediate, 0, count);
+		return 0;
+	}
+
+	JobSystem::Get().ParallelFor(listCount, 1, [&](size_t begin, size_t end)
+		{
+			for (size_t list = begin; list < end; ++list)
+			{
+				const auto [first, last] = GetListRange(count, listCount, static_cast<unsigned int>(list));
+				Context& context = target->BeginList(static_cast<unsigned int>(list));
+				record(context, first, last);
+				target->FinishList(static_cast<unsigned int>(list));
+			}
+		});
+	return listCount;
+}
+
+template<class Context>
+void CommandListRecorder::Execute(ICommandListTarget<Context>* target, unsigned int listCount)
+{
+	for (unsigned int list = 0; list < listCount; ++list) target->ExecuteList(list);
+}
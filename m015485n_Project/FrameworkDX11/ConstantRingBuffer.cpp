@@ -0,0 +1,100 @@
+#include "ConstantRingBuffer.h"
+
+HRESULT ConstantRingBuffer::Init(ID3D11Device* device, UINT slotCount)
+{
+	Clear();
+
+	if (device == nullptr)
+	{
+		m_slotCount = slotCount;
+		m_nextSlot = slotCount;
+		m_noOverwrite = true;
+		return S_OK;
+	}
+
+	D3D11_FEATURE_DATA_D3D11_OPTIONS options = {};
+	if (SUCCEEDED(device->CheckFeatureSupport(D3D11_FEATURE_D3D11_OPTIONS, &options, sizeof(options))))
+	{
+		m_supported = options.ConstantBufferOffsetting != FALSE;
+		m_noOverwrite = options.MapNoOverwriteOnDynamicConstantBuffer != FALSE;
+	}
+
+	// Drawing goes back to writing one buffer per draw
+	if (!m_supported) return S_OK;
+
+	return CreateBuffer(device, slotCount);
+}
+
+bool ConstantRingBuffer::Allocate(UINT count, UINT& firstSlot)
+{
+	// Without NO_OVERWRITE every map has to discard, so every map starts at the front
+	const bool restart = !m_noOverwrite || m_nextSlot + count > m_slotCount;
+	if (restart)
+	{
+		m_nextSlot = 0;
+		++m_wrapCount;
+	}
+
+	firstSlot = m_nextSlot;
+	m_nextSlot += count;
+	return restart;
+}
+
+BYTE* ConstantRingBuffer::Map(ID3D11Device* device, ID3D11DeviceContext* context, UINT count, UINT& firstSlot)
+{
+	if (!m_supported || count == 0) return nullptr;
+
+	if (count > m_slotCount)
+	{
+		UINT slotCount = m_slotCount;
+		while (slotCount < count) slotCount *= 2;
+		if (FAILED(CreateBuffer(device, slotCount))) return nullptr;
+	}
+
+	const bool restart = Allocate(count, firstSlot);
+
+	D3D11_MAPPED_SUBRESOURCE mapped = {};
+	if (FAILED(context->Map(m_buffer.Get(), 0, restart ? D3D11_MAP_WRITE_DISCARD : D3D11_MAP_WRITE_NO_OVERWRITE, 0, &mapped))) return nullptr;
+
+	return static_cast<BYTE*>(mapped.pData) + static_cast<size_t>(firstSlot) * SLOT_SIZE;
+}
+
+void ConstantRingBuffer::Unmap(ID3D11DeviceContext* context)
+{
+	context->Unmap(m_buffer.Get(), 0);
+}
+
+void ConstantRingBuffer::Clear()
+{
+	m_buffer.Reset();
+	m_slotCount = 0;
+	m_nextSlot = 0;
+	m_wrapCount = 0;
+	m_supported = false;
+	m_noOverwrite = false;
+}
+
+HRESULT ConstantRingBuffer::CreateBuffer(ID3D11Device* device, UINT slotCount)
+{
+	D3D11_BUFFER_DESC bd = {};
+	bd.Usage = D3D11_USAGE_DYNAMIC;
+	bd.ByteWidth = SLOT_SIZE * slotCount;
+	bd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+	bd.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+
+	m_buffer.Reset();
+	m_slotCount = 0;
+
+	HRESULT hr = device->CreateBuffer(&bd, nullptr, &m_buffer);
+	if (FAILED(hr))
+	{
+		MessageBox(nullptr, L"Failed to create the constant ring buffer.", L"Error", MB_OK);
+		m_supported = false;
+		return hr;
+	}
+
+	// A new buffer has to be discarded before anything can be written without overwriting
+	m_slotCount = slotCount;
+	m_nextSlot = slotCount;
+	return S_OK;
+}
@@ -0,0 +1,61 @@
+// One big dynamic constant buffer that each draw's constants are written into one after another and bound by offset
+
+#pragma once
+
+#include <d3d11_1.h>
+#include <wrl/client.h>
+
+/// <summary>
+/// Per draw constants go into fixed size slots of one dynamic buffer, and each draw binds its own slot with
+/// VSSetConstantBuffers1 rather than every draw rewriting a buffer of its own. Slots are handed out in order and carry
+/// on from frame to frame, mapped with NO_OVERWRITE since nothing the GPU may still be reading is written. When the
+/// end is reached the buffer is mapped with DISCARD, which gives it fresh memory, and handing out starts again at
+/// the front. A map bigger than the whole buffer recreates it at double the size.
+///
+/// Offsets need D3D 11.1, IsSupported says whether the device has them. Without a device only the slots are worked
+/// out, for measuring. Used on the render thread only.
+/// </summary>
+class ConstantRingBuffer
+{
+public:
+	// VSSetConstantBuffers1 takes offsets and sizes in 16 byte constants, and both have to be multiples of 16 of them
+	static constexpr UINT SLOT_SIZE = 256;
+	static constexpr UINT SLOT_CONSTANTS = SLOT_SIZE / 16;
+
+	/// @param device nullptr only hands out slots, Map can't be used.
+	HRESULT	Init(ID3D11Device* device, UINT slotCount);
+
+	/// True if the device can bind part of a constant buffer.
+	bool	IsSupported() const { return m_supported; }
+
+	/// Picks where the next count slots go, count can't be more than GetSlotCount.
+	/// @param firstSlot Set to the first of them.
+	/// @return True if they start the buffer over and it has to be mapped with DISCARD.
+	bool	Allocate(UINT count, UINT& firstSlot);
+
+	/// Maps the next count slots for writing, slot i of them at i * SLOT_SIZE from the pointer.
+	/// @param firstSlot Set to the first of them, bind slot s with FirstConstant s * SLOT_CONSTANTS.
+	/// @return nullptr if the map failed or count is 0.
+	BYTE*	Map(ID3D11Device* device, ID3D11DeviceContext* context, UINT count, UINT& firstSlot);
+	void	Unmap(ID3D11DeviceContext* context);
+
+	ID3D11Buffer*	GetBuffer() const { return m_buffer.Get(); }
+	UINT			GetSlotCount() const { return m_slotCount; }
+
+	/// Times the buffer was started over, for the stats window.
+	UINT	GetWrapCount() const { return m_wrapCount; }
+
+	void	Clear();
+
+private:
+	HRESULT	CreateBuffer(ID3D11Device* device, UINT slotCount);
+
+	Microsoft::WRL::ComPtr<ID3D11Buffer>	m_buffer;
+	UINT									m_slotCount = 0;
+	UINT									m_nextSlot = 0;
+	UINT									m_wrapCount = 0;
+	bool									m_supported = false;
+
+	// Some 11.1 drivers can bind by offset but not map a constant buffer without discarding it
+	bool									m_noOverwrite = false;
+};
@@ -19,11 +19,11 @@ DX11App::~DX11App()
 {
 }
 
-HRESULT DX11App::init()
+HRESULT DX11App::init(const StressTest::Settings* stressTest)
 {
 	m_pRenderer = new DX11Renderer();
 
-	HRESULT hr = m_pRenderer->Init(m_hWnd);
+	HRESULT hr = m_pRenderer->Init(m_hWnd, stressTest);
 
 	return hr;
 }
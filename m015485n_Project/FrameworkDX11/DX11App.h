@@ -16,6 +16,7 @@
 #pragma once
 #include "structures.h"
 #include "wrl.h"
+#include "StressTest.h"
 
 class DX11Renderer;
 
@@ -25,7 +26,7 @@ public: // methods
 	DX11App();
 	~DX11App();
 
-	HRESULT		init();
+	HRESULT		init(const StressTest::Settings* stressTest = nullptr);
 	void		cleanUp();
 	
 	HRESULT		initWindow(HINSTANCE hInstance, int nCmdShow);
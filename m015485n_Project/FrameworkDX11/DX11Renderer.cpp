@@ -1,26 +1,40 @@
 #include "DX11Renderer.h"
 #include "Scene.h"
-
+#include "FramePipeline.h"
+#include "FrameArena.h"
+#include "GBufferEncoding.h"
+#include "AllocationCounter.h"
+#include "PipelineStateCache.h"
+#include "ShaderPermutations.h"
+
+#include <algorithm>
+#include <chrono>
 #include <d3dcompiler.h>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <tuple>
 
 #include "globals.h"
 
-HRESULT DX11Renderer::Init(HWND hwnd)
+HRESULT DX11Renderer::Init(HWND hwnd, const StressTest::Settings* stressTest)
 {
 	InitDevice(hwnd);
+	PipelineStateCache::Get().Init(m_pd3dDevice.Get());
+	ShaderPermutations::Get().Init(m_pd3dDevice.Get(), L"shader.fx", L"ShaderCache");
+	m_stateContext.Init(m_pImmediateContext.Get(), m_pImmediateContext1.Get());
 
 	m_pScene = new Scene;
 
 	m_imguiRenderer = new ImGuiRendering(hwnd, m_pd3dDevice.Get(), m_pImmediateContext.Get());
 
-	m_pScene->m_textureMap.push_back({ "RenderTargetViewPass0",g_pRTTShaderResourceView });
-	m_pScene->m_textureMap.push_back({ "RenderTargetViewPass1",g_pRTTShaderResourceView2 });
-	m_pScene->m_textureMap.push_back({ "RenderTargetViewPass2",g_pRTTShaderResourceView3 });
+	HRESULT hr = BuildRenderGraph();
+	if (FAILED(hr))
+		return hr;
 
 	// Compile the vertex shader
 	ID3DBlob* pVSBlob = nullptr;
-	HRESULT hr = DX11Renderer::CompileShaderFromFile(L"shader.fx", "VS", "vs_4_0", &pVSBlob);
+	hr = DX11Renderer::CompileShaderFromFile(L"shader.fx", "VS", "vs_4_0", &pVSBlob);
 	if (FAILED(hr))
 	{
 		MessageBox(nullptr,
@@ -57,9 +71,8 @@ HRESULT DX11Renderer::Init(HWND hwnd)
 	// Set the input layout
 	m_pImmediateContext->IASetInputLayout(m_pVertexLayout.Get());
 
-	// Compile the pixel shader
-	ID3DBlob* pPSBlob = nullptr;
-	hr = CompileShaderFromFile(L"shader.fx", "PS", "ps_4_0", &pPSBlob);
+	// The instanced version takes each object's world matrix and material from a second, per instance stream
+	hr = DX11Renderer::CompileShaderFromFile(L"shader.fx", "VSInstanced", "vs_4_0", &pVSBlob);
 	if (FAILED(hr))
 	{
 		MessageBox(nullptr,
@@ -67,10 +80,66 @@ HRESULT DX11Renderer::Init(HWND hwnd)
 		return hr;
 	}
 
-	// Create the pixel shader
-	hr = m_pd3dDevice->CreatePixelShader(pPSBlob->GetBufferPointer(), pPSBlob->GetBufferSize(), nullptr, &m_pPixelShader);
+	hr = m_pd3dDevice->CreateVertexShader(pVSBlob->GetBufferPointer(), pVSBlob->GetBufferSize(), nullptr, &m_pInstancedVertexShader);
+	if (FAILED(hr))
+	{
+		pVSBlob->Release();
+		return hr;
+	}
+
+	D3D11_INPUT_ELEMENT_DESC instancedLayout[] =
+	{
+		{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, D3D11_APPEND_ALIGNED_ELEMENT , D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, D3D11_APPEND_ALIGNED_ELEMENT , D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "TANGENT", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "BINORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "WORLD", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, InstanceBuffer::VERTEX_SLOT, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+		{ "WORLD", 1, DXGI_FORMAT_R32G32B32A32_FLOAT, InstanceBuffer::VERTEX_SLOT, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+		{ "WORLD", 2, DXGI_FORMAT_R32G32B32A32_FLOAT, InstanceBuffer::VERTEX_SLOT, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+		{ "WORLD", 3, DXGI_FORMAT_R32G32B32A32_FLOAT, InstanceBuffer::VERTEX_SLOT, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+		{ "MATERIAL", 0, DXGI_FORMAT_R32_UINT, InstanceBuffer::VERTEX_SLOT, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_INSTANCE_DATA, 1 }
+	};
+
+	hr = m_pd3dDevice->CreateInputLayout(instancedLayout, ARRAYSIZE(instancedLayout), pVSBlob->GetBufferPointer(),
+		pVSBlob->GetBufferSize(), &m_pInstancedVertexLayout);
+	pVSBlob->Release();
+	if (FAILED(hr))
+		return hr;
+
+	// The material driven pixel shaders and their G-buffer versions are compiled per combination of the features
+	// they read, objects hold the variant with all of them on and are drawn with the one their material needs
+	const std::tuple<LPCSTR, LPCSTR, UINT, Microsoft::WRL::ComPtr<ID3D11PixelShader>*, Microsoft::WRL::ComPtr<ID3D11PixelShader>*> permutedShaders[] =
+	{
+		{ "PS", "PSGBuffer", SHADER_FEATURE_TEXTURE | SHADER_FEATURE_NORMAL_MAP, std::addressof(m_pPixelShader), std::addressof(m_pGBufferPixelShader) },
+		{ "PSTextureUnLit", "PSGBufferTextureUnLit", SHADER_FEATURE_TEXTURE, std::addressof(m_pTextureUnLitPixelShader), std::addressof(m_pGBufferTextureUnLitPixelShader) }
+	};
+	for (const auto& [entryPoint, gbufferEntryPoint, features, shader, gbufferShader] : permutedShaders)
+	{
+		UINT permuted = 0;
+		hr = ShaderPermutations::Get().AddShader(entryPoint, gbufferEntryPoint, features, permuted);
+		if (hr == ShaderPermutations::E_OVER_BUDGET)
+		{
+			const std::string name = entryPoint;
+			const std::wstring message = L"The pixel shader " + std::wstring(name.begin(), name.end()) + L" has more variants than are left in the budget of "
+				+ std::to_wstring(ShaderPermutations::VARIANT_BUDGET) + L".  Give it fewer features or raise ShaderPermutations::VARIANT_BUDGET.";
+			MessageBox(nullptr, message.c_str(), L"Error", MB_OK);
+			return hr;
+		}
+		if (FAILED(hr))
+		{
+			MessageBox(nullptr,
+				L"The FX file cannot be compiled.  Please run this executable from the directory that contains the FX file.", L"Error", MB_OK);
+			return hr;
+		}
+
+		const ShaderPermutations::Variant* allFeatures = ShaderPermutations::Get().GetVariant(permuted, features);
+		*shader = allFeatures->PixelShader;
+		*gbufferShader = allFeatures->GBufferPixelShader;
+	}
 
 	// Compile the pixel shader
+	ID3DBlob* pPSBlob = nullptr;
 	hr = CompileShaderFromFile(L"shader.fx", "PSSolid", "ps_4_0", &pPSBlob);
 	if (FAILED(hr))
 	{
@@ -82,28 +151,74 @@ HRESULT DX11Renderer::Init(HWND hwnd)
 	// Create the pixel shader
 	hr = m_pd3dDevice->CreatePixelShader(pPSBlob->GetBufferPointer(), pPSBlob->GetBufferSize(), nullptr, &m_pSolidPixelShader);
 
-	hr = CompileShaderFromFile(L"shader.fx", "PSTextureUnLit", "ps_4_0", &pPSBlob);
-	if (FAILED(hr))
+	// The deferred path's version of the one above, and the pass lighting what the G-buffer shaders wrote
+	const std::pair<LPCSTR, Microsoft::WRL::ComPtr<ID3D11PixelShader>*> deferredShaders[] =
 	{
-		MessageBox(nullptr,
-			L"The FX file cannot be compiled.  Please run this executable from the directory that contains the FX file.", L"Error", MB_OK);
-		return hr;
-	}
+		{ "PSGBufferSolid", std::addressof(m_pGBufferSolidPixelShader) },
+		{ "PSDeferredLighting", std::addressof(m_pDeferredLightingPixelShader) }
+	};
+	for (const auto& [entryPoint, shader] : deferredShaders)
+	{
+		pPSBlob->Release();
+		hr = CompileShaderFromFile(L"shader.fx", entryPoint, "ps_4_0", &pPSBlob);
+		if (FAILED(hr))
+		{
+			MessageBox(nullptr,
+				L"The FX file cannot be compiled.  Please run this executable from the directory that contains the FX file.", L"Error", MB_OK);
+			return hr;
+		}
 
-	// Create the pixel shader
-	hr = m_pd3dDevice->CreatePixelShader(pPSBlob->GetBufferPointer(), pPSBlob->GetBufferSize(), nullptr, &m_pTextureUnLitPixelShader);
+		hr = m_pd3dDevice->CreatePixelShader(pPSBlob->GetBufferPointer(), pPSBlob->GetBufferSize(), nullptr, shader->GetAddressOf());
+		if (FAILED(hr))
+			break;
+	}
 
 	pPSBlob->Release();
 	if (FAILED(hr))
 		return hr;
-	m_pScene->PushBackPixelShaders("Solid Pixel Shader", m_pSolidPixelShader);
-	m_pScene->PushBackPixelShaders("Texture Pixel Shader", m_pPixelShader);
-	m_pScene->PushBackPixelShaders("Texture UnLit Pixel Shader", m_pTextureUnLitPixelShader);
+	m_pScene->PushBackPixelShaders("Solid Pixel Shader", m_pSolidPixelShader, m_pGBufferSolidPixelShader);
+	m_pScene->PushBackPixelShaders("Texture Pixel Shader", m_pPixelShader, m_pGBufferPixelShader);
+	m_pScene->PushBackPixelShaders("Texture UnLit Pixel Shader", m_pTextureUnLitPixelShader, m_pGBufferTextureUnLitPixelShader);
+
+	D3D11_BUFFER_DESC bd = {};
+	bd.Usage = D3D11_USAGE_DEFAULT;
+	bd.ByteWidth = sizeof(DeferredConstantBuffer);
+	bd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+	hr = m_pd3dDevice->CreateBuffer(&bd, nullptr, &m_pDeferredConstantBuffer);
+	if (FAILED(hr))
+		return hr;
 
 	CreateFullScreenQuad();
 
 	m_pScene->Init(hwnd, m_pd3dDevice, m_pImmediateContext);
 
+	if (stressTest != nullptr)
+	{
+		m_pScene->CreateStressScene(*stressTest);
+		m_pScene->m_parallelSubmission = stressTest->ParallelSubmission;
+		m_pStressRecorder = new StressTest::Recorder(*stressTest);
+
+		// Measure what the frame costs, not how long it waits for the display
+		m_imguiRenderer->VSyncEnabled = false;
+	}
+
+	// The simulation stage, runs on the pipeline's thread when frames are pipelined
+	m_pFramePipeline = new FramePipeline([this](float deltaTime, RenderSnapshot& snapshot)
+		{
+			std::lock_guard<std::mutex> sceneLock(m_pScene->GetMutex());
+
+			auto updateStart = std::chrono::steady_clock::now();
+			m_pScene->Update(deltaTime);
+			auto buildStart = std::chrono::steady_clock::now();
+			m_pScene->BuildSnapshot(snapshot);
+
+			snapshot.UpdateMs = std::chrono::duration<float, std::milli>(buildStart - updateStart).count();
+			snapshot.BuildSnapshotMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - buildStart).count();
+		});
+
+	// Set before the first frame so every recorded frame runs in the mode asked for
+	if (stressTest != nullptr) m_pFramePipeline->SetPipelined(stressTest->Pipelined);
+
 	return hr;
 }
 
@@ -188,54 +303,168 @@ void DX11Renderer::CreateFullScreenQuad()
 	sampDesc.ComparisonFunc = D3D11_COMPARISON_NEVER;
 	sampDesc.MinLOD = 0;
 	sampDesc.MaxLOD = D3D11_FLOAT32_MAX;
-	hr = m_pd3dDevice->CreateSamplerState(&sampDesc, &m_textureSampler);
-	if (FAILED(hr))
-	{
-		MessageBox(nullptr,
-			L"Failed to init sampler in Full Screen Quad.", L"Error", MB_OK);
-	}
+	m_quadSamplerState = PipelineStateCache::Get().GetSamplerId(sampDesc);
+
+	// The deferred lighting quad adds to the colour already in the target
+	D3D11_BLEND_DESC blendDesc = {};
+	blendDesc.RenderTarget[0].BlendEnable = TRUE;
+	blendDesc.RenderTarget[0].SrcBlend = D3D11_BLEND_ONE;
+	blendDesc.RenderTarget[0].DestBlend = D3D11_BLEND_ONE;
+	blendDesc.RenderTarget[0].BlendOp = D3D11_BLEND_OP_ADD;
+	blendDesc.RenderTarget[0].SrcBlendAlpha = D3D11_BLEND_ONE;
+	blendDesc.RenderTarget[0].DestBlendAlpha = D3D11_BLEND_ONE;
+	blendDesc.RenderTarget[0].BlendOpAlpha = D3D11_BLEND_OP_ADD;
+	blendDesc.RenderTarget[0].RenderTargetWriteMask = D3D11_COLOR_WRITE_ENABLE_ALL;
+	m_additiveBlendState = PipelineStateCache::Get().GetBlendId(blendDesc);
 }
 
-void DX11Renderer::DrawFullScreenQuad()
+void DX11Renderer::DrawFullScreenQuad(ID3D11PixelShader* pixelShader, StateId blendState)
 {
-	m_pImmediateContext->IASetInputLayout(g_pQuadLayout.Get());
-	m_pImmediateContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP);
-
-	UINT stride = sizeof(SCREEN_VERTEX);
-	UINT offset = 0;
-	ID3D11Buffer* vb = g_pScreenQuadVB.Get();
-	m_pImmediateContext->IASetVertexBuffers(0, 1, &vb, &stride, &offset);
+	m_stateContext.IASetInputLayout(g_pQuadLayout.Get());
+	m_stateContext.IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP);
+	m_stateContext.IASetVertexBuffer(0, g_pScreenQuadVB.Get(), sizeof(SCREEN_VERTEX), 0);
 
-	m_pImmediateContext->VSSetShader(g_pQuadVS.Get(), nullptr, 0);
-	m_pImmediateContext->PSSetShader(g_pQuadPS.Get(), nullptr, 0);
+	m_stateContext.VSSetShader(g_pQuadVS.Get());
+	m_stateContext.PSSetShader(pixelShader != nullptr ? pixelShader : g_pQuadPS.Get());
 
-	ID3D11ShaderResourceView* srv = g_pRTTShaderResourceView.Get();
-	m_pImmediateContext->PSSetShaderResources(0, 1, &srv);
+	PipelineStateIds states;
+	states.Sampler = m_quadSamplerState;
+	states.Blend = blendState;
+	PipelineStateCache::Get().Bind(m_stateContext, states);
 
-	ID3D11SamplerState* ss = m_textureSampler.Get();
-	m_pImmediateContext->PSSetSamplers(0, 1, &ss);
-
-	m_pImmediateContext->Draw(4, 0);
+	m_stateContext.Get()->Draw(4, 0);
 }
 
-void DX11Renderer::SetRenderTargetAndClear(ID3D11RenderTargetView* rtv, bool clearDepth)
+HRESULT DX11Renderer::BuildRenderGraph()
 {
-	float clearColor[4] = { 0.f, 0.f, 0.f, 1.f };
+	// Everything is drawn at the size of the back buffer, which the depth buffer matches
+	D3D11_TEXTURE2D_DESC depthDesc;
+	m_pDepthStencil->GetDesc(&depthDesc);
 
-	m_pImmediateContext->OMSetRenderTargets(1, &rtv, clearDepth ? m_pDepthStencilView.Get() : nullptr);
-	m_pImmediateContext->ClearRenderTargetView(rtv, clearColor);
-	if (clearDepth)
-		m_pImmediateContext->ClearDepthStencilView(m_pDepthStencilView.Get(), D3D11_CLEAR_DEPTH, 1.0f, 0);
-}
+	// Lit colour can go over 1 but never needs alpha, a quarter of the bytes of R32G32B32A32_FLOAT
+	RenderTargetDesc colourDesc;
+	colourDesc.Width = depthDesc.Width;
+	colourDesc.Height = depthDesc.Height;
+	colourDesc.Format = DXGI_FORMAT_R11G11B10_FLOAT;
 
-void DX11Renderer::DrawFullscreenQuadWithSRVs(std::vector<ID3D11ShaderResourceView*> srvs)
-{
-	m_pImmediateContext->PSSetShaderResources(0, srvs.size(), srvs.data());
-	DrawFullScreenQuad();
+	if (m_historyTarget == RenderTargetPool::INVALID_ID)
+	{
+		m_historyTarget = m_renderTargetPool.Acquire(m_pd3dDevice.Get(), colourDesc);
+		if (m_historyTarget == RenderTargetPool::INVALID_ID)
+			return E_FAIL;
+	}
+
+	m_renderGraph.Clear();
+	const RenderGraph::ResourceId sceneColour = m_renderGraph.CreateTexture("Scene", colourDesc);
+	const RenderGraph::ResourceId renderTexture = m_renderGraph.CreateTexture("Render Texture", colourDesc);
+	const RenderGraph::ResourceId history = m_renderGraph.ImportTarget("Render Texture History", m_historyTarget);
+	const RenderGraph::ResourceId backBuffer = m_renderGraph.ImportTexture("Back Buffer", m_pRenderTargetView.Get(), nullptr);
+	const RenderGraph::ResourceId depth = m_renderGraph.ImportDepth("Depth", m_pDepthStencilView.Get(), m_pDepthStencilShaderResourceView.Get());
+
+	auto drawScene = [this](int renderPass, bool gbuffer)
+		{
+			return [this, renderPass, gbuffer](StateTrackingContext& context)
+				{
+					// The snapshot says which, the checkbox may have changed since it was built
+					const bool instanced = m_pFrameSnapshot->Instanced;
+					context.VSSetShader(instanced ? m_pInstancedVertexShader.Get() : m_pVertexShader.Get());
+					context.IASetInputLayout(instanced ? m_pInstancedVertexLayout.Get() : m_pVertexLayout.Get());
+					m_pScene->Draw(context, *m_pFrameSnapshot, renderPass, gbuffer);
+				};
+		};
+	auto drawQuad = [this](StateTrackingContext&) { DrawFullScreenQuad(); };
+
+	// Objects showing the render texture bind last frame's copy to t0 themselves, it is declared so the graph
+	// unbinds it before the copy below draws to it
+	RenderGraph::PassId pass;
+	if (m_deferredShading)
+	{
+		// Two 32 bit targets on top of the colour and depth, see GBufferEncoding for what goes where
+		RenderTargetDesc albedoDesc = colourDesc;
+		albedoDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+		RenderTargetDesc normalDesc = colourDesc;
+		normalDesc.Format = DXGI_FORMAT_R10G10B10A2_UNORM;
+		const RenderGraph::ResourceId albedo = m_renderGraph.CreateTexture("G-Buffer Albedo", albedoDesc);
+		const RenderGraph::ResourceId normal = m_renderGraph.CreateTexture("G-Buffer Normal", normalDesc);
+
+		// Emissive and ambient go straight to the scene colour, as does everything unlit
+		pass = m_renderGraph.AddPass("G-Buffer", drawScene(0, true));
+		m_renderGraph.Read(pass, history, 0);
+		m_renderGraph.Write(pass, sceneColour);
+		m_renderGraph.Write(pass, albedo);
+		m_renderGraph.Write(pass, normal, true, GBufferEncoding::CLEAR_NORMAL);
+		m_renderGraph.WriteDepth(pass, depth);
+
+		// One full screen pass over every light in each pixel's cluster, added on top
+		pass = m_renderGraph.AddPass("Deferred Lighting", [this](StateTrackingContext& context)
+			{
+				const XMMATRIX view = XMLoadFloat4x4(&m_pFrameSnapshot->View);
+				DeferredConstantBuffer cb;
+				cb.mInverseViewProjection = XMMatrixTranspose(XMMatrixInverse(nullptr, view * XMLoadFloat4x4(&m_pFrameSnapshot->Projection)));
+				cb.mView = XMMatrixTranspose(view);
+				context.Get()->UpdateSubresource(m_pDeferredConstantBuffer.Get(), 0, nullptr, &cb, 0, 0);
+				context.PSSetConstantBuffer(1, m_pDeferredConstantBuffer.Get());
+				DrawFullScreenQuad(m_pDeferredLightingPixelShader.Get(), m_additiveBlendState);
+			});
+		m_renderGraph.Read(pass, albedo, 6);
+		m_renderGraph.Read(pass, normal, 7);
+		m_renderGraph.Read(pass, depth, 8);
+		m_renderGraph.Write(pass, sceneColour, false);
+	}
+	else
+	{
+		pass = m_renderGraph.AddPass("Scene", drawScene(0, false));
+		m_renderGraph.Read(pass, history, 0);
+		m_renderGraph.Write(pass, sceneColour);
+		m_renderGraph.WriteDepth(pass, depth);
+	}
+
+	pass = m_renderGraph.AddPass("Render Texture", drawScene(1, false));
+	m_renderGraph.Read(pass, history, 0);
+	m_renderGraph.Write(pass, renderTexture);
+	m_renderGraph.WriteDepth(pass, depth);
+
+	pass = m_renderGraph.AddPass("Copy To History", drawQuad);
+	m_renderGraph.Read(pass, sceneColour, 0);
+	m_renderGraph.Write(pass, history);
+
+	pass = m_renderGraph.AddPass("Present", drawQuad);
+	m_renderGraph.Read(pass, sceneColour, 0);
+	m_renderGraph.Write(pass, backBuffer);
+
+	if (!m_renderGraph.Compile())
+	{
+		std::wstring error(m_renderGraph.GetError().begin(), m_renderGraph.GetError().end());
+		MessageBox(nullptr, error.c_str(), L"Error", MB_OK);
+		return E_FAIL;
+	}
+
+	HRESULT hr = m_renderGraph.Allocate(m_pd3dDevice.Get(), m_renderTargetPool);
+	if (FAILED(hr))
+		return hr;
+
+	// Targets only the other mode's passes used, like the G-buffer after going back to forward
+	m_renderTargetPool.Trim();
+
+	// Objects are kept out of the pass drawing the texture they show. A culled pass has no texture to show.
+	// A rebuild can hand the passes different targets, so the old entries are replaced
+	const std::pair<const char*, RenderGraph::ResourceId> renderTextures[] =
+	{
+		{ "RenderTargetViewPass0", sceneColour },
+		{ "RenderTargetViewPass1", renderTexture },
+		{ "RenderTargetViewPass2", history }
+	};
+	auto& textures = m_pScene->m_textureMap;
+	for (const auto& [name, resource] : renderTextures)
+	{
+		auto existing = std::find_if(textures.begin(), textures.end(), [name = name](const auto& texture) { return texture.first == name; });
+		if (existing != textures.end()) textures.erase(existing);
 
-	// unbind
-	std::vector<ID3D11ShaderResourceView*> nullSRVs(srvs.size(), nullptr);
-	m_pImmediateContext->PSSetShaderResources(0, nullSRVs.size(), nullSRVs.data());
+		ID3D11ShaderResourceView* view = m_renderGraph.GetShaderResourceView(resource);
+		if (view != nullptr) textures.push_back({ name, view });
+	}
+
+	return S_OK;
 }
 
 HRESULT DX11Renderer::InitDevice(HWND hwnd)
@@ -390,128 +619,18 @@ HRESULT DX11Renderer::InitDevice(HWND hwnd)
 			L"Failed to create a render target.", L"Error", MB_OK);
 		return hr;
 	}
-	D3D11_TEXTURE2D_DESC textureDesc;
-	ZeroMemory(&textureDesc, sizeof(textureDesc));
-
-	textureDesc.Width = width;
-	textureDesc.Height = height;
-	textureDesc.MipLevels = 1;
-	textureDesc.ArraySize = 1;
-	textureDesc.Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
-	textureDesc.SampleDesc.Count = 1;
-	textureDesc.SampleDesc.Quality = 0;
-	textureDesc.Usage = D3D11_USAGE_DEFAULT;
-	textureDesc.BindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE;
-	textureDesc.CPUAccessFlags = 0;
-	textureDesc.MiscFlags = 0;
-
-	hr = m_pd3dDevice->CreateTexture2D(&textureDesc, NULL, &g_pRTTRenderTargetTexture);
-	if (FAILED(hr))
-	{
-		MessageBox(nullptr,
-			L"Failed to create a render target Texture 2D.", L"Error", MB_OK);
-		return hr;
-	}
-
-	renderTargetViewDesc.Format = textureDesc.Format;
-	renderTargetViewDesc.ViewDimension = D3D11_RTV_DIMENSION_TEXTURE2D;
-	renderTargetViewDesc.Texture2D.MipSlice = 0;
-	hr = m_pd3dDevice->CreateRenderTargetView(g_pRTTRenderTargetTexture.Get(), &renderTargetViewDesc, g_RTTRenderTargetView.GetAddressOf());
-	if (FAILED(hr))
-	{
-		MessageBox(nullptr,
-			L"Failed to create a render target view", L"Error", MB_OK);
-		return hr;
-	}
-
-	shaderResourceViewDesc.Format = textureDesc.Format;
-	shaderResourceViewDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
-	shaderResourceViewDesc.Texture2D.MostDetailedMip = 0;
-	shaderResourceViewDesc.Texture2D.MipLevels = 1;
-
-	hr = m_pd3dDevice->CreateShaderResourceView(g_pRTTRenderTargetTexture.Get(), &shaderResourceViewDesc, g_pRTTShaderResourceView.GetAddressOf());
-	if (FAILED(hr))
-	{
-		MessageBox(nullptr,
-			L"Failed to create a render target shader resource view", L"Error", MB_OK);
-		return hr;
-	}
-
-	hr = m_pd3dDevice->CreateTexture2D(&textureDesc, NULL, &g_pRTTRenderTargetTexture2);
-	if (FAILED(hr))
-	{
-		MessageBox(nullptr,
-			L"Failed to create a render target Texture 2D.", L"Error", MB_OK);
-		return hr;
-	}
-
-	renderTargetViewDesc.Format = textureDesc.Format;
-	renderTargetViewDesc.ViewDimension = D3D11_RTV_DIMENSION_TEXTURE2D;
-	renderTargetViewDesc.Texture2D.MipSlice = 0;
-	hr = m_pd3dDevice->CreateRenderTargetView(g_pRTTRenderTargetTexture2.Get(), &renderTargetViewDesc, g_RTTRenderTargetView2.GetAddressOf());
-	if (FAILED(hr))
-	{
-		MessageBox(nullptr,
-			L"Failed to create a render target view", L"Error", MB_OK);
-		return hr;
-	}
-
-	shaderResourceViewDesc.Format = textureDesc.Format;
-	shaderResourceViewDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
-	shaderResourceViewDesc.Texture2D.MostDetailedMip = 0;
-	shaderResourceViewDesc.Texture2D.MipLevels = 1;
-
-	hr = m_pd3dDevice->CreateShaderResourceView(g_pRTTRenderTargetTexture2.Get(), &shaderResourceViewDesc, g_pRTTShaderResourceView2.GetAddressOf());
-	if (FAILED(hr))
-	{
-		MessageBox(nullptr,
-			L"Failed to create a render target shader resource view", L"Error", MB_OK);
-		return hr;
-	}
-
-	hr = m_pd3dDevice->CreateTexture2D(&textureDesc, NULL, &g_pRTTRenderTargetTexture3);
-	if (FAILED(hr))
-	{
-		MessageBox(nullptr,
-			L"Failed to create a render target Texture 2D.", L"Error", MB_OK);
-		return hr;
-	}
-
-	renderTargetViewDesc.Format = textureDesc.Format;
-	renderTargetViewDesc.ViewDimension = D3D11_RTV_DIMENSION_TEXTURE2D;
-	renderTargetViewDesc.Texture2D.MipSlice = 0;
-	hr = m_pd3dDevice->CreateRenderTargetView(g_pRTTRenderTargetTexture3.Get(), &renderTargetViewDesc, g_RTTRenderTargetView3.GetAddressOf());
-	if (FAILED(hr))
-	{
-		MessageBox(nullptr,
-			L"Failed to create a render target view", L"Error", MB_OK);
-		return hr;
-	}
-
-	shaderResourceViewDesc.Format = textureDesc.Format;
-	shaderResourceViewDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
-	shaderResourceViewDesc.Texture2D.MostDetailedMip = 0;
-	shaderResourceViewDesc.Texture2D.MipLevels = 1;
-
-	hr = m_pd3dDevice->CreateShaderResourceView(g_pRTTRenderTargetTexture3.Get(), &shaderResourceViewDesc, g_pRTTShaderResourceView3.GetAddressOf());
-	if (FAILED(hr))
-	{
-		MessageBox(nullptr,
-			L"Failed to create a render target shader resource view", L"Error", MB_OK);
-		return hr;
-	}
-
 	// Create depth stencil texture
 	D3D11_TEXTURE2D_DESC descDepth = {};
 	descDepth.Width = width;
 	descDepth.Height = height;
 	descDepth.MipLevels = 1;
 	descDepth.ArraySize = 1;
-	descDepth.Format = DXGI_FORMAT_D24_UNORM_S8_UINT;
+	// Typeless so the deferred lighting pass can read the depth back through a shader resource view
+	descDepth.Format = DXGI_FORMAT_R24G8_TYPELESS;
 	descDepth.SampleDesc.Count = 1;
 	descDepth.SampleDesc.Quality = 0;
 	descDepth.Usage = D3D11_USAGE_DEFAULT;
-	descDepth.BindFlags = D3D11_BIND_DEPTH_STENCIL;
+	descDepth.BindFlags = D3D11_BIND_DEPTH_STENCIL | D3D11_BIND_SHADER_RESOURCE;
 	descDepth.CPUAccessFlags = 0;
 	descDepth.MiscFlags = 0;
 	hr = m_pd3dDevice->CreateTexture2D(&descDepth, nullptr, &m_pDepthStencil);
@@ -524,7 +643,7 @@ HRESULT DX11Renderer::InitDevice(HWND hwnd)
 
 	// Create the depth stencil view
 	D3D11_DEPTH_STENCIL_VIEW_DESC descDSV = {};
-	descDSV.Format = descDepth.Format;
+	descDSV.Format = DXGI_FORMAT_D24_UNORM_S8_UINT;
 	descDSV.ViewDimension = D3D11_DSV_DIMENSION_TEXTURE2D;
 	descDSV.Texture2D.MipSlice = 0;
 	hr = m_pd3dDevice->CreateDepthStencilView(m_pDepthStencil.Get(), &descDSV, &m_pDepthStencilView);
@@ -535,6 +654,18 @@ HRESULT DX11Renderer::InitDevice(HWND hwnd)
 		return hr;
 	}
 
+	D3D11_SHADER_RESOURCE_VIEW_DESC descDepthSRV = {};
+	descDepthSRV.Format = DXGI_FORMAT_R24_UNORM_X8_TYPELESS;
+	descDepthSRV.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
+	descDepthSRV.Texture2D.MipLevels = 1;
+	hr = m_pd3dDevice->CreateShaderResourceView(m_pDepthStencil.Get(), &descDepthSRV, &m_pDepthStencilShaderResourceView);
+	if (FAILED(hr))
+	{
+		MessageBox(nullptr,
+			L"Failed to create a depth shader resource view.", L"Error", MB_OK);
+		return hr;
+	}
+
 	// Get the raw pointer.
 	ID3D11RenderTargetView* rtv = m_pRenderTargetView.Get();
 	m_pImmediateContext->OMSetRenderTargets(1, &rtv, m_pDepthStencilView.Get());
@@ -554,6 +685,13 @@ HRESULT DX11Renderer::InitDevice(HWND hwnd)
 
 void DX11Renderer::CleanUp()
 {
+	// Stop the simulation thread before anything it uses goes away
+	delete m_pFramePipeline;
+	m_pFramePipeline = nullptr;
+
+	delete m_pStressRecorder;
+	m_pStressRecorder = nullptr;
+
 	CleanupDevice();
 
 	m_imguiRenderer->ShutDownImGui();
@@ -573,7 +711,11 @@ void DX11Renderer::CleanupDevice()
 	if (m_pImmediateContext1) m_pImmediateContext1->Flush();
 	m_pImmediateContext->Flush();
 
-	// no need to release DX assets as they are com pointers
+	// no need to release DX assets as they are com pointers, the shared states just need letting go of before the device
+	PipelineStateCache::Get().Clear();
+	ShaderPermutations::Get().Clear();
+	m_renderGraph.ReleaseTargets();
+	m_renderTargetPool.Clear();
 
 	ID3D11Debug* debugDevice = nullptr;
 	m_pd3dDevice->QueryInterface(__uuidof(ID3D11Debug), reinterpret_cast<void**>(&debugDevice));
@@ -655,6 +797,26 @@ void DX11Renderer::Input(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 		ShowCursor(true);
 
 		break;
+	case WM_LBUTTONDOWN:
+	{
+		// ImGui draws under the scene lock, so its state is only looked at while holding it too
+		std::lock_guard<std::mutex> sceneLock(m_pScene->GetMutex());
+
+		// Clicks on a window or the gizmo belong to them
+		if (ImGui::GetIO().WantCaptureMouse || ImGuizmo::IsOver()) break;
+
+		RECT rect;
+		GetClientRect(hWnd, &rect);
+		if (rect.right <= rect.left || rect.bottom <= rect.top) break;
+
+		POINTS mousePos = MAKEPOINTS(lParam);
+		XMFLOAT3 origin, direction;
+		m_pScene->GetCamera()->GetPickRay(mousePos.x, mousePos.y, static_cast<float>(rect.right - rect.left), static_cast<float>(rect.bottom - rect.top), origin, direction);
+
+		// Clicking on empty space clears the selection
+		m_imguiRenderer->SelectObject(m_pScene->PickObject(origin, direction));
+	}
+	break;
 	case WM_MOUSEMOVE:
 	{
 		if (!mouseDown)
@@ -685,7 +847,10 @@ void DX11Renderer::Input(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 
 		// Update the camera with the delta
 		// (You may need to convert POINT to POINTS or use the deltas as is)
-		m_pScene->GetCamera()->UpdateLookAt({ static_cast<short>(delta.x), static_cast<short>(delta.y) });
+		{
+			std::lock_guard<std::mutex> sceneLock(m_pScene->GetMutex());
+			m_pScene->GetCamera()->UpdateLookAt({ static_cast<short>(delta.x), static_cast<short>(delta.y) });
+		}
 
 		// Recenter the cursor
 		SetCursorPos(windowCenter.x, windowCenter.y);
@@ -738,9 +903,21 @@ void DX11Renderer::CentreMouseInWindow(HWND hWnd)
 	SetCursorPos(center.x, center.y);
 }
 
-void DX11Renderer::Update(const float deltaTime)
+void DX11Renderer::Update(const float frameDeltaTime)
 {
-	UpdateKeyInputs();
+	auto frameStart = std::chrono::steady_clock::now();
+
+	// A stress run steps by the same amount every frame so the camera path is repeatable
+	const float deltaTime = m_pStressRecorder != nullptr ? m_pStressRecorder->GetSettings().DeltaTime : frameDeltaTime;
+
+	// Nothing allocated from the render thread's arena last frame is still in use by now
+	FrameArena::ThreadArena().Reset();
+	AllocationCounter::EndFrame();
+
+	{
+		std::lock_guard<std::mutex> sceneLock(m_pScene->GetMutex());
+		UpdateKeyInputs();
+	}
 
 	// ----- FPS calculation -----
 	static float timer = 0;
@@ -755,28 +932,81 @@ void DX11Renderer::Update(const float deltaTime)
 		frameCounter = 0;
 	}
 
-	// PASS 1
-	SetRenderTargetAndClear(g_RTTRenderTargetView.Get());
-	m_pImmediateContext->VSSetShader(m_pVertexShader.Get(), nullptr, 0);
-	m_pImmediateContext->PSSetShader(m_pPixelShader.Get(), nullptr, 0);
-	m_pImmediateContext->IASetInputLayout(m_pVertexLayout.Get());
+	// When pipelined this is last frame's simulation, and the next one is already running on the other thread
+	RenderSnapshot* snapshot = m_pFramePipeline->BeginFrame(deltaTime);
+	auto renderStart = std::chrono::steady_clock::now();
 
-	m_pScene->Update(deltaTime);
-	m_pScene->Draw(0);
+	// Last frame's ImGui and Present went to the context directly. ImGui puts back what it changes, but starting each
+	// frame from nothing known costs a dozen binds and doesn't rely on it
+	m_stateContext.ResetCounts();
+	m_stateContext.Invalidate();
+	m_pScene->CommitSnapshot(m_stateContext, *snapshot);
 
-	// PASS 2
-	SetRenderTargetAndClear(g_RTTRenderTargetView2.Get());
-	m_pScene->Draw(1);
+	// Switching between forward and deferred shading swaps the graph's passes, replacing the scene's render texture entries
+	if (m_imguiRenderer->DeferredShading != m_deferredShading)
+	{
+		std::lock_guard<std::mutex> sceneLock(m_pScene->GetMutex());
+		m_deferredShading = m_imguiRenderer->DeferredShading;
+		if (FAILED(BuildRenderGraph()))
+		{
+			// Back to the mode that was drawing, the checkbox goes back with it
+			m_deferredShading = !m_deferredShading;
+			m_imguiRenderer->DeferredShading = m_deferredShading;
+			if (FAILED(BuildRenderGraph()))
+			{
+				// Nothing left to draw with, an empty graph draws nothing rather than using targets it doesn't have
+				m_renderGraph.Clear();
+				MessageBox(nullptr, L"The render graph could not be rebuilt.", L"Error", MB_OK);
+				PostQuitMessage(1);
+			}
+		}
+	}
+	auto drawStart = std::chrono::steady_clock::now();
 
-	// PASS 3
-	SetRenderTargetAndClear(g_RTTRenderTargetView3.Get(), false);
-	DrawFullscreenQuadWithSRVs({ g_pRTTShaderResourceView.Get() });
+	m_pFrameSnapshot = snapshot;
+	m_renderTargetPool.BeginFrame();
+	m_renderGraph.Execute(m_stateContext);
+	m_pFrameSnapshot = nullptr;
 
-	// PASS 4
-	SetRenderTargetAndClear(m_pRenderTargetView.Get(), false);
-	DrawFullscreenQuadWithSRVs({ g_pRTTShaderResourceView2.Get(), g_pRTTShaderResourceView3.Get() });
+	auto drawEnd = std::chrono::steady_clock::now();
+	float renderMs = std::chrono::duration<float, std::milli>(drawEnd - renderStart).count();
 
-	m_imguiRenderer->ImGuiDrawAllWindows(FPS, m_totalTime, m_pScene, m_pImmediateContext.Get());
+	{
+		// ImGui edits the scene directly, so it can't overlap the simulation
+		std::lock_guard<std::mutex> sceneLock(m_pScene->GetMutex());
+		m_imguiRenderer->ImGuiDrawAllWindows(FPS, m_totalTime, m_pScene, m_pFramePipeline, &m_renderGraph, &m_stateContext);
+	}
 
+	auto presentStart = std::chrono::steady_clock::now();
 	m_pSwapChain->Present(m_imguiRenderer->VSyncEnabled, 0);
-}
\ No newline at end of file
+	auto frameEnd = std::chrono::steady_clock::now();
+
+	if (m_pStressRecorder != nullptr)
+	{
+		auto milliseconds = [](std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to)
+			{
+				return std::chrono::duration<float, std::milli>(to - from).count();
+			};
+
+		m_pStressRecorder->AddPhase(StressTest::PHASE_UPDATE, snapshot->UpdateMs);
+		m_pStressRecorder->AddPhase(StressTest::PHASE_BUILD_SNAPSHOT, snapshot->BuildSnapshotMs);
+		m_pStressRecorder->AddPhase(StressTest::PHASE_COMMIT, milliseconds(renderStart, drawStart));
+		m_pStressRecorder->AddPhase(StressTest::PHASE_DRAW, milliseconds(drawStart, drawEnd));
+		m_pStressRecorder->AddPhase(StressTest::PHASE_IMGUI, milliseconds(drawEnd, presentStart));
+		m_pStressRecorder->AddPhase(StressTest::PHASE_PRESENT, milliseconds(presentStart, frameEnd));
+		const DeferredContextPool& deferredContexts = m_pScene->GetDeferredContexts();
+		m_pStressRecorder->SetCommandLists(deferredContexts.GetListsExecuted(), deferredContexts.IsNative());
+		m_pStressRecorder->EndFrame(milliseconds(frameStart, frameEnd), milliseconds(snapshot->SimulationStart, frameEnd));
+
+		if (m_pStressRecorder->IsFinished())
+		{
+			bool written = m_pStressRecorder->WriteReports();
+			delete m_pStressRecorder;
+			m_pStressRecorder = nullptr;
+
+			PostQuitMessage(written ? 0 : 1);
+		}
+	}
+
+	m_pFramePipeline->EndFrame(snapshot, renderMs);
+}
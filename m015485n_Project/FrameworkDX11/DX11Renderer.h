@@ -23,8 +23,11 @@
 #include <unordered_map>
 
 #include "ImGuiRendering.h"
+#include "RenderGraph.h"
+#include "StressTest.h"
 
 class Scene;
+class FramePipeline;
 
 typedef vector<GameObject*> vecTypeDrawables;
 
@@ -39,13 +42,11 @@ public:
 	DX11Renderer() = default;
 	~DX11Renderer() = default;
 
-	HRESULT Init(HWND hwnd);
+	// Pass stress test settings to replace the scene with a generated one and record the frame times
+	HRESULT Init(HWND hwnd, const StressTest::Settings* stressTest = nullptr);
 	void CreateFullScreenQuad();
-	void DrawFullScreenQuad();
-
-	void SetRenderTargetAndClear(ID3D11RenderTargetView* rtv, bool clearDepth = true);;
-
-	void DrawFullscreenQuadWithSRVs(std::vector<ID3D11ShaderResourceView*> srvs);;
+	// Draws with QuadPS and no blending unless told otherwise
+	void DrawFullScreenQuad(ID3D11PixelShader* pixelShader = nullptr, StateId blendState = 0);
 
 	void	CleanUp();
 
@@ -62,6 +63,8 @@ public:
 
 private: // methods
 	HRESULT InitDevice(HWND hwnd);
+	// Declares the forward or deferred passes, depending on m_deferredShading, and takes their targets from the pool
+	HRESULT BuildRenderGraph();
 	void    CleanupDevice();
 	//void	initIMGUI(HWND hwnd);
 	//void	IMGUIDraw(const unsigned int FPS);
@@ -85,35 +88,49 @@ private: // properties
 	Microsoft::WRL::ComPtr <ID3D11RenderTargetView> m_pRenderTargetView;
 	Microsoft::WRL::ComPtr <ID3D11Texture2D>		m_pDepthStencil;
 	Microsoft::WRL::ComPtr <ID3D11DepthStencilView> m_pDepthStencilView;
+	Microsoft::WRL::ComPtr <ID3D11ShaderResourceView> m_pDepthStencilShaderResourceView;
 
 	Microsoft::WRL::ComPtr <ID3D11VertexShader>		m_pVertexShader;
+	Microsoft::WRL::ComPtr <ID3D11VertexShader>		m_pInstancedVertexShader;
 	Microsoft::WRL::ComPtr <ID3D11PixelShader>		m_pPixelShader;
 	Microsoft::WRL::ComPtr <ID3D11PixelShader>		m_pSolidPixelShader;
 	Microsoft::WRL::ComPtr <ID3D11PixelShader>		m_pTextureUnLitPixelShader;
+	Microsoft::WRL::ComPtr <ID3D11PixelShader>		m_pGBufferPixelShader;
+	Microsoft::WRL::ComPtr <ID3D11PixelShader>		m_pGBufferSolidPixelShader;
+	Microsoft::WRL::ComPtr <ID3D11PixelShader>		m_pGBufferTextureUnLitPixelShader;
+	Microsoft::WRL::ComPtr <ID3D11PixelShader>		m_pDeferredLightingPixelShader;
+	Microsoft::WRL::ComPtr <ID3D11Buffer>			m_pDeferredConstantBuffer;
 	Microsoft::WRL::ComPtr <ID3D11InputLayout>		m_pVertexLayout;
+	Microsoft::WRL::ComPtr <ID3D11InputLayout>		m_pInstancedVertexLayout;
+
+	RenderTargetPool m_renderTargetPool;
+	RenderGraph m_renderGraph;
 
-	Microsoft::WRL::ComPtr <ID3D11Texture2D> g_pRTTRenderTargetTexture;
-	Microsoft::WRL::ComPtr <ID3D11Texture2D> g_pRTTRenderTargetTexture2;
-	Microsoft::WRL::ComPtr <ID3D11Texture2D> g_pRTTRenderTargetTexture3;
+	// Every bind while drawing goes through this, it drops the ones that set what is already bound
+	StateTrackingContext m_stateContext;
 
-	D3D11_RENDER_TARGET_VIEW_DESC renderTargetViewDesc;
-	Microsoft::WRL::ComPtr <ID3D11RenderTargetView> g_RTTRenderTargetView;
-	Microsoft::WRL::ComPtr <ID3D11RenderTargetView> g_RTTRenderTargetView2;
-	Microsoft::WRL::ComPtr <ID3D11RenderTargetView> g_RTTRenderTargetView3;
+	// Which passes the render graph was built with, ImGui's checkbox is compared against it at the start of a frame
+	bool m_deferredShading = false;
 
-	D3D11_SHADER_RESOURCE_VIEW_DESC shaderResourceViewDesc;
-	Microsoft::WRL::ComPtr <ID3D11ShaderResourceView> g_pRTTShaderResourceView;
-	Microsoft::WRL::ComPtr <ID3D11ShaderResourceView> g_pRTTShaderResourceView2;
-	Microsoft::WRL::ComPtr <ID3D11ShaderResourceView> g_pRTTShaderResourceView3;
+	// Kept between frames for objects showing the render texture, the other pass targets belong to the render graph
+	RenderTargetPool::TargetId m_historyTarget = RenderTargetPool::INVALID_ID;
+
+	// The snapshot being drawn, only set while the render graph runs
+	const RenderSnapshot* m_pFrameSnapshot = nullptr;
 
 	Microsoft::WRL::ComPtr <ID3D11Texture2D> resolvedTexture;
 
 	Scene* m_pScene;
+	FramePipeline* m_pFramePipeline = nullptr;
+
+	// Only set during a stress run
+	StressTest::Recorder* m_pStressRecorder = nullptr;
 
 	// Full Screen Quad Stuff
 	Microsoft::WRL::ComPtr <ID3D11Buffer> g_pScreenQuadVB = nullptr;
 	Microsoft::WRL::ComPtr <ID3D11InputLayout> g_pQuadLayout = nullptr;
 	Microsoft::WRL::ComPtr <ID3D11VertexShader> g_pQuadVS = nullptr;
 	Microsoft::WRL::ComPtr <ID3D11PixelShader> g_pQuadPS = nullptr;
-	Microsoft::WRL::ComPtr < ID3D11SamplerState> m_textureSampler = nullptr;
+	StateId m_quadSamplerState = 0;
+	StateId m_additiveBlendState = 0;
 };
@@ -0,0 +1,72 @@
+#include "DeferredContextPool.h"
+
+HRESULT DeferredContextPool::Init(ID3D11Device* device)
+{
+	Clear();
+	m_device = device;
+
+	D3D11_FEATURE_DATA_THREADING threading = {};
+	HRESULT hr = device->CheckFeatureSupport(D3D11_FEATURE_THREADING, &threading, sizeof(threading));
+	if (FAILED(hr))
+		return hr;
+
+	m_native = threading.DriverCommandLists != FALSE;
+	return S_OK;
+}
+
+void DeferredContextPool::Clear()
+{
+	m_contexts.clear();
+	m_device.Reset();
+	m_immediate = nullptr;
+	m_viewportCount = 0;
+	m_listsExecuted = 0;
+	m_native = false;
+}
+
+bool DeferredContextPool::Prepare(StateTrackingContext& immediate, UINT listCount)
+{
+	if (m_device == nullptr) return false;
+
+	// Created once and kept, a context is reused by every pass after
+	while (m_contexts.size() < listCount)
+	{
+		DeferredContext deferred;
+		if (FAILED(m_device->CreateDeferredContext(0, &deferred.Context))) return false;
+		if (FAILED(deferred.Context->QueryInterface(__uuidof(ID3D11DeviceContext1), &deferred.Context1))) return false;
+		m_contexts.push_back(std::move(deferred));
+	}
+
+	// Viewports aren't tracked, read here while only this thread uses the immediate context
+	m_immediate = &immediate;
+	m_viewportCount = D3D11_VIEWPORT_AND_SCISSORRECT_OBJECT_COUNT_PER_PIPELINE;
+	immediate.Get()->RSGetViewports(&m_viewportCount, m_viewports);
+	return true;
+}
+
+StateTrackingContext& DeferredContextPool::BeginList(UINT list)
+{
+	DeferredContext& deferred = m_contexts[list];
+	deferred.State.Init(deferred.Context.Get(), deferred.Context1.Get());
+	deferred.State.Inherit(*m_immediate);
+	if (m_viewportCount > 0) deferred.Context->RSSetViewports(m_viewportCount, m_viewports);
+	return deferred.State;
+}
+
+void DeferredContextPool::FinishList(UINT list)
+{
+	// The context goes back to defaults, BeginList binds everything again for the next pass
+	DeferredContext& deferred = m_contexts[list];
+	deferred.Context->FinishCommandList(FALSE, &deferred.CommandList);
+}
+
+void DeferredContextPool::ExecuteList(UINT list)
+{
+	DeferredContext& deferred = m_contexts[list];
+	if (deferred.CommandList == nullptr) return;
+
+	m_immediate->Get()->ExecuteCommandList(deferred.CommandList.Get(), TRUE);
+	deferred.CommandList.Reset();
+	m_immediate->AddCounts(deferred.State);
+	++m_listsExecuted;
+}
@@ -0,0 +1,56 @@
+// D3D deferred contexts for CommandListRecorder to record a pass's draws into
+
+#pragma once
+
+#include <d3d11_1.h>
+#include <wrl/client.h>
+#include <vector>
+
+#include "CommandListRecorder.h"
+#include "StateTrackingContext.h"
+
+/// <summary>
+/// A deferred context per list, each with its own StateTrackingContext that starts from what the immediate context
+/// has bound, viewports included. Lists are played back with the immediate context's state restored after each, so
+/// its StateTrackingContext stays right and what the lists bound doesn't leak into later passes.
+///
+/// Drivers without their own command lists have the runtime emulate them, which is slower than drawing serially,
+/// IsNative says which. Used from the render thread and the job system's workers it hands lists to.
+/// </summary>
+class DeferredContextPool : public ICommandListTarget<StateTrackingContext>
+{
+public:
+	HRESULT	Init(ID3D11Device* device);
+
+	/// True if the driver records command lists itself.
+	bool	IsNative() const { return m_native; }
+
+	/// Lists played since ResetCounts, for the stats window.
+	UINT	GetListsExecuted() const { return m_listsExecuted; }
+	UINT	GetContextCount() const { return static_cast<UINT>(m_contexts.size()); }
+	void	ResetCounts() { m_listsExecuted = 0; }
+
+	void	Clear();
+
+	bool					Prepare(StateTrackingContext& immediate, UINT listCount) override;
+	StateTrackingContext&	BeginList(UINT list) override;
+	void					FinishList(UINT list) override;
+	void					ExecuteList(UINT list) override;
+
+private:
+	struct DeferredContext
+	{
+		Microsoft::WRL::ComPtr<ID3D11DeviceContext>		Context;
+		Microsoft::WRL::ComPtr<ID3D11DeviceContext1>	Context1;
+		Microsoft::WRL::ComPtr<ID3D11CommandList>		CommandList;
+		StateTrackingContext							State;
+	};
+
+	Microsoft::WRL::ComPtr<ID3D11Device>	m_device;
+	std::vector<DeferredContext>			m_contexts;
+	StateTrackingContext*					m_immediate = nullptr;
+	D3D11_VIEWPORT							m_viewports[D3D11_VIEWPORT_AND_SCISSORRECT_OBJECT_COUNT_PER_PIPELINE] = {};
+	UINT									m_viewportCount = 0;
+	UINT									m_listsExecuted = 0;
+	bool									m_native = false;
+};
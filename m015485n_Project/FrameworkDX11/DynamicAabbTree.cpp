@@ -0,0 +1,444 @@
+#include "DynamicAabbTree.h"
+
+DynamicAabbTree::Aabb DynamicAabbTree::Aabb::FromBoundingBox(const BoundingBox& box)
+{
+	Aabb result;
+	result.Min = XMFLOAT3(box.Center.x - box.Extents.x, box.Center.y - box.Extents.y, box.Center.z - box.Extents.z);
+	result.Max = XMFLOAT3(box.Center.x + box.Extents.x, box.Center.y + box.Extents.y, box.Center.z + box.Extents.z);
+	return result;
+}
+
+DynamicAabbTree::Aabb DynamicAabbTree::Aabb::Union(const Aabb& a, const Aabb& b)
+{
+	Aabb result;
+	result.Min = XMFLOAT3((std::min)(a.Min.x, b.Min.x), (std::min)(a.Min.y, b.Min.y), (std::min)(a.Min.z, b.Min.z));
+	result.Max = XMFLOAT3((std::max)(a.Max.x, b.Max.x), (std::max)(a.Max.y, b.Max.y), (std::max)(a.Max.z, b.Max.z));
+	return result;
+}
+
+BoundingBox DynamicAabbTree::Aabb::ToBoundingBox() const
+{
+	BoundingBox box;
+	box.Center = XMFLOAT3((Min.x + Max.x) * 0.5f, (Min.y + Max.y) * 0.5f, (Min.z + Max.z) * 0.5f);
+	box.Extents = XMFLOAT3((Max.x - Min.x) * 0.5f, (Max.y - Min.y) * 0.5f, (Max.z - Min.z) * 0.5f);
+	return box;
+}
+
+float DynamicAabbTree::Aabb::Area() const
+{
+	float x = Max.x - Min.x;
+	float y = Max.y - Min.y;
+	float z = Max.z - Min.z;
+	return 2.0f * (x * y + y * z + z * x);
+}
+
+bool DynamicAabbTree::Aabb::Contains(const Aabb& other) const
+{
+	return Min.x <= other.Min.x && Min.y <= other.Min.y && Min.z <= other.Min.z &&
+		Max.x >= other.Max.x && Max.y >= other.Max.y && Max.z >= other.Max.z;
+}
+
+bool DynamicAabbTree::Aabb::Overlaps(const Aabb& other) const
+{
+	return Min.x <= other.Max.x && Min.y <= other.Max.y && Min.z <= other.Max.z &&
+		Max.x >= other.Min.x && Max.y >= other.Min.y && Max.z >= other.Min.z;
+}
+
+int DynamicAabbTree::CreateProxy(const BoundingBox& bounds, uint32_t userData)
+{
+	int proxy = AllocateNode();
+	Node& node = m_nodes[proxy];
+
+	node.Bounds = bounds;
+	node.Fat = Fatten(bounds);
+	node.UserData = userData;
+	node.Height = 0;
+
+	InsertLeaf(proxy);
+	++m_proxyCount;
+	return proxy;
+}
+
+void DynamicAabbTree::DestroyProxy(int proxy)
+{
+	RemoveLeaf(proxy);
+	FreeNode(proxy);
+	--m_proxyCount;
+}
+
+bool DynamicAabbTree::MoveProxy(int proxy, const BoundingBox& bounds)
+{
+	Node& node = m_nodes[proxy];
+	node.Bounds = bounds;
+
+	// Still inside the fattened box, so every ancestor still bounds it
+	if (node.Fat.Contains(Aabb::FromBoundingBox(bounds))) return false;
+
+	RemoveLeaf(proxy);
+	m_nodes[proxy].Fat = Fatten(bounds);
+	InsertLeaf(proxy);
+	return true;
+}
+
+void DynamicAabbTree::Clear()
+{
+	m_nodes.clear();
+	m_root = NULL_NODE;
+	m_freeList = NULL_NODE;
+	m_proxyCount = 0;
+}
+
+float DynamicAabbTree::GetAreaRatio() const
+{
+	if (m_root == NULL_NODE) return 0.0f;
+
+	float rootArea = m_nodes[m_root].Fat.Area();
+	if (rootArea <= 0.0f) return 0.0f;
+
+	float totalArea = 0.0f;
+	for (const Node& node : m_nodes)
+	{
+		// Free nodes have a height of -1 and leaves 0
+		if (node.Height > 0) totalArea += node.Fat.Area();
+	}
+	return totalArea / rootArea;
+}
+
+bool DynamicAabbTree::Validate() const
+{
+	if (m_root == NULL_NODE) return m_proxyCount == 0;
+	if (m_nodes[m_root].Parent != NULL_NODE) return false;
+
+	UINT leaves = 0;
+	UINT reachable = 0;
+
+	std::vector<int> stack;
+	stack.push_back(m_root);
+	while (!stack.empty())
+	{
+		int index = stack.back();
+		stack.pop_back();
+		const Node& node = m_nodes[index];
+		++reachable;
+
+		if (node.IsLeaf())
+		{
+			if (node.Child2 != NULL_NODE || node.Height != 0) return false;
+			if (!node.Fat.Contains(Aabb::FromBoundingBox(node.Bounds))) return false;
+			++leaves;
+			continue;
+		}
+
+		const Node& child1 = m_nodes[node.Child1];
+		const Node& child2 = m_nodes[node.Child2];
+		if (child1.Parent != index || child2.Parent != index) return false;
+		if (node.Height != 1 + (std::max)(child1.Height, child2.Height)) return false;
+		if (!node.Fat.Contains(child1.Fat) || !node.Fat.Contains(child2.Fat)) return false;
+
+		stack.push_back(node.Child1);
+		stack.push_back(node.Child2);
+	}
+
+	UINT freeNodes = 0;
+	for (int index = m_freeList; index != NULL_NODE; index = m_nodes[index].Parent)
+	{
+		if (m_nodes[index].Height != -1) return false;
+		++freeNodes;
+	}
+
+	return leaves == m_proxyCount && reachable + freeNodes == m_nodes.size();
+}
+
+DynamicAabbTree::Aabb DynamicAabbTree::Fatten(const BoundingBox& bounds) const
+{
+	Aabb fat = Aabb::FromBoundingBox(bounds);
+	fat.Min = XMFLOAT3(fat.Min.x - m_margin, fat.Min.y - m_margin, fat.Min.z - m_margin);
+	fat.Max = XMFLOAT3(fat.Max.x + m_margin, fat.Max.y + m_margin, fat.Max.z + m_margin);
+	return fat;
+}
+
+int DynamicAabbTree::AllocateNode()
+{
+	if (m_freeList == NULL_NODE)
+	{
+		m_nodes.push_back(Node{});
+		return static_cast<int>(m_nodes.size() - 1);
+	}
+
+	int index = m_freeList;
+	m_freeList = m_nodes[index].Parent;
+	m_nodes[index] = Node{};
+	return index;
+}
+
+void DynamicAabbTree::FreeNode(int node)
+{
+	m_nodes[node].Parent = m_freeList;
+	m_nodes[node].Height = -1;
+	m_freeList = node;
+}
+
+void DynamicAabbTree::InsertLeaf(int leaf)
+{
+	if (m_root == NULL_NODE)
+	{
+		m_root = leaf;
+		m_nodes[leaf].Parent = NULL_NODE;
+		return;
+	}
+
+	// Walk down towards the cheapest sibling. Pairing with a node costs the area of the new branch, and every
+	// ancestor above it grows by the same amount, so descending only pays off if a child is cheaper than stopping here
+	const Aabb leafBox = m_nodes[leaf].Fat;
+	int index = m_root;
+	while (!m_nodes[index].IsLeaf())
+	{
+		const Node& node = m_nodes[index];
+
+		float area = node.Fat.Area();
+		float combinedArea = Aabb::Union(node.Fat, leafBox).Area();
+
+		float cost = 2.0f * combinedArea;
+		float inheritanceCost = 2.0f * (combinedArea - area);
+
+		auto descendCost = [&](int child)
+		{
+			const Node& childNode = m_nodes[child];
+			float unionArea = Aabb::Union(leafBox, childNode.Fat).Area();
+			return childNode.IsLeaf() ? unionArea + inheritanceCost : unionArea - childNode.Fat.Area() + inheritanceCost;
+		};
+
+		float cost1 = descendCost(node.Child1);
+		float cost2 = descendCost(node.Child2);
+
+		if (cost < cost1 && cost < cost2) break;
+
+		index = cost1 < cost2 ? node.Child1 : node.Child2;
+	}
+
+	const int sibling = index;
+	const int oldParent = m_nodes[sibling].Parent;
+
+	// Allocating can grow m_nodes, so no references into it are held across this
+	const int newParent = AllocateNode();
+	m_nodes[newParent].Parent = oldParent;
+	m_nodes[newParent].Fat = Aabb::Union(leafBox, m_nodes[sibling].Fat);
+	m_nodes[newParent].Height = m_nodes[sibling].Height + 1;
+	m_nodes[newParent].Child1 = sibling;
+	m_nodes[newParent].Child2 = leaf;
+	m_nodes[sibling].Parent = newParent;
+	m_nodes[leaf].Parent = newParent;
+
+	if (oldParent == NULL_NODE)
+	{
+		m_root = newParent;
+	}
+	else if (m_nodes[oldParent].Child1 == sibling)
+	{
+		m_nodes[oldParent].Child1 = newParent;
+	}
+	else
+	{
+		m_nodes[oldParent].Child2 = newParent;
+	}
+
+	RefitAncestors(m_nodes[leaf].Parent);
+}
+
+void DynamicAabbTree::RemoveLeaf(int leaf)
+{
+	if (leaf == m_root)
+	{
+		m_root = NULL_NODE;
+		return;
+	}
+
+	const int parent = m_nodes[leaf].Parent;
+	const int grandParent = m_nodes[parent].Parent;
+	const int sibling = m_nodes[parent].Child1 == leaf ? m_nodes[parent].Child2 : m_nodes[parent].Child1;
+
+	// The sibling takes the parent's place
+	if (grandParent == NULL_NODE)
+	{
+		m_root = sibling;
+		m_nodes[sibling].Parent = NULL_NODE;
+		FreeNode(parent);
+		return;
+	}
+
+	if (m_nodes[grandParent].Child1 == parent)
+	{
+		m_nodes[grandParent].Child1 = sibling;
+	}
+	else
+	{
+		m_nodes[grandParent].Child2 = sibling;
+	}
+	m_nodes[sibling].Parent = grandParent;
+	FreeNode(parent);
+
+	RefitAncestors(grandParent);
+}
+
+void DynamicAabbTree::RefitAncestors(int index)
+{
+	while (index != NULL_NODE)
+	{
+		index = Balance(index);
+
+		Node& node = m_nodes[index];
+		const Node& child1 = m_nodes[node.Child1];
+		const Node& child2 = m_nodes[node.Child2];
+
+		node.Height = 1 + (std::max)(child1.Height, child2.Height);
+		node.Fat = Aabb::Union(child1.Fat, child2.Fat);
+
+		index = node.Parent;
+	}
+}
+
+int DynamicAabbTree::Balance(int iA)
+{
+	Node& A = m_nodes[iA];
+	if (A.IsLeaf() || A.Height < 2) return iA;
+
+	const int iB = A.Child1;
+	const int iC = A.Child2;
+	Node& B = m_nodes[iB];
+	Node& C = m_nodes[iC];
+
+	const int balance = C.Height - B.Height;
+
+	// C is too tall, it takes A's place and A takes whichever of C's children is shorter
+	if (balance > 1)
+	{
+		const int iF = C.Child1;
+		const int iG = C.Child2;
+		Node& F = m_nodes[iF];
+		Node& G = m_nodes[iG];
+
+		C.Child1 = iA;
+		C.Parent = A.Parent;
+		A.Parent = iC;
+
+		if (C.Parent == NULL_NODE)
+		{
+			m_root = iC;
+		}
+		else if (m_nodes[C.Parent].Child1 == iA)
+		{
+			m_nodes[C.Parent].Child1 = iC;
+		}
+		else
+		{
+			m_nodes[C.Parent].Child2 = iC;
+		}
+
+		if (F.Height > G.Height)
+		{
+			C.Child2 = iF;
+			A.Child2 = iG;
+			G.Parent = iA;
+			A.Fat = Aabb::Union(B.Fat, G.Fat);
+			C.Fat = Aabb::Union(A.Fat, F.Fat);
+			A.Height = 1 + (std::max)(B.Height, G.Height);
+			C.Height = 1 + (std::max)(A.Height, F.Height);
+		}
+		else
+		{
+			C.Child2 = iG;
+			A.Child2 = iF;
+			F.Parent = iA;
+			A.Fat = Aabb::Union(B.Fat, F.Fat);
+			C.Fat = Aabb::Union(A.Fat, G.Fat);
+			A.Height = 1 + (std::max)(B.Height, F.Height);
+			C.Height = 1 + (std::max)(A.Height, G.Height);
+		}
+
+		return iC;
+	}
+
+	// Same again the other way round with B
+	if (balance < -1)
+	{
+		const int iD = B.Child1;
+		const int iE = B.Child2;
+		Node& D = m_nodes[iD];
+		Node& E = m_nodes[iE];
+
+		B.Child1 = iA;
+		B.Parent = A.Parent;
+		A.Parent = iB;
+
+		if (B.Parent == NULL_NODE)
+		{
+			m_root = iB;
+		}
+		else if (m_nodes[B.Parent].Child1 == iA)
+		{
+			m_nodes[B.Parent].Child1 = iB;
+		}
+		else
+		{
+			m_nodes[B.Parent].Child2 = iB;
+		}
+
+		if (D.Height > E.Height)
+		{
+			B.Child2 = iD;
+			A.Child1 = iE;
+			E.Parent = iA;
+			A.Fat = Aabb::Union(C.Fat, E.Fat);
+			B.Fat = Aabb::Union(A.Fat, D.Fat);
+			A.Height = 1 + (std::max)(C.Height, E.Height);
+			B.Height = 1 + (std::max)(A.Height, D.Height);
+		}
+		else
+		{
+			B.Child2 = iE;
+			A.Child1 = iD;
+			D.Parent = iA;
+			A.Fat = Aabb::Union(C.Fat, D.Fat);
+			B.Fat = Aabb::Union(A.Fat, E.Fat);
+			A.Height = 1 + (std::max)(C.Height, D.Height);
+			B.Height = 1 + (std::max)(A.Height, E.Height);
+		}
+
+		return iB;
+	}
+
+	return iA;
+}
+
+DynamicAabbTree::FrustumSide DynamicAabbTree::Classify(const CullingFrustum& frustum, const BoundingBox& box)
+{
+	const XMFLOAT3& center = box.Center;
+	const XMFLOAT3& extents = box.Extents;
+
+	FrustumSide side = FRUSTUM_INSIDE;
+	for (const XMFLOAT4& plane : frustum.Planes)
+	{
+		// Same sum as CullingFrustum::IsVisible, so leaves get exactly the same answer as the linear cull
+		float distance = plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w;
+		float radius = fabsf(plane.x) * extents.x + fabsf(plane.y) * extents.y + fabsf(plane.z) * extents.z;
+		if (distance + radius < 0.0f) return FRUSTUM_OUTSIDE;
+		if (distance - radius < 0.0f) side = FRUSTUM_INTERSECTS;
+	}
+	return side;
+}
+
+float DynamicAabbTree::RayEntry(const XMFLOAT3& origin, const XMFLOAT3& inverseDirection, float maxDistance, const Aabb& box)
+{
+	float tx1 = (box.Min.x - origin.x) * inverseDirection.x;
+	float tx2 = (box.Max.x - origin.x) * inverseDirection.x;
+	float ty1 = (box.Min.y - origin.y) * inverseDirection.y;
+	float ty2 = (box.Max.y - origin.y) * inverseDirection.y;
+	float tz1 = (box.Min.z - origin.z) * inverseDirection.z;
+	float tz2 = (box.Max.z - origin.z) * inverseDirection.z;
+
+	// fminf and fmaxf drop the NaN from 0 * infinity when the ray lies on a slab's plane
+	float entry = fmaxf(fmaxf(fminf(tx1, tx2), fminf(ty1, ty2)), fmaxf(fminf(tz1, tz2), 0.0f));
+	float exit = fminf(fminf(fmaxf(tx1, tx2), fmaxf(ty1, ty2)), fminf(fmaxf(tz1, tz2), maxDistance));
+
+	return entry <= exit ? entry : -1.0f;
+}
@@ -0,0 +1,253 @@
+// Dynamic bounding volume hierarchy of axis aligned boxes, for culling, picking and overlap queries without scanning every object
+
+#pragma once
+
+#include <windows.h>
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "FrustumCuller.h"
+
+using namespace DirectX;
+
+/// <summary>
+/// A binary tree of boxes where every leaf is one proxy (an object's box) and every branch bounds its two children.
+/// Leaves are inserted next to whichever sibling adds the least surface area to the tree, and rotated AVL style on
+/// the way back up so the height stays logarithmic. Each leaf's box is fattened by a margin, so an object that only
+/// moves a little is refitted in place rather than taken out and reinserted.
+///
+/// Leaves are tested with the exact box last passed in, so queries give the same answer as a brute force scan.
+/// Pure CPU code, not thread safe: change and query it from one thread at a time.
+/// </summary>
+class DynamicAabbTree
+{
+public:
+	static constexpr int NULL_NODE = -1;
+
+	/// @param margin How far each leaf's box is grown in every direction before it goes in the tree.
+	explicit DynamicAabbTree(float margin = 0.1f) : m_margin(margin) {}
+
+	/// Adds a box, userData comes back out of the queries. Returns the proxy id to move or destroy it with.
+	int			CreateProxy(const BoundingBox& bounds, uint32_t userData);
+	void		DestroyProxy(int proxy);
+
+	/// Updates a proxy's box. It is only reinserted if it has moved outside its fattened box.
+	/// @return True if the proxy was reinserted.
+	bool		MoveProxy(int proxy, const BoundingBox& bounds);
+
+	uint32_t	GetUserData(int proxy) const { return m_nodes[proxy].UserData; }
+	UINT		GetProxyCount() const { return m_proxyCount; }
+
+	void		Clear();
+
+	/// Counts from a single query, for the stats window and benchmarks.
+	struct QueryStats
+	{
+		UINT	NodesVisited = 0;
+		UINT	LeavesTested = 0;
+		UINT	Results = 0;
+	};
+
+	/// Calls visit(userData) for every proxy inside or touching the frustum. Whole subtrees that are
+	/// inside the frustum are taken without testing anything under them.
+	template <typename Visit>
+	QueryStats	QueryFrustum(const CullingFrustum& frustum, Visit&& visit) const;
+
+	/// Calls visit(userData) for every proxy whose box overlaps bounds. Return false from visit to stop early.
+	template <typename Visit>
+	QueryStats	QueryOverlap(const BoundingBox& bounds, Visit&& visit) const;
+
+	/// Walks the proxies whose boxes the ray passes through within maxDistance, calling
+	/// hit(userData, entryDistance) for each. hit returns the new max distance, so returning the distance to
+	/// a confirmed hit skips everything further away, and returning 0 stops the query.
+	/// @param direction Doesn't need to be normalised, distances are in multiples of it.
+	template <typename Hit>
+	QueryStats	RayCast(const XMFLOAT3& origin, const XMFLOAT3& direction, float maxDistance, Hit&& hit) const;
+
+	/// Longest path from the root to a leaf, 0 for a single leaf.
+	int			GetHeight() const { return m_root == NULL_NODE ? 0 : m_nodes[m_root].Height; }
+
+	/// Total surface area of the branches over the root's. Lower is better, it is roughly how many branches an
+	/// average query ends up visiting.
+	float		GetAreaRatio() const;
+
+	/// Checks every link, height and box in the tree. Only for tests, it visits every node.
+	bool		Validate() const;
+
+private:
+	struct Aabb
+	{
+		XMFLOAT3	Min;
+		XMFLOAT3	Max;
+
+		static Aabb		FromBoundingBox(const BoundingBox& box);
+		static Aabb		Union(const Aabb& a, const Aabb& b);
+		BoundingBox		ToBoundingBox() const;
+		float			Area() const;
+		bool			Contains(const Aabb& other) const;
+		bool			Overlaps(const Aabb& other) const;
+	};
+
+	struct Node
+	{
+		Aabb		Fat;
+
+		// The box as it was last given, only meaningful for leaves
+		BoundingBox	Bounds;
+
+		// Parent for nodes in the tree, next free node for the ones on the free list
+		int			Parent = NULL_NODE;
+		int			Child1 = NULL_NODE;
+		int			Child2 = NULL_NODE;
+
+		// Leaves are 0, free nodes -1
+		int			Height = -1;
+		uint32_t	UserData = 0;
+
+		bool		IsLeaf() const { return Child1 == NULL_NODE; }
+	};
+
+	// Traversal stack depth. The balancing keeps a million proxies well under 64 levels
+	static constexpr int MAX_STACK = 256;
+
+	Aabb		Fatten(const BoundingBox& bounds) const;
+	int			AllocateNode();
+	void		FreeNode(int node);
+	void		InsertLeaf(int leaf);
+	void		RemoveLeaf(int leaf);
+	int			Balance(int node);
+	void		RefitAncestors(int node);
+
+	// Which side of the frustum's planes a box is: fully outside one of them, straddling, or inside all
+	enum FrustumSide { FRUSTUM_OUTSIDE, FRUSTUM_INTERSECTS, FRUSTUM_INSIDE };
+	static FrustumSide Classify(const CullingFrustum& frustum, const BoundingBox& box);
+
+	// Distance along the ray to where it enters box, or a negative number if it misses within maxDistance
+	static float RayEntry(const XMFLOAT3& origin, const XMFLOAT3& inverseDirection, float maxDistance, const Aabb& box);
+
+	std::vector<Node>	m_nodes;
+	int					m_root = NULL_NODE;
+	int					m_freeList = NULL_NODE;
+	UINT				m_proxyCount = 0;
+	float				m_margin;
+};
+
+template <typename Visit>
+DynamicAabbTree::QueryStats DynamicAabbTree::QueryFrustum(const CullingFrustum& frustum, Visit&& visit) const
+{
+	QueryStats stats;
+	if (m_root == NULL_NODE) return stats;
+
+	// The bool says the node is already known to be inside the frustum
+	std::pair<int, bool> stack[MAX_STACK];
+	int stackSize = 0;
+	stack[stackSize++] = { m_root, false };
+
+	while (stackSize > 0)
+	{
+		auto [nodeIndex, inside] = stack[--stackSize];
+		const Node& node = m_nodes[nodeIndex];
+		++stats.NodesVisited;
+
+		if (!inside)
+		{
+			const bool leaf = node.IsLeaf();
+			if (leaf) ++stats.LeavesTested;
+
+			FrustumSide side = Classify(frustum, leaf ? node.Bounds : node.Fat.ToBoundingBox());
+			if (side == FRUSTUM_OUTSIDE) continue;
+			inside = side == FRUSTUM_INSIDE;
+		}
+
+		if (node.IsLeaf())
+		{
+			++stats.Results;
+			visit(node.UserData);
+			continue;
+		}
+
+		stack[stackSize++] = { node.Child2, inside };
+		stack[stackSize++] = { node.Child1, inside };
+	}
+
+	return stats;
+}
+
+template <typename Visit>
+DynamicAabbTree::QueryStats DynamicAabbTree::QueryOverlap(const BoundingBox& bounds, Visit&& visit) const
+{
+	QueryStats stats;
+	if (m_root == NULL_NODE) return stats;
+
+	const Aabb box = Aabb::FromBoundingBox(bounds);
+
+	int stack[MAX_STACK];
+	int stackSize = 0;
+	stack[stackSize++] = m_root;
+
+	while (stackSize > 0)
+	{
+		const Node& node = m_nodes[stack[--stackSize]];
+		++stats.NodesVisited;
+
+		if (node.IsLeaf())
+		{
+			++stats.LeavesTested;
+			if (!Aabb::FromBoundingBox(node.Bounds).Overlaps(box)) continue;
+
+			++stats.Results;
+			if (!visit(node.UserData)) break;
+			continue;
+		}
+
+		if (!node.Fat.Overlaps(box)) continue;
+
+		stack[stackSize++] = node.Child2;
+		stack[stackSize++] = node.Child1;
+	}
+
+	return stats;
+}
+
+template <typename Hit>
+DynamicAabbTree::QueryStats DynamicAabbTree::RayCast(const XMFLOAT3& origin, const XMFLOAT3& direction, float maxDistance, Hit&& hit) const
+{
+	QueryStats stats;
+	if (m_root == NULL_NODE) return stats;
+
+	// Division by zero gives infinity, which the slab test copes with
+	const XMFLOAT3 inverseDirection(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+
+	int stack[MAX_STACK];
+	int stackSize = 0;
+	stack[stackSize++] = m_root;
+
+	while (stackSize > 0)
+	{
+		const Node& node = m_nodes[stack[--stackSize]];
+		++stats.NodesVisited;
+
+		if (node.IsLeaf())
+		{
+			++stats.LeavesTested;
+			float entry = RayEntry(origin, inverseDirection, maxDistance, Aabb::FromBoundingBox(node.Bounds));
+			if (entry < 0.0f) continue;
+
+			++stats.Results;
+			maxDistance = hit(node.UserData, entry);
+			if (maxDistance <= 0.0f) break;
+			continue;
+		}
+
+		if (RayEntry(origin, inverseDirection, maxDistance, node.Fat) < 0.0f) continue;
+
+		stack[stackSize++] = node.Child2;
+		stack[stackSize++] = node.Child1;
+	}
+
+	return stats;
+}
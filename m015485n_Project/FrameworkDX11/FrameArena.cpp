@@ -0,0 +1,107 @@
+#include "FrameArena.h"
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+
+namespace
+{
+	size_t AlignUp(size_t value, size_t alignment)
+	{
+		return (value + alignment - 1) & ~(alignment - 1);
+	}
+
+	// Room for the largest alignment anything in the renderer asks for (XMVECTOR / XMMATRIX)
+	constexpr size_t BLOCK_ALIGNMENT = 16;
+}
+
+FrameArena::FrameArena(size_t capacity)
+	: m_capacity(AlignUp(capacity, BLOCK_ALIGNMENT))
+{
+	m_block = static_cast<unsigned char*>(::operator new(m_capacity, std::align_val_t(BLOCK_ALIGNMENT)));
+	m_overflow.reserve(16);
+}
+
+FrameArena::~FrameArena()
+{
+	for (const Overflow& overflow : m_overflow)
+	{
+		::operator delete(overflow.Memory, std::align_val_t(overflow.Alignment));
+	}
+
+	::operator delete(m_block, std::align_val_t(BLOCK_ALIGNMENT));
+}
+
+FrameArena& FrameArena::ThreadArena()
+{
+	thread_local FrameArena arena;
+	return arena;
+}
+
+void* FrameArena::Allocate(size_t size, size_t alignment)
+{
+	if (size == 0) size = 1;
+
+	size_t start = AlignUp(m_offset, alignment);
+	if (alignment <= BLOCK_ALIGNMENT && start + size <= m_capacity)
+	{
+		m_offset = start + size;
+		return m_block + start;
+	}
+
+	// Out of room this frame, fall back to the heap and remember how much we needed
+	alignment = (std::max)(alignment, BLOCK_ALIGNMENT);
+	void* overflow = ::operator new(size, std::align_val_t(alignment));
+
+	m_overflow.push_back({ overflow, alignment });
+	m_overflowBytes += AlignUp(size, alignment);
+
+	return overflow;
+}
+
+void FrameArena::Reset()
+{
+	size_t used = GetUsed();
+	if (used > m_highWater) m_highWater = used;
+
+	for (const Overflow& overflow : m_overflow)
+	{
+		::operator delete(overflow.Memory, std::align_val_t(overflow.Alignment));
+	}
+	m_overflow.clear();
+
+	// Grow once so the same workload fits in the block from now on
+	if (m_overflowBytes > 0)
+	{
+		::operator delete(m_block, std::align_val_t(BLOCK_ALIGNMENT));
+
+		m_capacity = AlignUp(m_highWater + m_highWater / 2, BLOCK_ALIGNMENT);
+		m_block = static_cast<unsigned char*>(::operator new(m_capacity, std::align_val_t(BLOCK_ALIGNMENT)));
+	}
+
+	m_offset = 0;
+	m_overflowBytes = 0;
+}
+
+const char* FrameArena::Format(const char* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	va_list argsCopy;
+	va_copy(argsCopy, args);
+
+	int length = std::vsnprintf(nullptr, 0, format, args);
+	va_end(args);
+
+	if (length < 0)
+	{
+		va_end(argsCopy);
+		return "";
+	}
+
+	char* text = static_cast<char*>(Allocate(static_cast<size_t>(length) + 1, 1));
+	std::vsnprintf(text, static_cast<size_t>(length) + 1, format, argsCopy);
+	va_end(argsCopy);
+
+	return text;
+}
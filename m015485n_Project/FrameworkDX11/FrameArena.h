@@ -0,0 +1,55 @@
+// Per-thread bump allocator for memory that only has to live until the end of the current frame
+
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+/// <summary>
+/// A linear allocator that hands out memory by bumping an offset and frees everything at once on Reset.
+/// Each thread gets its own arena from ThreadArena, so allocating never takes a lock. If a frame runs past
+/// the end of the block the rest goes to the heap, and the next Reset grows the block to fit.
+/// </summary>
+class FrameArena
+{
+public:
+	static constexpr size_t DEFAULT_CAPACITY = 256 * 1024;
+
+	explicit FrameArena(size_t capacity = DEFAULT_CAPACITY);
+	~FrameArena();
+
+	/// Gets the calling thread's arena, creating it the first time.
+	static FrameArena& ThreadArena();
+
+	void* Allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+
+	/// Throws away everything allocated since the last reset. Only the owning thread may call this,
+	/// and only once nothing from the previous frame is still being used.
+	void Reset();
+
+	/// printf into the arena, handy for ImGui labels.
+	const char* Format(const char* format, ...);
+
+	size_t GetUsed() const { return m_offset + m_overflowBytes; }
+	size_t GetCapacity() const { return m_capacity; }
+	size_t GetHighWater() const { return m_highWater; }
+
+	FrameArena(const FrameArena&) = delete;
+	FrameArena& operator=(const FrameArena&) = delete;
+
+private:
+	unsigned char*			m_block = nullptr;
+	size_t					m_capacity = 0;
+	size_t					m_offset = 0;
+	size_t					m_highWater = 0;
+
+	// Allocations that didn't fit this frame, freed on Reset
+	struct Overflow
+	{
+		void*	Memory;
+		size_t	Alignment;
+	};
+	std::vector<Overflow>	m_overflow;
+	size_t					m_overflowBytes = 0;
+};
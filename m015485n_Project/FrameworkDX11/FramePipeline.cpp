@@ -0,0 +1,149 @@
+#include "FramePipeline.h"
+#include "FrameArena.h"
+
+namespace
+{
+	// Exponential smoothing so the stats window is readable
+	float Smooth(float current, float sample)
+	{
+		return current == 0.0f ? sample : current * 0.9f + sample * 0.1f;
+	}
+
+	float MillisecondsSince(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+}
+
+FramePipeline::FramePipeline(SimulateFunction simulate)
+	: m_simulate(std::move(simulate))
+{
+	for (RenderSnapshot& snapshot : m_snapshots)
+	{
+		m_freeSnapshots.push_back(&snapshot);
+	}
+
+	m_simulationThread = std::thread(&FramePipeline::SimulationLoop, this);
+}
+
+FramePipeline::~FramePipeline()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_quit = true;
+	}
+	m_condition.notify_all();
+
+	m_simulationThread.join();
+}
+
+RenderSnapshot* FramePipeline::BeginFrame(float deltaTime)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	ApplyRequestedMode(lock);
+
+	if (!m_pipelined)
+	{
+		// Frames simulated ahead before switching modes still get rendered
+		WaitForIdle(lock);
+		if (!m_readySnapshots.empty())
+		{
+			RenderSnapshot* snapshot = m_readySnapshots.front();
+			m_readySnapshots.pop_front();
+			return snapshot;
+		}
+
+		RenderSnapshot* snapshot = m_freeSnapshots.front();
+		m_freeSnapshots.pop_front();
+
+		lock.unlock();
+		Simulate(deltaTime, *snapshot);
+		return snapshot;
+	}
+
+	// The first pipelined frame has nothing queued yet, so simulate it as well as the next one
+	if (!m_primed)
+	{
+		m_pendingFrames.push_back(deltaTime);
+		m_primed = true;
+	}
+
+	m_pendingFrames.push_back(deltaTime);
+	m_condition.notify_all();
+
+	m_condition.wait(lock, [this] { return !m_readySnapshots.empty(); });
+
+	RenderSnapshot* snapshot = m_readySnapshots.front();
+	m_readySnapshots.pop_front();
+	return snapshot;
+}
+
+void FramePipeline::EndFrame(RenderSnapshot* snapshot, float renderMs)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	m_renderMs = Smooth(m_renderMs, renderMs);
+	m_simulationMs = Smooth(m_simulationMs, snapshot->SimulationMs);
+
+	// From the simulation starting on this frame to it having been presented
+	m_latencyMs = Smooth(m_latencyMs, MillisecondsSince(snapshot->SimulationStart));
+
+	m_freeSnapshots.push_back(snapshot);
+	m_condition.notify_all();
+}
+
+void FramePipeline::ApplyRequestedMode(std::unique_lock<std::mutex>& lock)
+{
+	bool pipelined = m_requestedPipelined;
+	if (m_pipelined == pipelined) return;
+
+	WaitForIdle(lock);
+	m_pipelined = pipelined;
+	m_primed = false;
+}
+
+void FramePipeline::WaitForIdle(std::unique_lock<std::mutex>& lock)
+{
+	m_condition.wait(lock, [this] { return m_pendingFrames.empty() && !m_simulating; });
+}
+
+void FramePipeline::SimulationLoop()
+{
+	for (;;)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		// Only start on a frame once there is somewhere to put it, this is what bounds the queue
+		m_condition.wait(lock, [this] { return m_quit || (!m_pendingFrames.empty() && !m_freeSnapshots.empty()); });
+
+		if (m_quit) return;
+
+		float deltaTime = m_pendingFrames.front();
+		m_pendingFrames.pop_front();
+
+		RenderSnapshot* snapshot = m_freeSnapshots.front();
+		m_freeSnapshots.pop_front();
+		m_simulating = true;
+
+		lock.unlock();
+		FrameArena::ThreadArena().Reset();
+		Simulate(deltaTime, *snapshot);
+		lock.lock();
+
+		m_simulating = false;
+		m_readySnapshots.push_back(snapshot);
+		m_condition.notify_all();
+	}
+}
+
+void FramePipeline::Simulate(float deltaTime, RenderSnapshot& snapshot)
+{
+	snapshot.SimulationStart = std::chrono::steady_clock::now();
+	snapshot.FrameIndex = m_nextFrameIndex++;
+	snapshot.DeltaTime = deltaTime;
+
+	m_simulate(deltaTime, snapshot);
+
+	snapshot.SimulationMs = MillisecondsSince(snapshot.SimulationStart);
+}
@@ -0,0 +1,77 @@
+// Two stage frame pipeline, the scene for frame N+1 is simulated on its own thread while frame N is being submitted
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "RenderSnapshot.h"
+
+/// <summary>
+/// Owns a small ring of render snapshots. The simulation stage fills free snapshots and queues them,
+/// the render stage takes the oldest queued one and hands it back when the frame has been presented.
+/// The number of snapshots bounds how far ahead the simulation can get.
+/// </summary>
+class FramePipeline
+{
+public:
+	typedef std::function<void(float deltaTime, RenderSnapshot& snapshot)> SimulateFunction;
+
+	/// @param simulate Updates the scene and fills in the snapshot, called on the simulation thread when pipelined.
+	explicit FramePipeline(SimulateFunction simulate);
+	~FramePipeline();
+
+	/// Gets the snapshot to render this frame. When pipelined this also starts simulating the next frame.
+	RenderSnapshot* BeginFrame(float deltaTime);
+
+	/// Hands the snapshot back once the frame has been presented.
+	/// @param renderMs How long the render stage spent on the frame.
+	void EndFrame(RenderSnapshot* snapshot, float renderMs);
+
+	/// Switches between pipelined and serial frames. Takes effect at the start of the next frame,
+	/// so it is safe to call while holding locks the simulation needs.
+	void SetPipelined(bool pipelined) { m_requestedPipelined = pipelined; }
+	bool IsPipelined() const { return m_requestedPipelined; }
+
+	float GetSimulationMs() const { return m_simulationMs; }
+	float GetRenderMs() const { return m_renderMs; }
+	float GetLatencyMs() const { return m_latencyMs; }
+
+	FramePipeline(const FramePipeline&) = delete;
+	FramePipeline& operator=(const FramePipeline&) = delete;
+
+private:
+	void SimulationLoop();
+	void Simulate(float deltaTime, RenderSnapshot& snapshot);
+	void WaitForIdle(std::unique_lock<std::mutex>& lock);
+	void ApplyRequestedMode(std::unique_lock<std::mutex>& lock);
+
+	// One being rendered, one queued and one being simulated
+	static constexpr int SNAPSHOT_COUNT = 3;
+
+	SimulateFunction				m_simulate;
+	RenderSnapshot					m_snapshots[SNAPSHOT_COUNT];
+	unsigned long long				m_nextFrameIndex = 0;
+
+	std::deque<RenderSnapshot*>		m_freeSnapshots;
+	std::deque<RenderSnapshot*>		m_readySnapshots;
+	std::deque<float>				m_pendingFrames;
+	bool							m_simulating = false;
+
+	std::thread						m_simulationThread;
+	std::mutex						m_mutex;
+	std::condition_variable			m_condition;
+	bool							m_quit = false;
+	bool							m_pipelined = false;
+	std::atomic<bool>				m_requestedPipelined{ false };
+	bool							m_primed = false;
+
+	// Smoothed timings for the ImGui stats window
+	float							m_simulationMs = 0.0f;
+	float							m_renderMs = 0.0f;
+	float							m_latencyMs = 0.0f;
+};
@@ -0,0 +1,127 @@
+#include "FrustumCuller.h"
+
+#include <cmath>
+#include <cstdint>
+
+namespace
+{
+	void SetLane(XMFLOAT4A& vector, UINT lane, float value)
+	{
+		switch (lane)
+		{
+		case 0: vector.x = value; break;
+		case 1: vector.y = value; break;
+		case 2: vector.z = value; break;
+		default: vector.w = value; break;
+		}
+	}
+}
+
+CullingFrustum CullingFrustum::FromViewProjection(FXMMATRIX viewProjection)
+{
+	// Clip space is row vector * matrix, so each plane comes from the matrix's columns
+	XMMATRIX columns = XMMatrixTranspose(viewProjection);
+
+	XMVECTOR planes[6] =
+	{
+		XMVectorAdd(columns.r[3], columns.r[0]),		// left
+		XMVectorSubtract(columns.r[3], columns.r[0]),	// right
+		XMVectorAdd(columns.r[3], columns.r[1]),		// bottom
+		XMVectorSubtract(columns.r[3], columns.r[1]),	// top
+		columns.r[2],									// near
+		XMVectorSubtract(columns.r[3], columns.r[2])	// far
+	};
+
+	CullingFrustum frustum;
+	for (int i = 0; i < 6; ++i)
+	{
+		XMStoreFloat4(&frustum.Planes[i], XMPlaneNormalize(planes[i]));
+	}
+	return frustum;
+}
+
+bool CullingFrustum::IsVisible(const BoundingBox& box) const
+{
+	for (const XMFLOAT4& plane : Planes)
+	{
+		float distance = plane.x * box.Center.x + plane.y * box.Center.y + plane.z * box.Center.z + plane.w;
+		float radius = fabsf(plane.x) * box.Extents.x + fabsf(plane.y) * box.Extents.y + fabsf(plane.z) * box.Extents.z;
+		if (distance + radius < 0.0f) return false;
+	}
+	return true;
+}
+
+bool CullingFrustum::IsVisible(const BoundingSphere& sphere) const
+{
+	for (const XMFLOAT4& plane : Planes)
+	{
+		float distance = plane.x * sphere.Center.x + plane.y * sphere.Center.y + plane.z * sphere.Center.z + plane.w;
+		if (distance + sphere.Radius < 0.0f) return false;
+	}
+	return true;
+}
+
+void FrustumCuller::Add(const BoundingBox& box)
+{
+	UINT lane = m_count % LANES;
+	if (lane == 0) m_blocks.push_back(BoxBlock{});
+
+	BoxBlock& block = m_blocks.back();
+	SetLane(block.CenterX, lane, box.Center.x);
+	SetLane(block.CenterY, lane, box.Center.y);
+	SetLane(block.CenterZ, lane, box.Center.z);
+	SetLane(block.ExtentX, lane, box.Extents.x);
+	SetLane(block.ExtentY, lane, box.Extents.y);
+	SetLane(block.ExtentZ, lane, box.Extents.z);
+
+	++m_count;
+}
+
+void FrustumCuller::Cull(const CullingFrustum& frustum, std::vector<UINT>& visible) const
+{
+	visible.clear();
+
+	// Each plane's components splatted across all four lanes, along with their absolute values for the box's reach
+	XMVECTOR normalX[6], normalY[6], normalZ[6], offset[6], reachX[6], reachY[6], reachZ[6];
+	for (int i = 0; i < 6; ++i)
+	{
+		const XMFLOAT4& plane = frustum.Planes[i];
+		normalX[i] = XMVectorReplicate(plane.x);
+		normalY[i] = XMVectorReplicate(plane.y);
+		normalZ[i] = XMVectorReplicate(plane.z);
+		offset[i] = XMVectorReplicate(plane.w);
+		reachX[i] = XMVectorReplicate(fabsf(plane.x));
+		reachY[i] = XMVectorReplicate(fabsf(plane.y));
+		reachZ[i] = XMVectorReplicate(fabsf(plane.z));
+	}
+
+	const XMVECTOR zero = XMVectorZero();
+
+	for (size_t blockIndex = 0; blockIndex < m_blocks.size(); ++blockIndex)
+	{
+		const BoxBlock& block = m_blocks[blockIndex];
+		XMVECTOR centerX = XMLoadFloat4A(&block.CenterX);
+		XMVECTOR centerY = XMLoadFloat4A(&block.CenterY);
+		XMVECTOR centerZ = XMLoadFloat4A(&block.CenterZ);
+		XMVECTOR extentX = XMLoadFloat4A(&block.ExtentX);
+		XMVECTOR extentY = XMLoadFloat4A(&block.ExtentY);
+		XMVECTOR extentZ = XMLoadFloat4A(&block.ExtentZ);
+
+		XMVECTOR outside = XMVectorFalseInt();
+		for (int i = 0; i < 6; ++i)
+		{
+			XMVECTOR distance = XMVectorMultiplyAdd(centerX, normalX[i], XMVectorMultiplyAdd(centerY, normalY[i], XMVectorMultiplyAdd(centerZ, normalZ[i], offset[i])));
+			XMVECTOR radius = XMVectorMultiplyAdd(extentX, reachX[i], XMVectorMultiplyAdd(extentY, reachY[i], XMVectorMultiply(extentZ, reachZ[i])));
+			outside = XMVectorOrInt(outside, XMVectorLess(XMVectorAdd(distance, radius), zero));
+		}
+
+		uint32_t lanes[LANES];
+		XMStoreInt4(lanes, outside);
+
+		const UINT first = static_cast<UINT>(blockIndex) * LANES;
+		for (UINT lane = 0; lane < LANES; ++lane)
+		{
+			if (lanes[lane] == 0 && first + lane < m_count) visible.push_back(first + lane);
+		}
+	}
+}
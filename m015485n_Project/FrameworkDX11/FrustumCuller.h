@@ -0,0 +1,64 @@
+// Tests world space bounding boxes against the camera frustum, four at a time
+
+#pragma once
+
+#include <windows.h>
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
+#include <vector>
+
+using namespace DirectX;
+
+/// <summary>
+/// The six frustum planes, normals pointing inwards, so a point is inside when dot(normal, point) + w >= 0 for all of them.
+/// </summary>
+struct CullingFrustum
+{
+	XMFLOAT4	Planes[6];
+
+	/// Pulls the planes out of a view * projection matrix (D3D clip space, z from 0 to w).
+	static CullingFrustum FromViewProjection(FXMMATRIX viewProjection);
+
+	/// Single box test, the same sum the batched test does.
+	bool IsVisible(const BoundingBox& box) const;
+
+	/// Culled once the sphere is fully behind any plane.
+	bool IsVisible(const BoundingSphere& sphere) const;
+};
+
+/// <summary>
+/// Holds boxes in blocks of four with each component in its own vector (x of four centres, then y, ...),
+/// so one set of vector instructions tests a whole block against a plane. A box is culled once it is fully
+/// behind any plane, which keeps a few boxes near the frustum's corners that are really outside, same as
+/// BoundingFrustum does.
+/// </summary>
+class FrustumCuller
+{
+public:
+	void	Clear() { m_blocks.clear(); m_count = 0; }
+	void	Reserve(size_t count) { m_blocks.reserve((count + LANES - 1) / LANES); }
+
+	/// Adds a box, boxes are numbered in the order they are added.
+	void	Add(const BoundingBox& box);
+
+	UINT	GetCount() const { return m_count; }
+
+	/// Fills visible with the numbers of the boxes inside or touching the frustum, in order.
+	void	Cull(const CullingFrustum& frustum, std::vector<UINT>& visible) const;
+
+private:
+	static constexpr UINT LANES = 4;
+
+	struct BoxBlock
+	{
+		XMFLOAT4A	CenterX;
+		XMFLOAT4A	CenterY;
+		XMFLOAT4A	CenterZ;
+		XMFLOAT4A	ExtentX;
+		XMFLOAT4A	ExtentY;
+		XMFLOAT4A	ExtentZ;
+	};
+
+	std::vector<BoxBlock>	m_blocks;
+	UINT					m_count = 0;
+};
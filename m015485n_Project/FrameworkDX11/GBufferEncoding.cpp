@@ -0,0 +1,100 @@
+#include "GBufferEncoding.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+	float Saturate(float value)
+	{
+		return (std::min)((std::max)(value, 0.0f), 1.0f);
+	}
+
+	float SignNotZero(float value)
+	{
+		return value >= 0.0f ? 1.0f : -1.0f;
+	}
+
+	// Float to UNORM as D3D does it, round to nearest
+	uint32_t ToUnorm(float value, uint32_t bits)
+	{
+		const float maximum = static_cast<float>((1u << bits) - 1);
+		return static_cast<uint32_t>(Saturate(value) * maximum + 0.5f);
+	}
+
+	float FromUnorm(uint32_t value, uint32_t bits)
+	{
+		const uint32_t maximum = (1u << bits) - 1;
+		return static_cast<float>(value & maximum) / static_cast<float>(maximum);
+	}
+}
+
+XMFLOAT2 GBufferEncoding::EncodeNormal(const XMFLOAT3& normal)
+{
+	// Onto the octahedron |x| + |y| + |z| = 1, then the lower half is folded out over the corners of the square
+	const float sum = fabsf(normal.x) + fabsf(normal.y) + fabsf(normal.z);
+	float x = normal.x / sum;
+	float y = normal.y / sum;
+	if (normal.z < 0.0f)
+	{
+		const float foldedX = (1.0f - fabsf(y)) * SignNotZero(x);
+		const float foldedY = (1.0f - fabsf(x)) * SignNotZero(y);
+		x = foldedX;
+		y = foldedY;
+	}
+
+	return XMFLOAT2(x * 0.5f + 0.5f, y * 0.5f + 0.5f);
+}
+
+XMFLOAT3 GBufferEncoding::DecodeNormal(const XMFLOAT2& encoded)
+{
+	float x = encoded.x * 2.0f - 1.0f;
+	float y = encoded.y * 2.0f - 1.0f;
+	const float z = 1.0f - fabsf(x) - fabsf(y);
+
+	// Past the diamond's edge z went negative, unfold back onto the lower half
+	const float t = Saturate(-z);
+	x += x >= 0.0f ? -t : t;
+	y += y >= 0.0f ? -t : t;
+
+	const float length = sqrtf(x * x + y * y + z * z);
+	return XMFLOAT3(x / length, y / length, z / length);
+}
+
+float GBufferEncoding::EncodeSpecularPower(float power)
+{
+	return Saturate(log2f((std::max)(power, 1.0f)) / SPECULAR_POWER_LOG2_RANGE);
+}
+
+float GBufferEncoding::DecodeSpecularPower(float encoded)
+{
+	return exp2f(encoded * SPECULAR_POWER_LOG2_RANGE);
+}
+
+GBufferEncoding::PackedSurface GBufferEncoding::Pack(const Surface& surface)
+{
+	PackedSurface packed;
+	packed.Albedo = ToUnorm(surface.Albedo.x, 8)
+		| ToUnorm(surface.Albedo.y, 8) << 8
+		| ToUnorm(surface.Albedo.z, 8) << 16
+		| ToUnorm(EncodeSpecularPower(surface.SpecularPower), 8) << 24;
+
+	const XMFLOAT2 normal = EncodeNormal(surface.Normal);
+	packed.Normal = ToUnorm(normal.x, 10)
+		| ToUnorm(normal.y, 10) << 10
+		| ToUnorm(surface.SpecularIntensity, 10) << 20
+		| ToUnorm(surface.Lit ? 1.0f : 0.0f, 2) << 30;
+
+	return packed;
+}
+
+GBufferEncoding::Surface GBufferEncoding::Unpack(const PackedSurface& packed)
+{
+	Surface surface;
+	surface.Albedo = XMFLOAT3(FromUnorm(packed.Albedo, 8), FromUnorm(packed.Albedo >> 8, 8), FromUnorm(packed.Albedo >> 16, 8));
+	surface.SpecularPower = DecodeSpecularPower(FromUnorm(packed.Albedo >> 24, 8));
+	surface.Normal = DecodeNormal(XMFLOAT2(FromUnorm(packed.Normal, 10), FromUnorm(packed.Normal >> 10, 10)));
+	surface.SpecularIntensity = FromUnorm(packed.Normal >> 20, 10);
+	surface.Lit = FromUnorm(packed.Normal >> 30, 2) >= 0.5f;
+	return surface;
+}
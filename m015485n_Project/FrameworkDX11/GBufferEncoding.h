@@ -0,0 +1,62 @@
+// How the deferred path packs a surface into the G-buffer, the same sums shader.fx does, for checking them on the CPU
+
+#pragma once
+
+#include <windows.h>
+#include <DirectXMath.h>
+#include <cstdint>
+
+using namespace DirectX;
+
+/// <summary>
+/// The deferred path keeps two 32 bit targets per pixel next to the depth buffer, position is worked back out from
+/// depth rather than stored:
+///
+///   Albedo	R8G8B8A8_UNORM		rgb diffuse colour (material diffuse times texture), a specular power
+///   Normal	R10G10B10A2_UNORM	rg world normal (octahedral), b specular intensity, a 1 if lit
+///
+/// Octahedral encoding folds the unit sphere onto a square, so a normal fits in two channels with close to even
+/// precision everywhere. Specular power is stored as log2(power) / SPECULAR_POWER_LOG2_RANGE so every step is the
+/// same fraction of the power, 1 to 1024 in 8 bits is under 1.4% per step.
+///
+/// Packing rounds to the nearest step the same way the GPU converts to UNORM.
+/// </summary>
+namespace GBufferEncoding
+{
+	constexpr float SPECULAR_POWER_LOG2_RANGE = 10.0f;
+
+	/// A surface as the G-buffer pass writes it.
+	struct Surface
+	{
+		XMFLOAT3	Albedo = XMFLOAT3(0.0f, 0.0f, 0.0f);
+		float		SpecularPower = 1.0f;
+		XMFLOAT3	Normal = XMFLOAT3(0.0f, 0.0f, 1.0f);
+		float		SpecularIntensity = 0.0f;
+		bool		Lit = true;
+	};
+
+	/// The bits of one pixel of each target.
+	struct PackedSurface
+	{
+		uint32_t	Albedo;
+		uint32_t	Normal;
+	};
+
+	/// @param normal Unit length.
+	/// @return 0-1 in both channels.
+	XMFLOAT2	EncodeNormal(const XMFLOAT3& normal);
+	XMFLOAT3	DecodeNormal(const XMFLOAT2& encoded);
+
+	/// @return 0-1, powers outside 1 to 2^SPECULAR_POWER_LOG2_RANGE are clamped.
+	float		EncodeSpecularPower(float power);
+	float		DecodeSpecularPower(float encoded);
+
+	PackedSurface	Pack(const Surface& surface);
+	Surface			Unpack(const PackedSurface& packed);
+
+	/// What the normal target is cleared to. Flagged unlit, so the lighting pass skips pixels nothing was drawn to.
+	constexpr float	CLEAR_NORMAL[4] = { 0.5f, 0.5f, 0.0f, 0.0f };
+
+	/// Bytes the G-buffer adds per pixel, on top of the colour and depth the forward path has anyway.
+	constexpr UINT	BYTES_PER_PIXEL = 8;
+}
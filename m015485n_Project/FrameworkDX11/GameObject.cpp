@@ -10,7 +10,7 @@ GameObject::GameObject(XMFLOAT3 Position, XMFLOAT3 Rotation, XMFLOAT3 Scale, str
 	SetRotate(Rotation);
 	SetScale(Scale);
 	m_orginalPosition = Position;
-	m_orginalRotation = Rotation;
+	m_orginalRotation = m_rotation;
 	m_orginalScale = Scale;
 	objectName = ObjectName;
 	m_pixelShader = pixelShader;
@@ -20,8 +20,6 @@ GameObject::GameObject(XMFLOAT3 Position, XMFLOAT3 Rotation, XMFLOAT3 Scale, str
 	m_originalMaterial = m_material;
 	m_meshData = meshData;
 	CreateSampler(m_pd3dDevice, m_pImmediateContext);
-
-	CreateMaterialBuffer(m_pd3dDevice, m_pImmediateContext);
 }
 
 GameObject::GameObject(XMFLOAT3 Position, XMFLOAT3 Rotation, XMFLOAT3 Scale, string ObjectName, MeshData meshData, ID3D11Device* m_pd3dDevice, ID3D11DeviceContext* m_pImmediateContext, Microsoft::WRL::ComPtr <ID3D11PixelShader> pixelShader, Microsoft::WRL::ComPtr < ID3D11ShaderResourceView> texture)
@@ -30,7 +28,7 @@ GameObject::GameObject(XMFLOAT3 Position, XMFLOAT3 Rotation, XMFLOAT3 Scale, str
 	SetRotate(Rotation);
 	SetScale(Scale);
 	m_orginalPosition = Position;
-	m_orginalRotation = Rotation;
+	m_orginalRotation = m_rotation;
 	m_orginalScale = Scale;
 	objectName = ObjectName;
 	m_pixelShader = pixelShader;
@@ -43,8 +41,6 @@ GameObject::GameObject(XMFLOAT3 Position, XMFLOAT3 Rotation, XMFLOAT3 Scale, str
 	m_meshData = meshData;
 
 	CreateSampler(m_pd3dDevice, m_pImmediateContext);
-
-	CreateMaterialBuffer(m_pd3dDevice, m_pImmediateContext);
 }
 
 GameObject::GameObject(XMFLOAT3 Position, XMFLOAT3 Rotation, XMFLOAT3 Scale, string ObjectName, MeshData meshData, ID3D11Device* m_pd3dDevice, ID3D11DeviceContext* m_pImmediateContext, Microsoft::WRL::ComPtr <ID3D11PixelShader> pixelShader, Microsoft::WRL::ComPtr < ID3D11ShaderResourceView> texture, Microsoft::WRL::ComPtr < ID3D11ShaderResourceView> normalMap)
@@ -53,7 +49,7 @@ GameObject::GameObject(XMFLOAT3 Position, XMFLOAT3 Rotation, XMFLOAT3 Scale, str
 	SetRotate(Rotation);
 	SetScale(Scale);
 	m_orginalPosition = Position;
-	m_orginalRotation = Rotation;
+	m_orginalRotation = m_rotation;
 	m_orginalScale = Scale;
 	objectName = ObjectName;
 	m_pixelShader = pixelShader;
@@ -68,8 +64,6 @@ GameObject::GameObject(XMFLOAT3 Position, XMFLOAT3 Rotation, XMFLOAT3 Scale, str
 	m_meshData = meshData;
 
 	CreateSampler(m_pd3dDevice, m_pImmediateContext);
-
-	CreateMaterialBuffer(m_pd3dDevice, m_pImmediateContext);
 }
 
 GameObject::~GameObject()
@@ -77,6 +71,9 @@ GameObject::~GameObject()
 
 void GameObject::CreateSampler(ID3D11Device* m_pd3dDevice, ID3D11DeviceContext* m_pImmediateContext)
 {
+	// No device when running headless (the benchmarks), the object just won't be drawable
+	if (m_pd3dDevice == nullptr) return;
+
 	D3D11_SAMPLER_DESC sampDesc;
 	ZeroMemory(&sampDesc, sizeof(sampDesc));
 	sampDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_POINT;
@@ -86,31 +83,7 @@ void GameObject::CreateSampler(ID3D11Device* m_pd3dDevice, ID3D11DeviceContext*
 	sampDesc.ComparisonFunc = D3D11_COMPARISON_NEVER;
 	sampDesc.MinLOD = 0;
 	sampDesc.MaxLOD = D3D11_FLOAT32_MAX;
-	HRESULT hr = m_pd3dDevice->CreateSamplerState(&sampDesc, &m_textureSampler);
-	if (FAILED(hr))
-	{
-		MessageBox(nullptr,
-			L"Failed to init sampler in game object.", L"Error", MB_OK);
-	}
-}
-
-void GameObject::CreateMaterialBuffer(ID3D11Device* m_pd3dDevice, ID3D11DeviceContext* m_pImmediateContext)
-{
-	D3D11_BUFFER_DESC bd = {};
-
-	// Create the material constant buffer
-	bd.Usage = D3D11_USAGE_DEFAULT;
-	bd.ByteWidth = sizeof(MaterialPropertiesConstantBuffer);
-	bd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
-	bd.CPUAccessFlags = 0;
-
-	Microsoft::WRL::ComPtr <ID3D11Buffer>* buf_out = &m_materialConstantBuffer;
-	HRESULT hr = m_pd3dDevice->CreateBuffer(&bd, nullptr, buf_out->GetAddressOf());
-	if (FAILED(hr))
-	{
-		MessageBox(nullptr,
-			L"Failed to init Material Buffer in game object.", L"Error", MB_OK);
-	}
 
-	m_pImmediateContext->UpdateSubresource(m_materialConstantBuffer.Get(), 0, nullptr, &m_material, 0, 0);
+	// Every object asks for the same sampler, the cache makes sure only one gets created
+	m_pipelineStates.Sampler = PipelineStateCache::Get().GetSamplerId(sampDesc);
 }
\ No newline at end of file
@@ -35,12 +35,10 @@ public:
 
 	~GameObject();
 
-	string GetObjectName() { return objectName; }
+	const string& GetObjectName() const { return objectName; }
 
 	void CreateSampler(ID3D11Device* m_pd3dDevice, ID3D11DeviceContext* m_pImmediateContext);
 
-	void CreateMaterialBuffer(ID3D11Device* m_pd3dDevice, ID3D11DeviceContext* m_pImmediateContext);
-
 private: // variables
 
 	string objectName = "null";
@@ -1,4 +1,5 @@
 #include "IRenderable.h"
+#include "ShaderPermutations.h"
 
 IRenderable::IRenderable()
 {
@@ -6,7 +7,6 @@ IRenderable::IRenderable()
 	m_meshData.IndexBuffer = nullptr;
 
 	m_textureResourceView = nullptr;
-	m_textureSampler = nullptr;
 
 	// Initialize the world matrix
 	XMStoreFloat4x4(&m_world, XMMatrixIdentity());
@@ -17,93 +17,106 @@ IRenderable::~IRenderable()
 	Cleanup();
 }
 
-void IRenderable::Update(const float deltaTime, ID3D11DeviceContext* pContext)
+void IRenderable::Update(const float deltaTime)
 {
-	// Don't overflow the rotation
-	if (m_rotation.x > 360.0f) m_rotation.x = 0.0f;
-
-	if (m_rotation.x < -360.0f) m_rotation.x = 0.0f;
-
-	if (m_rotation.y > 360.0f) m_rotation.y = 0.0f;
-
-	if (m_rotation.y < -360.0f) m_rotation.y = 0.0f;
-
-	if (m_rotation.z > 360.0f) m_rotation.z = 0.0f;
-
-	if (m_rotation.z < -360.0f) m_rotation.z = 0.0f;
-
-	if (m_autoRotateX)
+	if (m_autoRotateX || m_autoRotateY || m_autoRotateZ)
 	{
-		m_rotation.x += m_autoRotationSpeed * deltaTime;
+		float step = XMConvertToRadians(m_autoRotationSpeed * deltaTime);
+		XMVECTOR rotation = XMLoadFloat4(&m_rotation);
+
+		// Spin about the object's own axes. This deliberately isn't what bumping the Euler angles used to do: X is
+		// applied first in RotX * RotY * RotZ so only it matched, with other angles set a Y or Z bump turned about
+		// a different axis
+		if (m_autoRotateZ) rotation = XMQuaternionMultiply(XMQuaternionRotationAxis(XMVectorSet(0, 0, 1, 0), step), rotation);
+		if (m_autoRotateY) rotation = XMQuaternionMultiply(XMQuaternionRotationAxis(XMVectorSet(0, 1, 0, 0), step), rotation);
+		if (m_autoRotateX) rotation = XMQuaternionMultiply(XMQuaternionRotationAxis(XMVectorSet(1, 0, 0, 0), step), rotation);
+
+		// Renormalise so the rounding from spinning every frame doesn't build up
+		XMStoreFloat4(&m_rotation, XMQuaternionNormalize(rotation));
 	}
 
-	if (m_autoRotateY)
-	{
-		m_rotation.y += m_autoRotationSpeed * deltaTime;
-	}
-
-	if (m_autoRotateZ)
-	{
-		m_rotation.z += m_autoRotationSpeed * deltaTime;
-	}
-
-	XMMATRIX translate = XMMatrixTranslation(m_position.x, m_position.y, m_position.z);
-	XMMATRIX scale = XMMatrixScaling(m_scale.x, m_scale.y, m_scale.z);
-	XMMATRIX rotation = XMMatrixRotationX(XMConvertToRadians(m_rotation.x)) * XMMatrixRotationY(XMConvertToRadians(m_rotation.y)) * XMMatrixRotationZ(XMConvertToRadians(m_rotation.z));
-	XMMATRIX world = scale * rotation * translate;
+	XMMATRIX world = XMMatrixAffineTransformation(XMLoadFloat3(&m_scale), XMVectorZero(), XMLoadFloat4(&m_rotation), XMLoadFloat3(&m_position));
 	XMStoreFloat4x4(&m_world, world);
+
+	// Box around the transformed mesh box, the centre goes through the matrix and the extents through its absolute value
+	const BoundingBox& localBounds = m_meshData.Bounds;
+	XMVECTOR center = XMVector3Transform(XMLoadFloat3(&localBounds.Center), world);
+	XMVECTOR extents = XMVectorMultiplyAdd(XMVectorAbs(world.r[0]), XMVectorReplicate(localBounds.Extents.x),
+		XMVectorMultiplyAdd(XMVectorAbs(world.r[1]), XMVectorReplicate(localBounds.Extents.y),
+			XMVectorMultiply(XMVectorAbs(world.r[2]), XMVectorReplicate(localBounds.Extents.z))));
+	XMStoreFloat3(&m_worldBounds.Center, center);
+	XMStoreFloat3(&m_worldBounds.Extents, extents);
 }
 
-void IRenderable::Draw(ID3D11DeviceContext* pContext, Camera* camera, ID3D11Buffer* m_pConstantBuffer)
+void IRenderable::BuildRenderItem(RenderItem& item)
 {
-	pContext->PSSetShader(m_pixelShader.Get(), nullptr, 0);
+	item.World = m_world;
+	item.MaterialIndex = m_materialIndex;
 
-	ConstantBuffer cb;
-	cb.mView = XMMatrixTranspose(camera->GetViewMatrix());
-	cb.mProjection = XMMatrixTranspose(camera->GetProjectionMatrix());
-	cb.vOutputColor = XMFLOAT4(0, 0, 0, 0);
+	// Looked up again only when the shader or the material's features change
+	const UINT features = ShaderPermutations::GetFeatures(m_material.Material);
+	if (m_variantSource != m_pixelShader.Get() || m_variantFeatures != features || m_pixelShaderVariant == nullptr)
+	{
+		m_variantSource = m_pixelShader.Get();
+		m_variantFeatures = features;
+		m_pixelShaderVariant = ShaderPermutations::Get().Select(m_variantSource, features);
+	}
+	item.PixelShader = m_pixelShaderVariant;
+	item.Texture = m_textureResourceView.Get();
+	item.NormalMap = m_normalMapResourceView.Get();
+	item.States = m_pipelineStates;
+
+	item.VertexBuffer = m_meshData.VertexBuffer.Get();
+	item.IndexBuffer = m_meshData.IndexBuffer.Get();
+	item.VBStride = m_meshData.VBStride;
+	item.VBOffset = m_meshData.VBOffset;
+	item.VertexCount = m_meshData.VertexCount;
+}
 
-	// store world and the view / projection in a constant buffer for the vertex shader to use
-	cb.mWorld = XMMatrixTranspose(XMLoadFloat4x4(GetTransform()));
-	pContext->UpdateSubresource(m_pConstantBuffer, 0, nullptr, &cb, 0, 0);
+void IRenderable::SyncMaterial(MaterialTable& table)
+{
+	if (!m_materialDirty && m_materialIndex != MaterialTable::INVALID_INDEX) return;
 
-	// Render a cube
-	pContext->VSSetConstantBuffers(0, 1, &m_pConstantBuffer);
+	m_materialIndex = table.Change(m_materialIndex, m_material.Material);
+	m_materialDirty = false;
+}
 
-	ID3D11Buffer* materialCB = GetMaterialConstantBuffer();
-	pContext->PSSetConstantBuffers(1, 1, &materialCB);
+void IRenderable::Draw(StateTrackingContext& context, const RenderItem& item, ID3D11PixelShader* pixelShader)
+{
+	Bind(context, item, pixelShader);
+	context.Get()->DrawIndexed(item.VertexCount, 0, 0);
+}
 
-	// Set vertex buffer
-	ID3D11Buffer* vbuf = m_meshData.VertexBuffer.Get();
-	pContext->IASetVertexBuffers(0, 1, &vbuf, &m_meshData.VBStride, &m_meshData.VBOffset);
+void IRenderable::FillObjectConstants(const RenderItem& item, ObjectConstantBuffer& constants)
+{
+	// The view and projection are in the frame constants, only the world matrix is the object's own
+	constants.mWorld = XMMatrixTranspose(XMLoadFloat4x4(&item.World));
 
-	// Set index buffer
-	pContext->IASetIndexBuffer(m_meshData.IndexBuffer.Get(), DXGI_FORMAT_R16_UINT, 0);
+	// The pixel shader looks the material up in the scene's material buffer
+	constants.MaterialIndex = item.MaterialIndex;
+	constants.Padding[0] = constants.Padding[1] = constants.Padding[2] = 0;
+}
 
-	// Set primitive topology
-	pContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+void IRenderable::DrawInstanced(StateTrackingContext& context, const RenderItem& item, UINT first, UINT count, ID3D11PixelShader* pixelShader)
+{
+	Bind(context, item, pixelShader);
+	context.Get()->DrawIndexedInstanced(item.VertexCount, count, 0, 0, first);
+}
 
-	// Set the texture and sampler
-	//if (m_textureResourceView != nullptr)
+void IRenderable::Bind(StateTrackingContext& context, const RenderItem& item, ID3D11PixelShader* pixelShader)
+{
+	// Every call goes through the context's filter, consecutive objects sharing a shader, mesh or texture only set it once
+	context.PSSetShader(pixelShader != nullptr ? pixelShader : item.PixelShader);
 
-	{
-		ID3D11ShaderResourceView* srv = m_textureResourceView.Get();
-		pContext->PSSetShaderResources(0, 1, &srv);
-		//if (m_normalMapResourceView != nullptr)
-		{
-			ID3D11ShaderResourceView* nrv = m_normalMapResourceView.Get();
-			pContext->PSSetShaderResources(1, 1, &nrv);
-		}
-
-		ID3D11SamplerState* ss = m_textureSampler.Get();
-		pContext->PSSetSamplers(0, 1, &ss);
-	}
+	context.IASetVertexBuffer(0, item.VertexBuffer, item.VBStride, item.VBOffset);
+	context.IASetIndexBuffer(item.IndexBuffer, DXGI_FORMAT_R16_UINT, 0);
+	context.IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 
-	// draw
-	pContext->DrawIndexed(m_meshData.VertexCount, 0, 0);
+	// Left bound after the draw, the render graph unbinds its textures before anything draws to them
+	context.PSSetShaderResource(0, item.Texture);
+	context.PSSetShaderResource(1, item.NormalMap);
 
-	ID3D11ShaderResourceView* nullSRVs[2] = { nullptr, nullptr };
-	pContext->PSSetShaderResources(0, 2, nullSRVs);
+	PipelineStateCache::Get().Bind(context, item.States);
 }
 
 void IRenderable::Cleanup()
@@ -115,38 +128,48 @@ void IRenderable::SetTransform(XMMATRIX newTransform)
 {
 	XMVECTOR scaleVector, rotationQuatVector, translationVector;
 
-	// This gives the rotation as a quaternion, so I needed to convert it to Euler angles
+	// The gizmo hands back a full matrix, the rotation part goes straight in as a quaternion
 	XMMatrixDecompose(&scaleVector, &rotationQuatVector, &translationVector, newTransform);
 
-	XMFLOAT3 scale;
-	XMFLOAT3 translation;
-	XMFLOAT4 rotQuat;
-	XMStoreFloat3(&scale, scaleVector);
-	XMStoreFloat3(&translation, translationVector);
-	XMStoreFloat4(&rotQuat, rotationQuatVector);
-
-	float ysqr = rotQuat.y * rotQuat.y;
-
-	// Roll x-axis
-	float t0 = +2.0f * (rotQuat.w * rotQuat.x + rotQuat.y * rotQuat.z);
-	float t1 = +1.0f - 2.0f * (rotQuat.x * rotQuat.x + ysqr);
-	float roll = atan2f(t0, t1);
-
-	// Pitch y-axis
-	float t2 = +2.0f * (rotQuat.w * rotQuat.y - rotQuat.z * rotQuat.x);
-	t2 = t2 > 1.0f ? 1.0f : t2;
-	t2 = t2 < -1.0f ? -1.0f : t2;
-	float pitch = asinf(t2);
-
-	// Yaw z-axis
-	float t3 = +2.0f * (rotQuat.w * rotQuat.z + rotQuat.x * rotQuat.y);
-	float t4 = +1.0f - 2.0f * (ysqr + rotQuat.z * rotQuat.z);
-	float yaw = atan2f(t3, t4);
-
-	XMFLOAT3 rotationF(XMConvertToDegrees(roll), XMConvertToDegrees(pitch), XMConvertToDegrees(yaw));
-
-	// Set components
-	SetScale(scale);
-	SetRotate(rotationF);
-	SetPosition(translation);
-}
\ No newline at end of file
+	XMStoreFloat3(&m_scale, scaleVector);
+	XMStoreFloat4(&m_rotation, XMQuaternionNormalize(rotationQuatVector));
+	XMStoreFloat3(&m_position, translationVector);
+}
+
+XMFLOAT4 IRenderable::EulerDegreesToQuaternion(const XMFLOAT3& eulerDegrees)
+{
+	// X then Y then Z, the order the Euler angles were always applied in
+	XMVECTOR x = XMQuaternionRotationAxis(XMVectorSet(1, 0, 0, 0), XMConvertToRadians(eulerDegrees.x));
+	XMVECTOR y = XMQuaternionRotationAxis(XMVectorSet(0, 1, 0, 0), XMConvertToRadians(eulerDegrees.y));
+	XMVECTOR z = XMQuaternionRotationAxis(XMVectorSet(0, 0, 1, 0), XMConvertToRadians(eulerDegrees.z));
+
+	XMFLOAT4 quaternion;
+	XMStoreFloat4(&quaternion, XMQuaternionMultiply(XMQuaternionMultiply(x, y), z));
+	return quaternion;
+}
+
+XMFLOAT3 IRenderable::QuaternionToEulerDegrees(const XMFLOAT4& quaternion)
+{
+	XMFLOAT4X4 m;
+	XMStoreFloat4x4(&m, XMMatrixRotationQuaternion(XMLoadFloat4(&quaternion)));
+
+	// For Rx * Ry * Rz, _13 is -sin(y). Near +-90 degrees on Y, X and Z spin about the same axis so put it all in X
+	float sinY = -m._13;
+	sinY = sinY > 1.0f ? 1.0f : sinY;
+	sinY = sinY < -1.0f ? -1.0f : sinY;
+
+	float x, y, z;
+	y = asinf(sinY);
+	if (fabsf(sinY) < 0.9999f)
+	{
+		x = atan2f(m._23, m._33);
+		z = atan2f(m._12, m._11);
+	}
+	else
+	{
+		x = atan2f(-m._32, m._22);
+		z = 0.0f;
+	}
+
+	return XMFLOAT3(XMConvertToDegrees(x), XMConvertToDegrees(y), XMConvertToDegrees(z));
+}
@@ -19,8 +19,11 @@
 #include <DirectXMath.h>
 #include "wrl.h"
 #include "structures.h"
+#include <cstring>
 #include <utility>
 #include "Camera.h"
+#include "RenderSnapshot.h"
+#include "StateTrackingContext.h"
 
 using namespace DirectX;
 
@@ -30,10 +33,23 @@ public:
 	IRenderable();
 	virtual ~IRenderable();
 
-	virtual void	Update(const float deltaTime, ID3D11DeviceContext* pContext);
-	virtual void	Draw(ID3D11DeviceContext* pContext, Camera* camera, ID3D11Buffer* m_pConstantBuffer);
+	// Update and BuildRenderItem are pure CPU work and may run off the render thread
+	virtual void	Update(const float deltaTime);
+	virtual void	BuildRenderItem(RenderItem& item);
 	virtual void	Cleanup();
 
+	// Draws a snapshot of an object, the object itself may already be on its next frame. Its constants, filled in by
+	// FillObjectConstants, have to be bound already. pixelShader replaces the item's own when set
+	static void		Draw(StateTrackingContext& context, const RenderItem& item, ID3D11PixelShader* pixelShader = nullptr);
+	static void		FillObjectConstants(const RenderItem& item, ObjectConstantBuffer& constants);
+
+	// Draws count copies of an item's mesh, the world matrices and materials come from rows first onwards of the
+	// instance buffer in vertex slot 1. The view and projection have to be in the constant buffer already
+	static void		DrawInstanced(StateTrackingContext& context, const RenderItem& item, UINT first, UINT count, ID3D11PixelShader* pixelShader = nullptr);
+
+	// Everything Draw binds for an item, split out so the binds can be counted without a device
+	static void		Bind(StateTrackingContext& context, const RenderItem& item, ID3D11PixelShader* pixelShader = nullptr);
+
 	const ID3D11Buffer* GetVertexBuffer() const { return m_meshData.VertexBuffer.Get(); }
 	const ID3D11Buffer* GetIndexBuffer() const { return m_meshData.IndexBuffer.Get(); }
 	const ID3D11ShaderResourceView* GetTextureResourceView() const { return m_textureResourceView.Get(); }
@@ -43,29 +59,56 @@ public:
 	void SetNormalMapResourceView(Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> normalMapResourceView) { m_normalMapResourceView = normalMapResourceView; }
 	void SetNormalMapResourceView(std::nullptr_t) { m_normalMapResourceView.Reset(); }
 	const XMFLOAT4X4* GetTransform() const { return &m_world; }
+	const BoundingBox& GetWorldBounds() const { return m_worldBounds; }
 	void SetTransform(XMMATRIX newTransform);
 
-	const ID3D11SamplerState* GetTextureSamplerState() const { return m_textureSampler.Get(); }
-	ID3D11Buffer* GetMaterialConstantBuffer() const { return m_materialConstantBuffer.Get(); }
+	const PipelineStateIds& GetPipelineStates() const { return m_pipelineStates; }
 	MaterialPropertiesConstantBuffer GetMaterialConstantBufferData() const { return m_material; }
 	MaterialPropertiesConstantBuffer GetOriginalMaterialConstantBufferData() const { return m_originalMaterial; }
-	void UpdateMaterialConstantBuffer(const MaterialPropertiesConstantBuffer& newMaterialBuffer, ID3D11DeviceContext* pContext)
+	void SetOriginalMaterial(const MaterialPropertiesConstantBuffer& originalMaterial) { m_originalMaterial = originalMaterial; }
+	void UpdateMaterialConstantBuffer(const MaterialPropertiesConstantBuffer& newMaterialBuffer)
 	{
+		// The material window calls this every frame, only an actual change needs the table touching
+		if (memcmp(&m_material, &newMaterialBuffer, sizeof(MaterialPropertiesConstantBuffer)) == 0) return;
+
 		m_material = newMaterialBuffer;
-		pContext->UpdateSubresource(m_materialConstantBuffer.Get(), 0, nullptr, &m_material, 0, 0);
+		m_materialDirty = true;
 	}
 
+	/// Points the object at the table entry for its material, picking up any edits since the last call.
+	void SyncMaterial(MaterialTable& table);
+	UINT GetMaterialIndex() const { return m_materialIndex; }
+
 	void	SetPosition(const XMFLOAT3 position) { m_position = position; }
 	void	SetScale(const XMFLOAT3 scale) { m_scale = scale; }
-	void	SetRotate(const XMFLOAT3 rotation) { m_rotation = rotation; }
+
+	// Rotation is stored as a quaternion, the Euler versions (degrees, applied X then Y then Z) are only for the UI
+	void	SetRotate(const XMFLOAT3 rotation) { m_rotation = EulerDegreesToQuaternion(rotation); }
+	void	SetRotationQuaternion(const XMFLOAT4 rotation) { m_rotation = rotation; }
 
 	XMFLOAT3	GetPosition() { return m_position; }
 	XMFLOAT3	GetScale() { return m_scale; }
-	XMFLOAT3	GetRotation() { return { m_rotation }; }
+	XMFLOAT3	GetRotation() const { return QuaternionToEulerDegrees(m_rotation); }
+	XMFLOAT4	GetRotationQuaternion() const { return m_rotation; }
+
+	static XMFLOAT4	EulerDegreesToQuaternion(const XMFLOAT3& eulerDegrees);
+	static XMFLOAT3	QuaternionToEulerDegrees(const XMFLOAT4& quaternion);
+
 	void SetPixelShader(Microsoft::WRL::ComPtr <ID3D11PixelShader> pixelShader) { m_pixelShader = pixelShader; }
 
 	Microsoft::WRL::ComPtr <ID3D11PixelShader> GetPixelShader() { return m_pixelShader; }
-	void	ResetTransform() { SetPosition(m_orginalPosition); SetScale(m_orginalScale); SetRotate(m_orginalRotation); }
+	void	ResetTransform() { SetPosition(m_orginalPosition); SetScale(m_orginalScale); SetRotationQuaternion(m_orginalRotation); }
+
+	// The transform ResetTransform goes back to, saved with the scene
+	XMFLOAT3	GetOriginalPosition() const { return m_orginalPosition; }
+	XMFLOAT4	GetOriginalRotationQuaternion() const { return m_orginalRotation; }
+	XMFLOAT3	GetOriginalScale() const { return m_orginalScale; }
+	void		SetOriginalTransform(const XMFLOAT3 position, const XMFLOAT4 rotation, const XMFLOAT3 scale)
+	{
+		m_orginalPosition = position;
+		m_orginalRotation = rotation;
+		m_orginalScale = scale;
+	}
 
 	bool m_autoRotateX = false;
 	bool m_autoRotateY = false;
@@ -73,26 +116,36 @@ public:
 
 	bool renderTexture = false;
 
+	// Rasterized into the occlusion buffer to hide whatever is behind it
+	bool m_occluder = false;
+
 	float m_autoRotationSpeed = 50.0f;
 	MeshData m_meshData;
 protected:
 
 	XMFLOAT4X4													m_world;
+	BoundingBox													m_worldBounds;
 	MaterialPropertiesConstantBuffer							m_material;
 	MaterialPropertiesConstantBuffer							m_originalMaterial;
 
 	Microsoft::WRL::ComPtr < ID3D11ShaderResourceView>			m_textureResourceView = nullptr;
 	Microsoft::WRL::ComPtr < ID3D11ShaderResourceView>			m_normalMapResourceView = nullptr;
 
-	Microsoft::WRL::ComPtr < ID3D11SamplerState>				m_textureSampler = nullptr;
+	PipelineStateIds											m_pipelineStates;
 
-	Microsoft::WRL::ComPtr < ID3D11Buffer>						m_materialConstantBuffer = nullptr;
+	UINT														m_materialIndex = MaterialTable::INVALID_INDEX;
+	bool														m_materialDirty = false;
 	XMFLOAT3													m_position;
 	XMFLOAT3													m_orginalPosition;
 	XMFLOAT3													m_scale = XMFLOAT3(1, 1, 1);
 	XMFLOAT3													m_orginalScale = XMFLOAT3(1, 1, 1);
-	XMFLOAT3													m_rotation;
-	XMFLOAT3													m_orginalRotation;
+	XMFLOAT4													m_rotation = XMFLOAT4(0, 0, 0, 1);
+	XMFLOAT4													m_orginalRotation = XMFLOAT4(0, 0, 0, 1);
 
 	Microsoft::WRL::ComPtr <ID3D11PixelShader> m_pixelShader = nullptr;
+
+	// The variant of m_pixelShader the material's features need, owned by ShaderPermutations
+	ID3D11PixelShader*											m_variantSource = nullptr;
+	UINT														m_variantFeatures = 0;
+	ID3D11PixelShader*											m_pixelShaderVariant = nullptr;
 };
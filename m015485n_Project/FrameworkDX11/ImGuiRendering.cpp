@@ -1,6 +1,14 @@
 ﻿#include "ImGuiRendering.h"
-
-ImGuiRendering::ImGuiRendering(HWND hwnd, ID3D11Device* m_pd3dDevice, ID3D11DeviceContext* m_pImmediateContext)
+#include "FramePipeline.h"
+#include "FrameArena.h"
+#include "AllocationCounter.h"
+#include "PipelineStateCache.h"
+#include "ShaderPermutations.h"
+#include "RenderGraph.h"
+
+ImGuiRendering::ImGuiRendering(HWND hwnd, ID3D11Device* device, ID3D11DeviceContext* context)
+	: m_pd3dDevice(device)
+	, m_pImmediateContext(context)
 {
 	// Setup Dear ImGui context
 	IMGUI_CHECKVERSION();
@@ -12,7 +20,7 @@ ImGuiRendering::ImGuiRendering(HWND hwnd, ID3D11Device* m_pd3dDevice, ID3D11Devi
 
 	// Setup Platform/Renderer backends
 	ImGui_ImplWin32_Init(hwnd);
-	ImGui_ImplDX11_Init(m_pd3dDevice, m_pImmediateContext);
+	ImGui_ImplDX11_Init(device, context);
 
 	io.IniFilename = nullptr;
 }
@@ -24,9 +32,10 @@ void ImGuiRendering::ShutDownImGui()
 	ImGui::DestroyContext();
 }
 
-void ImGuiRendering::ImGuiDrawAllWindows(const unsigned int FPS, float totalAppTime, Scene* currentScene, ID3D11DeviceContext* pContext)
+void ImGuiRendering::ImGuiDrawAllWindows(const unsigned int FPS, float totalAppTime, Scene* currentScene, FramePipeline* framePipeline, const RenderGraph* renderGraph, const StateTrackingContext* stateContext)
 {
 	m_currentScene = currentScene;
+	ResolveSelection();
 
 	StartIMGUIDraw();
 
@@ -38,14 +47,16 @@ void ImGuiRendering::ImGuiDrawAllWindows(const unsigned int FPS, float totalAppT
 		DrawSelectLightWindow();
 		DrawLightUpdateWindow();
 		DrawObjectSelectionWindow();
-		DrawUpdateObjectMaterialBufferWindow(pContext);
+		DrawUpdateObjectMaterialBufferWindow();
 		DrawObjectMovementWindow();
 		DrawPixelShaderSelectionWindow();
-		DrawTextureSelectionWindow(pContext);
-		DrawNormalMapSelectionWindow(pContext);
+		DrawTextureSelectionWindow();
+		DrawNormalMapSelectionWindow();
 		DrawCameraStatsWindow();
 		DrawMeshSelectionWindow();
 		if (showCameraSplineWindow)DrawCameraSplineWindow();
+		DrawFramePipelineWindow(framePipeline, renderGraph, stateContext);
+		if (showOcclusionBuffer) DrawOcclusionBufferWindow();
 
 		DrawObjectGimzo();
 	}
@@ -53,6 +64,25 @@ void ImGuiRendering::ImGuiDrawAllWindows(const unsigned int FPS, float totalAppT
 	CompleteIMGUIDraw();
 }
 
+void ImGuiRendering::SelectObject(GameObjectHandle handle)
+{
+	// Looked up again by ResolveSelection when the windows are next drawn
+	m_selectedObjectHandle = handle;
+	m_selectedObject = nullptr;
+	lightIndex = -1;
+	m_selectedLight = nullptr;
+}
+
+void ImGuiRendering::ResolveSelection()
+{
+	m_selectedObject = m_currentScene->GetGameObject(m_selectedObjectHandle);
+	if (m_selectedObject == nullptr) m_selectedObjectHandle = GameObjectHandle();
+
+	auto& lights = m_currentScene->GetLights();
+	if (lightIndex >= static_cast<int>(lights.size())) lightIndex = -1;
+	m_selectedLight = lightIndex >= 0 ? &lights[lightIndex] : nullptr;
+}
+
 void ImGuiRendering::DrawVersionWindow(const unsigned int FPS, float totalAppTime)
 {
 	ImGui::SetNextWindowPos(ImVec2(10, 10), ImGuiCond_FirstUseEver);
@@ -61,6 +91,17 @@ void ImGuiRendering::DrawVersionWindow(const unsigned int FPS, float totalAppTim
 	ImGui::Text("Application Runtime (%f)", totalAppTime);
 	ImGui::Text("FPS %d", FPS);
 	ImGui::Checkbox("VSync Enabled", &VSyncEnabled);
+
+	ImGui::Separator();
+	if (ImGui::Button("Save Scene")) m_currentScene->SaveToFile(Scene::DEFAULT_SCENE_FILE);
+	ImGui::SameLine();
+	if (ImGui::Button("Load Scene") && m_currentScene->LoadFromFile(Scene::DEFAULT_SCENE_FILE))
+	{
+		// Every object and light was replaced, and Clear starts the pool's handles over, so drop the selection
+		m_selectedObjectHandle = GameObjectHandle();
+		lightIndex = -1;
+		ResolveSelection();
+	}
 	ImGui::End();
 }
 
@@ -74,6 +115,9 @@ void ImGuiRendering::DrawHideAllWindows()
 
 void ImGuiRendering::DrawSelectLightWindow()
 {
+	// Labels only have to live until ImGui has hashed them, so they come from the frame arena
+	FrameArena& arena = FrameArena::ThreadArena();
+
 	ImGui::SetNextWindowPos(ImVec2(250, 10), ImGuiCond_FirstUseEver);
 	ImGui::Begin("Light Selection", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
 
@@ -81,7 +125,9 @@ void ImGuiRendering::DrawSelectLightWindow()
 	if (ImGui::Button("Add Light"))
 	{
 		m_currentScene->AddLight();
-		m_selectedLight = nullptr;
+
+		// Adding a light can move the whole array
+		ResolveSelection();
 	}
 
 	ImGui::Separator();
@@ -90,20 +136,21 @@ void ImGuiRendering::DrawSelectLightWindow()
 
 	for (unsigned int i = 0; i < lights.size(); ++i)
 	{
-		Light* light = &lights[i];
-		bool isSelected = (m_selectedLight == light);
+		bool isSelected = (lightIndex == static_cast<int>(i));
 
-		if (ImGui::Selectable(("Light " + std::to_string(i)).c_str(), isSelected))
+		if (ImGui::Selectable(arena.Format("Light %u", i), isSelected))
 		{
 			if (isSelected)
 			{
+				lightIndex = -1;
 				m_selectedLight = nullptr;
 			}
 			else
 			{
-				m_selectedLight = light;
+				lightIndex = static_cast<int>(i);
+				m_selectedLight = &lights[i];
+				m_selectedObjectHandle = GameObjectHandle();
 				m_selectedObject = nullptr;
-				lightIndex = i;
 			}
 		}
 	}
@@ -113,6 +160,8 @@ void ImGuiRendering::DrawSelectLightWindow()
 
 void ImGuiRendering::DrawLightUpdateWindow()
 {
+	FrameArena& arena = FrameArena::ThreadArena();
+
 	if (m_selectedLight != nullptr)
 	{
 		ImGui::SetNextWindowPos(ImVec2(10, 200), ImGuiCond_FirstUseEver);
@@ -121,7 +170,7 @@ void ImGuiRendering::DrawLightUpdateWindow()
 
 		bool lightEnabled = m_selectedLight->Enabled;
 		ImGui::Text("Light %d", lightIndex);
-		string lightTypeString;
+		const char* lightTypeString;
 
 		switch (m_selectedLight->LightType)
 		{
@@ -137,17 +186,17 @@ void ImGuiRendering::DrawLightUpdateWindow()
 		default:
 			lightTypeString = "Unknown Light Type";
 		}
-		if (ImGui::Checkbox(("Light " + std::to_string(lightIndex) + " Enable").c_str(), &lightEnabled))
+		if (ImGui::Checkbox(arena.Format("Light %d Enable", lightIndex), &lightEnabled))
 		{
 			lightEnabled ? m_selectedLight->Enabled = 1 : m_selectedLight->Enabled = 0;
 		}
 
-		ImGui::SliderInt(("Light Type: " + lightTypeString).c_str(), &m_selectedLight->LightType, 0, 2);
+		ImGui::SliderInt(arena.Format("Light Type: %s", lightTypeString), &m_selectedLight->LightType, 0, 2);
 
 		if (m_selectedLight->LightType != PointLight)
 		{
 			float lightDirection[3] = { m_selectedLight->Direction.x, m_selectedLight->Direction.y, m_selectedLight->Direction.z };
-			if (ImGui::DragFloat3(("Light " + std::to_string(lightIndex) + " Direction").c_str(), lightDirection, 0.05f, -1.0f, 1.0f))
+			if (ImGui::DragFloat3(arena.Format("Light %d Direction", lightIndex), lightDirection, 0.05f, -1.0f, 1.0f))
 			{
 				m_selectedLight->Direction = XMFLOAT4(lightDirection[0], lightDirection[1], lightDirection[2], 0);
 			}
@@ -156,7 +205,7 @@ void ImGuiRendering::DrawLightUpdateWindow()
 		{
 			float spotAngleDeg = XMConvertToDegrees(m_selectedLight->SpotAngle);
 
-			if (ImGui::SliderFloat(("Light " + std::to_string(lightIndex) + " Spot Angle").c_str(), &spotAngleDeg, 0.0f, 90.0f))
+			if (ImGui::SliderFloat(arena.Format("Light %d Spot Angle", lightIndex), &spotAngleDeg, 0.0f, 90.0f))
 			{
 				m_selectedLight->SpotAngle = XMConvertToRadians(spotAngleDeg);
 			}
@@ -165,30 +214,30 @@ void ImGuiRendering::DrawLightUpdateWindow()
 		if (m_selectedLight->LightType != DirectionalLight)
 		{
 			float lightPosition[3] = { m_selectedLight->Position.x, m_selectedLight->Position.y, m_selectedLight->Position.z };
-			if (ImGui::DragFloat3(("Light " + std::to_string(lightIndex) + " Position").c_str(), lightPosition, 0.1f))
+			if (ImGui::DragFloat3(arena.Format("Light %d Position", lightIndex), lightPosition, 0.1f))
 			{
 				m_selectedLight->Position = XMFLOAT4(lightPosition[0], lightPosition[1], lightPosition[2], 1);
 			}
 
 			float constantAttenuation = m_selectedLight->ConstantAttenuation;
-			if (ImGui::SliderFloat(("Light " + std::to_string(lightIndex) + " Constant Attenuation").c_str(), &constantAttenuation, 0.1f, 1.0f))
+			if (ImGui::SliderFloat(arena.Format("Light %d Constant Attenuation", lightIndex), &constantAttenuation, 0.1f, 1.0f))
 			{
 				m_selectedLight->ConstantAttenuation = constantAttenuation;
 			}
 			float linearAttenuation = m_selectedLight->LinearAttenuation;
-			if (ImGui::SliderFloat(("Light " + std::to_string(lightIndex) + " Linear Attenuation").c_str(), &linearAttenuation, 0.1f, 1.0f))
+			if (ImGui::SliderFloat(arena.Format("Light %d Linear Attenuation", lightIndex), &linearAttenuation, 0.1f, 1.0f))
 			{
 				m_selectedLight->LinearAttenuation = linearAttenuation;
 			}
 			float quadraticAttenuation = m_selectedLight->QuadraticAttenuation;
-			if (ImGui::SliderFloat(("Light " + std::to_string(lightIndex) + " Quadratic Attenuation").c_str(), &quadraticAttenuation, 0.1f, 1.0f))
+			if (ImGui::SliderFloat(arena.Format("Light %d Quadratic Attenuation", lightIndex), &quadraticAttenuation, 0.1f, 1.0f))
 			{
 				m_selectedLight->QuadraticAttenuation = quadraticAttenuation;
 			}
 		}
 
 		float lightColor[3] = { m_selectedLight->Color.x, m_selectedLight->Color.y, m_selectedLight->Color.z };
-		if (ImGui::ColorEdit3(("Light " + std::to_string(lightIndex) + " Color").c_str(), lightColor))
+		if (ImGui::ColorEdit3(arena.Format("Light %d Color", lightIndex), lightColor))
 		{
 			m_selectedLight->Color = XMFLOAT4(lightColor[0], lightColor[1], lightColor[2], 1);
 		}
@@ -251,7 +300,7 @@ void ImGuiRendering::DrawObjectMovementWindow()
 	}
 }
 
-void ImGuiRendering::DrawUpdateObjectMaterialBufferWindow(ID3D11DeviceContext* pContext)
+void ImGuiRendering::DrawUpdateObjectMaterialBufferWindow()
 {
 	if (m_selectedObject != nullptr)
 	{
@@ -325,11 +374,11 @@ void ImGuiRendering::DrawUpdateObjectMaterialBufferWindow(ID3D11DeviceContext* p
 
 			ImGui::Separator();
 		}
-		m_selectedObject->UpdateMaterialConstantBuffer(currentMaterialBuffer, pContext);
+		m_selectedObject->UpdateMaterialConstantBuffer(currentMaterialBuffer);
 
 		if (ImGui::Button("Reset Material Values"))
 		{
-			m_selectedObject->UpdateMaterialConstantBuffer(m_selectedObject->GetOriginalMaterialConstantBufferData(), pContext);
+			m_selectedObject->UpdateMaterialConstantBuffer(m_selectedObject->GetOriginalMaterialConstantBufferData());
 		}
 
 		ImGui::End();
@@ -423,23 +472,29 @@ void ImGuiRendering::DrawObjectSelectionWindow()
 	ImGui::Text("Choose an object to select!");
 	ImGui::Separator();
 
-	for (auto dgo : m_currentScene->m_vecDrawables)
-	{
-		bool isSelected = (m_selectedObject == dgo);
-
-		if (ImGui::Selectable(dgo->GetObjectName().c_str(), isSelected))
+	m_currentScene->m_gameObjects.ForEachWithHandle([&](GameObjectHandle handle, GameObject& dgo)
 		{
-			if (isSelected)
-			{
-				m_selectedObject = nullptr;
-			}
-			else
+			bool isSelected = (m_selectedObjectHandle == handle);
+
+			// The name alone isn't unique, so push the handle as the ID
+			ImGui::PushID(static_cast<int>(handle.Index));
+			if (ImGui::Selectable(dgo.GetObjectName().c_str(), isSelected))
 			{
-				m_selectedObject = dgo;
-				m_selectedLight = nullptr;
+				if (isSelected)
+				{
+					m_selectedObjectHandle = GameObjectHandle();
+					m_selectedObject = nullptr;
+				}
+				else
+				{
+					m_selectedObjectHandle = handle;
+					m_selectedObject = &dgo;
+					lightIndex = -1;
+					m_selectedLight = nullptr;
+				}
 			}
-		}
-	}
+			ImGui::PopID();
+		});
 
 	ImGui::End();
 }
@@ -473,7 +528,7 @@ void ImGuiRendering::DrawPixelShaderSelectionWindow()
 	}
 }
 
-void ImGuiRendering::DrawTextureSelectionWindow(ID3D11DeviceContext* pContext)
+void ImGuiRendering::DrawTextureSelectionWindow()
 {
 	if (m_selectedObject != nullptr)
 	{
@@ -492,7 +547,7 @@ void ImGuiRendering::DrawTextureSelectionWindow(ID3D11DeviceContext* pContext)
 		{
 			MaterialPropertiesConstantBuffer buffer = m_selectedObject->GetMaterialConstantBufferData();
 			buffer.Material.UseTexture = false;
-			m_selectedObject->UpdateMaterialConstantBuffer(buffer, pContext);
+			m_selectedObject->UpdateMaterialConstantBuffer(buffer);
 			m_selectedObject->SetTextureResourceView(nullptr);
 		}
 
@@ -511,7 +566,7 @@ void ImGuiRendering::DrawTextureSelectionWindow(ID3D11DeviceContext* pContext)
 			{
 				MaterialPropertiesConstantBuffer buffer = m_selectedObject->GetMaterialConstantBufferData();
 				buffer.Material.UseTexture = true;
-				m_selectedObject->UpdateMaterialConstantBuffer(buffer, pContext);
+				m_selectedObject->UpdateMaterialConstantBuffer(buffer);
 				m_selectedObject->SetTextureResourceView(shaderPair.second);
 			}
 		}
@@ -549,7 +604,7 @@ void ImGuiRendering::DrawMeshSelectionWindow()
 	}
 }
 
-void ImGuiRendering::DrawNormalMapSelectionWindow(ID3D11DeviceContext* pContext)
+void ImGuiRendering::DrawNormalMapSelectionWindow()
 {
 	if (m_selectedObject != nullptr)
 	{
@@ -568,7 +623,7 @@ void ImGuiRendering::DrawNormalMapSelectionWindow(ID3D11DeviceContext* pContext)
 		{
 			MaterialPropertiesConstantBuffer buffer = m_selectedObject->GetMaterialConstantBufferData();
 			buffer.Material.UseNormalMap = false;
-			m_selectedObject->UpdateMaterialConstantBuffer(buffer, pContext);
+			m_selectedObject->UpdateMaterialConstantBuffer(buffer);
 			m_selectedObject->SetNormalMapResourceView(nullptr);
 		}
 
@@ -582,7 +637,7 @@ void ImGuiRendering::DrawNormalMapSelectionWindow(ID3D11DeviceContext* pContext)
 			{
 				MaterialPropertiesConstantBuffer buffer = m_selectedObject->GetMaterialConstantBufferData();
 				buffer.Material.UseNormalMap = true;
-				m_selectedObject->UpdateMaterialConstantBuffer(buffer, pContext);
+				m_selectedObject->UpdateMaterialConstantBuffer(buffer);
 				m_selectedObject->SetNormalMapResourceView(shaderPair.second);
 			}
 		}
@@ -621,6 +676,8 @@ void ImGuiRendering::DrawCameraStatsWindow()
 
 void ImGuiRendering::DrawCameraSplineWindow()
 {
+	FrameArena& arena = FrameArena::ThreadArena();
+
 	ImGui::SetNextWindowPos(ImVec2(800, 300), ImGuiCond_FirstUseEver);
 	ImGui::Begin("Camera Spline Animation", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
 
@@ -645,13 +702,13 @@ void ImGuiRendering::DrawCameraSplineWindow()
 		XMFLOAT3 point;
 		XMStoreFloat3(&point, m_currentScene->m_controlPoints[i]);
 
-		string pointName = "Spline Point " + to_string(i);
+		const char* pointName;
 
 		if (i == 0) pointName = "Initial Velocity";
+		else if (i == m_currentScene->m_controlPoints.size() - 1) pointName = "Final Velocity";
+		else pointName = arena.Format("Spline Point %zu", i);
 
-		if (i == m_currentScene->m_controlPoints.size() - 1) pointName = "Final Velocity";
-
-		if (ImGui::DragFloat3(pointName.c_str(), reinterpret_cast<float*>(&point), 0.1f))
+		if (ImGui::DragFloat3(pointName, reinterpret_cast<float*>(&point), 0.1f))
 		{
 			m_currentScene->m_controlPoints[i] = XMLoadFloat3(&point);
 		}
@@ -661,6 +718,201 @@ void ImGuiRendering::DrawCameraSplineWindow()
 	ImGui::End();
 }
 
+void ImGuiRendering::DrawFramePipelineWindow(FramePipeline* framePipeline, const RenderGraph* renderGraph, const StateTrackingContext* stateContext)
+{
+	ImGui::SetNextWindowPos(ImVec2(10, 100), ImGuiCond_FirstUseEver);
+	ImGui::Begin("Frame Pipeline", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
+
+	bool pipelined = framePipeline->IsPipelined();
+	if (ImGui::Checkbox("Simulate Next Frame While Rendering", &pipelined))
+	{
+		framePipeline->SetPipelined(pipelined);
+	}
+
+	ImGui::Separator();
+	ImGui::Text("Simulation: %.3f ms", framePipeline->GetSimulationMs());
+	ImGui::Text("Render Submission: %.3f ms", framePipeline->GetRenderMs());
+	ImGui::Text("Simulation To Present Latency: %.3f ms", framePipeline->GetLatencyMs());
+	ImGui::Text("Objects: %d (%u in view)", static_cast<int>(m_currentScene->m_gameObjects.Size()), m_currentScene->GetVisibleObjectCount());
+	ImGui::Checkbox("Cull With Object Tree", &m_currentScene->m_cullWithObjectTree);
+	const DynamicAabbTree& objectTree = m_currentScene->GetObjectTree();
+	const DynamicAabbTree::QueryStats& cullStats = m_currentScene->GetCullStats();
+	ImGui::Text("Culling: %u nodes visited, %u boxes tested", cullStats.NodesVisited, cullStats.LeavesTested);
+	ImGui::Text("Object Tree: height %d, area ratio %.1f", objectTree.GetHeight(), objectTree.GetAreaRatio());
+
+	ImGui::Checkbox("Occlusion Culling", &m_currentScene->m_occlusionCulling);
+	ImGui::SameLine();
+	ImGui::Checkbox("Show Occlusion Buffer", &showOcclusionBuffer);
+	if (m_currentScene->m_occlusionCulling)
+	{
+		const OcclusionCuller::Stats& occlusionStats = m_currentScene->GetOcclusionCuller().GetStats();
+		ImGui::Text("Occluders: %u (%u triangles), rasterized in %.3f ms", occlusionStats.Occluders, occlusionStats.Triangles, occlusionStats.RasterizeMs);
+		ImGui::Text("Occlusion Culled: %u of %u in %.3f ms", occlusionStats.Culled, occlusionStats.Tested, occlusionStats.TestMs);
+	}
+	ImGui::Text("Unique Materials: %u (%u uploaded last frame)", m_currentScene->GetMaterialTable().GetUniqueCount(), m_currentScene->GetMaterialBuffer().GetLastUploadCount());
+
+	ImGui::Checkbox("Sort Draws", &m_currentScene->m_sortDraws);
+	const RenderQueue::Stats& queueStats = m_currentScene->GetRenderQueue().GetStats();
+	ImGui::Text("Draw Queue: %u draws, built in %.3f ms", queueStats.Draws, queueStats.BuildMs);
+	ImGui::Text("Rebinds Unsorted: %u shaders, %u textures, %u buffers", queueStats.Unsorted.Shaders, queueStats.Unsorted.Textures, queueStats.Unsorted.Buffers);
+	ImGui::Text("Rebinds In Queue: %u shaders, %u textures, %u buffers", queueStats.Sorted.Shaders, queueStats.Sorted.Textures, queueStats.Sorted.Buffers);
+
+	ImGui::Checkbox("Instance Draws", &m_currentScene->m_instanceDraws);
+	ImGui::Text("Draw Calls: %u for %u draws, instance buffer holds %u", queueStats.Batches, queueStats.Draws, m_currentScene->GetInstanceBuffer().GetCapacity());
+
+	// Against every draw writing the camera and its own constants together
+	const ConstantRingBuffer& constantRing = m_currentScene->GetObjectConstants();
+	ImGui::Text("Constants Uploaded: %.1f KB last frame, %.1f KB unsplit", m_currentScene->GetConstantBytesUploaded() / 1024.0f, queueStats.Draws * UNSPLIT_CONSTANT_BUFFER_SIZE / 1024.0f);
+	if (constantRing.IsSupported()) ImGui::Text("Constant Ring: %u slots, started over %u times", constantRing.GetSlotCount(), constantRing.GetWrapCount());
+	else ImGui::Text("Constant Ring: not supported, one buffer rewritten per draw");
+
+	ImGui::Checkbox("Parallel Submission", &m_currentScene->m_parallelSubmission);
+	const DeferredContextPool& deferredContexts = m_currentScene->GetDeferredContexts();
+	if (deferredContexts.IsNative()) ImGui::Text("Command Lists: %u last frame, %u deferred contexts", deferredContexts.GetListsExecuted(), deferredContexts.GetContextCount());
+	else ImGui::Text("Command Lists: emulated by the runtime, drawing serially");
+
+	ImGui::Checkbox("Clustered Lighting", &m_currentScene->m_clusteredLighting);
+	const LightClusterGrid::Stats& clusterStats = m_currentScene->GetLightClusters().GetStats();
+	ImGui::Text("Lights: %d (%u in view)", static_cast<int>(m_currentScene->GetLights().size()), m_currentScene->GetVisibleLightCount());
+	const LightBuffer& lightBuffer = m_currentScene->GetLightBuffer();
+	ImGui::Text("Light Buffer: %u uploaded last frame, room for %u", lightBuffer.GetLastUploadCount(), lightBuffer.GetCapacity());
+	ImGui::Text("Light Clusters: %u global, %u clustered, built in %.3f ms", clusterStats.GlobalLights, clusterStats.ClusteredLights, clusterStats.BuildMs);
+	ImGui::Text("Cluster Light Indices: %u (at most %u in one cluster)", clusterStats.Indices, clusterStats.MaxClusterLights);
+
+	ImGui::Separator();
+	ImGui::Checkbox("Deferred Shading", &DeferredShading);
+	const RenderGraph::Stats& graphStats = renderGraph->GetStats();
+	ImGui::Text("Render Graph: %u of %u passes run", graphStats.Passes - graphStats.CulledPasses, graphStats.Passes);
+	for (RenderGraph::PassId pass = 0; pass < renderGraph->GetPassCount(); ++pass)
+	{
+		ImGui::BulletText("%s%s", renderGraph->GetPassName(pass), renderGraph->IsPassCulled(pass) ? " (culled)" : "");
+	}
+	ImGui::Text("Graph Textures: %u in %u, %.1f MB shared from %.1f MB", graphStats.TransientTextures, graphStats.PhysicalTextures,
+		graphStats.AliasedBytes / (1024.0f * 1024.0f), graphStats.TransientBytes / (1024.0f * 1024.0f));
+	ImGui::Text("Graph Unbinds: %u shader resources, %u render targets", graphStats.UnbindSlots, graphStats.UnbindRenderTargets);
+	if (renderGraph->GetPool() != nullptr)
+	{
+		const RenderTargetPool::Stats poolStats = renderGraph->GetPool()->GetStats();
+		ImGui::Text("Render Targets: %u (%.1f MB), %llu of %llu requests reused one", poolStats.Targets, poolStats.Bytes / (1024.0f * 1024.0f),
+			static_cast<unsigned long long>(poolStats.Reuses), static_cast<unsigned long long>(poolStats.Acquires));
+		ImGui::Text("Render Target Traffic: %.1f MB read, %.1f MB written last frame", poolStats.FrameReadBytes / (1024.0f * 1024.0f), poolStats.FrameWrittenBytes / (1024.0f * 1024.0f));
+	}
+
+	ImGui::Separator();
+	const PipelineStateCache& stateCache = PipelineStateCache::Get();
+	const std::pair<const char*, PipelineStateCache::Stats> stateStats[] =
+	{
+		{ "Sampler", stateCache.GetSamplerStats() },
+		{ "Rasterizer", stateCache.GetRasterizerStats() },
+		{ "Blend", stateCache.GetBlendStats() },
+		{ "Depth Stencil", stateCache.GetDepthStencilStats() }
+	};
+	for (const auto& [name, stats] : stateStats)
+	{
+		ImGui::Text("%s States: %u (%.0f%% of %llu requests hit the cache)", name, stats.Objects, stats.GetHitRate() * 100.0f, static_cast<unsigned long long>(stats.Requests));
+	}
+
+	const ShaderPermutations& permutations = ShaderPermutations::Get();
+	ImGui::Text("Shader Variants: %u compiled of %u possible (budget %u)", permutations.GetVariantCount(), permutations.GetPossibleVariantCount(), ShaderPermutations::VARIANT_BUDGET);
+	if (ImGui::TreeNode("Shader Variants"))
+	{
+		for (UINT i = 0; i < permutations.GetVariantCount(); ++i)
+		{
+			const ShaderPermutations::Variant& variant = permutations.GetVariantAt(i);
+			ImGui::Text("%s [%s%s%s]: %u instructions, %u in the G-buffer version, %.1f ms%s", permutations.GetEntryPoint(variant.Shader),
+				(variant.Features & SHADER_FEATURE_TEXTURE) != 0 ? ShaderPermutations::GetKeyword(0) : "",
+				variant.Features == SHADER_FEATURES_ALL ? " " : "",
+				(variant.Features & SHADER_FEATURE_NORMAL_MAP) != 0 ? ShaderPermutations::GetKeyword(1) : "",
+				variant.Instructions, variant.GBufferInstructions, variant.LoadMs, variant.FromCache ? " from the cache" : "");
+		}
+		ImGui::TreePop();
+	}
+
+	// Counted over the frame that has just been drawn, ImGui's own binds don't go through the filter
+	const StateTrackingContext::CallCounts totalCalls = stateContext->GetTotalCounts();
+	ImGui::Text("Bind Calls Last Frame: %llu issued, %llu dropped as redundant", static_cast<unsigned long long>(totalCalls.Issued), static_cast<unsigned long long>(totalCalls.Elided));
+	if (ImGui::TreeNode("Bind Calls By Kind"))
+	{
+		for (UINT type = 0; type < StateTrackingContext::CALL_TYPE_COUNT; ++type)
+		{
+			const StateTrackingContext::CallCounts& calls = stateContext->GetCounts(static_cast<StateTrackingContext::CallType>(type));
+			ImGui::Text("%s: %llu issued, %llu dropped", StateTrackingContext::GetCallName(static_cast<StateTrackingContext::CallType>(type)),
+				static_cast<unsigned long long>(calls.Issued), static_cast<unsigned long long>(calls.Elided));
+		}
+		ImGui::TreePop();
+	}
+
+	ImGui::Separator();
+	FrameArena& arena = FrameArena::ThreadArena();
+	ImGui::Text("Heap Allocations Last Frame: %llu", AllocationCounter::GetLastFrameAllocations());
+	ImGui::Text("Render Thread Frame Arena: %.1f / %.1f KB", arena.GetUsed() / 1024.0f, arena.GetCapacity() / 1024.0f);
+
+	ImGui::End();
+}
+
+void ImGuiRendering::DrawOcclusionBufferWindow()
+{
+	constexpr UINT width = OcclusionCuller::WIDTH;
+	constexpr UINT height = OcclusionCuller::HEIGHT;
+
+	if (m_occlusionTexture == nullptr)
+	{
+		D3D11_TEXTURE2D_DESC desc = {};
+		desc.Width = width;
+		desc.Height = height;
+		desc.MipLevels = 1;
+		desc.ArraySize = 1;
+		desc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+		desc.SampleDesc.Count = 1;
+		desc.Usage = D3D11_USAGE_DYNAMIC;
+		desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+		desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+
+		if (FAILED(m_pd3dDevice->CreateTexture2D(&desc, nullptr, m_occlusionTexture.GetAddressOf())) ||
+			FAILED(m_pd3dDevice->CreateShaderResourceView(m_occlusionTexture.Get(), nullptr, m_occlusionTextureView.GetAddressOf())))
+		{
+			MessageBox(nullptr, L"Failed to create the occlusion buffer texture", L"Error", MB_OK);
+			m_occlusionTexture.Reset();
+			showOcclusionBuffer = false;
+			return;
+		}
+	}
+
+	// Depth bunches up near 1, so stretch whatever range is covered this frame from white (near) to dark grey (far)
+	const float* depth = m_currentScene->GetOcclusionCuller().GetDepth();
+	float nearest = 1.0f;
+	float farthest = 0.0f;
+	for (UINT i = 0; i < width * height; ++i)
+	{
+		if (depth[i] >= 1.0f) continue;
+		nearest = (std::min)(nearest, depth[i]);
+		farthest = (std::max)(farthest, depth[i]);
+	}
+	const float scale = farthest > nearest ? 1.0f / (farthest - nearest) : 0.0f;
+
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	if (SUCCEEDED(m_pImmediateContext->Map(m_occlusionTexture.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))
+	{
+		for (UINT y = 0; y < height; ++y)
+		{
+			uint32_t* row = reinterpret_cast<uint32_t*>(static_cast<uint8_t*>(mapped.pData) + y * mapped.RowPitch);
+			for (UINT x = 0; x < width; ++x)
+			{
+				float value = depth[y * width + x];
+				uint32_t grey = value >= 1.0f ? 0 : static_cast<uint32_t>(255.0f - 191.0f * (value - nearest) * scale);
+				row[x] = 0xFF000000 | (grey << 16) | (grey << 8) | grey;
+			}
+		}
+		m_pImmediateContext->Unmap(m_occlusionTexture.Get(), 0);
+	}
+
+	ImGui::SetNextWindowPos(ImVec2(10, 420), ImGuiCond_FirstUseEver);
+	ImGui::Begin("Occlusion Buffer", &showOcclusionBuffer, ImGuiWindowFlags_AlwaysAutoResize);
+	ImGui::Image(m_occlusionTextureView.Get(), ImVec2(width * 2.0f, height * 2.0f));
+	ImGui::Text("%u x %u, black is empty", width, height);
+	ImGui::End();
+}
+
 void ImGuiRendering::StartIMGUIDraw()
 {
 	ImGui_ImplDX11_NewFrame();
@@ -9,39 +9,63 @@
 #include <d3d11_1.h>
 #include "Scene.h"
 
+class FramePipeline;
+class RenderGraph;
+class StateTrackingContext;
+
 class ImGuiRendering
 {
 public:
-	ImGuiRendering(HWND hwnd, ID3D11Device* m_pd3dDevice, ID3D11DeviceContext* m_pImmediateContext);
+	ImGuiRendering(HWND hwnd, ID3D11Device* device, ID3D11DeviceContext* context);
 
 	void ShutDownImGui();
 
-	void ImGuiDrawAllWindows(const unsigned int FPS, float totalAppTime, Scene* currentScene, ID3D11DeviceContext* pContext);
+	void ImGuiDrawAllWindows(const unsigned int FPS, float totalAppTime, Scene* currentScene, FramePipeline* framePipeline, const RenderGraph* renderGraph, const StateTrackingContext* stateContext);
+
+	// Selects an object the same as picking it from the list, a null handle clears the selection
+	void SelectObject(GameObjectHandle handle);
 
 	bool VSyncEnabled = true;
 
+	// The renderer rebuilds its render graph when this changes
+	bool DeferredShading = false;
+
 private:
 	void	DrawVersionWindow(const unsigned int FPS, float totalAppTime);
 	void	DrawHideAllWindows();
 	void	DrawSelectLightWindow();
 	void	DrawLightUpdateWindow();
 	void	DrawObjectMovementWindow();
-	void	DrawUpdateObjectMaterialBufferWindow(ID3D11DeviceContext* pContext);
+	void	DrawUpdateObjectMaterialBufferWindow();
 	void	DrawObjectGimzo();
 	void	DrawObjectSelectionWindow();
 	void	DrawPixelShaderSelectionWindow();
-	void	DrawTextureSelectionWindow(ID3D11DeviceContext* pContext);
+	void	DrawTextureSelectionWindow();
 	void DrawMeshSelectionWindow();
-	void	DrawNormalMapSelectionWindow(ID3D11DeviceContext* pContext);
+	void	DrawNormalMapSelectionWindow();
 	void	DrawCameraStatsWindow();
 	void    DrawCameraSplineWindow();
+	void	DrawFramePipelineWindow(FramePipeline* framePipeline, const RenderGraph* renderGraph, const StateTrackingContext* stateContext);
+	void	DrawOcclusionBufferWindow();
+	void	ResolveSelection();
 	void	StartIMGUIDraw();
 	void	CompleteIMGUIDraw();
 
 	bool showWindows = false;
 	bool showCameraSplineWindow = false;
+	bool showOcclusionBuffer = false;
 	Scene* m_currentScene = nullptr;
+
+	// What is selected is kept as a handle / index, the pointers below are looked up again every frame
+	GameObjectHandle m_selectedObjectHandle;
+	int lightIndex = -1;
 	GameObject* m_selectedObject = nullptr;
 	Light* m_selectedLight = nullptr;
-	int lightIndex = 0;
+
+	Microsoft::WRL::ComPtr<ID3D11Device>				m_pd3dDevice;
+	Microsoft::WRL::ComPtr<ID3D11DeviceContext>			m_pImmediateContext;
+
+	// The occlusion culler's depth buffer as grey levels, only created once the view is opened
+	Microsoft::WRL::ComPtr<ID3D11Texture2D>				m_occlusionTexture;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>	m_occlusionTextureView;
 };
@@ -0,0 +1,151 @@
+#include "JobSystem.h"
+#include "FrameArena.h"
+
+#include <algorithm>
+
+namespace
+{
+	// Set while a thread is running chunks so nested ParallelFor calls don't wait on themselves
+	thread_local bool s_insideJob = false;
+}
+
+JobSystem& JobSystem::Get()
+{
+	static JobSystem jobSystem;
+	return jobSystem;
+}
+
+JobSystem::JobSystem()
+{
+	unsigned int hardwareThreads = std::thread::hardware_concurrency();
+
+	// The thread calling ParallelFor does work too, so leave a core for it
+	StartWorkers(hardwareThreads > 1 ? hardwareThreads - 1 : 0);
+}
+
+JobSystem::~JobSystem()
+{
+	StopWorkers();
+}
+
+void JobSystem::SetWorkerCount(unsigned int workerCount)
+{
+	std::lock_guard<std::mutex> submitLock(m_submitMutex);
+
+	StopWorkers();
+	StartWorkers(workerCount);
+}
+
+void JobSystem::StartWorkers(unsigned int workerCount)
+{
+	m_quit = false;
+	m_workers.reserve(workerCount);
+
+	for (unsigned int i = 0; i < workerCount; ++i)
+	{
+		m_workers.emplace_back(&JobSystem::WorkerLoop, this, m_generation);
+	}
+	m_workerCount.store(workerCount, std::memory_order_relaxed);
+}
+
+void JobSystem::StopWorkers()
+{
+	m_workerCount.store(0, std::memory_order_relaxed);
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_quit = true;
+	}
+	m_wakeCondition.notify_all();
+
+	for (std::thread& worker : m_workers)
+	{
+		worker.join();
+	}
+
+	m_workers.clear();
+}
+
+void JobSystem::ParallelFor(size_t count, size_t chunkSize, const RangeJob& job)
+{
+	if (count == 0) return;
+
+	if (chunkSize == 0) chunkSize = 1;
+
+	size_t chunkCount = (count + chunkSize - 1) / chunkSize;
+
+	// Not worth waking anybody up, or we are already on a worker
+	if (GetWorkerCount() == 0 || chunkCount == 1 || s_insideJob)
+	{
+		for (size_t begin = 0; begin < count; begin += chunkSize)
+		{
+			job(begin, (std::min)(begin + chunkSize, count));
+		}
+		return;
+	}
+
+	// Only one range is in flight at a time. The pool can't change while this is held, the count checked above may
+	// be stale but a pool emptied since just leaves every chunk to this thread
+	std::lock_guard<std::mutex> submitLock(m_submitMutex);
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_job = &job;
+		m_count = count;
+		m_chunkSize = chunkSize;
+		m_chunkCount = chunkCount;
+		m_nextChunk = 0;
+		m_activeWorkers = static_cast<unsigned int>(m_workers.size());
+		++m_generation;
+	}
+	m_wakeCondition.notify_all();
+
+	s_insideJob = true;
+	RunChunks();
+	s_insideJob = false;
+
+	// Every worker has to check out before the job reference goes out of scope
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_doneCondition.wait(lock, [this] { return m_activeWorkers == 0; });
+	m_job = nullptr;
+}
+
+void JobSystem::WorkerLoop(unsigned long long seenGeneration)
+{
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_wakeCondition.wait(lock, [&] { return m_quit || m_generation != seenGeneration; });
+
+			if (m_quit) return;
+
+			seenGeneration = m_generation;
+		}
+
+		// Each range gets a clean worker arena, chunks can't hand arena memory back to the caller
+		FrameArena::ThreadArena().Reset();
+
+		s_insideJob = true;
+		RunChunks();
+		s_insideJob = false;
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (--m_activeWorkers == 0) m_doneCondition.notify_one();
+		}
+	}
+}
+
+void JobSystem::RunChunks()
+{
+	for (;;)
+	{
+		size_t chunk = m_nextChunk.fetch_add(1);
+		if (chunk >= m_chunkCount) break;
+
+		size_t begin = chunk * m_chunkSize;
+		size_t end = (std::min)(begin + m_chunkSize, m_count);
+
+		(*m_job)(begin, end);
+	}
+}
@@ -0,0 +1,66 @@
+// A small persistent worker pool for splitting CPU work (object updates etc.) across threads
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// <summary>
+/// Persistent pool of worker threads. Work is handed out as fixed size chunks of an index range,
+/// so the way a range is split never depends on how many threads end up running it.
+/// </summary>
+class JobSystem
+{
+public:
+	typedef std::function<void(size_t begin, size_t end)> RangeJob;
+
+	/// Gets the shared job system, spinning up the workers the first time it is used.
+	static JobSystem& Get();
+
+	/// Runs job over [0, count) in chunks of chunkSize. The calling thread helps out and
+	/// the call only returns once every chunk has finished. Calls made from inside a job run inline.
+	/// @param count The number of items to process.
+	/// @param chunkSize The number of items handed to a thread at a time.
+	/// @param job The function called once per chunk with the chunk's [begin, end) range.
+	void ParallelFor(size_t count, size_t chunkSize, const RangeJob& job);
+
+	/// Changes the number of worker threads (0 runs everything on the calling thread).
+	void SetWorkerCount(unsigned int workerCount);
+	unsigned int GetWorkerCount() const { return m_workerCount.load(std::memory_order_relaxed); }
+
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+
+private:
+	JobSystem();
+	~JobSystem();
+
+	void StartWorkers(unsigned int workerCount);
+	void StopWorkers();
+	void WorkerLoop(unsigned long long seenGeneration);
+	void RunChunks();
+
+	std::vector<std::thread>	m_workers;
+
+	// m_workers' size, read without m_submitMutex while SetWorkerCount may be changing the pool
+	std::atomic<unsigned int>	m_workerCount{ 0 };
+	std::mutex					m_mutex;
+	std::condition_variable		m_wakeCondition;
+	std::condition_variable		m_doneCondition;
+	std::mutex					m_submitMutex;
+
+	// The job currently being run, only valid while a ParallelFor call is in flight
+	const RangeJob*				m_job = nullptr;
+	size_t						m_count = 0;
+	size_t						m_chunkSize = 1;
+	size_t						m_chunkCount = 0;
+	std::atomic<size_t>			m_nextChunk{ 0 };
+	unsigned int				m_activeWorkers = 0;
+	unsigned long long			m_generation = 0;
+	bool						m_quit = false;
+};
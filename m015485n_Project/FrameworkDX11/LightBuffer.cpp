@@ -0,0 +1,140 @@
+#include "LightBuffer.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+	constexpr UINT MIN_BUFFER_CAPACITY = 64;
+
+	// Changed lights this close together are written in one go, a few unchanged ones cost less than another call
+	constexpr UINT RANGE_MERGE_GAP = 4;
+
+	// Past this many ranges everything from the first change to the last is written in one go
+	constexpr UINT MAX_CHANGED_RANGES = 32;
+}
+
+HRESULT LightBuffer::Apply(ID3D11Device* device, ID3D11DeviceContext* context, const std::vector<Light>& lights)
+{
+	// A new buffer starts out with everything in it, so there is nothing left to patch
+	if (Stage(lights))
+	{
+		m_lastUploadCount = m_capacity;
+		return CreateBuffer(device);
+	}
+
+	m_lastUploadCount = 0;
+	for (const LightRange& range : m_changedRanges)
+	{
+		D3D11_BOX box = {};
+		box.left = range.First * sizeof(Light);
+		box.right = box.left + range.Count * sizeof(Light);
+		box.bottom = 1;
+		box.back = 1;
+
+		context->UpdateSubresource(m_buffer.Get(), 0, &box, &m_lights[range.First], 0, 0);
+		m_lastUploadCount += range.Count;
+	}
+
+	return S_OK;
+}
+
+bool LightBuffer::Stage(const std::vector<Light>& lights)
+{
+	m_changedRanges.clear();
+	const UINT count = static_cast<UINT>(lights.size());
+
+	if (count > m_capacity || m_capacity == 0)
+	{
+		UINT capacity = (std::max)(m_capacity, MIN_BUFFER_CAPACITY);
+		while (capacity < count) capacity *= 2;
+
+		m_lights.resize(capacity);
+		std::copy(lights.begin(), lights.end(), m_lights.begin());
+		m_capacity = capacity;
+		++m_growCount;
+
+		m_changedRanges.push_back({ 0, capacity });
+		return true;
+	}
+
+	// Entries past the end are left as they are, the shader never indexes them
+	for (UINT i = 0; i < count; ++i)
+	{
+		if (memcmp(&m_lights[i], &lights[i], sizeof(Light)) == 0) continue;
+		m_lights[i] = lights[i];
+
+		if (!m_changedRanges.empty() && i - (m_changedRanges.back().First + m_changedRanges.back().Count) <= RANGE_MERGE_GAP)
+		{
+			m_changedRanges.back().Count = i + 1 - m_changedRanges.back().First;
+		}
+		else
+		{
+			m_changedRanges.push_back({ i, 1 });
+		}
+	}
+
+	if (m_changedRanges.size() > MAX_CHANGED_RANGES)
+	{
+		LightRange merged = { m_changedRanges.front().First, m_changedRanges.back().First + m_changedRanges.back().Count - m_changedRanges.front().First };
+		m_changedRanges.clear();
+		m_changedRanges.push_back(merged);
+	}
+
+	return false;
+}
+
+HRESULT LightBuffer::CreateBuffer(ID3D11Device* device)
+{
+	D3D11_BUFFER_DESC sbDesc = {};
+	sbDesc.Usage = D3D11_USAGE_DEFAULT;
+	sbDesc.ByteWidth = sizeof(Light) * m_capacity;
+	sbDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+	sbDesc.CPUAccessFlags = 0;
+	sbDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+	sbDesc.StructureByteStride = sizeof(Light);
+
+	D3D11_SUBRESOURCE_DATA initData = {};
+	initData.pSysMem = m_lights.data();
+
+	m_buffer.Reset();
+	m_shaderResourceView.Reset();
+
+	// Left at 0 if anything fails so the next frame tries again
+	const UINT capacity = m_capacity;
+	m_capacity = 0;
+
+	HRESULT hr = device->CreateBuffer(&sbDesc, &initData, &m_buffer);
+	if (FAILED(hr))
+	{
+		MessageBox(nullptr, L"Failed to create the light buffer.", L"Error", MB_OK);
+		return hr;
+	}
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+	srvDesc.Buffer.FirstElement = 0;
+	srvDesc.Buffer.NumElements = capacity;
+
+	hr = device->CreateShaderResourceView(m_buffer.Get(), &srvDesc, &m_shaderResourceView);
+	if (FAILED(hr))
+	{
+		MessageBox(nullptr, L"Failed to create the light buffer view.", L"Error", MB_OK);
+		m_buffer.Reset();
+		return hr;
+	}
+
+	m_capacity = capacity;
+	return S_OK;
+}
+
+void LightBuffer::Clear()
+{
+	m_lights.clear();
+	m_changedRanges.clear();
+	m_buffer.Reset();
+	m_shaderResourceView.Reset();
+	m_capacity = 0;
+	m_lastUploadCount = 0;
+	m_growCount = 0;
+}
@@ -0,0 +1,64 @@
+// The structured buffer the pixel shader reads the lights from, grown as needed and only written where lights changed
+
+#pragma once
+
+#include <d3d11_1.h>
+#include <wrl/client.h>
+#include <vector>
+
+#include "structures.h"
+
+/// <summary>
+/// A run of lights next to each other in the buffer.
+/// </summary>
+struct LightRange
+{
+	UINT	First;
+	UINT	Count;
+};
+
+/// <summary>
+/// Render side of the lights, a copy of the snapshot's light list in a structured buffer at t2. A copy of what the
+/// buffer holds is kept on the CPU and each frame's lights are compared against it, so a frame where one light
+/// moved writes one light. The buffer is recreated at double the size when the lights outgrow it.
+///
+/// Staging is plain CPU work and can be run on its own, Apply stages and then writes what changed to the GPU.
+/// </summary>
+class LightBuffer
+{
+public:
+	static constexpr UINT SHADER_SLOT = 2;
+
+	HRESULT	Apply(ID3D11Device* device, ID3D11DeviceContext* context, const std::vector<Light>& lights);
+
+	/// Brings the CPU copy up to date with lights and lists the ranges of it that changed.
+	/// @return True if the lights don't fit any more, the capacity has been raised and the whole buffer needs making again.
+	bool	Stage(const std::vector<Light>& lights);
+
+	/// Ranges found by the last Stage, in order and not overlapping.
+	const std::vector<LightRange>&	GetChangedRanges() const { return m_changedRanges; }
+
+	/// What the GPU buffer holds once the changed ranges are written, GetCapacity entries.
+	const std::vector<Light>&		GetContents() const { return m_lights; }
+
+	ID3D11ShaderResourceView*	GetShaderResourceView() const { return m_shaderResourceView.Get(); }
+	UINT						GetCapacity() const { return m_capacity; }
+
+	/// Lights written and times the buffer was recreated, for the stats window.
+	UINT	GetLastUploadCount() const { return m_lastUploadCount; }
+	UINT	GetGrowCount() const { return m_growCount; }
+
+	void	Clear();
+
+private:
+	HRESULT	CreateBuffer(ID3D11Device* device);
+
+	// Kept so changes can be found and growing can fill the new buffer without reading the old one back
+	std::vector<Light>									m_lights;
+	std::vector<LightRange>								m_changedRanges;
+	Microsoft::WRL::ComPtr<ID3D11Buffer>				m_buffer;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>	m_shaderResourceView;
+	UINT												m_capacity = 0;
+	UINT												m_lastUploadCount = 0;
+	UINT												m_growCount = 0;
+};
@@ -0,0 +1,201 @@
+#include "MaterialTable.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+	constexpr UINT MIN_BUFFER_CAPACITY = 64;
+}
+
+size_t MaterialTable::MaterialHash::operator()(const _Material& material) const
+{
+	// FNV-1a over the raw bytes
+	const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&material);
+	size_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < sizeof(_Material); ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+bool MaterialTable::MaterialEqual::operator()(const _Material& a, const _Material& b) const
+{
+	return memcmp(&a, &b, sizeof(_Material)) == 0;
+}
+
+UINT MaterialTable::Acquire(const _Material& material)
+{
+	auto existing = m_lookup.find(material);
+	if (existing != m_lookup.end())
+	{
+		++m_entries[existing->second].References;
+		return existing->second;
+	}
+
+	UINT index;
+	if (!m_freeIndices.empty())
+	{
+		index = m_freeIndices.back();
+		m_freeIndices.pop_back();
+	}
+	else
+	{
+		index = static_cast<UINT>(m_entries.size());
+		m_entries.emplace_back();
+	}
+
+	m_entries[index].Material = material;
+	m_entries[index].References = 1;
+	m_lookup.emplace(material, index);
+	MarkDirty(index);
+
+	return index;
+}
+
+void MaterialTable::Release(UINT index)
+{
+	if (index == INVALID_INDEX) return;
+
+	Entry& entry = m_entries[index];
+	if (--entry.References > 0) return;
+
+	// Left in the GPU buffer as it is, nothing draws with it until it gets reused and rewritten
+	m_lookup.erase(entry.Material);
+	m_freeIndices.push_back(index);
+}
+
+UINT MaterialTable::Change(UINT index, const _Material& material)
+{
+	if (index != INVALID_INDEX && MaterialEqual()(m_entries[index].Material, material)) return index;
+
+	// Share an entry that already has this material, or take a new one if the current entry is shared
+	if (m_lookup.count(material) > 0 || index == INVALID_INDEX || m_entries[index].References > 1)
+	{
+		UINT newIndex = Acquire(material);
+		Release(index);
+		return newIndex;
+	}
+
+	// Only this object uses the entry, so patch it rather than taking a new one
+	Entry& entry = m_entries[index];
+	m_lookup.erase(entry.Material);
+	entry.Material = material;
+	m_lookup.emplace(material, index);
+	MarkDirty(index);
+
+	return index;
+}
+
+void MaterialTable::MarkDirty(UINT index)
+{
+	if (m_entries[index].Dirty) return;
+
+	m_entries[index].Dirty = true;
+	m_dirtyIndices.push_back(index);
+}
+
+void MaterialTable::TakeUpdates(std::vector<MaterialUpdate>& updates)
+{
+	for (UINT index : m_dirtyIndices)
+	{
+		m_entries[index].Dirty = false;
+		updates.push_back({ index, m_entries[index].Material });
+	}
+	m_dirtyIndices.clear();
+}
+
+void MaterialTable::Clear()
+{
+	m_entries.clear();
+	m_lookup.clear();
+	m_freeIndices.clear();
+	m_dirtyIndices.clear();
+}
+
+HRESULT MaterialBuffer::Apply(ID3D11Device* device, ID3D11DeviceContext* context, UINT materialCount, const std::vector<MaterialUpdate>& updates)
+{
+	if (m_materials.size() < materialCount) m_materials.resize(materialCount);
+
+	for (const MaterialUpdate& update : updates)
+	{
+		m_materials[update.Index] = update.Material;
+	}
+
+	// A new buffer starts out with everything in it, so there is nothing left to patch
+	if (materialCount > m_capacity)
+	{
+		m_lastUploadCount = materialCount;
+		return Grow(device, materialCount);
+	}
+
+	for (const MaterialUpdate& update : updates)
+	{
+		D3D11_BOX box = {};
+		box.left = update.Index * sizeof(_Material);
+		box.right = box.left + sizeof(_Material);
+		box.bottom = 1;
+		box.back = 1;
+
+		context->UpdateSubresource(m_buffer.Get(), 0, &box, &update.Material, 0, 0);
+	}
+
+	m_lastUploadCount = static_cast<UINT>(updates.size());
+	return S_OK;
+}
+
+HRESULT MaterialBuffer::Grow(ID3D11Device* device, UINT materialCount)
+{
+	UINT capacity = (std::max)(m_capacity, MIN_BUFFER_CAPACITY);
+	while (capacity < materialCount) capacity *= 2;
+
+	m_materials.resize(capacity);
+
+	D3D11_BUFFER_DESC sbDesc = {};
+	sbDesc.Usage = D3D11_USAGE_DEFAULT;
+	sbDesc.ByteWidth = sizeof(_Material) * capacity;
+	sbDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+	sbDesc.CPUAccessFlags = 0;
+	sbDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+	sbDesc.StructureByteStride = sizeof(_Material);
+
+	D3D11_SUBRESOURCE_DATA initData = {};
+	initData.pSysMem = m_materials.data();
+
+	m_buffer.Reset();
+	m_shaderResourceView.Reset();
+	m_capacity = 0;
+
+	HRESULT hr = device->CreateBuffer(&sbDesc, &initData, &m_buffer);
+	if (FAILED(hr))
+	{
+		MessageBox(nullptr, L"Failed to create the material buffer.", L"Error", MB_OK);
+		return hr;
+	}
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+	srvDesc.Buffer.FirstElement = 0;
+	srvDesc.Buffer.NumElements = capacity;
+
+	hr = device->CreateShaderResourceView(m_buffer.Get(), &srvDesc, &m_shaderResourceView);
+	if (FAILED(hr))
+	{
+		MessageBox(nullptr, L"Failed to create the material buffer view.", L"Error", MB_OK);
+		return hr;
+	}
+
+	m_capacity = capacity;
+	return S_OK;
+}
+
+void MaterialBuffer::Clear()
+{
+	m_materials.clear();
+	m_buffer.Reset();
+	m_shaderResourceView.Reset();
+	m_capacity = 0;
+	m_lastUploadCount = 0;
+}
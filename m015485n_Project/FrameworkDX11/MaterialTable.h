@@ -0,0 +1,112 @@
+// One shared, deduplicated list of materials that every object indexes into, drawn from a single structured buffer
+
+#pragma once
+
+#include <d3d11_1.h>
+#include <wrl/client.h>
+#include <climits>
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+#include "structures.h"
+
+/// <summary>
+/// A changed entry in the material table, passed from the simulation stage to the render stage in the snapshot.
+/// </summary>
+struct MaterialUpdate
+{
+	UINT		Index;
+	_Material	Material;
+};
+
+/// <summary>
+/// CPU side of the material system. Objects with identical materials share one entry, entries are reference
+/// counted and reused once nothing points at them. Every entry that changes is remembered so only those get
+/// uploaded. Lives with the scene, so it is only touched with the scene mutex held.
+/// </summary>
+class MaterialTable
+{
+public:
+	static constexpr UINT INVALID_INDEX = UINT_MAX;
+
+	/// Finds the material or adds it, and takes a reference to the entry.
+	UINT Acquire(const _Material& material);
+
+	/// Drops a reference, the entry is free to be reused once nothing else holds it.
+	void Release(UINT index);
+
+	/// Moves an object from one material to another. Edits the entry in place when nothing else shares it.
+	/// @param index The object's current entry, or INVALID_INDEX if it doesn't have one yet.
+	/// @return The entry the object should use from now on.
+	UINT Change(UINT index, const _Material& material);
+
+	const _Material& Get(UINT index) const { return m_entries[index].Material; }
+
+	/// Size of the table including free entries, this is how big the GPU buffer has to be.
+	UINT GetCount() const { return static_cast<UINT>(m_entries.size()); }
+
+	/// Number of distinct materials in use.
+	UINT GetUniqueCount() const { return static_cast<UINT>(m_entries.size() - m_freeIndices.size()); }
+
+	/// Appends every entry that changed since the last call.
+	void TakeUpdates(std::vector<MaterialUpdate>& updates);
+
+	void Clear();
+
+private:
+	struct Entry
+	{
+		_Material	Material;
+		UINT		References = 0;
+		bool		Dirty = false;
+	};
+
+	// _Material has no padding bytes, so two materials are the same if their bytes are
+	struct MaterialHash
+	{
+		size_t operator()(const _Material& material) const;
+	};
+
+	struct MaterialEqual
+	{
+		bool operator()(const _Material& a, const _Material& b) const;
+	};
+
+	void MarkDirty(UINT index);
+
+	std::vector<Entry>										m_entries;
+	std::unordered_map<_Material, UINT, MaterialHash, MaterialEqual>	m_lookup;
+	std::vector<UINT>										m_freeIndices;
+	std::vector<UINT>										m_dirtyIndices;
+};
+
+/// <summary>
+/// Render side of the material system, a copy of the table in a structured buffer at t3. Only the entries
+/// in the snapshot's update list are written, the buffer is only recreated when the table outgrows it.
+/// </summary>
+class MaterialBuffer
+{
+public:
+	static constexpr UINT SHADER_SLOT = 3;
+
+	HRESULT Apply(ID3D11Device* device, ID3D11DeviceContext* context, UINT materialCount, const std::vector<MaterialUpdate>& updates);
+
+	ID3D11ShaderResourceView* GetShaderResourceView() const { return m_shaderResourceView.Get(); }
+	UINT GetCapacity() const { return m_capacity; }
+
+	/// Entries written by the last Apply, for the stats window.
+	UINT GetLastUploadCount() const { return m_lastUploadCount; }
+
+	void Clear();
+
+private:
+	HRESULT Grow(ID3D11Device* device, UINT materialCount);
+
+	// Kept so growing can fill the new buffer without reading the old one back
+	std::vector<_Material>								m_materials;
+	Microsoft::WRL::ComPtr<ID3D11Buffer>				m_buffer;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>	m_shaderResourceView;
+	UINT												m_capacity = 0;
+	UINT												m_lastUploadCount = 0;
+};
@@ -0,0 +1,283 @@
+#include "MeshBvh.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <utility>
+
+namespace
+{
+	float Component(const XMFLOAT3& v, int axis) { return axis == 0 ? v.x : (axis == 1 ? v.y : v.z); }
+
+	void Grow(XMFLOAT3& min, XMFLOAT3& max, const XMFLOAT3& pointMin, const XMFLOAT3& pointMax)
+	{
+		min = XMFLOAT3((std::min)(min.x, pointMin.x), (std::min)(min.y, pointMin.y), (std::min)(min.z, pointMin.z));
+		max = XMFLOAT3((std::max)(max.x, pointMax.x), (std::max)(max.y, pointMax.y), (std::max)(max.z, pointMax.z));
+	}
+
+	float Area(const XMFLOAT3& min, const XMFLOAT3& max)
+	{
+		float x = max.x - min.x;
+		float y = max.y - min.y;
+		float z = max.z - min.z;
+		return x < 0.0f ? 0.0f : 2.0f * (x * y + y * z + z * x);
+	}
+}
+
+MeshBvh::MeshBvh(const std::vector<XMFLOAT3>& positions, const std::vector<UINT>& indices)
+{
+	const UINT triangleCount = static_cast<UINT>(indices.size() / 3);
+	if (triangleCount == 0) return;
+
+	std::vector<XMFLOAT3> centroids(triangleCount);
+	std::vector<XMFLOAT3> triangleMin(triangleCount);
+	std::vector<XMFLOAT3> triangleMax(triangleCount);
+	m_triangleIds.resize(triangleCount);
+
+	for (UINT i = 0; i < triangleCount; ++i)
+	{
+		const XMFLOAT3& v0 = positions[indices[i * 3]];
+		const XMFLOAT3& v1 = positions[indices[i * 3 + 1]];
+		const XMFLOAT3& v2 = positions[indices[i * 3 + 2]];
+
+		triangleMin[i] = v0;
+		triangleMax[i] = v0;
+		Grow(triangleMin[i], triangleMax[i], v1, v1);
+		Grow(triangleMin[i], triangleMax[i], v2, v2);
+
+		centroids[i] = XMFLOAT3((triangleMin[i].x + triangleMax[i].x) * 0.5f, (triangleMin[i].y + triangleMax[i].y) * 0.5f, (triangleMin[i].z + triangleMax[i].z) * 0.5f);
+		m_triangleIds[i] = i;
+	}
+
+	// A binary tree with n leaves has 2n - 1 nodes, so this never reallocates during the build
+	m_nodes.reserve(triangleCount * 2);
+
+	Node root;
+	root.First = 0;
+	root.Count = triangleCount;
+	m_nodes.push_back(root);
+
+	Subdivide(0, 0, centroids, triangleMin, triangleMax);
+
+	m_vertices.resize(triangleCount * 3);
+	for (UINT i = 0; i < triangleCount; ++i)
+	{
+		UINT triangle = m_triangleIds[i];
+		for (UINT corner = 0; corner < 3; ++corner) m_vertices[i * 3 + corner] = positions[indices[triangle * 3 + corner]];
+	}
+}
+
+void MeshBvh::Subdivide(UINT nodeIndex, UINT depth, const std::vector<XMFLOAT3>& centroids, const std::vector<XMFLOAT3>& triangleMin, const std::vector<XMFLOAT3>& triangleMax)
+{
+	const UINT first = m_nodes[nodeIndex].First;
+	const UINT count = m_nodes[nodeIndex].Count;
+
+	XMFLOAT3 min(FLT_MAX, FLT_MAX, FLT_MAX), max(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	XMFLOAT3 centroidMin = min, centroidMax = max;
+	for (UINT i = first; i < first + count; ++i)
+	{
+		UINT triangle = m_triangleIds[i];
+		Grow(min, max, triangleMin[triangle], triangleMax[triangle]);
+		Grow(centroidMin, centroidMax, centroids[triangle], centroids[triangle]);
+	}
+
+	m_nodes[nodeIndex].Min = min;
+	m_nodes[nodeIndex].Max = max;
+	m_depth = (std::max)(m_depth, depth);
+
+	if (count <= MAX_LEAF_SIZE || depth + 1 >= MAX_DEPTH) return;
+
+	// Bin the centroids along each axis and try a split between every pair of neighbouring bins
+	float bestCost = FLT_MAX;
+	int bestAxis = -1;
+	UINT bestSplit = 0;
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		float axisMin = Component(centroidMin, axis);
+		float extent = Component(centroidMax, axis) - axisMin;
+		if (extent <= 0.0f) continue;
+
+		UINT binCount[BIN_COUNT] = {};
+		XMFLOAT3 binMin[BIN_COUNT], binMax[BIN_COUNT];
+		std::fill(std::begin(binMin), std::end(binMin), XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX));
+		std::fill(std::begin(binMax), std::end(binMax), XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX));
+
+		const float scale = BIN_COUNT / extent;
+		for (UINT i = first; i < first + count; ++i)
+		{
+			UINT triangle = m_triangleIds[i];
+			UINT bin = (std::min)(BIN_COUNT - 1, static_cast<UINT>((Component(centroids[triangle], axis) - axisMin) * scale));
+			++binCount[bin];
+			Grow(binMin[bin], binMax[bin], triangleMin[triangle], triangleMax[triangle]);
+		}
+
+		// Sweep from the right to get the cost of everything past each split, then from the left to total it up
+		float rightCost[BIN_COUNT] = {};
+		XMFLOAT3 sweepMin(FLT_MAX, FLT_MAX, FLT_MAX), sweepMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		UINT sweepCount = 0;
+		for (UINT bin = BIN_COUNT - 1; bin > 0; --bin)
+		{
+			sweepCount += binCount[bin];
+			Grow(sweepMin, sweepMax, binMin[bin], binMax[bin]);
+			rightCost[bin] = sweepCount * Area(sweepMin, sweepMax);
+		}
+
+		sweepMin = XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX);
+		sweepMax = XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		sweepCount = 0;
+		for (UINT split = 1; split < BIN_COUNT; ++split)
+		{
+			sweepCount += binCount[split - 1];
+			Grow(sweepMin, sweepMax, binMin[split - 1], binMax[split - 1]);
+			if (sweepCount == 0 || sweepCount == count) continue;
+
+			float cost = sweepCount * Area(sweepMin, sweepMax) + rightCost[split];
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = split;
+			}
+		}
+	}
+
+	if (bestAxis < 0 || bestCost >= count * Area(min, max)) return;
+
+	const float axisMin = Component(centroidMin, bestAxis);
+	const float scale = BIN_COUNT / (Component(centroidMax, bestAxis) - axisMin);
+	auto middle = std::partition(m_triangleIds.begin() + first, m_triangleIds.begin() + first + count, [&](UINT triangle)
+		{
+			return (std::min)(BIN_COUNT - 1, static_cast<UINT>((Component(centroids[triangle], bestAxis) - axisMin) * scale)) < bestSplit;
+		});
+
+	const UINT leftCount = static_cast<UINT>(middle - (m_triangleIds.begin() + first));
+
+	const UINT children = static_cast<UINT>(m_nodes.size());
+	Node left, right;
+	left.First = first;
+	left.Count = leftCount;
+	right.First = first + leftCount;
+	right.Count = count - leftCount;
+	m_nodes.push_back(left);
+	m_nodes.push_back(right);
+
+	m_nodes[nodeIndex].First = children;
+	m_nodes[nodeIndex].Count = 0;
+
+	Subdivide(children, depth + 1, centroids, triangleMin, triangleMax);
+	Subdivide(children + 1, depth + 1, centroids, triangleMin, triangleMax);
+}
+
+bool MeshBvh::RayCast(const XMFLOAT3& origin, const XMFLOAT3& direction, float maxDistance, Hit& hit, UINT* nodesVisited) const
+{
+	if (nodesVisited != nullptr) *nodesVisited = 0;
+	if (m_nodes.empty()) return false;
+
+	// Division by zero gives infinity, which the slab test copes with
+	const XMFLOAT3 inverseDirection(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+
+	if (RayEntry(origin, inverseDirection, maxDistance, m_nodes[0]) == FLT_MAX) return false;
+
+	// The far child of each branch taken, with the distance it was entered at so it can be skipped once something nearer is hit
+	std::pair<UINT, float> stack[MAX_DEPTH];
+	UINT stackSize = 0;
+	UINT nodeIndex = 0;
+	UINT visited = 0;
+	bool found = false;
+
+	while (true)
+	{
+		const Node& node = m_nodes[nodeIndex];
+		++visited;
+
+		if (node.Count > 0)
+		{
+			for (UINT i = node.First; i < node.First + node.Count; ++i)
+			{
+				float u, v;
+				float distance = IntersectTriangle(origin, direction, m_vertices[i * 3], m_vertices[i * 3 + 1], m_vertices[i * 3 + 2], &u, &v);
+				if (distance < 0.0f || distance >= maxDistance) continue;
+
+				maxDistance = distance;
+				hit.Distance = distance;
+				hit.Triangle = m_triangleIds[i];
+				hit.U = u;
+				hit.V = v;
+				found = true;
+			}
+		}
+		else
+		{
+			UINT nearChild = node.First;
+			UINT farChild = node.First + 1;
+			float nearEntry = RayEntry(origin, inverseDirection, maxDistance, m_nodes[nearChild]);
+			float farEntry = RayEntry(origin, inverseDirection, maxDistance, m_nodes[farChild]);
+			if (farEntry < nearEntry)
+			{
+				std::swap(nearChild, farChild);
+				std::swap(nearEntry, farEntry);
+			}
+
+			if (nearEntry != FLT_MAX)
+			{
+				if (farEntry != FLT_MAX) stack[stackSize++] = { farChild, farEntry };
+				nodeIndex = nearChild;
+				continue;
+			}
+		}
+
+		// Nothing more down this branch, go back to the nearest far child that could still beat the best hit
+		while (stackSize > 0 && stack[stackSize - 1].second >= maxDistance) --stackSize;
+		if (stackSize == 0) break;
+		nodeIndex = stack[--stackSize].first;
+	}
+
+	if (nodesVisited != nullptr) *nodesVisited = visited;
+	return found;
+}
+
+float MeshBvh::IntersectTriangle(const XMFLOAT3& origin, const XMFLOAT3& direction, const XMFLOAT3& v0, const XMFLOAT3& v1, const XMFLOAT3& v2, float* u, float* v)
+{
+	// Moller-Trumbore, solving origin + t * direction = v0 + u * edge1 + v * edge2 with Cramer's rule
+	const XMFLOAT3 edge1(v1.x - v0.x, v1.y - v0.y, v1.z - v0.z);
+	const XMFLOAT3 edge2(v2.x - v0.x, v2.y - v0.y, v2.z - v0.z);
+
+	const XMFLOAT3 p(direction.y * edge2.z - direction.z * edge2.y, direction.z * edge2.x - direction.x * edge2.z, direction.x * edge2.y - direction.y * edge2.x);
+	const float determinant = edge1.x * p.x + edge1.y * p.y + edge1.z * p.z;
+
+	// The ray runs along the triangle's plane, or the triangle has no area
+	if (determinant == 0.0f) return -1.0f;
+	const float inverseDeterminant = 1.0f / determinant;
+
+	const XMFLOAT3 s(origin.x - v0.x, origin.y - v0.y, origin.z - v0.z);
+	const float hitU = (s.x * p.x + s.y * p.y + s.z * p.z) * inverseDeterminant;
+	if (hitU < 0.0f || hitU > 1.0f) return -1.0f;
+
+	const XMFLOAT3 q(s.y * edge1.z - s.z * edge1.y, s.z * edge1.x - s.x * edge1.z, s.x * edge1.y - s.y * edge1.x);
+	const float hitV = (direction.x * q.x + direction.y * q.y + direction.z * q.z) * inverseDeterminant;
+	if (hitV < 0.0f || hitU + hitV > 1.0f) return -1.0f;
+
+	const float distance = (edge2.x * q.x + edge2.y * q.y + edge2.z * q.z) * inverseDeterminant;
+	if (distance < 0.0f) return -1.0f;
+
+	if (u != nullptr) *u = hitU;
+	if (v != nullptr) *v = hitV;
+	return distance;
+}
+
+float MeshBvh::RayEntry(const XMFLOAT3& origin, const XMFLOAT3& inverseDirection, float maxDistance, const Node& node)
+{
+	float tx1 = (node.Min.x - origin.x) * inverseDirection.x;
+	float tx2 = (node.Max.x - origin.x) * inverseDirection.x;
+	float ty1 = (node.Min.y - origin.y) * inverseDirection.y;
+	float ty2 = (node.Max.y - origin.y) * inverseDirection.y;
+	float tz1 = (node.Min.z - origin.z) * inverseDirection.z;
+	float tz2 = (node.Max.z - origin.z) * inverseDirection.z;
+
+	// fminf and fmaxf drop the NaN from 0 * infinity when the ray lies on a slab's plane
+	float entry = fmaxf(fmaxf(fminf(tx1, tx2), fminf(ty1, ty2)), fmaxf(fminf(tz1, tz2), 0.0f));
+	float exit = fminf(fminf(fmaxf(tx1, tx2), fmaxf(ty1, ty2)), fminf(fmaxf(tz1, tz2), maxDistance));
+
+	return entry <= exit ? entry : FLT_MAX;
+}
@@ -0,0 +1,78 @@
+// Static bounding volume hierarchy over one mesh's triangles, for exact ray hits when picking
+
+#pragma once
+
+#include <windows.h>
+#include <DirectXMath.h>
+#include <vector>
+
+using namespace DirectX;
+
+/// <summary>
+/// Built once from a mesh's CPU positions and indices, then only read. Triangles are split into two groups at
+/// whichever of a few evenly spaced planes on each axis gives the smallest surface area cost, until a node is down to
+/// a handful of triangles. The triangles are copied into leaf order so a leaf's vertices sit next to each other.
+///
+/// Everything is in the mesh's local space. Read only after construction, so any number of threads can cast at once.
+/// </summary>
+class MeshBvh
+{
+public:
+	MeshBvh(const std::vector<XMFLOAT3>& positions, const std::vector<UINT>& indices);
+
+	struct Hit
+	{
+		// In multiples of the ray's direction
+		float	Distance = 0.0f;
+
+		// Index of the triangle in the mesh's index list, and the barycentrics of the hit on it
+		UINT	Triangle = 0;
+		float	U = 0.0f;
+		float	V = 0.0f;
+	};
+
+	/// Finds the nearest triangle the ray hits closer than maxDistance. Both faces of a triangle count.
+	/// @param direction Doesn't need to be normalised, the distance comes back in multiples of it.
+	/// @param nodesVisited Optional count of the nodes the cast looked at, for the benchmarks.
+	bool	RayCast(const XMFLOAT3& origin, const XMFLOAT3& direction, float maxDistance, Hit& hit, UINT* nodesVisited = nullptr) const;
+
+	/// The same test against one triangle, for checking the tree against a plain loop.
+	/// @return The distance along the ray, or a negative number if it misses.
+	static float	IntersectTriangle(const XMFLOAT3& origin, const XMFLOAT3& direction, const XMFLOAT3& v0, const XMFLOAT3& v1, const XMFLOAT3& v2, float* u = nullptr, float* v = nullptr);
+
+	UINT	GetTriangleCount() const { return static_cast<UINT>(m_triangleIds.size()); }
+	UINT	GetNodeCount() const { return static_cast<UINT>(m_nodes.size()); }
+	UINT	GetDepth() const { return m_depth; }
+
+private:
+	// Leaves keep at most this many triangles, unless splitting them wouldn't make casts any cheaper
+	static constexpr UINT MAX_LEAF_SIZE = 4;
+	static constexpr UINT BIN_COUNT = 12;
+
+	// Deeper nodes are left as leaves so the traversal stack can't overflow
+	static constexpr UINT MAX_DEPTH = 64;
+
+	struct Node
+	{
+		XMFLOAT3	Min;
+
+		// A branch's first child, the second is right after it. A leaf's first triangle
+		UINT		First = 0;
+		XMFLOAT3	Max;
+
+		// Triangles in a leaf, 0 for a branch
+		UINT		Count = 0;
+	};
+
+	void	Subdivide(UINT node, UINT depth, const std::vector<XMFLOAT3>& centroids, const std::vector<XMFLOAT3>& triangleMin, const std::vector<XMFLOAT3>& triangleMax);
+
+	// Distance along the ray to where it enters the node's box, or FLT_MAX if it misses within maxDistance
+	static float	RayEntry(const XMFLOAT3& origin, const XMFLOAT3& inverseDirection, float maxDistance, const Node& node);
+
+	std::vector<Node>		m_nodes;
+
+	// Three vertices per triangle in leaf order, and which triangle of the mesh each one came from
+	std::vector<XMFLOAT3>	m_vertices;
+	std::vector<UINT>		m_triangleIds;
+	UINT					m_depth = 0;
+};
@@ -0,0 +1,179 @@
+// Pooled storage for scene objects, addressed through generational handles instead of raw pointers
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+/// <summary>
+/// Refers to an object in an ObjectPool. The generation changes every time a slot is reused,
+/// so a handle to a destroyed object stays invalid even after something else takes its slot.
+/// </summary>
+struct PoolHandle
+{
+	uint32_t Index = 0;
+	uint32_t Generation = 0; // 0 is never handed out, so a default handle is always null
+
+	bool IsNull() const { return Generation == 0; }
+	bool operator==(const PoolHandle& other) const { return Index == other.Index && Generation == other.Generation; }
+	bool operator!=(const PoolHandle& other) const { return !(*this == other); }
+};
+
+/// <summary>
+/// Stores objects in fixed size chunks so they sit next to each other in memory and never move once created.
+/// Create and Destroy are O(1) through a free list of slots, and iteration walks the slots in order, so destroying
+/// an object never changes the order the others are visited in.
+/// </summary>
+template <typename T, size_t CHUNK_SIZE = 1024>
+class ObjectPool
+{
+public:
+	ObjectPool() = default;
+	~ObjectPool() { Clear(); }
+
+	ObjectPool(const ObjectPool&) = delete;
+	ObjectPool& operator=(const ObjectPool&) = delete;
+
+	template <typename... Args>
+	PoolHandle Create(Args&&... args)
+	{
+		uint32_t index;
+		if (!m_freeSlots.empty())
+		{
+			index = m_freeSlots.back();
+			m_freeSlots.pop_back();
+		}
+		else
+		{
+			index = static_cast<uint32_t>(m_generations.size());
+			if (index % CHUNK_SIZE == 0) m_chunks.push_back(std::make_unique<Chunk>());
+
+			m_generations.push_back(1);
+			m_alive.push_back(0);
+		}
+
+		new (SlotAddress(index)) T(std::forward<Args>(args)...);
+		m_alive[index] = 1;
+		++m_liveCount;
+
+		return { index, m_generations[index] };
+	}
+
+	void Destroy(PoolHandle handle)
+	{
+		T* object = Get(handle);
+		if (object == nullptr) return;
+
+		object->~T();
+		m_alive[handle.Index] = 0;
+		--m_liveCount;
+
+		// Skip 0 on wrap around so the slot can't produce a null handle
+		if (++m_generations[handle.Index] == 0) m_generations[handle.Index] = 1;
+		m_freeSlots.push_back(handle.Index);
+	}
+
+	/// Gets the object a handle refers to, or nullptr if it has been destroyed.
+	T* Get(PoolHandle handle)
+	{
+		return IsValid(handle) ? SlotAddress(handle.Index) : nullptr;
+	}
+
+	const T* Get(PoolHandle handle) const
+	{
+		return IsValid(handle) ? SlotAddress(handle.Index) : nullptr;
+	}
+
+	bool IsValid(PoolHandle handle) const
+	{
+		return !handle.IsNull() && handle.Index < m_generations.size() && m_alive[handle.Index] && m_generations[handle.Index] == handle.Generation;
+	}
+
+	/// Number of live objects.
+	size_t Size() const { return m_liveCount; }
+
+	/// Number of slots ever used, live or not. Slot indices are what ParallelFor style loops split up.
+	size_t GetSlotCount() const { return m_generations.size(); }
+
+	/// Gets the object in a slot, or nullptr if the slot is empty.
+	T* GetAt(size_t slot)
+	{
+		return m_alive[slot] ? SlotAddress(static_cast<uint32_t>(slot)) : nullptr;
+	}
+
+	const T* GetAt(size_t slot) const
+	{
+		return m_alive[slot] ? SlotAddress(static_cast<uint32_t>(slot)) : nullptr;
+	}
+
+	PoolHandle GetHandleAt(size_t slot) const
+	{
+		return m_alive[slot] ? PoolHandle{ static_cast<uint32_t>(slot), m_generations[slot] } : PoolHandle{};
+	}
+
+	/// Calls function(T&) for every live object in slot order.
+	template <typename Function>
+	void ForEach(Function&& function)
+	{
+		for (size_t slot = 0; slot < m_generations.size(); ++slot)
+		{
+			if (m_alive[slot]) function(*SlotAddress(static_cast<uint32_t>(slot)));
+		}
+	}
+
+	/// Calls function(PoolHandle, T&) for every live object in slot order.
+	template <typename Function>
+	void ForEachWithHandle(Function&& function)
+	{
+		for (size_t slot = 0; slot < m_generations.size(); ++slot)
+		{
+			if (m_alive[slot]) function(PoolHandle{ static_cast<uint32_t>(slot), m_generations[slot] }, *SlotAddress(static_cast<uint32_t>(slot)));
+		}
+	}
+
+	/// Makes room for count objects up front, so bulk loading doesn't keep growing the bookkeeping.
+	void Reserve(size_t count)
+	{
+		m_chunks.reserve((count + CHUNK_SIZE - 1) / CHUNK_SIZE);
+		m_generations.reserve(count);
+		m_alive.reserve(count);
+	}
+
+	/// Destroys every object and releases the chunks.
+	void Clear()
+	{
+		for (size_t slot = 0; slot < m_generations.size(); ++slot)
+		{
+			if (m_alive[slot]) SlotAddress(static_cast<uint32_t>(slot))->~T();
+		}
+
+		m_chunks.clear();
+		m_generations.clear();
+		m_alive.clear();
+		m_freeSlots.clear();
+		m_liveCount = 0;
+	}
+
+private:
+	struct Chunk
+	{
+		alignas(T) unsigned char Storage[CHUNK_SIZE * sizeof(T)];
+	};
+
+	T* SlotAddress(uint32_t index) const
+	{
+		return std::launder(reinterpret_cast<T*>(m_chunks[index / CHUNK_SIZE]->Storage) + index % CHUNK_SIZE);
+	}
+
+	std::vector<std::unique_ptr<Chunk>>		m_chunks;
+
+	// Per slot bookkeeping is kept apart from the objects so skipping empty slots doesn't touch them
+	std::vector<uint32_t>					m_generations;
+	std::vector<uint8_t>					m_alive;
+	std::vector<uint32_t>					m_freeSlots;
+	size_t									m_liveCount = 0;
+};
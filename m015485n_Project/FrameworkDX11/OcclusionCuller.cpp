@@ -0,0 +1,327 @@
+#include "OcclusionCuller.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+
+#include "JobSystem.h"
+
+namespace
+{
+	// Boxes handed to each job while testing
+	constexpr size_t OCCLUSION_TEST_CHUNK_SIZE = 256;
+
+	typedef std::chrono::steady_clock Clock;
+
+	float MillisecondsSince(Clock::time_point start)
+	{
+		return std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+	}
+
+	XMFLOAT4 LerpClip(const XMFLOAT4& a, const XMFLOAT4& b, float t)
+	{
+		return XMFLOAT4(a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t, a.z + (b.z - a.z) * t, a.w + (b.w - a.w) * t);
+	}
+}
+
+OcclusionCuller::OcclusionCuller()
+	: m_depth(WIDTH * HEIGHT, 1.0f)
+	, m_blockDepth(BLOCKS_X * BLOCKS_Y, 1.0f)
+{
+	XMStoreFloat4x4(&m_viewProjection, XMMatrixIdentity());
+}
+
+void OcclusionCuller::BeginFrame(FXMMATRIX viewProjection)
+{
+	XMStoreFloat4x4(&m_viewProjection, viewProjection);
+	m_triangles.clear();
+	for (std::vector<UINT>& bin : m_bins) bin.clear();
+	m_submittedTriangles = 0;
+	m_stats = Stats();
+}
+
+bool OcclusionCuller::AddOccluder(const OccluderMesh& mesh, FXMMATRIX world)
+{
+	const UINT triangleCount = static_cast<UINT>(mesh.Indices.size() / 3);
+	if (m_submittedTriangles + triangleCount > TRIANGLE_BUDGET) return false;
+	m_submittedTriangles += triangleCount;
+	++m_stats.Occluders;
+
+	XMMATRIX worldViewProjection = world * XMLoadFloat4x4(&m_viewProjection);
+	m_clipVertices.resize(mesh.Positions.size());
+	for (size_t i = 0; i < mesh.Positions.size(); ++i)
+	{
+		XMStoreFloat4(&m_clipVertices[i], XMVector3Transform(XMLoadFloat3(&mesh.Positions[i]), worldViewProjection));
+	}
+
+	// A mirrored object turns its triangles inside out, so swap the winding back
+	const bool mirrored = XMVectorGetX(XMMatrixDeterminant(world)) < 0.0f;
+
+	for (size_t i = 0; i + 2 < mesh.Indices.size(); i += 3)
+	{
+		XMFLOAT4 v[3] = { m_clipVertices[mesh.Indices[i]], m_clipVertices[mesh.Indices[i + 1]], m_clipVertices[mesh.Indices[i + 2]] };
+		if (mirrored) std::swap(v[1], v[2]);
+
+		// Entirely outside one of the frustum's sides
+		if (v[0].x > v[0].w && v[1].x > v[1].w && v[2].x > v[2].w) continue;
+		if (v[0].x < -v[0].w && v[1].x < -v[1].w && v[2].x < -v[2].w) continue;
+		if (v[0].y > v[0].w && v[1].y > v[1].w && v[2].y > v[2].w) continue;
+		if (v[0].y < -v[0].w && v[1].y < -v[1].w && v[2].y < -v[2].w) continue;
+		if (v[0].z > v[0].w && v[1].z > v[1].w && v[2].z > v[2].w) continue;
+
+		const int behind = (v[0].z < 0.0f) + (v[1].z < 0.0f) + (v[2].z < 0.0f);
+		if (behind == 3) continue;
+		if (behind == 0)
+		{
+			AddClippedTriangle(v[0], v[1], v[2]);
+			continue;
+		}
+
+		// Cut off the part in front of the near plane (z = 0), which leaves a triangle or a quad
+		XMFLOAT4 polygon[4];
+		int polygonSize = 0;
+		for (int edge = 0; edge < 3; ++edge)
+		{
+			const XMFLOAT4& a = v[edge];
+			const XMFLOAT4& b = v[(edge + 1) % 3];
+			if (a.z >= 0.0f) polygon[polygonSize++] = a;
+			if ((a.z >= 0.0f) != (b.z >= 0.0f)) polygon[polygonSize++] = LerpClip(a, b, a.z / (a.z - b.z));
+		}
+
+		AddClippedTriangle(polygon[0], polygon[1], polygon[2]);
+		if (polygonSize == 4) AddClippedTriangle(polygon[0], polygon[2], polygon[3]);
+	}
+
+	return true;
+}
+
+void OcclusionCuller::AddClippedTriangle(const XMFLOAT4& v0, const XMFLOAT4& v1, const XMFLOAT4& v2)
+{
+	// To pixels, y down
+	const XMFLOAT4* vertices[3] = { &v0, &v1, &v2 };
+	float x[3], y[3], z[3];
+	for (int i = 0; i < 3; ++i)
+	{
+		float inverseW = 1.0f / vertices[i]->w;
+		x[i] = (vertices[i]->x * inverseW * 0.5f + 0.5f) * WIDTH;
+		y[i] = (0.5f - vertices[i]->y * inverseW * 0.5f) * HEIGHT;
+		z[i] = vertices[i]->z * inverseW;
+	}
+
+	// Front faces are clockwise on screen, which with y down is a positive area
+	const float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+	if (!(area > 0.0f)) return;
+
+	// Pixel centres are at + 0.5
+	Triangle triangle;
+	triangle.MinX = (std::max)(0, static_cast<int>(ceilf((std::min)({ x[0], x[1], x[2] }) - 0.5f)));
+	triangle.MaxX = (std::min)(static_cast<int>(WIDTH) - 1, static_cast<int>(floorf((std::max)({ x[0], x[1], x[2] }) - 0.5f)));
+	triangle.MinY = (std::max)(0, static_cast<int>(ceilf((std::min)({ y[0], y[1], y[2] }) - 0.5f)));
+	triangle.MaxY = (std::min)(static_cast<int>(HEIGHT) - 1, static_cast<int>(floorf((std::max)({ y[0], y[1], y[2] }) - 0.5f)));
+	if (triangle.MinX > triangle.MaxX || triangle.MinY > triangle.MaxY) return;
+
+	for (int edge = 0; edge < 3; ++edge)
+	{
+		int next = (edge + 1) % 3;
+		triangle.EdgeA[edge] = y[edge] - y[next];
+		triangle.EdgeB[edge] = x[next] - x[edge];
+		triangle.EdgeC[edge] = x[edge] * y[next] - y[edge] * x[next];
+	}
+
+	triangle.DzDx = ((z[1] - z[0]) * (y[2] - y[0]) - (z[2] - z[0]) * (y[1] - y[0])) / area;
+	triangle.DzDy = ((z[2] - z[0]) * (x[1] - x[0]) - (z[1] - z[0]) * (x[2] - x[0])) / area;
+	triangle.Z0 = z[0] - triangle.DzDx * x[0] - triangle.DzDy * y[0];
+
+	const UINT index = static_cast<UINT>(m_triangles.size());
+	m_triangles.push_back(triangle);
+
+	for (int tileY = triangle.MinY / static_cast<int>(TILE_HEIGHT); tileY <= triangle.MaxY / static_cast<int>(TILE_HEIGHT); ++tileY)
+	{
+		for (int tileX = triangle.MinX / static_cast<int>(TILE_WIDTH); tileX <= triangle.MaxX / static_cast<int>(TILE_WIDTH); ++tileX)
+		{
+			m_bins[tileY * TILES_X + tileX].push_back(index);
+		}
+	}
+}
+
+void OcclusionCuller::Rasterize()
+{
+	auto start = Clock::now();
+	m_stats.Triangles = static_cast<UINT>(m_triangles.size());
+
+	// Tiles only write their own pixels and blocks, so they need no locking
+	JobSystem::Get().ParallelFor(TILES_X * TILES_Y, 1, [this](size_t begin, size_t end)
+		{
+			for (size_t tile = begin; tile < end; ++tile) RasterizeTile(static_cast<UINT>(tile));
+		});
+
+	m_stats.RasterizeMs = MillisecondsSince(start);
+}
+
+void OcclusionCuller::RasterizeTile(UINT tile)
+{
+	const int tileMinX = static_cast<int>((tile % TILES_X) * TILE_WIDTH);
+	const int tileMinY = static_cast<int>((tile / TILES_X) * TILE_HEIGHT);
+	const int tileMaxX = tileMinX + static_cast<int>(TILE_WIDTH) - 1;
+	const int tileMaxY = tileMinY + static_cast<int>(TILE_HEIGHT) - 1;
+
+	for (int y = tileMinY; y <= tileMaxY; ++y)
+	{
+		std::fill_n(&m_depth[y * WIDTH + tileMinX], TILE_WIDTH, 1.0f);
+	}
+
+	const XMVECTOR laneOffsets = XMVectorSet(0.5f, 1.5f, 2.5f, 3.5f);
+	const XMVECTOR zero = XMVectorZero();
+
+	for (UINT triangleIndex : m_bins[tile])
+	{
+		const Triangle& triangle = m_triangles[triangleIndex];
+
+		// Four pixels across at a time, starting on a multiple of four so a group never leaves the tile
+		const int minX = (std::max)(triangle.MinX, tileMinX) & ~3;
+		const int maxX = (std::min)(triangle.MaxX, tileMaxX);
+		const int minY = (std::max)(triangle.MinY, tileMinY);
+		const int maxY = (std::min)(triangle.MaxY, tileMaxY);
+
+		const XMVECTOR edgeA0 = XMVectorReplicate(triangle.EdgeA[0]);
+		const XMVECTOR edgeA1 = XMVectorReplicate(triangle.EdgeA[1]);
+		const XMVECTOR edgeA2 = XMVectorReplicate(triangle.EdgeA[2]);
+		const XMVECTOR dzdx = XMVectorReplicate(triangle.DzDx);
+
+		// Moving four pixels right adds four times each x gradient
+		const XMVECTOR edgeStep0 = XMVectorReplicate(triangle.EdgeA[0] * 4.0f);
+		const XMVECTOR edgeStep1 = XMVectorReplicate(triangle.EdgeA[1] * 4.0f);
+		const XMVECTOR edgeStep2 = XMVectorReplicate(triangle.EdgeA[2] * 4.0f);
+		const XMVECTOR depthStep = XMVectorReplicate(triangle.DzDx * 4.0f);
+
+		const XMVECTOR pixelX = XMVectorAdd(XMVectorReplicate(static_cast<float>(minX)), laneOffsets);
+
+		for (int y = minY; y <= maxY; ++y)
+		{
+			const float pixelY = static_cast<float>(y) + 0.5f;
+
+			XMVECTOR edge0 = XMVectorMultiplyAdd(edgeA0, pixelX, XMVectorReplicate(triangle.EdgeB[0] * pixelY + triangle.EdgeC[0]));
+			XMVECTOR edge1 = XMVectorMultiplyAdd(edgeA1, pixelX, XMVectorReplicate(triangle.EdgeB[1] * pixelY + triangle.EdgeC[1]));
+			XMVECTOR edge2 = XMVectorMultiplyAdd(edgeA2, pixelX, XMVectorReplicate(triangle.EdgeB[2] * pixelY + triangle.EdgeC[2]));
+			XMVECTOR depth = XMVectorMultiplyAdd(dzdx, pixelX, XMVectorReplicate(triangle.DzDy * pixelY + triangle.Z0));
+
+			float* row = &m_depth[y * WIDTH];
+			for (int x = minX; x <= maxX; x += 4)
+			{
+				XMVECTOR inside = XMVectorAndInt(XMVectorAndInt(XMVectorGreaterOrEqual(edge0, zero), XMVectorGreaterOrEqual(edge1, zero)), XMVectorGreaterOrEqual(edge2, zero));
+
+				XMFLOAT4* pixels = reinterpret_cast<XMFLOAT4*>(&row[x]);
+				XMVECTOR current = XMLoadFloat4(pixels);
+				XMStoreFloat4(pixels, XMVectorSelect(current, XMVectorMin(current, depth), inside));
+
+				edge0 = XMVectorAdd(edge0, edgeStep0);
+				edge1 = XMVectorAdd(edge1, edgeStep1);
+				edge2 = XMVectorAdd(edge2, edgeStep2);
+				depth = XMVectorAdd(depth, depthStep);
+			}
+		}
+	}
+
+	// Farthest depth in each block, a box behind it is hidden by the whole block
+	for (int blockY = tileMinY / static_cast<int>(BLOCK_SIZE); blockY <= tileMaxY / static_cast<int>(BLOCK_SIZE); ++blockY)
+	{
+		for (int blockX = tileMinX / static_cast<int>(BLOCK_SIZE); blockX <= tileMaxX / static_cast<int>(BLOCK_SIZE); ++blockX)
+		{
+			XMVECTOR farthest = XMVectorZero();
+			for (UINT y = 0; y < BLOCK_SIZE; ++y)
+			{
+				const float* row = &m_depth[(blockY * BLOCK_SIZE + y) * WIDTH + blockX * BLOCK_SIZE];
+				for (UINT x = 0; x < BLOCK_SIZE; x += 4)
+				{
+					farthest = XMVectorMax(farthest, XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&row[x])));
+				}
+			}
+
+			XMFLOAT4 lanes;
+			XMStoreFloat4(&lanes, farthest);
+			m_blockDepth[blockY * BLOCKS_X + blockX] = (std::max)((std::max)(lanes.x, lanes.y), (std::max)(lanes.z, lanes.w));
+		}
+	}
+}
+
+bool OcclusionCuller::IsVisible(const BoundingBox& box) const
+{
+	XMFLOAT3 corners[BoundingBox::CORNER_COUNT];
+	box.GetCorners(corners);
+
+	const XMMATRIX viewProjection = XMLoadFloat4x4(&m_viewProjection);
+
+	float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX;
+	float nearestDepth = FLT_MAX;
+	for (const XMFLOAT3& corner : corners)
+	{
+		XMFLOAT4 clip;
+		XMStoreFloat4(&clip, XMVector3Transform(XMLoadFloat3(&corner), viewProjection));
+
+		// Reaches past the near plane, there is nothing in front of it to hide it
+		if (clip.z < 0.0f || clip.w <= 0.0f) return true;
+
+		float inverseW = 1.0f / clip.w;
+		float x = (clip.x * inverseW * 0.5f + 0.5f) * WIDTH;
+		float y = (0.5f - clip.y * inverseW * 0.5f) * HEIGHT;
+		minX = (std::min)(minX, x);
+		maxX = (std::max)(maxX, x);
+		minY = (std::min)(minY, y);
+		maxY = (std::max)(maxY, y);
+		nearestDepth = (std::min)(nearestDepth, clip.z * inverseW);
+	}
+
+	// Every pixel the box's screen rectangle touches
+	const int pixelMinX = (std::max)(0, static_cast<int>(floorf(minX)));
+	const int pixelMaxX = (std::min)(static_cast<int>(WIDTH) - 1, static_cast<int>(floorf(maxX)));
+	const int pixelMinY = (std::max)(0, static_cast<int>(floorf(minY)));
+	const int pixelMaxY = (std::min)(static_cast<int>(HEIGHT) - 1, static_cast<int>(floorf(maxY)));
+	if (pixelMinX > pixelMaxX || pixelMinY > pixelMaxY) return true;
+
+	for (int blockY = pixelMinY / static_cast<int>(BLOCK_SIZE); blockY <= pixelMaxY / static_cast<int>(BLOCK_SIZE); ++blockY)
+	{
+		for (int blockX = pixelMinX / static_cast<int>(BLOCK_SIZE); blockX <= pixelMaxX / static_cast<int>(BLOCK_SIZE); ++blockX)
+		{
+			if (m_blockDepth[blockY * BLOCKS_X + blockX] < nearestDepth) continue;
+
+			// Something in this block is as far as the box, check the pixels the box actually covers
+			const int startX = (std::max)(pixelMinX, blockX * static_cast<int>(BLOCK_SIZE));
+			const int endX = (std::min)(pixelMaxX, (blockX + 1) * static_cast<int>(BLOCK_SIZE) - 1);
+			const int startY = (std::max)(pixelMinY, blockY * static_cast<int>(BLOCK_SIZE));
+			const int endY = (std::min)(pixelMaxY, (blockY + 1) * static_cast<int>(BLOCK_SIZE) - 1);
+			for (int y = startY; y <= endY; ++y)
+			{
+				for (int x = startX; x <= endX; ++x)
+				{
+					if (m_depth[y * WIDTH + x] >= nearestDepth) return true;
+				}
+			}
+		}
+	}
+
+	return false;
+}
+
+void OcclusionCuller::Cull(const std::vector<BoundingBox>& bounds, std::vector<UINT>& visible)
+{
+	auto start = Clock::now();
+
+	m_hidden.resize(visible.size());
+	JobSystem::Get().ParallelFor(visible.size(), OCCLUSION_TEST_CHUNK_SIZE, [&](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; ++i) m_hidden[i] = !IsVisible(bounds[visible[i]]);
+		});
+
+	size_t kept = 0;
+	for (size_t i = 0; i < visible.size(); ++i)
+	{
+		if (!m_hidden[i]) visible[kept++] = visible[i];
+	}
+
+	m_stats.Tested = static_cast<UINT>(visible.size());
+	m_stats.Culled = static_cast<UINT>(visible.size() - kept);
+	visible.resize(kept);
+
+	m_stats.TestMs = MillisecondsSince(start);
+}
@@ -0,0 +1,108 @@
+// Rasterizes a few big meshes into a small depth buffer on the CPU, then tests bounding boxes against it so objects hidden behind them are never submitted
+
+#pragma once
+
+#include <windows.h>
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
+#include <vector>
+
+#include "structures.h"
+
+using namespace DirectX;
+
+/// <summary>
+/// A low resolution software depth buffer. Occluder triangles are transformed, clipped against the near plane and
+/// binned into screen tiles, then each tile is rasterized on its own job, four pixels at a time. Once a tile is
+/// done it records the farthest depth in each 8x8 block, so most boxes are settled by a handful of block reads.
+///
+/// A box is only culled when every pixel it covers already holds something nearer than its nearest point, so
+/// anything the buffer doesn't cover stays visible. Depth is D3D style, 0 at the near plane and 1 at the far one.
+/// </summary>
+class OcclusionCuller
+{
+public:
+	static constexpr UINT WIDTH = 256;
+	static constexpr UINT HEIGHT = 144;
+	static constexpr UINT TILE_WIDTH = 32;
+	static constexpr UINT TILE_HEIGHT = 24;
+	static constexpr UINT TILES_X = WIDTH / TILE_WIDTH;
+	static constexpr UINT TILES_Y = HEIGHT / TILE_HEIGHT;
+	static constexpr UINT BLOCK_SIZE = 8;
+	static constexpr UINT BLOCKS_X = WIDTH / BLOCK_SIZE;
+	static constexpr UINT BLOCKS_Y = HEIGHT / BLOCK_SIZE;
+
+	// Occluders past this many triangles in a frame are left out, the caller adds the most useful ones first
+	static constexpr UINT TRIANGLE_BUDGET = 32768;
+
+	OcclusionCuller();
+
+	/// Forgets the last frame's occluders, ready for a new set seen through viewProjection.
+	void	BeginFrame(FXMMATRIX viewProjection);
+
+	/// Transforms and bins one occluder's triangles. Back faces are dropped, the same ones the renderer drops.
+	/// @return False if the mesh would go over TRIANGLE_BUDGET, in which case nothing is added.
+	bool	AddOccluder(const OccluderMesh& mesh, FXMMATRIX world);
+
+	/// Clears and fills the buffer, one job per tile.
+	void	Rasterize();
+
+	/// Tests a world space box against the buffer. Only meaningful after Rasterize.
+	bool	IsVisible(const BoundingBox& box) const;
+
+	/// Removes the entries of visible whose boxes are hidden, keeping the rest in order.
+	/// @param bounds World space boxes, indexed by the values in visible.
+	void	Cull(const std::vector<BoundingBox>& bounds, std::vector<UINT>& visible);
+
+	struct Stats
+	{
+		UINT	Occluders = 0;
+		UINT	Triangles = 0;
+		UINT	Tested = 0;
+		UINT	Culled = 0;
+		float	RasterizeMs = 0.0f;
+		float	TestMs = 0.0f;
+	};
+
+	const Stats& GetStats() const { return m_stats; }
+
+	/// WIDTH * HEIGHT depths, top row first, for the debug view.
+	const float* GetDepth() const { return m_depth.data(); }
+
+private:
+	struct Triangle
+	{
+		// Edge functions A * x + B * y + C, positive inside
+		float	EdgeA[3];
+		float	EdgeB[3];
+		float	EdgeC[3];
+
+		// Depth as a plane over the screen, Z0 + DzDx * x + DzDy * y
+		float	Z0;
+		float	DzDx;
+		float	DzDy;
+
+		// Pixels whose centres could be inside, inclusive
+		int		MinX;
+		int		MinY;
+		int		MaxX;
+		int		MaxY;
+	};
+
+	void	AddClippedTriangle(const XMFLOAT4& v0, const XMFLOAT4& v1, const XMFLOAT4& v2);
+	void	RasterizeTile(UINT tile);
+
+	XMFLOAT4X4					m_viewProjection;
+
+	// Reused every frame, the clip space vertices of the occluder being added and the triangles of all of them
+	std::vector<XMFLOAT4>		m_clipVertices;
+	std::vector<Triangle>		m_triangles;
+	std::vector<UINT>			m_bins[TILES_X * TILES_Y];
+
+	std::vector<float>			m_depth;
+	std::vector<float>			m_blockDepth;
+	std::vector<char>			m_hidden;
+	UINT						m_submittedTriangles = 0;
+
+	Stats						m_stats;
+};
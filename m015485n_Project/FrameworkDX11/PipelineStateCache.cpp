@@ -0,0 +1,103 @@
+#include "PipelineStateCache.h"
+
+#include <cstring>
+#include <limits>
+
+namespace
+{
+	// FNV-1a over the raw bytes
+	size_t HashBytes(const void* data, size_t size)
+	{
+		const unsigned char* bytes = static_cast<const unsigned char*>(data);
+		size_t hash = 14695981039346656037ull;
+		for (size_t i = 0; i < size; ++i)
+		{
+			hash ^= bytes[i];
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+}
+
+PipelineStateCache& PipelineStateCache::Get()
+{
+	static PipelineStateCache cache;
+	return cache;
+}
+
+template <typename Desc, typename State>
+template <typename CreateFunction>
+StateId PipelineStateCache::StateTable<Desc, State>::Find(const Desc& desc, CreateFunction&& create)
+{
+	++m_requests;
+
+	size_t hash = HashBytes(&desc, sizeof(Desc));
+	auto range = m_lookup.equal_range(hash);
+	for (auto it = range.first; it != range.second; ++it)
+	{
+		if (memcmp(&m_descs[it->second], &desc, sizeof(Desc)) == 0)
+		{
+			++m_hits;
+			return it->second;
+		}
+	}
+
+	if (m_states.size() > (std::numeric_limits<StateId>::max)())
+	{
+		MessageBox(nullptr, L"Ran out of pipeline state ids, using the default state.", L"Error", MB_OK);
+		return 0;
+	}
+
+	Microsoft::WRL::ComPtr<State> state;
+	HRESULT hr = create(desc, state.GetAddressOf());
+	if (FAILED(hr))
+	{
+		MessageBox(nullptr, L"Failed to create a pipeline state, using the default state.", L"Error", MB_OK);
+		return 0;
+	}
+
+	StateId id = static_cast<StateId>(m_states.size());
+	m_descs.push_back(desc);
+	m_states.push_back(state);
+	m_lookup.emplace(hash, id);
+
+	return id;
+}
+
+StateId PipelineStateCache::GetSamplerId(const D3D11_SAMPLER_DESC& desc)
+{
+	return m_samplers.Find(desc, [this](const D3D11_SAMPLER_DESC& d, ID3D11SamplerState** state) { return m_pd3dDevice->CreateSamplerState(&d, state); });
+}
+
+StateId PipelineStateCache::GetRasterizerId(const D3D11_RASTERIZER_DESC& desc)
+{
+	return m_rasterizers.Find(desc, [this](const D3D11_RASTERIZER_DESC& d, ID3D11RasterizerState** state) { return m_pd3dDevice->CreateRasterizerState(&d, state); });
+}
+
+StateId PipelineStateCache::GetBlendId(const D3D11_BLEND_DESC& desc)
+{
+	return m_blends.Find(desc, [this](const D3D11_BLEND_DESC& d, ID3D11BlendState** state) { return m_pd3dDevice->CreateBlendState(&d, state); });
+}
+
+StateId PipelineStateCache::GetDepthStencilId(const D3D11_DEPTH_STENCIL_DESC& desc)
+{
+	return m_depthStencils.Find(desc, [this](const D3D11_DEPTH_STENCIL_DESC& d, ID3D11DepthStencilState** state) { return m_pd3dDevice->CreateDepthStencilState(&d, state); });
+}
+
+void PipelineStateCache::Bind(StateTrackingContext& context, const PipelineStateIds& states) const
+{
+	context.PSSetSampler(0, m_samplers.Get(states.Sampler));
+	context.RSSetState(m_rasterizers.Get(states.Rasterizer));
+	context.OMSetBlendState(m_blends.Get(states.Blend));
+	context.OMSetDepthStencilState(m_depthStencils.Get(states.DepthStencil));
+}
+
+void PipelineStateCache::Clear()
+{
+	m_samplers.Clear();
+	m_rasterizers.Clear();
+	m_blends.Clear();
+	m_depthStencils.Clear();
+
+	m_pd3dDevice = nullptr;
+}
@@ -0,0 +1,130 @@
+// Shared cache of sampler, rasterizer, blend and depth stencil states, looked up by their descriptions
+
+#pragma once
+
+#include <d3d11_1.h>
+#include <wrl/client.h>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "StateTrackingContext.h"
+
+/// Small handle to a cached state. 0 is always the D3D default (binding nullptr).
+typedef uint16_t StateId;
+
+/// <summary>
+/// The fixed function states a draw uses, stored as ids so a render item stays small and comparing two is cheap.
+/// </summary>
+struct PipelineStateIds
+{
+	StateId	Sampler = 0;
+	StateId	Rasterizer = 0;
+	StateId	Blend = 0;
+	StateId	DepthStencil = 0;
+};
+
+/// <summary>
+/// Creates each distinct state object once and hands the same one back to everyone asking for an identical
+/// description. Descriptions are compared by their bytes, so zero them (= {} or ZeroMemory) before filling
+/// them in. The Get*Id calls update the lists and hit counts without a lock, so states are only created on the
+/// render thread. Bind and the getters only read, so the job system's threads can bind while recording command
+/// lists, as long as nothing creates a state until they're done.
+/// </summary>
+class PipelineStateCache
+{
+public:
+	/// Gets the shared cache.
+	static PipelineStateCache& Get();
+
+	void	Init(ID3D11Device* device) { m_pd3dDevice = device; }
+
+	/// Releases every state, call before the device goes away.
+	void	Clear();
+
+	StateId	GetSamplerId(const D3D11_SAMPLER_DESC& desc);
+	StateId	GetRasterizerId(const D3D11_RASTERIZER_DESC& desc);
+	StateId	GetBlendId(const D3D11_BLEND_DESC& desc);
+	StateId	GetDepthStencilId(const D3D11_DEPTH_STENCIL_DESC& desc);
+
+	ID3D11SamplerState*			GetSampler(StateId id) const { return m_samplers.Get(id); }
+	ID3D11RasterizerState*		GetRasterizer(StateId id) const { return m_rasterizers.Get(id); }
+	ID3D11BlendState*			GetBlend(StateId id) const { return m_blends.Get(id); }
+	ID3D11DepthStencilState*	GetDepthStencil(StateId id) const { return m_depthStencils.Get(id); }
+
+	/// Binds the states for a draw, the context skips any that are already bound.
+	/// The sampler goes in pixel shader slot 0.
+	void	Bind(StateTrackingContext& context, const PipelineStateIds& states) const;
+
+	/// Counts for the stats window.
+	struct Stats
+	{
+		UINT		Objects = 0;
+		uint64_t	Requests = 0;
+		uint64_t	Hits = 0;
+
+		float		GetHitRate() const { return Requests == 0 ? 0.0f : static_cast<float>(Hits) / static_cast<float>(Requests); }
+	};
+
+	Stats	GetSamplerStats() const { return m_samplers.GetStats(); }
+	Stats	GetRasterizerStats() const { return m_rasterizers.GetStats(); }
+	Stats	GetBlendStats() const { return m_blends.GetStats(); }
+	Stats	GetDepthStencilStats() const { return m_depthStencils.GetStats(); }
+
+	PipelineStateCache(const PipelineStateCache&) = delete;
+	PipelineStateCache& operator=(const PipelineStateCache&) = delete;
+
+private:
+	PipelineStateCache() = default;
+
+	/// <summary>
+	/// One kind of state. Slot 0 holds nullptr for the default state and is never looked up.
+	/// </summary>
+	template <typename Desc, typename State>
+	class StateTable
+	{
+	public:
+		StateTable() { Clear(); }
+
+		/// @param create Called as create(desc, State**) when the description hasn't been seen before.
+		template <typename CreateFunction>
+		StateId Find(const Desc& desc, CreateFunction&& create);
+
+		State* Get(StateId id) const { return id < m_states.size() ? m_states[id].Get() : nullptr; }
+
+		Stats GetStats() const
+		{
+			Stats stats;
+			stats.Objects = static_cast<UINT>(m_states.size() - 1);
+			stats.Requests = m_requests;
+			stats.Hits = m_hits;
+			return stats;
+		}
+
+		void Clear()
+		{
+			m_descs.assign(1, Desc{});
+			m_states.assign(1, nullptr);
+			m_lookup.clear();
+			m_requests = 0;
+			m_hits = 0;
+		}
+
+	private:
+		std::vector<Desc>								m_descs;
+		std::vector<Microsoft::WRL::ComPtr<State>>		m_states;
+
+		// Hash of the description to every id with that hash
+		std::unordered_multimap<size_t, StateId>		m_lookup;
+
+		uint64_t										m_requests = 0;
+		uint64_t										m_hits = 0;
+	};
+
+	ID3D11Device*														m_pd3dDevice = nullptr;
+
+	StateTable<D3D11_SAMPLER_DESC, ID3D11SamplerState>					m_samplers;
+	StateTable<D3D11_RASTERIZER_DESC, ID3D11RasterizerState>			m_rasterizers;
+	StateTable<D3D11_BLEND_DESC, ID3D11BlendState>						m_blends;
+	StateTable<D3D11_DEPTH_STENCIL_DESC, ID3D11DepthStencilState>		m_depthStencils;
+};
@@ -0,0 +1,411 @@
+#include "RenderGraph.h"
+
+#include <algorithm>
+
+namespace
+{
+	// Imported resources are keyed by their id, created ones by their texture with this bit set
+	constexpr UINT PHYSICAL_KEY_BIT = 0x80000000u;
+}
+
+RenderGraph::ResourceId RenderGraph::CreateTexture(const char* name, const RenderTargetDesc& desc)
+{
+	Resource resource;
+	resource.Name = name;
+	resource.Type = RESOURCE_CREATED;
+	resource.Desc = desc;
+	m_resources.push_back(resource);
+	return static_cast<ResourceId>(m_resources.size() - 1);
+}
+
+RenderGraph::ResourceId RenderGraph::ImportTexture(const char* name, ID3D11RenderTargetView* renderTargetView, ID3D11ShaderResourceView* shaderResourceView)
+{
+	Resource resource;
+	resource.Name = name;
+	resource.Type = RESOURCE_IMPORTED;
+	resource.ImportedRenderTarget = renderTargetView;
+	resource.ImportedShaderResource = shaderResourceView;
+	m_resources.push_back(resource);
+	return static_cast<ResourceId>(m_resources.size() - 1);
+}
+
+RenderGraph::ResourceId RenderGraph::ImportTarget(const char* name, RenderTargetPool::TargetId target)
+{
+	Resource resource;
+	resource.Name = name;
+	resource.Type = RESOURCE_IMPORTED;
+	resource.ImportedTarget = target;
+	m_resources.push_back(resource);
+	return static_cast<ResourceId>(m_resources.size() - 1);
+}
+
+RenderGraph::ResourceId RenderGraph::ImportDepth(const char* name, ID3D11DepthStencilView* depthStencilView, ID3D11ShaderResourceView* shaderResourceView)
+{
+	Resource resource;
+	resource.Name = name;
+	resource.Type = RESOURCE_IMPORTED_DEPTH;
+	resource.ImportedDepthStencil = depthStencilView;
+	resource.ImportedShaderResource = shaderResourceView;
+	m_resources.push_back(resource);
+	return static_cast<ResourceId>(m_resources.size() - 1);
+}
+
+RenderGraph::PassId RenderGraph::AddPass(const char* name, ExecuteFunction execute)
+{
+	Pass pass;
+	pass.Name = name;
+	pass.Execute = std::move(execute);
+	m_passes.push_back(std::move(pass));
+	return static_cast<PassId>(m_passes.size() - 1);
+}
+
+void RenderGraph::Read(PassId pass, ResourceId resource, UINT slot)
+{
+	m_passes[pass].Reads.push_back({ resource, slot });
+}
+
+void RenderGraph::Write(PassId pass, ResourceId resource, bool clear, const float* clearColour)
+{
+	WriteAccess write = { resource, clear };
+	if (clearColour != nullptr) std::copy(clearColour, clearColour + 4, write.ClearColour);
+	m_passes[pass].Writes.push_back(write);
+}
+
+void RenderGraph::WriteDepth(PassId pass, ResourceId resource, bool clear)
+{
+	m_passes[pass].Depth = { resource, clear };
+}
+
+void RenderGraph::Clear()
+{
+	ReleaseTargets();
+	m_resources.clear();
+	m_passes.clear();
+	m_executionOrder.clear();
+	m_physicalDescs.clear();
+	m_error.clear();
+	m_stats = {};
+}
+
+bool RenderGraph::Compile()
+{
+	ReleaseTargets();
+	m_executionOrder.clear();
+	m_physicalDescs.clear();
+	m_error.clear();
+	m_stats = {};
+	for (Resource& resource : m_resources) resource.Physical = INVALID_ID;
+
+	// A graph texture holds nothing until a pass has drawn to it, imported ones still have last frame's contents
+	for (PassId pass = 0; pass < m_passes.size(); ++pass)
+	{
+		for (const ReadAccess& read : m_passes[pass].Reads)
+		{
+			if (m_resources[read.Resource].Type != RESOURCE_CREATED || FindLastWriter(read.Resource, pass) != INVALID_ID) continue;
+
+			m_error = "Pass '" + m_passes[pass].Name + "' reads '" + m_resources[read.Resource].Name + "' before anything writes it";
+			for (Pass& culled : m_passes) culled.Kept = false;
+			return false;
+		}
+	}
+
+	CullPasses();
+
+	// Passes were added in an order that works, keeping it means a pass reading last frame's contents of an
+	// imported texture still runs before the pass that overwrites them
+	for (PassId pass = 0; pass < m_passes.size(); ++pass)
+	{
+		if (m_passes[pass].Kept) m_executionOrder.push_back({ pass, {}, false });
+	}
+
+	AssignPhysicalTextures();
+	FindUnbinds();
+
+	m_stats.Passes = static_cast<UINT>(m_passes.size());
+	m_stats.CulledPasses = m_stats.Passes - static_cast<UINT>(m_executionOrder.size());
+	for (const CompiledPass& compiled : m_executionOrder)
+	{
+		m_stats.UnbindSlots += static_cast<UINT>(compiled.UnbindSlots.size());
+		if (compiled.UnbindRenderTargets) ++m_stats.UnbindRenderTargets;
+	}
+
+	return true;
+}
+
+RenderGraph::PassId RenderGraph::FindLastWriter(ResourceId resource, PassId before) const
+{
+	for (PassId pass = before; pass-- > 0;)
+	{
+		const Pass& writer = m_passes[pass];
+		if (writer.Depth.Resource == resource) return pass;
+		for (const WriteAccess& write : writer.Writes)
+		{
+			if (write.Resource == resource) return pass;
+		}
+	}
+	return INVALID_ID;
+}
+
+bool RenderGraph::PassWrites(const Pass& pass, UINT resourceKey) const
+{
+	if (pass.Depth.Resource != INVALID_ID && GetResourceKey(pass.Depth.Resource) == resourceKey) return true;
+	for (const WriteAccess& write : pass.Writes)
+	{
+		if (GetResourceKey(write.Resource) == resourceKey) return true;
+	}
+	return false;
+}
+
+UINT RenderGraph::GetResourceKey(ResourceId resource) const
+{
+	const Resource& r = m_resources[resource];
+	return r.Type == RESOURCE_CREATED ? (r.Physical | PHYSICAL_KEY_BIT) : resource;
+}
+
+void RenderGraph::CullPasses()
+{
+	std::vector<PassId> needed;
+	for (PassId pass = 0; pass < m_passes.size(); ++pass)
+	{
+		Pass& p = m_passes[pass];
+		p.Kept = p.SideEffects;
+		for (const WriteAccess& write : p.Writes)
+		{
+			if (m_resources[write.Resource].Type == RESOURCE_IMPORTED) p.Kept = true;
+		}
+		if (p.Kept) needed.push_back(pass);
+	}
+
+	// Whatever wrote a kept pass's inputs last is kept too, as is whoever wrote a target it draws over without clearing
+	auto keepWriter = [this, &needed](ResourceId resource, PassId reader)
+		{
+			const PassId writer = FindLastWriter(resource, reader);
+			if (writer == INVALID_ID || m_passes[writer].Kept) return;
+			m_passes[writer].Kept = true;
+			needed.push_back(writer);
+		};
+
+	while (!needed.empty())
+	{
+		const PassId pass = needed.back();
+		needed.pop_back();
+
+		const Pass& p = m_passes[pass];
+		for (const ReadAccess& read : p.Reads) keepWriter(read.Resource, pass);
+		for (const WriteAccess& write : p.Writes)
+		{
+			if (!write.Clear) keepWriter(write.Resource, pass);
+		}
+		if (p.Depth.Resource != INVALID_ID && !p.Depth.Clear) keepWriter(p.Depth.Resource, pass);
+	}
+}
+
+void RenderGraph::AssignPhysicalTextures()
+{
+	// Each created texture lives from the first kept pass using it to the last
+	std::vector<UINT> firstUse(m_resources.size(), INVALID_ID);
+	std::vector<UINT> lastUse(m_resources.size(), 0);
+	auto use = [this, &firstUse, &lastUse](ResourceId resource, UINT position)
+		{
+			if (m_resources[resource].Type != RESOURCE_CREATED) return;
+			if (firstUse[resource] == INVALID_ID) firstUse[resource] = position;
+			lastUse[resource] = position;
+		};
+
+	for (UINT position = 0; position < m_executionOrder.size(); ++position)
+	{
+		const Pass& pass = m_passes[m_executionOrder[position].Pass];
+		for (const ReadAccess& read : pass.Reads) use(read.Resource, position);
+		for (const WriteAccess& write : pass.Writes) use(write.Resource, position);
+		if (pass.Depth.Resource != INVALID_ID) use(pass.Depth.Resource, position);
+	}
+
+	std::vector<ResourceId> transients;
+	for (ResourceId resource = 0; resource < m_resources.size(); ++resource)
+	{
+		if (firstUse[resource] != INVALID_ID) transients.push_back(resource);
+	}
+	std::stable_sort(transients.begin(), transients.end(), [&firstUse](ResourceId a, ResourceId b) { return firstUse[a] < firstUse[b]; });
+
+	// Handed out in the order they come alive, a texture is free again once the pass after its last user starts.
+	// A pass reading one texture and writing another never gets the same one for both
+	std::vector<UINT> physicalLastUse;
+	for (ResourceId resource : transients)
+	{
+		Resource& r = m_resources[resource];
+		++m_stats.TransientTextures;
+		m_stats.TransientBytes += r.Desc.GetSize();
+
+		UINT physical = INVALID_ID;
+		for (UINT candidate = 0; candidate < m_physicalDescs.size(); ++candidate)
+		{
+			if (m_physicalDescs[candidate] == r.Desc && physicalLastUse[candidate] < firstUse[resource])
+			{
+				physical = candidate;
+				break;
+			}
+		}
+
+		if (physical == INVALID_ID)
+		{
+			physical = static_cast<UINT>(m_physicalDescs.size());
+			m_physicalDescs.push_back(r.Desc);
+			physicalLastUse.push_back(0);
+			m_stats.AliasedBytes += r.Desc.GetSize();
+		}
+
+		r.Physical = physical;
+		physicalLastUse[physical] = lastUse[resource];
+	}
+
+	m_stats.PhysicalTextures = static_cast<UINT>(m_physicalDescs.size());
+}
+
+void RenderGraph::FindUnbinds()
+{
+	const UINT count = static_cast<UINT>(m_executionOrder.size());
+	for (UINT position = 0; position < count; ++position)
+	{
+		CompiledPass& compiled = m_executionOrder[position];
+		const Pass& pass = m_passes[compiled.Pass];
+
+		// A shader resource stays bound until another pass binds over its slot. If a pass draws to the texture first
+		// (render targets are bound before shader resources) or nothing does before the frame ends, it is unbound
+		for (const ReadAccess& read : pass.Reads)
+		{
+			const UINT key = GetResourceKey(read.Resource);
+			bool unbind = true;
+			for (UINT next = position + 1; next < count; ++next)
+			{
+				const Pass& nextPass = m_passes[m_executionOrder[next].Pass];
+				if (PassWrites(nextPass, key)) break;
+
+				auto sameSlot = [&read](const ReadAccess& other) { return other.Slot == read.Slot; };
+				if (std::any_of(nextPass.Reads.begin(), nextPass.Reads.end(), sameSlot))
+				{
+					unbind = false;
+					break;
+				}
+			}
+
+			if (unbind && std::find(compiled.UnbindSlots.begin(), compiled.UnbindSlots.end(), read.Slot) == compiled.UnbindSlots.end())
+			{
+				compiled.UnbindSlots.push_back(read.Slot);
+			}
+		}
+
+		// Render targets stay bound until a pass binds its own, so the passes in between that don't draw to anything
+		// can't sample them. The last pass's are left bound for whatever draws over the frame afterwards
+		if (pass.Writes.empty() && pass.Depth.Resource == INVALID_ID) continue;
+
+		for (UINT next = position + 1; next < count; ++next)
+		{
+			const Pass& nextPass = m_passes[m_executionOrder[next].Pass];
+			if (!nextPass.Writes.empty() || nextPass.Depth.Resource != INVALID_ID) break;
+
+			auto sampled = [this, &pass](const ReadAccess& read) { return PassWrites(pass, GetResourceKey(read.Resource)); };
+			if (std::any_of(nextPass.Reads.begin(), nextPass.Reads.end(), sampled))
+			{
+				m_executionOrder[next - 1].UnbindRenderTargets = true;
+				break;
+			}
+		}
+	}
+}
+
+HRESULT RenderGraph::Allocate(ID3D11Device* device, RenderTargetPool& pool)
+{
+	ReleaseTargets();
+	m_pool = &pool;
+
+	for (const RenderTargetDesc& desc : m_physicalDescs)
+	{
+		const RenderTargetPool::TargetId target = pool.Acquire(device, desc);
+		if (target == RenderTargetPool::INVALID_ID)
+		{
+			ReleaseTargets();
+			return E_FAIL;
+		}
+		m_targets.push_back(target);
+	}
+
+	return S_OK;
+}
+
+const float* RenderGraph::GetClearColour(PassId pass, ResourceId resource) const
+{
+	for (const WriteAccess& write : m_passes[pass].Writes)
+	{
+		if (write.Resource == resource) return write.ClearColour;
+	}
+	return nullptr;
+}
+
+void RenderGraph::Execute(StateTrackingContext& context) const
+{
+	for (const CompiledPass& compiled : m_executionOrder)
+	{
+		const Pass& pass = m_passes[compiled.Pass];
+
+		// A pass that draws to nothing leaves the last pass's targets bound
+		if (!pass.Writes.empty() || pass.Depth.Resource != INVALID_ID)
+		{
+			ID3D11RenderTargetView* renderTargets[D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT] = {};
+			const UINT renderTargetCount = (std::min)(static_cast<UINT>(pass.Writes.size()), static_cast<UINT>(D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT));
+			for (UINT i = 0; i < renderTargetCount; ++i) renderTargets[i] = GetRenderTargetView(pass.Writes[i].Resource);
+
+			ID3D11DepthStencilView* depth = pass.Depth.Resource != INVALID_ID ? m_resources[pass.Depth.Resource].ImportedDepthStencil : nullptr;
+			context.OMSetRenderTargets(renderTargetCount, renderTargets, depth);
+
+			for (UINT i = 0; i < renderTargetCount; ++i)
+			{
+				if (pass.Writes[i].Clear && renderTargets[i] != nullptr) context.Get()->ClearRenderTargetView(renderTargets[i], pass.Writes[i].ClearColour);
+			}
+			if (depth != nullptr && pass.Depth.Clear) context.Get()->ClearDepthStencilView(depth, D3D11_CLEAR_DEPTH, 1.0f, 0);
+		}
+
+		for (const ReadAccess& read : pass.Reads)
+		{
+			context.PSSetShaderResource(read.Slot, GetShaderResourceView(read.Resource));
+
+			const RenderTargetPool::TargetId target = GetPoolTarget(read.Resource);
+			if (target != RenderTargetPool::INVALID_ID) m_pool->AddRead(target);
+		}
+		for (const WriteAccess& write : pass.Writes)
+		{
+			const RenderTargetPool::TargetId target = GetPoolTarget(write.Resource);
+			if (target != RenderTargetPool::INVALID_ID) m_pool->AddWrite(target);
+		}
+
+		if (pass.Execute) pass.Execute(context);
+
+		for (UINT slot : compiled.UnbindSlots) context.PSSetShaderResource(slot, nullptr);
+		if (compiled.UnbindRenderTargets) context.OMSetRenderTargets(0, nullptr, nullptr);
+	}
+}
+
+ID3D11ShaderResourceView* RenderGraph::GetShaderResourceView(ResourceId resource) const
+{
+	const RenderTargetPool::TargetId target = GetPoolTarget(resource);
+	return target != RenderTargetPool::INVALID_ID ? m_pool->GetShaderResourceView(target) : m_resources[resource].ImportedShaderResource;
+}
+
+ID3D11RenderTargetView* RenderGraph::GetRenderTargetView(ResourceId resource) const
+{
+	const RenderTargetPool::TargetId target = GetPoolTarget(resource);
+	return target != RenderTargetPool::INVALID_ID ? m_pool->GetRenderTargetView(target) : m_resources[resource].ImportedRenderTarget;
+}
+
+RenderTargetPool::TargetId RenderGraph::GetPoolTarget(ResourceId resource) const
+{
+	const Resource& r = m_resources[resource];
+	if (m_pool == nullptr) return RenderTargetPool::INVALID_ID;
+	if (r.Type != RESOURCE_CREATED) return r.ImportedTarget;
+	return r.Physical < m_targets.size() ? m_targets[r.Physical] : RenderTargetPool::INVALID_ID;
+}
+
+void RenderGraph::ReleaseTargets()
+{
+	for (RenderTargetPool::TargetId target : m_targets) m_pool->Release(target);
+	m_targets.clear();
+}
@@ -0,0 +1,197 @@
+// The frame's passes declared with the textures they read and write, compiled into what runs, in what order and on which textures
+
+#pragma once
+
+#include <windows.h>
+#include <d3d11_1.h>
+#include <wrl/client.h>
+#include <climits>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "RenderTargetPool.h"
+#include "StateTrackingContext.h"
+
+/// <summary>
+/// Passes are added in the order they should run and say which textures they read (and the pixel shader slot they
+/// read them from) and which they draw to. Compile then works backwards from the passes that write textures living
+/// outside the graph, the back buffer or anything kept between frames, and drops every pass nothing needs. Textures
+/// the graph makes are only alive from the first pass that uses them to the last, and ones whose lives don't overlap
+/// are given the same texture. It also works out where a shader resource has to be unbound before the texture is
+/// drawn to again, and where render targets have to be unbound before the next pass samples them.
+///
+/// Compiling is plain CPU work on the declarations, so it runs in the benchmarks without a device. Allocate then
+/// takes the textures from a render target pool and Execute runs the passes.
+/// </summary>
+class RenderGraph
+{
+public:
+	typedef UINT ResourceId;
+	typedef UINT PassId;
+	typedef std::function<void(StateTrackingContext& context)> ExecuteFunction;
+
+	static constexpr UINT INVALID_ID = UINT_MAX;
+
+	/// A texture made and owned by the graph, only valid while the passes using it run.
+	ResourceId	CreateTexture(const char* name, const RenderTargetDesc& desc);
+
+	/// A texture owned by someone else that outlives the frame, so passes writing it are always kept.
+	ResourceId	ImportTexture(const char* name, ID3D11RenderTargetView* renderTargetView, ID3D11ShaderResourceView* shaderResourceView);
+
+	/// A pool target held by someone else for longer than a frame, counted in the pool's traffic like the graph's own.
+	ResourceId	ImportTarget(const char* name, RenderTargetPool::TargetId target);
+
+	/// A depth buffer owned by someone else. Nothing reads it after the frame, so writing it doesn't keep a pass.
+	/// @param shaderResourceView Lets later passes sample the depth, nullptr if the buffer can't be.
+	ResourceId	ImportDepth(const char* name, ID3D11DepthStencilView* depthStencilView, ID3D11ShaderResourceView* shaderResourceView = nullptr);
+
+	/// @param execute Draws the pass, called with its render targets and shader resources already bound.
+	PassId		AddPass(const char* name, ExecuteFunction execute);
+
+	/// The pass samples resource from pixel shader slot, it is bound there before the pass runs.
+	void	Read(PassId pass, ResourceId resource, UINT slot);
+
+	/// The pass draws to resource, render targets are bound in the order they are written.
+	/// @param clear Clear first, otherwise the pass draws over what was there and needs whoever wrote it.
+	/// @param clearColour What to clear to, nullptr for opaque black.
+	void	Write(PassId pass, ResourceId resource, bool clear = true, const float* clearColour = nullptr);
+
+	/// The pass depth tests against resource, clearing it to 1 first if clear is set.
+	void	WriteDepth(PassId pass, ResourceId resource, bool clear = true);
+
+	/// The pass does something outside the graph's textures and is never dropped.
+	void	SetSideEffects(PassId pass) { m_passes[pass].SideEffects = true; }
+
+	/// Forgets every pass and resource and hands the targets back to the pool.
+	void	Clear();
+
+	/// Culls, orders, assigns textures and works out the unbinds.
+	/// @return False if a pass reads a graph texture nothing wrote before it, GetError says which.
+	bool	Compile();
+
+	/// <summary>
+	/// A pass that survived compiling, with what to unbind once it has run.
+	/// </summary>
+	struct CompiledPass
+	{
+		PassId				Pass;
+		std::vector<UINT>	UnbindSlots;
+		bool				UnbindRenderTargets;
+	};
+
+	const std::vector<CompiledPass>&	GetExecutionOrder() const { return m_executionOrder; }
+	const std::string&					GetError() const { return m_error; }
+
+	UINT		GetPassCount() const { return static_cast<UINT>(m_passes.size()); }
+	const char*	GetPassName(PassId pass) const { return m_passes[pass].Name.c_str(); }
+	bool		IsPassCulled(PassId pass) const { return !m_passes[pass].Kept; }
+
+	/// What pass clears resource to before drawing to it, nullptr if it doesn't write it.
+	const float*	GetClearColour(PassId pass, ResourceId resource) const;
+
+	UINT		GetResourceCount() const { return static_cast<UINT>(m_resources.size()); }
+	const char*	GetResourceName(ResourceId resource) const { return m_resources[resource].Name.c_str(); }
+
+	/// Which of the graph's textures a created resource was given, INVALID_ID for imported or unused ones.
+	UINT		GetPhysicalTexture(ResourceId resource) const { return m_resources[resource].Physical; }
+
+	/// Descriptions of the textures the last compile needs, indexed by GetPhysicalTexture.
+	const std::vector<RenderTargetDesc>&	GetPhysicalTextures() const { return m_physicalDescs; }
+
+	struct Stats
+	{
+		UINT		Passes = 0;
+		UINT		CulledPasses = 0;
+		UINT		TransientTextures = 0;
+		UINT		PhysicalTextures = 0;
+		uint64_t	TransientBytes = 0;
+		uint64_t	AliasedBytes = 0;
+		UINT		UnbindSlots = 0;
+		UINT		UnbindRenderTargets = 0;
+	};
+
+	/// TransientBytes is what the created textures would take each in their own texture, AliasedBytes what they take shared.
+	const Stats&	GetStats() const { return m_stats; }
+
+	/// Acquires the targets the last compile needs. The ones from before are handed back first, so a recompile
+	/// that still needs the same textures gets the same ones.
+	HRESULT	Allocate(ID3D11Device* device, RenderTargetPool& pool);
+
+	/// The pool the last Allocate took its targets from.
+	const RenderTargetPool*	GetPool() const { return m_pool; }
+
+	/// Runs the compiled passes, counting their reads and writes of the pool's targets.
+	void	Execute(StateTrackingContext& context) const;
+
+	/// The texture a resource uses, nullptr for a created resource that hasn't been allocated or was culled.
+	ID3D11ShaderResourceView*	GetShaderResourceView(ResourceId resource) const;
+	ID3D11RenderTargetView*		GetRenderTargetView(ResourceId resource) const;
+
+	/// Hands every target back to the pool.
+	void	ReleaseTargets();
+
+private:
+	enum ResourceType
+	{
+		RESOURCE_CREATED,
+		RESOURCE_IMPORTED,
+		RESOURCE_IMPORTED_DEPTH
+	};
+
+	struct Resource
+	{
+		std::string					Name;
+		ResourceType				Type;
+		RenderTargetDesc			Desc;
+		ID3D11RenderTargetView*		ImportedRenderTarget = nullptr;
+		ID3D11ShaderResourceView*	ImportedShaderResource = nullptr;
+		ID3D11DepthStencilView*		ImportedDepthStencil = nullptr;
+		RenderTargetPool::TargetId	ImportedTarget = RenderTargetPool::INVALID_ID;
+		UINT						Physical = INVALID_ID;
+	};
+
+	struct ReadAccess
+	{
+		ResourceId	Resource;
+		UINT		Slot;
+	};
+
+	struct WriteAccess
+	{
+		ResourceId	Resource;
+		bool		Clear;
+		float		ClearColour[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+	};
+
+	struct Pass
+	{
+		std::string					Name;
+		ExecuteFunction				Execute;
+		std::vector<ReadAccess>		Reads;
+		std::vector<WriteAccess>	Writes;
+		WriteAccess					Depth = { INVALID_ID, false };
+		bool						SideEffects = false;
+		bool						Kept = false;
+	};
+
+	PassId	FindLastWriter(ResourceId resource, PassId before) const;
+	bool	PassWrites(const Pass& pass, UINT resourceKey) const;
+	UINT	GetResourceKey(ResourceId resource) const;
+	RenderTargetPool::TargetId	GetPoolTarget(ResourceId resource) const;
+	void	CullPasses();
+	void	AssignPhysicalTextures();
+	void	FindUnbinds();
+
+	std::vector<Resource>				m_resources;
+	std::vector<Pass>					m_passes;
+	std::vector<CompiledPass>			m_executionOrder;
+	std::vector<RenderTargetDesc>		m_physicalDescs;
+	std::string							m_error;
+	Stats								m_stats;
+
+	// The pool's target for each of the last compile's textures, set by Allocate
+	RenderTargetPool*							m_pool = nullptr;
+	std::vector<RenderTargetPool::TargetId>		m_targets;
+};
@@ -0,0 +1,350 @@
+#include "RenderQueue.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace
+{
+	// Used when the projection isn't a perspective one the planes can be read back out of
+	constexpr float DEFAULT_NEAR = 0.01f;
+	constexpr float DEFAULT_FAR = 1000.0f;
+
+	constexpr UINT MIN_ID_SLOTS = 64;
+	constexpr UINT MIN_INSTANCE_CAPACITY = 256;
+
+	typedef std::chrono::steady_clock Clock;
+
+	float MillisecondsSince(Clock::time_point start)
+	{
+		return std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+	}
+
+	uint64_t Field(UINT value, UINT bits)
+	{
+		return (std::min)(value, (1u << bits) - 1);
+	}
+
+	size_t HashPointer(const void* pointer)
+	{
+		// The low bits of a heap pointer are mostly alignment
+		const uint64_t bits = reinterpret_cast<uintptr_t>(pointer) >> 4;
+		return static_cast<size_t>((bits * 0x9E3779B97F4A7C15ull) >> 32);
+	}
+
+	void CountChange(const RenderItem& item, const RenderItem* previous, RenderQueue::RebindCounts& counts)
+	{
+		if (previous == nullptr || item.PixelShader != previous->PixelShader) ++counts.Shaders;
+		if (previous == nullptr || item.Texture != previous->Texture) ++counts.Textures;
+		if (previous == nullptr || item.NormalMap != previous->NormalMap) ++counts.Textures;
+		if (previous == nullptr || item.VertexBuffer != previous->VertexBuffer) ++counts.Buffers;
+		if (previous == nullptr || item.IndexBuffer != previous->IndexBuffer) ++counts.Buffers;
+	}
+}
+
+uint64_t RenderQueue::MakeKey(UINT pass, bool transparent, UINT shader, UINT texture, UINT normalMap, UINT material, UINT mesh, UINT depth)
+{
+	uint64_t state = Field(shader, SHADER_BITS);
+	state = state << TEXTURE_BITS | Field(texture, TEXTURE_BITS);
+	state = state << NORMAL_MAP_BITS | Field(normalMap, NORMAL_MAP_BITS);
+	state = state << MESH_BITS | Field(mesh, MESH_BITS);
+	state = state << MATERIAL_BITS | Field(material, MATERIAL_BITS);
+
+	const uint64_t depthField = Field(depth, DEPTH_BITS);
+	const uint64_t maxDepth = (1ull << DEPTH_BITS) - 1;
+
+	uint64_t key = static_cast<uint64_t>(pass) << PASS_SHIFT;
+	if (transparent) key |= 1ull << (PASS_SHIFT - 1) | (maxDepth - depthField) << (PASS_SHIFT - 1 - DEPTH_BITS) | state;
+	else key |= state << DEPTH_BITS | depthField;
+	return key;
+}
+
+void RenderQueue::Build(RenderSnapshot& snapshot, bool sort, bool instance)
+{
+	const Clock::time_point start = Clock::now();
+	std::vector<SortedDraw>& draws = snapshot.DrawQueue;
+	draws.clear();
+
+	// A left handed perspective projection has _33 = f / (f - n) and _43 = -n f / (f - n)
+	const XMFLOAT4X4& projection = snapshot.Projection;
+	float nearPlane = DEFAULT_NEAR;
+	float farPlane = DEFAULT_FAR;
+	if (projection._33 != 0.0f && projection._33 != 1.0f && projection._34 != 0.0f)
+	{
+		nearPlane = -projection._43 / projection._33;
+		farPlane = projection._43 / (1.0f - projection._33);
+	}
+	if (!(nearPlane > 0.0f) || !(farPlane > nearPlane))
+	{
+		nearPlane = DEFAULT_NEAR;
+		farPlane = DEFAULT_FAR;
+	}
+	const float maxDepth = static_cast<float>((1u << DEPTH_BITS) - 1);
+	const float depthScale = maxDepth / logf(farPlane / nearPlane);
+
+	const XMFLOAT4X4& view = snapshot.View;
+	for (UINT index : snapshot.VisibleItems)
+	{
+		const RenderItem& item = snapshot.RenderItems[index];
+
+		uint64_t key = 0;
+		if (sort)
+		{
+			const float viewZ = item.World._41 * view._13 + item.World._42 * view._23 + item.World._43 * view._33 + view._43;
+			const float bucket = logf((std::max)(viewZ, nearPlane) / nearPlane) * depthScale;
+			const UINT depth = static_cast<UINT>((std::min)(bucket, maxDepth));
+
+			key = MakeKey(0, item.States.Blend != 0, m_shaderIds.GetId(item.PixelShader), m_textureIds.GetId(item.Texture),
+				m_textureIds.GetId(item.NormalMap), item.MaterialIndex, m_meshIds.GetId(item.VertexBuffer), depth);
+		}
+
+		for (UINT pass = 0; pass < PASS_COUNT; ++pass)
+		{
+			if (item.PassMask & (1u << pass)) draws.push_back({ key | static_cast<uint64_t>(pass) << PASS_SHIFT, index });
+		}
+	}
+
+	RadixSort(draws, m_scratch);
+
+	snapshot.Instanced = instance;
+	if (instance) BuildBatches(snapshot);
+
+	m_stats.Draws = static_cast<UINT>(draws.size());
+	m_stats.Batches = static_cast<UINT>(instance ? snapshot.DrawBatches.size() : draws.size());
+	m_stats.BuildMs = MillisecondsSince(start);
+	m_stats.Sorted = CountRebinds(snapshot);
+	m_stats.Unsorted = CountUnsortedRebinds(snapshot);
+}
+
+void RenderQueue::RadixSort(std::vector<SortedDraw>& draws, std::vector<SortedDraw>& scratch)
+{
+	const size_t count = draws.size();
+	if (count < 2) return;
+
+	// Every byte's histogram in one read of the keys
+	UINT histograms[8][256] = {};
+	for (const SortedDraw& draw : draws)
+	{
+		for (UINT digit = 0; digit < 8; ++digit) ++histograms[digit][(draw.Key >> (digit * 8)) & 0xFF];
+	}
+
+	scratch.resize(count);
+	SortedDraw* source = draws.data();
+	SortedDraw* destination = scratch.data();
+	bool swapped = false;
+
+	for (UINT digit = 0; digit < 8; ++digit)
+	{
+		UINT* histogram = histograms[digit];
+
+		// Every key has the same byte here, the pass wouldn't move anything
+		if (histogram[(source[0].Key >> (digit * 8)) & 0xFF] == count) continue;
+
+		UINT offset = 0;
+		for (UINT bucket = 0; bucket < 256; ++bucket)
+		{
+			const UINT size = histogram[bucket];
+			histogram[bucket] = offset;
+			offset += size;
+		}
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			destination[histogram[(source[i].Key >> (digit * 8)) & 0xFF]++] = source[i];
+		}
+
+		std::swap(source, destination);
+		swapped = !swapped;
+	}
+
+	// The sorted keys ended up in the scratch buffer, hand its storage over rather than copying back
+	if (swapped) draws.swap(scratch);
+}
+
+std::pair<size_t, size_t> RenderQueue::FindPass(const std::vector<SortedDraw>& draws, UINT pass)
+{
+	const uint64_t first = static_cast<uint64_t>(pass) << PASS_SHIFT;
+	auto keyLess = [](const SortedDraw& draw, uint64_t key) { return draw.Key < key; };
+
+	auto begin = std::lower_bound(draws.begin(), draws.end(), first, keyLess);
+	auto end = pass + 1 < (1u << (64 - PASS_SHIFT)) ? std::lower_bound(begin, draws.end(), first + (1ull << PASS_SHIFT), keyLess) : draws.end();
+	return { static_cast<size_t>(begin - draws.begin()), static_cast<size_t>(end - draws.begin()) };
+}
+
+void RenderQueue::BuildBatches(RenderSnapshot& snapshot)
+{
+	const std::vector<SortedDraw>& draws = snapshot.DrawQueue;
+	snapshot.Instances.resize(draws.size());
+	snapshot.DrawBatches.clear();
+
+	const RenderItem* previous = nullptr;
+	UINT previousPass = 0;
+	for (UINT i = 0; i < static_cast<UINT>(draws.size()); ++i)
+	{
+		const RenderItem& item = snapshot.RenderItems[draws[i].Item];
+		snapshot.Instances[i] = { item.World, item.MaterialIndex };
+
+		// Only neighbours are joined, a transparent draw can't jump ahead of whatever it has to blend over
+		const UINT pass = GetPass(draws[i].Key);
+		if (previous != nullptr && pass == previousPass && CanInstance(item, *previous)) ++snapshot.DrawBatches.back().Count;
+		else snapshot.DrawBatches.push_back({ i, 1 });
+
+		previous = &item;
+		previousPass = pass;
+	}
+}
+
+bool RenderQueue::CanInstance(const RenderItem& a, const RenderItem& b)
+{
+	return a.PixelShader == b.PixelShader && a.Texture == b.Texture && a.NormalMap == b.NormalMap &&
+		a.VertexBuffer == b.VertexBuffer && a.IndexBuffer == b.IndexBuffer && a.VBStride == b.VBStride && a.VBOffset == b.VBOffset &&
+		a.VertexCount == b.VertexCount && a.States.Sampler == b.States.Sampler && a.States.Rasterizer == b.States.Rasterizer &&
+		a.States.Blend == b.States.Blend && a.States.DepthStencil == b.States.DepthStencil;
+}
+
+std::pair<size_t, size_t> RenderQueue::FindBatches(const std::vector<DrawBatch>& batches, size_t first, size_t last)
+{
+	auto firstLess = [](const DrawBatch& batch, size_t draw) { return batch.First < draw; };
+
+	auto begin = std::lower_bound(batches.begin(), batches.end(), first, firstLess);
+	auto end = std::lower_bound(begin, batches.end(), last, firstLess);
+	return { static_cast<size_t>(begin - batches.begin()), static_cast<size_t>(end - batches.begin()) };
+}
+
+RenderQueue::RebindCounts RenderQueue::CountRebinds(const RenderSnapshot& snapshot)
+{
+	RebindCounts counts;
+	const RenderItem* previous = nullptr;
+	UINT previousPass = 0;
+	for (const SortedDraw& draw : snapshot.DrawQueue)
+	{
+		// Each pass starts with nothing bound
+		if (GetPass(draw.Key) != previousPass) previous = nullptr;
+		previousPass = GetPass(draw.Key);
+
+		const RenderItem& item = snapshot.RenderItems[draw.Item];
+		CountChange(item, previous, counts);
+		previous = &item;
+	}
+	return counts;
+}
+
+RenderQueue::RebindCounts RenderQueue::CountUnsortedRebinds(const RenderSnapshot& snapshot)
+{
+	RebindCounts counts;
+	for (UINT pass = 0; pass < PASS_COUNT; ++pass)
+	{
+		const RenderItem* previous = nullptr;
+		for (UINT index : snapshot.VisibleItems)
+		{
+			const RenderItem& item = snapshot.RenderItems[index];
+			if (!(item.PassMask & (1u << pass))) continue;
+
+			CountChange(item, previous, counts);
+			previous = &item;
+		}
+	}
+	return counts;
+}
+
+void RenderQueue::Clear()
+{
+	m_shaderIds.Clear();
+	m_textureIds.Clear();
+	m_meshIds.Clear();
+}
+
+UINT RenderQueue::IdTable::GetId(const void* pointer)
+{
+	if (pointer == nullptr) return 0;
+	if (pointer == m_lastPointer) return m_lastId;
+
+	// Kept at most half full so probes stay short
+	if ((m_count + 1) * 2 > m_slots.size()) Grow();
+
+	const size_t mask = m_slots.size() - 1;
+	size_t slot = HashPointer(pointer) & mask;
+	while (m_slots[slot].first != nullptr && m_slots[slot].first != pointer) slot = (slot + 1) & mask;
+
+	if (m_slots[slot].first == nullptr) m_slots[slot] = { pointer, ++m_count };
+
+	m_lastPointer = pointer;
+	m_lastId = m_slots[slot].second;
+	return m_lastId;
+}
+
+void RenderQueue::IdTable::Clear()
+{
+	m_slots.clear();
+	m_count = 0;
+	m_lastPointer = nullptr;
+	m_lastId = 0;
+}
+
+void RenderQueue::IdTable::Grow()
+{
+	std::vector<std::pair<const void*, UINT>> old;
+	old.swap(m_slots);
+	m_slots.assign((std::max)(static_cast<size_t>(MIN_ID_SLOTS), old.size() * 2), { nullptr, 0 });
+
+	const size_t mask = m_slots.size() - 1;
+	for (const auto& entry : old)
+	{
+		if (entry.first == nullptr) continue;
+
+		size_t slot = HashPointer(entry.first) & mask;
+		while (m_slots[slot].first != nullptr) slot = (slot + 1) & mask;
+		m_slots[slot] = entry;
+	}
+}
+
+HRESULT InstanceBuffer::Apply(ID3D11Device* device, ID3D11DeviceContext* context, const std::vector<InstanceData>& instances)
+{
+	if (instances.empty()) return S_OK;
+
+	if (instances.size() > m_capacity)
+	{
+		HRESULT hr = Grow(device, static_cast<UINT>(instances.size()));
+		if (FAILED(hr)) return hr;
+	}
+
+	// Only the part of the buffer this frame uses
+	D3D11_BOX box = {};
+	box.right = static_cast<UINT>(sizeof(InstanceData) * instances.size());
+	box.bottom = 1;
+	box.back = 1;
+	context->UpdateSubresource(m_buffer.Get(), 0, &box, instances.data(), 0, 0);
+
+	return S_OK;
+}
+
+HRESULT InstanceBuffer::Grow(ID3D11Device* device, UINT instanceCount)
+{
+	UINT capacity = (std::max)(m_capacity, MIN_INSTANCE_CAPACITY);
+	while (capacity < instanceCount) capacity *= 2;
+
+	D3D11_BUFFER_DESC bd = {};
+	bd.Usage = D3D11_USAGE_DEFAULT;
+	bd.ByteWidth = sizeof(InstanceData) * capacity;
+	bd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+	bd.CPUAccessFlags = 0;
+
+	m_buffer.Reset();
+	m_capacity = 0;
+
+	HRESULT hr = device->CreateBuffer(&bd, nullptr, &m_buffer);
+	if (FAILED(hr))
+	{
+		MessageBox(nullptr, L"Failed to create the instance buffer.", L"Error", MB_OK);
+		return hr;
+	}
+
+	m_capacity = capacity;
+	return S_OK;
+}
+
+void InstanceBuffer::Clear()
+{
+	m_buffer.Reset();
+	m_capacity = 0;
+}
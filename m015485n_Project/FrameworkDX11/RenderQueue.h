@@ -0,0 +1,148 @@
+// Orders a frame's draws by a 64 bit key so draws sharing a shader, textures and mesh go one after another
+
+#pragma once
+
+#include <windows.h>
+#include <d3d11_1.h>
+#include <wrl/client.h>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "RenderSnapshot.h"
+
+/// <summary>
+/// Builds a key for every visible item in every pass it is drawn in and radix sorts them, so a pass's draws come
+/// out grouped by what they bind. From the most significant bit:
+///
+///   opaque		pass 2 | 0 | shader 7 | texture 14 | normal map 8 | mesh 10 | material 12 | depth 10
+///   transparent	pass 2 | 1 | far to near depth 10 | shader 7 | texture 14 | normal map 8 | mesh 10 | material 12
+///
+/// Opaque draws are sorted by state and only then near to far, transparent ones (anything with a blend state) go
+/// after them back to front so they blend over the right things. Materials are only an index in the per object
+/// constants and cost nothing to change, so they come below the mesh. Depth is the distance to the object's origin,
+/// spaced logarithmically between the near and far planes. Shaders, textures and meshes are numbered the first
+/// time the queue sees them; a number too big for its field is clamped, which only costs some grouping.
+///
+/// Runs on the simulation thread while the snapshot is built. Sorting is least significant byte first, skipping the
+/// bytes every key shares, into a scratch buffer that is kept between frames.
+///
+/// With instancing on, the sorted queue is then cut into batches, runs of draws that bind exactly the same things,
+/// and every draw's world matrix and material goes in the snapshot's instance list. The key puts an item's material
+/// and depth below everything it binds, so objects sharing a mesh, shader and textures end up in one batch.
+/// </summary>
+class RenderQueue
+{
+public:
+	static constexpr UINT PASS_COUNT = 2;
+
+	static constexpr UINT SHADER_BITS = 7;
+	static constexpr UINT TEXTURE_BITS = 14;
+	static constexpr UINT NORMAL_MAP_BITS = 8;
+	static constexpr UINT MATERIAL_BITS = 12;
+	static constexpr UINT MESH_BITS = 10;
+	static constexpr UINT DEPTH_BITS = 10;
+	static constexpr UINT PASS_SHIFT = 62;
+
+	static uint64_t	MakeKey(UINT pass, bool transparent, UINT shader, UINT texture, UINT normalMap, UINT material, UINT mesh, UINT depth);
+	static UINT		GetPass(uint64_t key) { return static_cast<UINT>(key >> PASS_SHIFT); }
+
+	/// Fills snapshot.DrawQueue from its RenderItems and VisibleItems.
+	/// @param sort False keeps each pass in the order the items are visible, to compare against.
+	/// @param instance Also fills snapshot.Instances and snapshot.DrawBatches.
+	void	Build(RenderSnapshot& snapshot, bool sort = true, bool instance = false);
+
+	/// True if two items can be drawn as instances of one draw, everything but the world matrix and material matches.
+	static bool	CanInstance(const RenderItem& a, const RenderItem& b);
+
+	/// Sorts by key, draws with equal keys stay in the order they were in.
+	static void	RadixSort(std::vector<SortedDraw>& draws, std::vector<SortedDraw>& scratch);
+
+	/// Where one pass's draws are in a sorted queue, [first, last).
+	static std::pair<size_t, size_t>	FindPass(const std::vector<SortedDraw>& draws, UINT pass);
+
+	/// The batches whose draws are in [first, last) of the queue, as found by FindPass. Batches never span passes.
+	static std::pair<size_t, size_t>	FindBatches(const std::vector<DrawBatch>& batches, size_t first, size_t last);
+
+	/// How often consecutive draws of a pass differ in what they bind, what a submission skipping redundant
+	/// binds would set. Textures count the texture and normal map apart, buffers the vertex and index buffer.
+	struct RebindCounts
+	{
+		UINT	Shaders = 0;
+		UINT	Textures = 0;
+		UINT	Buffers = 0;
+	};
+
+	/// Counts the queue as it is.
+	static RebindCounts	CountRebinds(const RenderSnapshot& snapshot);
+
+	/// Counts each pass's visible items in the order they were added, as they were drawn before sorting.
+	static RebindCounts	CountUnsortedRebinds(const RenderSnapshot& snapshot);
+
+	struct Stats
+	{
+		UINT			Draws = 0;
+		UINT			Batches = 0;	// draw calls, the same as Draws with instancing off
+		float			BuildMs = 0.0f;
+		RebindCounts	Sorted;
+		RebindCounts	Unsorted;
+	};
+
+	/// The last Build's.
+	const Stats&	GetStats() const { return m_stats; }
+
+	/// Forgets the numbers given to shaders, textures and meshes, for when they are all replaced.
+	void	Clear();
+
+private:
+	void	BuildBatches(RenderSnapshot& snapshot);
+
+	/// <summary>
+	/// Numbers pointers from 1 in the order they are first seen, nullptr is 0. Open addressing with linear probing,
+	/// and the last pointer looked up is remembered as neighbouring items often share one.
+	/// </summary>
+	class IdTable
+	{
+	public:
+		UINT	GetId(const void* pointer);
+		void	Clear();
+
+	private:
+		void	Grow();
+
+		std::vector<std::pair<const void*, UINT>>	m_slots;
+		UINT										m_count = 0;
+		const void*									m_lastPointer = nullptr;
+		UINT										m_lastId = 0;
+	};
+
+	IdTable						m_shaderIds;
+	IdTable						m_textureIds;
+	IdTable						m_meshIds;
+	std::vector<SortedDraw>		m_scratch;
+	Stats						m_stats;
+};
+
+/// <summary>
+/// Render side of the instances, the snapshot's instance list in a vertex buffer bound to slot 1 for the instanced
+/// vertex shader. Only the part the frame uses is written, the buffer is recreated at double the size when the
+/// instances outgrow it.
+/// </summary>
+class InstanceBuffer
+{
+public:
+	static constexpr UINT VERTEX_SLOT = 1;
+
+	HRESULT	Apply(ID3D11Device* device, ID3D11DeviceContext* context, const std::vector<InstanceData>& instances);
+
+	ID3D11Buffer*	GetBuffer() const { return m_buffer.Get(); }
+	UINT			GetCapacity() const { return m_capacity; }
+
+	void	Clear();
+
+private:
+	HRESULT	Grow(ID3D11Device* device, UINT instanceCount);
+
+	Microsoft::WRL::ComPtr<ID3D11Buffer>	m_buffer;
+	UINT									m_capacity = 0;
+};
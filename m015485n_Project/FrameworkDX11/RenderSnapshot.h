@@ -0,0 +1,123 @@
+// The immutable per-frame copy of the scene that the simulation stage hands to the render stage
+
+#pragma once
+
+#include <d3d11_1.h>
+#include <DirectXMath.h>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "ClusteredLights.h"
+#include "MaterialTable.h"
+#include "PipelineStateCache.h"
+#include "structures.h"
+
+using namespace DirectX;
+
+// Which of the scene passes in DX11Renderer::Update an item is drawn in
+enum RenderPassMask
+{
+	RENDER_PASS_SCENE = 1 << 0,
+	RENDER_PASS_RENDER_TEXTURE = 1 << 1
+};
+
+/// <summary>
+/// Everything needed to draw one object. The D3D pointers are not ref counted, the scene owns
+/// the meshes, textures and shaders for its whole lifetime so they outlive any snapshot.
+/// </summary>
+struct RenderItem
+{
+	XMFLOAT4X4							World;
+	UINT								MaterialIndex;
+	UINT								PassMask;
+	PipelineStateIds					States;
+
+	ID3D11PixelShader*					PixelShader;
+	ID3D11ShaderResourceView*			Texture;
+	ID3D11ShaderResourceView*			NormalMap;
+
+	ID3D11Buffer*						VertexBuffer;
+	ID3D11Buffer*						IndexBuffer;
+	UINT								VBStride;
+	UINT								VBOffset;
+	UINT								VertexCount;
+};
+
+// One draw of an item in one pass, ordered by RenderQueue's key
+struct SortedDraw
+{
+	uint64_t							Key;
+	UINT								Item;
+};
+
+// One draw's row of the per instance vertex stream, read by the instanced vertex shader as WORLD0-3 and MATERIAL
+struct InstanceData
+{
+	XMFLOAT4X4							World;
+	UINT								MaterialIndex;
+};
+
+// A run of draws next to each other in the queue that bind the same things, drawn with one instanced draw
+struct DrawBatch
+{
+	UINT								First;
+	UINT								Count;
+};
+
+struct RenderSnapshot
+{
+	void Clear()
+	{
+		RenderItems.clear();
+		VisibleItems.clear();
+		DrawQueue.clear();
+		Instances.clear();
+		DrawBatches.clear();
+		Lights.clear();
+		LightClusterRanges.clear();
+		LightClusterIndices.clear();
+		MaterialUpdates.clear();
+	}
+
+	unsigned long long							FrameIndex = 0;
+	float										DeltaTime = 0.0f;
+
+	XMFLOAT4X4									View;
+	XMFLOAT4X4									Projection;
+	XMFLOAT4									EyePosition;
+
+	std::vector<RenderItem>						RenderItems;
+
+	// Indexes into RenderItems of the items inside the camera frustum, in the same order
+	std::vector<UINT>							VisibleItems;
+
+	// The visible items in the order they are drawn, each pass's draws together and pass 0 first
+	std::vector<SortedDraw>						DrawQueue;
+
+	// Only filled when Instanced is set. Instances has a row for each entry in DrawQueue, so a batch's
+	// First is both where its draws start in the queue and its first instance
+	bool										Instanced = false;
+	std::vector<InstanceData>					Instances;
+	std::vector<DrawBatch>						DrawBatches;
+	std::vector<Light>							Lights;
+
+	// Which lights reach each cluster of the view, copied out of the scene's LightClusterGrid
+	std::vector<LightClusterRange>				LightClusterRanges;
+	std::vector<UINT>							LightClusterIndices;
+	UINT										GlobalLightCount = 0;
+	float										ClusterDepthScale = 0.0f;
+	float										ClusterDepthBias = 0.0f;
+
+	// Size of the material table and the entries that changed since the last snapshot
+	UINT										MaterialCount = 0;
+	std::vector<MaterialUpdate>					MaterialUpdates;
+
+	// When the simulation stage started on this frame, used to measure the pipeline's latency
+	std::chrono::steady_clock::time_point		SimulationStart;
+	float										SimulationMs = 0.0f;
+
+	// How the simulation time split between updating the scene and filling in this snapshot
+	float										UpdateMs = 0.0f;
+	float										BuildSnapshotMs = 0.0f;
+};
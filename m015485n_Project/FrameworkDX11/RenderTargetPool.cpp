@@ -0,0 +1,152 @@
+#include "RenderTargetPool.h"
+
+UINT RenderTargetDesc::GetBytesPerPixel(DXGI_FORMAT format)
+{
+	switch (format)
+	{
+	case DXGI_FORMAT_R32G32B32A32_FLOAT:
+	case DXGI_FORMAT_R32G32B32A32_UINT:
+		return 16;
+	case DXGI_FORMAT_R16G16B16A16_FLOAT:
+	case DXGI_FORMAT_R16G16B16A16_UNORM:
+	case DXGI_FORMAT_R32G32_FLOAT:
+		return 8;
+	case DXGI_FORMAT_R8G8B8A8_UNORM:
+	case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB:
+	case DXGI_FORMAT_B8G8R8A8_UNORM:
+	case DXGI_FORMAT_R10G10B10A2_UNORM:
+	case DXGI_FORMAT_R11G11B10_FLOAT:
+	case DXGI_FORMAT_R16G16_FLOAT:
+	case DXGI_FORMAT_R16G16_UNORM:
+	case DXGI_FORMAT_R32_FLOAT:
+	case DXGI_FORMAT_D24_UNORM_S8_UINT:
+	case DXGI_FORMAT_D32_FLOAT:
+		return 4;
+	case DXGI_FORMAT_R16_FLOAT:
+	case DXGI_FORMAT_R8G8_UNORM:
+		return 2;
+	case DXGI_FORMAT_R8_UNORM:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+RenderTargetPool::TargetId RenderTargetPool::Acquire(ID3D11Device* device, const RenderTargetDesc& desc)
+{
+	++m_acquires;
+
+	TargetId emptySlot = INVALID_ID;
+	for (TargetId id = 0; id < m_targets.size(); ++id)
+	{
+		Target& target = m_targets[id];
+		if (target.Texture == nullptr)
+		{
+			if (emptySlot == INVALID_ID) emptySlot = id;
+			continue;
+		}
+		if (target.InUse || target.Desc != desc) continue;
+
+		target.InUse = true;
+		++m_reuses;
+		return id;
+	}
+
+	Target created;
+	created.Desc = desc;
+
+	D3D11_TEXTURE2D_DESC textureDesc = {};
+	textureDesc.Width = desc.Width;
+	textureDesc.Height = desc.Height;
+	textureDesc.MipLevels = 1;
+	textureDesc.ArraySize = 1;
+	textureDesc.Format = desc.Format;
+	textureDesc.SampleDesc.Count = 1;
+	textureDesc.SampleDesc.Quality = 0;
+	textureDesc.Usage = D3D11_USAGE_DEFAULT;
+	textureDesc.BindFlags = desc.BindFlags;
+
+	HRESULT hr = device->CreateTexture2D(&textureDesc, nullptr, &created.Texture);
+	if (FAILED(hr))
+	{
+		MessageBox(nullptr, L"Failed to create a pooled render target.", L"Error", MB_OK);
+		return INVALID_ID;
+	}
+
+	if (desc.BindFlags & D3D11_BIND_RENDER_TARGET)
+	{
+		hr = device->CreateRenderTargetView(created.Texture.Get(), nullptr, &created.RenderTargetView);
+		if (FAILED(hr))
+		{
+			MessageBox(nullptr, L"Failed to create a pooled render target view.", L"Error", MB_OK);
+			return INVALID_ID;
+		}
+	}
+
+	if (desc.BindFlags & D3D11_BIND_SHADER_RESOURCE)
+	{
+		hr = device->CreateShaderResourceView(created.Texture.Get(), nullptr, &created.ShaderResourceView);
+		if (FAILED(hr))
+		{
+			MessageBox(nullptr, L"Failed to create a pooled render target shader resource view.", L"Error", MB_OK);
+			return INVALID_ID;
+		}
+	}
+
+	created.InUse = true;
+	if (emptySlot != INVALID_ID)
+	{
+		m_targets[emptySlot] = created;
+		return emptySlot;
+	}
+
+	m_targets.push_back(created);
+	return static_cast<TargetId>(m_targets.size() - 1);
+}
+
+void RenderTargetPool::Release(TargetId target)
+{
+	if (target < m_targets.size()) m_targets[target].InUse = false;
+}
+
+void RenderTargetPool::BeginFrame()
+{
+	m_lastFrameReadBytes = m_frameReadBytes;
+	m_lastFrameWrittenBytes = m_frameWrittenBytes;
+	m_frameReadBytes = 0;
+	m_frameWrittenBytes = 0;
+}
+
+void RenderTargetPool::Trim()
+{
+	for (Target& target : m_targets)
+	{
+		if (!target.InUse) target = Target();
+	}
+}
+
+void RenderTargetPool::Clear()
+{
+	m_targets.clear();
+	m_frameReadBytes = 0;
+	m_frameWrittenBytes = 0;
+	m_lastFrameReadBytes = 0;
+	m_lastFrameWrittenBytes = 0;
+}
+
+RenderTargetPool::Stats RenderTargetPool::GetStats() const
+{
+	Stats stats;
+	for (const Target& target : m_targets)
+	{
+		if (target.Texture == nullptr) continue;
+		++stats.Targets;
+		if (target.InUse) ++stats.TargetsInUse;
+		stats.Bytes += target.Desc.GetSize();
+	}
+	stats.Acquires = m_acquires;
+	stats.Reuses = m_reuses;
+	stats.FrameReadBytes = m_lastFrameReadBytes;
+	stats.FrameWrittenBytes = m_lastFrameWrittenBytes;
+	return stats;
+}
@@ -0,0 +1,105 @@
+// Render targets looked up by size, format and usage, handed back to the pool when done with and handed out again
+
+#pragma once
+
+#include <windows.h>
+#include <d3d11_1.h>
+#include <wrl/client.h>
+#include <climits>
+#include <cstdint>
+#include <vector>
+
+/// <summary>
+/// What a render target is for. Two targets with the same description are interchangeable.
+/// </summary>
+struct RenderTargetDesc
+{
+	UINT		Width = 0;
+	UINT		Height = 0;
+	DXGI_FORMAT	Format = DXGI_FORMAT_UNKNOWN;
+	UINT		BindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE;
+
+	/// 0 for a format the pool doesn't know the size of.
+	static UINT	GetBytesPerPixel(DXGI_FORMAT format);
+
+	/// Bytes the target takes up.
+	uint64_t	GetSize() const { return static_cast<uint64_t>(Width) * Height * GetBytesPerPixel(Format); }
+
+	bool operator==(const RenderTargetDesc& other) const
+	{
+		return Width == other.Width && Height == other.Height && Format == other.Format && BindFlags == other.BindFlags;
+	}
+	bool operator!=(const RenderTargetDesc& other) const { return !(*this == other); }
+};
+
+/// <summary>
+/// Owns every offscreen render target. Acquire hands out a free target with a matching description, only making a
+/// new one when they are all taken, and Release puts it back for the next user, this frame or a later one. Targets
+/// that outlive the frame, like the history the scene samples, are simply never released.
+///
+/// Formats should be as narrow as the contents allow: R11G11B10_FLOAT for HDR colour without alpha, RGBA16F when it
+/// needs alpha or more precision, RGBA8 for anything already in 0-1. Each pass reading or writing a target counts
+/// its size towards the frame's traffic, an estimate of the bandwidth the targets cost assuming every pixel is touched once.
+/// </summary>
+class RenderTargetPool
+{
+public:
+	typedef UINT TargetId;
+	static constexpr UINT INVALID_ID = UINT_MAX;
+
+	/// @return INVALID_ID if the target couldn't be made.
+	TargetId	Acquire(ID3D11Device* device, const RenderTargetDesc& desc);
+
+	/// Hands a target back, its contents are kept but whoever acquires it next shouldn't rely on them.
+	void		Release(TargetId target);
+
+	ID3D11RenderTargetView*		GetRenderTargetView(TargetId target) const { return m_targets[target].RenderTargetView.Get(); }
+	ID3D11ShaderResourceView*	GetShaderResourceView(TargetId target) const { return m_targets[target].ShaderResourceView.Get(); }
+	const RenderTargetDesc&		GetDesc(TargetId target) const { return m_targets[target].Desc; }
+
+	/// Counts a target being sampled or drawn to towards this frame's traffic.
+	void	AddRead(TargetId target) { m_frameReadBytes += m_targets[target].Desc.GetSize(); }
+	void	AddWrite(TargetId target) { m_frameWrittenBytes += m_targets[target].Desc.GetSize(); }
+
+	/// Keeps the last frame's traffic for GetStats and starts counting again.
+	void	BeginFrame();
+
+	/// Destroys the targets nobody holds.
+	void	Trim();
+
+	/// Destroys everything, call before the device goes away.
+	void	Clear();
+
+	struct Stats
+	{
+		UINT		Targets = 0;
+		UINT		TargetsInUse = 0;
+		uint64_t	Bytes = 0;
+		uint64_t	Acquires = 0;
+		uint64_t	Reuses = 0;
+		uint64_t	FrameReadBytes = 0;
+		uint64_t	FrameWrittenBytes = 0;
+	};
+
+	/// Traffic is the last full frame's.
+	Stats	GetStats() const;
+
+private:
+	struct Target
+	{
+		RenderTargetDesc									Desc;
+		Microsoft::WRL::ComPtr<ID3D11Texture2D>				Texture;
+		Microsoft::WRL::ComPtr<ID3D11RenderTargetView>		RenderTargetView;
+		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>	ShaderResourceView;
+		bool												InUse = false;
+	};
+
+	// Destroyed targets leave their slot empty so the ids of the others stay the same
+	std::vector<Target>	m_targets;
+	uint64_t			m_acquires = 0;
+	uint64_t			m_reuses = 0;
+	uint64_t			m_frameReadBytes = 0;
+	uint64_t			m_frameWrittenBytes = 0;
+	uint64_t			m_lastFrameReadBytes = 0;
+	uint64_t			m_lastFrameWrittenBytes = 0;
+};
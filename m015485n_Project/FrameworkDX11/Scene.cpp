@@ -1,11 +1,33 @@
 #include "Scene.h"
 
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <random>
 #include <unordered_map>
 
 #include "DDSTextureLoader.h"
+#include "JobSystem.h"
+#include "MeshBvh.h"
+#include "SceneFile.h"
+#include "ShaderPermutations.h"
 #include "WaveFrontReader.h"
 
+// Objects handed to a worker at a time when updating in parallel
+constexpr size_t OBJECT_UPDATE_CHUNK_SIZE = 64;
+
+// Draws the object constant ring has room for before it wraps, 1 MB. It grows if one pass draws more
+constexpr UINT OBJECT_CONSTANT_RING_SLOTS = 4096;
+
+// Draws whose constants a worker fills at a time when the pass is recorded in parallel
+constexpr size_t OBJECT_CONSTANT_FILL_CHUNK_SIZE = 1024;
+
+// The spline animation needs a start velocity, an end velocity and at least two points between them
+constexpr size_t MIN_SPLINE_POINTS = 4;
+
 HRESULT Scene::Init(HWND hwnd, const Microsoft::WRL::ComPtr<ID3D11Device>& device, const Microsoft::WRL::ComPtr<ID3D11DeviceContext>& context)
 {
 	m_pd3dDevice = device;
@@ -21,13 +43,26 @@ HRESULT Scene::Init(HWND hwnd, const Microsoft::WRL::ComPtr<ID3D11Device>& devic
 
 	m_pCamera = new Camera(XMFLOAT3(0, 3, 4.5), XMFLOAT3(0, -0.65, -1), XMFLOAT3(0.0f, 1.0f, 0.0f), width, height);
 
-	// Create the constant buffer
+	// Create the constant buffers, the camera's and the one the objects fall back to without the ring
 	D3D11_BUFFER_DESC bd = {};
 	bd.Usage = D3D11_USAGE_DEFAULT;
-	bd.ByteWidth = sizeof(ConstantBuffer);
+	bd.ByteWidth = sizeof(FrameConstantBuffer);
 	bd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
 	bd.CPUAccessFlags = 0;
-	HRESULT	hr = m_pd3dDevice->CreateBuffer(&bd, nullptr, &m_pConstantBuffer);
+	HRESULT	hr = m_pd3dDevice->CreateBuffer(&bd, nullptr, &m_pFrameConstantBuffer);
+	if (FAILED(hr))
+		return hr;
+
+	bd.ByteWidth = sizeof(ObjectConstantBuffer);
+	hr = m_pd3dDevice->CreateBuffer(&bd, nullptr, &m_pObjectConstantBuffer);
+	if (FAILED(hr))
+		return hr;
+
+	hr = m_objectConstants.Init(m_pd3dDevice.Get(), OBJECT_CONSTANT_RING_SLOTS);
+	if (FAILED(hr))
+		return hr;
+
+	hr = m_deferredContexts.Init(m_pd3dDevice.Get());
 	if (FAILED(hr))
 		return hr;
 
@@ -36,6 +71,11 @@ HRESULT Scene::Init(HWND hwnd, const Microsoft::WRL::ComPtr<ID3D11Device>& devic
 	return S_OK;
 }
 
+void Scene::InitHeadless(UINT width, UINT height)
+{
+	m_pCamera = new Camera(XMFLOAT3(0, 3, 4.5), XMFLOAT3(0, -0.65, -1), XMFLOAT3(0.0f, 1.0f, 0.0f), width, height);
+}
+
 void Scene::LoadTextures()
 {
 	for (const auto& entry : filesystem::directory_iterator(L"resources\\Textures"))
@@ -98,19 +138,20 @@ void Scene::LoadModels()
 void Scene::CreateGameObjects()
 {
 	// CREATE A SIMPLE game object
-	GameObject* go = new GameObject(XMFLOAT3(2.0f, 0, 0), XMFLOAT3(0, 0, 0), XMFLOAT3(1, 1, 1), "Cube 1", GetModelData("Cube"), m_pd3dDevice.Get(), m_pImmediateContext.Get(), GetPixelShader("Texture Pixel Shader"), GetTexture(m_textureMap, "stone.dds"), GetTexture(m_normalMapTextureMap, "conenormal.dds"));
+	GameObject* go = m_gameObjects.Get(m_gameObjects.Create(XMFLOAT3(2.0f, 0, 0), XMFLOAT3(0, 0, 0), XMFLOAT3(1, 1, 1), "Cube 1", GetModelData("Cube"), m_pd3dDevice.Get(), m_pImmediateContext.Get(), GetPixelShader("Texture Pixel Shader"), GetTexture(m_textureMap, "stone.dds"), GetTexture(m_normalMapTextureMap, "conenormal.dds")));
 
-	GameObject* go2 = new GameObject(XMFLOAT3(-2.0f, 0, 0), XMFLOAT3(0, 0, 0), XMFLOAT3(1, 1, 1), "Cube 2", GetModelData("Cube"), m_pd3dDevice.Get(), m_pImmediateContext.Get(), GetPixelShader("Texture UnLit Pixel Shader"), GetTexture(m_textureMap, "RenderTargetViewPass2"));
+	GameObject* go2 = m_gameObjects.Get(m_gameObjects.Create(XMFLOAT3(-2.0f, 0, 0), XMFLOAT3(0, 0, 0), XMFLOAT3(1, 1, 1), "Cube 2", GetModelData("Cube"), m_pd3dDevice.Get(), m_pImmediateContext.Get(), GetPixelShader("Texture UnLit Pixel Shader"), GetTexture(m_textureMap, "RenderTargetViewPass2")));
 
 	// CREATE A SIMPLE game object
-	GameObject* go3 = new GameObject(XMFLOAT3(7.6, -1.3, -7.1), XMFLOAT3(0, -31, 0), XMFLOAT3(2, 2, 2), "Asha", GetModelData("asha.obj"), m_pd3dDevice.Get(), m_pImmediateContext.Get(), GetPixelShader("Texture Pixel Shader"), GetTexture(m_textureMap, "AshaTex.dds"));
+	m_gameObjects.Create(XMFLOAT3(7.6, -1.3, -7.1), XMFLOAT3(0, -31, 0), XMFLOAT3(2, 2, 2), "Asha", GetModelData("asha.obj"), m_pd3dDevice.Get(), m_pImmediateContext.Get(), GetPixelShader("Texture Pixel Shader"), GetTexture(m_textureMap, "AshaTex.dds"));
 
-	GameObject* go4 = new GameObject(XMFLOAT3(-8, -1.4, -8.4), XMFLOAT3(0, -47, 0), XMFLOAT3(10, 10, 10), "Bunny", GetModelData("bunny.obj"), m_pd3dDevice.Get(), m_pImmediateContext.Get(), GetPixelShader("Texture Pixel Shader"), GetTexture(m_textureMap, "BunnyTex.dds"));
+	GameObject* bunny = m_gameObjects.Get(m_gameObjects.Create(XMFLOAT3(-8, -1.4, -8.4), XMFLOAT3(0, -47, 0), XMFLOAT3(10, 10, 10), "Bunny", GetModelData("bunny.obj"), m_pd3dDevice.Get(), m_pImmediateContext.Get(), GetPixelShader("Texture Pixel Shader"), GetTexture(m_textureMap, "BunnyTex.dds")));
 
 	// CREATE A SIMPLE game object
-	GameObject* go5 = new GameObject(XMFLOAT3(0, -1.5, 0), XMFLOAT3(0, 0, 0), XMFLOAT3(10, 0.1, 10), "Floor 1", GetModelData("Cube"), m_pd3dDevice.Get(), m_pImmediateContext.Get(), GetPixelShader("Texture Pixel Shader"), GetTexture(m_textureMap, "Pathway.dds"), GetTexture(m_normalMapTextureMap, "PathwayNormal.dds"));
+	GameObject* floorObject = m_gameObjects.Get(m_gameObjects.Create(XMFLOAT3(0, -1.5, 0), XMFLOAT3(0, 0, 0), XMFLOAT3(10, 0.1, 10), "Floor 1", GetModelData("Cube"), m_pd3dDevice.Get(), m_pImmediateContext.Get(), GetPixelShader("Texture Pixel Shader"), GetTexture(m_textureMap, "Pathway.dds"), GetTexture(m_normalMapTextureMap, "PathwayNormal.dds")));
 
-	GameObject* go6 = new GameObject(XMFLOAT3(0, 0, 0), XMFLOAT3(0, 0, 0), XMFLOAT3(-50, -50, -50), "Skybox", GetModelData("Cube"), m_pd3dDevice.Get(), m_pImmediateContext.Get(), GetPixelShader("Texture UnLit Pixel Shader"), GetTexture(m_textureMap, "Stars.dds"));
+	m_skyboxHandle = m_gameObjects.Create(XMFLOAT3(0, 0, 0), XMFLOAT3(0, 0, 0), XMFLOAT3(-50, -50, -50), "Skybox", GetModelData("Cube"), m_pd3dDevice.Get(), m_pImmediateContext.Get(), GetPixelShader("Texture UnLit Pixel Shader"), GetTexture(m_textureMap, "Stars.dds"));
+	GameObject* go6 = m_gameObjects.Get(m_skyboxHandle);
 
 	go->m_autoRotateX = true;
 	go->m_autoRotateY = true;
@@ -121,25 +162,287 @@ void Scene::CreateGameObjects()
 	go6->m_autoRotateY = true;
 	go6->m_autoRotationSpeed = 1.5f;
 
-	m_vecDrawables.push_back(go);
-	m_vecDrawables.push_back(go2);
-	m_vecDrawables.push_back(go3);
-	m_vecDrawables.push_back(go4);
-	m_vecDrawables.push_back(go5);
-	m_vecDrawables.push_back(go6);
+	// The big ones hide the most
+	bunny->m_occluder = true;
+	floorObject->m_occluder = true;
 }
 
 void Scene::CleanUp()
 {
-	for (GameObject* obj : m_vecDrawables)
+	ClearGameObjects();
+	m_materialBuffer.Clear();
+	m_lightBuffer.Clear();
+	m_lightClusterBuffer.Clear();
+	m_instanceBuffer.Clear();
+	m_objectConstants.Clear();
+	m_deferredContexts.Clear();
+	m_lightPropertiesUploaded = false;
+
+	delete m_pCamera;
+	m_pCamera = nullptr;
+}
+
+void Scene::ClearGameObjects()
+{
+	m_gameObjects.ForEach([](GameObject& obj) { obj.Cleanup(); });
+	m_gameObjects.Clear();
+	m_materials.Clear();
+	m_skyboxHandle = GameObjectHandle();
+
+	m_objectTree.Clear();
+	m_objectProxies.clear();
+	m_renderQueue.Clear();
+}
+
+void Scene::CreateStressScene(const StressTest::Settings& settings)
+{
+	std::mt19937 random(settings.Seed);
+
+	// The render target textures change every frame and would pull objects out of the main pass
+	vector<const Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>*> textures;
+	for (const auto& texturePair : m_textureMap)
 	{
-		obj->Cleanup();
-		delete obj;
+		if (texturePair.first.rfind("RenderTargetView", 0) != 0) textures.push_back(std::addressof(texturePair.second));
 	}
 
-	m_vecDrawables.clear();
+	Microsoft::WRL::ComPtr<ID3D11PixelShader> pixelShader;
+	for (const auto& shaderPair : m_pixelShadersMap)
+	{
+		if (shaderPair.first == "Texture Pixel Shader") pixelShader = shaderPair.second;
+	}
 
-	delete m_pCamera;
+	// Roughly the same density whatever the count
+	const float extent = (std::max)(10.0f, std::cbrt(static_cast<float>(settings.ObjectCount)) * 2.0f);
+	std::uniform_real_distribution<float> position(-extent, extent);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	std::uniform_real_distribution<float> angle(-180.0f, 180.0f);
+
+	// A handful of colours, so most objects share a material the way a real scene would
+	constexpr int STRESS_PALETTE_SIZE = 8;
+	XMFLOAT4 palette[STRESS_PALETTE_SIZE];
+	for (XMFLOAT4& colour : palette) colour = XMFLOAT4(unit(random), unit(random), unit(random), 1.0f);
+
+	ClearGameObjects();
+	m_gameObjects.Reserve(settings.ObjectCount);
+
+	for (UINT i = 0; i < settings.ObjectCount; ++i)
+	{
+		const MeshData mesh = m_models.empty() ? MeshData{} : m_models[random() % m_models.size()].second;
+		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> texture = textures.empty() ? nullptr : *textures[random() % textures.size()];
+		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> normalMap = m_normalMapTextureMap.empty() || random() % 2 == 0 ? nullptr : m_normalMapTextureMap[random() % m_normalMapTextureMap.size()].second;
+
+		const float scale = 0.25f + unit(random);
+		GameObject* object = m_gameObjects.Get(m_gameObjects.Create(XMFLOAT3(position(random), position(random), position(random)),
+			XMFLOAT3(angle(random), angle(random), angle(random)), XMFLOAT3(scale, scale, scale), "Stress Object",
+			mesh, m_pd3dDevice.Get(), m_pImmediateContext.Get(), pixelShader, texture, normalMap));
+
+		MaterialPropertiesConstantBuffer material = object->GetMaterialConstantBufferData();
+		material.Material.Diffuse = palette[random() % STRESS_PALETTE_SIZE];
+		object->UpdateMaterialConstantBuffer(material);
+		object->SetOriginalMaterial(material);
+
+		object->m_autoRotateY = random() % 2 == 0;
+		object->m_autoRotationSpeed = 0.5f + unit(random);
+
+		// The biggest 15% or so
+		object->m_occluder = scale > 1.1f;
+	}
+
+	m_lights.clear();
+	for (UINT i = 0; i < settings.LightCount; ++i)
+	{
+		Light light;
+		light.Enabled = static_cast<int>(true);
+		light.LightType = PointLight;
+		light.Color = XMFLOAT4(unit(random), unit(random), unit(random), 1.0f);
+		light.ConstantAttenuation = 1.0f;
+		light.LinearAttenuation = 0.1f;
+		light.QuadraticAttenuation = 0.01f;
+		light.Position = XMFLOAT4(position(random), position(random), position(random), 1.0f);
+		m_lights.push_back(light);
+	}
+
+	// One lap of a ring just inside the field over the whole run. The first and last points are only
+	// there to shape the ends of the curve
+	const float radius = extent * 0.75f;
+	const float height = extent * 0.25f;
+	m_controlPoints.clear();
+	for (int i = -1; i <= 5; ++i)
+	{
+		float ringAngle = XM_PIDIV2 * static_cast<float>(i);
+		m_controlPoints.push_back(XMVectorSet(cosf(ringAngle) * radius, height, sinf(ringAngle) * radius, 0.0f));
+	}
+
+	m_totalSplineAnimation = static_cast<float>(settings.WarmupFrames + settings.FrameCount) * settings.DeltaTime;
+	m_playCameraSplineAnimation = true;
+}
+
+bool Scene::SaveToFile(const std::wstring& fileName)
+{
+	SceneFile::SceneData scene;
+	scene.Objects.reserve(m_gameObjects.Size());
+
+	// Resources are saved under the name the scene loaded them with
+	auto findName = [&scene](const auto& resources, const void* resource) -> uint32_t
+		{
+			if (resource == nullptr) return SceneFile::NO_STRING;
+
+			for (const auto& resourcePair : resources)
+			{
+				if (resourcePair.second.Get() == resource) return scene.AddString(resourcePair.first);
+			}
+			return SceneFile::NO_STRING;
+		};
+
+	m_gameObjects.ForEachWithHandle([&](GameObjectHandle handle, GameObject& object)
+		{
+			SceneFile::ObjectRecord record = {};
+			record.Position = object.GetPosition();
+			record.Rotation = object.GetRotationQuaternion();
+			record.Scale = object.GetScale();
+			record.OriginalPosition = object.GetOriginalPosition();
+			record.OriginalRotation = object.GetOriginalRotationQuaternion();
+			record.OriginalScale = object.GetOriginalScale();
+			record.Material = object.GetMaterialConstantBufferData().Material;
+			record.OriginalMaterial = object.GetOriginalMaterialConstantBufferData().Material;
+			record.AutoRotationSpeed = object.m_autoRotationSpeed;
+
+			record.Flags = 0;
+			if (object.m_autoRotateX) record.Flags |= SceneFile::OBJECT_AUTO_ROTATE_X;
+			if (object.m_autoRotateY) record.Flags |= SceneFile::OBJECT_AUTO_ROTATE_Y;
+			if (object.m_autoRotateZ) record.Flags |= SceneFile::OBJECT_AUTO_ROTATE_Z;
+			if (object.renderTexture) record.Flags |= SceneFile::OBJECT_RENDER_TEXTURE;
+			if (handle == m_skyboxHandle) record.Flags |= SceneFile::OBJECT_SKYBOX;
+			if (object.m_occluder) record.Flags |= SceneFile::OBJECT_OCCLUDER;
+
+			record.Name = scene.AddString(object.GetObjectName());
+
+			record.Model = SceneFile::NO_STRING;
+			for (const auto& modelPair : m_models)
+			{
+				if (modelPair.second.VertexBuffer.Get() == object.m_meshData.VertexBuffer.Get())
+				{
+					record.Model = scene.AddString(modelPair.first);
+					break;
+				}
+			}
+
+			record.Texture = findName(m_textureMap, object.GetTextureResourceView());
+			record.NormalMap = findName(m_normalMapTextureMap, object.GetNormalMapResourceView());
+			record.PixelShader = findName(m_pixelShadersMap, object.GetPixelShader().Get());
+
+			scene.Objects.push_back(record);
+		});
+
+	scene.Lights = m_lights;
+
+	scene.SplineDuration = m_totalSplineAnimation;
+	for (const XMVECTOR& point : m_controlPoints)
+	{
+		XMFLOAT4 storedPoint;
+		XMStoreFloat4(&storedPoint, point);
+		scene.SplinePoints.push_back(storedPoint);
+	}
+
+	if (!SceneFile::Write(fileName, scene))
+	{
+		MessageBox(nullptr, L"Failed to save the scene file.", L"Error", MB_OK);
+		return false;
+	}
+
+	return true;
+}
+
+bool Scene::LoadFromFile(const std::wstring& fileName)
+{
+	SceneFile::MappedFile file;
+	if (!file.Open(fileName))
+	{
+		MessageBox(nullptr, L"Failed to open the scene file, it is missing or not a valid scene.", L"Error", MB_OK);
+		return false;
+	}
+
+	const SceneFile::Header& header = file.GetHeader();
+
+	// Look every name up once, the objects then just index these
+	auto findResource = [](auto& resources, std::string_view name) -> decltype(std::addressof(resources[0].second))
+		{
+			for (auto& resourcePair : resources)
+			{
+				if (resourcePair.first == name) return std::addressof(resourcePair.second);
+			}
+			return nullptr;
+		};
+
+	std::vector<const MeshData*> models(header.StringCount, nullptr);
+	std::vector<Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>*> textures(header.StringCount, nullptr);
+	std::vector<Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>*> normalMaps(header.StringCount, nullptr);
+	std::vector<Microsoft::WRL::ComPtr<ID3D11PixelShader>*> pixelShaders(header.StringCount, nullptr);
+	for (uint32_t i = 0; i < header.StringCount; ++i)
+	{
+		std::string_view name = file.GetString(i);
+		models[i] = findResource(m_models, name);
+		textures[i] = findResource(m_textureMap, name);
+		normalMaps[i] = findResource(m_normalMapTextureMap, name);
+		pixelShaders[i] = findResource(m_pixelShadersMap, name);
+	}
+
+	// Anything the file names that this build doesn't have falls back the same way the Get functions do
+	const MeshData* fallbackModel = m_models.empty() ? nullptr : &m_models[0].second;
+	Microsoft::WRL::ComPtr<ID3D11PixelShader>* fallbackPixelShader = m_pixelShadersMap.empty() ? nullptr : std::addressof(m_pixelShadersMap[0].second);
+
+	ClearGameObjects();
+	m_gameObjects.Reserve(header.ObjectCount);
+
+	const SceneFile::ObjectRecord* records = file.GetObjects();
+	for (uint32_t i = 0; i < header.ObjectCount; ++i)
+	{
+		const SceneFile::ObjectRecord& record = records[i];
+
+		const MeshData* model = record.Model != SceneFile::NO_STRING && models[record.Model] != nullptr ? models[record.Model] : fallbackModel;
+		Microsoft::WRL::ComPtr<ID3D11PixelShader>* pixelShader = record.PixelShader != SceneFile::NO_STRING && pixelShaders[record.PixelShader] != nullptr ? pixelShaders[record.PixelShader] : fallbackPixelShader;
+		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>* texture = record.Texture != SceneFile::NO_STRING ? textures[record.Texture] : nullptr;
+		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>* normalMap = record.NormalMap != SceneFile::NO_STRING ? normalMaps[record.NormalMap] : nullptr;
+
+		GameObjectHandle handle = m_gameObjects.Create(record.Position, XMFLOAT3(0, 0, 0), record.Scale, string(file.GetString(record.Name)),
+			model != nullptr ? *model : MeshData{}, m_pd3dDevice.Get(), m_pImmediateContext.Get(),
+			pixelShader != nullptr ? *pixelShader : nullptr, texture != nullptr ? *texture : nullptr, normalMap != nullptr ? *normalMap : nullptr);
+		GameObject* object = m_gameObjects.Get(handle);
+
+		object->SetRotationQuaternion(record.Rotation);
+		object->SetOriginalTransform(record.OriginalPosition, record.OriginalRotation, record.OriginalScale);
+
+		MaterialPropertiesConstantBuffer material;
+		material.Material = record.Material;
+		object->UpdateMaterialConstantBuffer(material);
+		material.Material = record.OriginalMaterial;
+		object->SetOriginalMaterial(material);
+
+		object->m_autoRotationSpeed = record.AutoRotationSpeed;
+		object->m_autoRotateX = (record.Flags & SceneFile::OBJECT_AUTO_ROTATE_X) != 0;
+		object->m_autoRotateY = (record.Flags & SceneFile::OBJECT_AUTO_ROTATE_Y) != 0;
+		object->m_autoRotateZ = (record.Flags & SceneFile::OBJECT_AUTO_ROTATE_Z) != 0;
+		object->renderTexture = (record.Flags & SceneFile::OBJECT_RENDER_TEXTURE) != 0;
+		object->m_occluder = (record.Flags & SceneFile::OBJECT_OCCLUDER) != 0;
+
+		if (record.Flags & SceneFile::OBJECT_SKYBOX) m_skyboxHandle = handle;
+	}
+
+	// Lights and spline points are the same layout in the file as in memory
+	m_lights.assign(file.GetLights(), file.GetLights() + header.LightCount);
+
+	if (header.SplinePointCount >= MIN_SPLINE_POINTS)
+	{
+		const XMFLOAT4* points = file.GetSplinePoints();
+		m_controlPoints.clear();
+		for (uint32_t i = 0; i < header.SplinePointCount; ++i)
+		{
+			m_controlPoints.push_back(XMLoadFloat4(&points[i]));
+		}
+		m_totalSplineAnimation = header.SplineDuration;
+	}
+
+	return true;
 }
 
 MeshData Scene::GetModelData(const string& modelToFind)
@@ -241,6 +544,14 @@ MeshData Scene::InitCubeMesh(ID3D11Device* pd3dDevice, ID3D11DeviceContext* pCon
 
 	CalculateModelVectorsNoSharedVertices(vertices, 36);
 
+	BoundingBox::CreateFromPoints(meshData.Bounds, 36, &vertices[0].Pos, sizeof(SimpleVertex));
+
+	auto occluder = std::make_shared<OccluderMesh>();
+	for (const SimpleVertex& vertex : vertices) occluder->Positions.push_back(vertex.Pos);
+	occluder->Indices.assign(std::begin(indices), std::end(indices));
+	meshData.Occluder = occluder;
+	meshData.PickingBvh = std::make_shared<MeshBvh>(occluder->Positions, occluder->Indices);
+
 	D3D11_BUFFER_DESC bd = {};
 	bd.Usage = D3D11_USAGE_DEFAULT;
 	bd.ByteWidth = sizeof(SimpleVertex) * 36;
@@ -307,6 +618,14 @@ MeshData Scene::LoadOBJMesh(ID3D11Device* pd3dDevice, const std::string& filenam
 
 	CalculateModelVectorsSharedVertices(vertices, indices);
 
+	meshData.Bounds = objReader.bounds;
+
+	auto occluder = std::make_shared<OccluderMesh>();
+	for (const auto& vertex : objReader.vertices) occluder->Positions.push_back(vertex.position);
+	occluder->Indices.assign(objReader.indices.begin(), objReader.indices.end());
+	meshData.Occluder = occluder;
+	meshData.PickingBvh = std::make_shared<MeshBvh>(occluder->Positions, occluder->Indices);
+
 	D3D11_BUFFER_DESC bd = {};
 	bd.Usage = D3D11_USAGE_DEFAULT;
 	bd.ByteWidth = static_cast<UINT>(sizeof(SimpleVertex) * vertexCount);
@@ -354,7 +673,7 @@ Microsoft::WRL::ComPtr<ID3D11PixelShader>& Scene::GetPixelShader(const string& s
 	return m_pixelShadersMap[0].second;
 }
 
-Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>& Scene::GetTexture(vector<std::pair<string, Microsoft::WRL::ComPtr < ID3D11ShaderResourceView>>>& mapToCheck, const string& textureToFind)
+Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>& Scene::GetTexture(vector<std::pair<string, Microsoft::WRL::ComPtr < ID3D11ShaderResourceView>>>& mapToCheck, std::string_view textureToFind)
 {
 	for (auto& texturePair : mapToCheck)
 	{
@@ -435,7 +754,7 @@ void Scene::SetupLightProperties()
 		light4.Direction = { 0,-1,0,0 };
 		m_lights.push_back(light4);
 	}
-	//for (unsigned int i = 0; i < MAX_LIGHTS; i++)
+	//for (unsigned int i = 0; i < 128; i++)
 	//{
 	//	Light light;
 	//	light.Enabled = static_cast<int>(true);
@@ -459,7 +778,7 @@ void Scene::SetupLightProperties()
 	//	m_lightProperties.Lights[i] = light;
 	//}
 
-	m_lightProperties.EyePosition = XMFLOAT4(GetCamera()->GetPosition().x, GetCamera()->GetPosition().y, GetCamera()->GetPosition().z, 1);
+	m_lightPropertiesUploaded = false;
 
 	D3D11_BUFFER_DESC bd = {};
 	// Create the light constant buffer
@@ -473,69 +792,48 @@ void Scene::SetupLightProperties()
 		MessageBox(nullptr,
 			L"Failed to create lighting buffer in scene.cpp", L"Error", MB_OK);
 	}
-
-	D3D11_BUFFER_DESC sbDesc = {};
-	sbDesc.Usage = D3D11_USAGE_DYNAMIC;
-	sbDesc.ByteWidth = sizeof(Light) * 128; // max you expect
-	sbDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
-	sbDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
-	sbDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
-	sbDesc.StructureByteStride = sizeof(Light);
-
-	hr = m_pd3dDevice->CreateBuffer(&sbDesc, nullptr, &m_lightStructuredBuffer);
-
-	D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
-	srvDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
-	srvDesc.Buffer.FirstElement = 0;
-	srvDesc.Buffer.NumElements = 128;
-
-	hr = m_pd3dDevice->CreateShaderResourceView(
-		m_lightStructuredBuffer.Get(),
-		&srvDesc,
-		&m_lightSRV
-	);
 }
 
-void Scene::UpdateLightBuffer()
+void Scene::UpdateLightBuffer(StateTrackingContext& context, const RenderSnapshot& snapshot)
 {
-	D3D11_MAPPED_SUBRESOURCE mapped;
-	m_pImmediateContext->Map(
-		m_lightStructuredBuffer.Get(),
-		0,
-		D3D11_MAP_WRITE_DISCARD,
-		0,
-		&mapped
-	);
+	// Grows as lights are added and only writes the lights that changed
+	m_lightBuffer.Apply(m_pd3dDevice.Get(), m_pImmediateContext.Get(), snapshot.Lights);
 
-	memcpy(mapped.pData, m_lights.data(), sizeof(Light) * m_lights.size());
+	m_lightClusterBuffer.Apply(m_pd3dDevice.Get(), m_pImmediateContext.Get(), snapshot.LightClusterRanges, snapshot.LightClusterIndices);
 
-	m_pImmediateContext->Unmap(m_lightStructuredBuffer.Get(), 0);
+	// The render textures are the same size as the back buffer, so the viewport gives the pixels per cluster for both passes
+	UINT viewportCount = 1;
+	D3D11_VIEWPORT viewport = {};
+	m_pImmediateContext->RSGetViewports(&viewportCount, &viewport);
 
 	LightPropertiesConstantBuffer globals = {};
-	globals.EyePosition = XMFLOAT4(
-		GetCamera()->GetPosition().x,
-		GetCamera()->GetPosition().y,
-		GetCamera()->GetPosition().z,
-		1.0f
-	);
 	//globals.GlobalAmbient = XMFLOAT4(0.1f, 0.1f, 0.1f, 1.0f);
-	globals.LightCount = static_cast<UINT>(m_lights.size());
-
-	m_pImmediateContext->UpdateSubresource(
-		m_pLightConstantBuffer.Get(),
-		0,
-		nullptr,
-		&globals,
-		0,
-		0
-	);
+	globals.LightCount = static_cast<UINT>(snapshot.Lights.size());
+	globals.GlobalLightCount = snapshot.GlobalLightCount;
+	globals.ClusterDepthScale = snapshot.ClusterDepthScale;
+	globals.ClusterDepthBias = snapshot.ClusterDepthBias;
+	globals.ClusterTileScale = XMFLOAT2(viewport.Width > 0.0f ? LightClusterGrid::CLUSTERS_X / viewport.Width : 0.0f, viewport.Height > 0.0f ? LightClusterGrid::CLUSTERS_Y / viewport.Height : 0.0f);
+	globals.Padding = XMFLOAT2(0.0f, 0.0f);
+
+	// Only changes when the lights in view do
+	if (!m_lightPropertiesUploaded || memcmp(&globals, &m_lightProperties, sizeof(LightPropertiesConstantBuffer)) != 0)
+	{
+		m_pImmediateContext->UpdateSubresource(
+			m_pLightConstantBuffer.Get(),
+			0,
+			nullptr,
+			&globals,
+			0,
+			0
+		);
+		m_lightProperties = globals;
+		m_lightPropertiesUploaded = true;
+	}
 
 	// Bind to PS
-	ID3D11Buffer* cb = m_pLightConstantBuffer.Get();
-	m_pImmediateContext->PSSetConstantBuffers(2, 1, &cb);
-
-	ID3D11ShaderResourceView* srv = m_lightSRV.Get();
-	m_pImmediateContext->PSSetShaderResources(2, 1, &srv);
+	context.PSSetConstantBuffer(2, m_pLightConstantBuffer.Get());
+	context.PSSetShaderResource(LightBuffer::SHADER_SLOT, m_lightBuffer.GetShaderResourceView());
+	m_lightClusterBuffer.Bind(context);
 }
 
 void Scene::AddLight()
@@ -556,53 +854,360 @@ void Scene::Update(const float deltaTime)
 {
 	static bool moveLightRight = true;
 
-	if (m_lights[4].Position.x >= 5.0f)
+	// A loaded scene might not have the light that gets animated
+	if (m_lights.size() > 4)
 	{
-		moveLightRight = false;
+		if (m_lights[4].Position.x >= 5.0f)
+		{
+			moveLightRight = false;
+		}
+		else if (m_lights[4].Position.x <= -5.0f)
+		{
+			moveLightRight = true;
+		}
+
+		if (moveLightRight)
+		{
+			m_lights[4].Position.x += 2 * deltaTime;
+		}
+		else
+		{
+			m_lights[4].Position.x -= 2 * deltaTime;
+		}
 	}
-	else if (m_lights[4].Position.x <= -5.0f)
+
+	if (m_playCameraSplineAnimation)
 	{
-		moveLightRight = true;
+		m_pCamera->CameraSplineAnimation(deltaTime, m_controlPoints, m_totalSplineAnimation);
 	}
 
-	if (moveLightRight)
+	// Anything reading shared state has to happen before the objects are split across threads
+	if (GameObject* skybox = m_gameObjects.Get(m_skyboxHandle))
 	{
-		m_lights[4].Position.x += 2 * deltaTime;
+		skybox->SetPosition(GetCamera()->GetPosition());
 	}
-	else
+
+	// Every object only touches its own data, so the chunking doesn't change the result
+	JobSystem::Get().ParallelFor(m_gameObjects.GetSlotCount(), OBJECT_UPDATE_CHUNK_SIZE, [&](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; i++)
+			{
+				if (GameObject* object = m_gameObjects.GetAt(i)) object->Update(deltaTime);
+			}
+		});
+}
+
+void Scene::BuildSnapshot(RenderSnapshot& snapshot)
+{
+	snapshot.Clear();
+
+	XMStoreFloat4x4(&snapshot.View, GetCamera()->GetViewMatrix());
+	snapshot.Projection = GetCamera()->GetProjectionMatrixFloat4x4();
+	XMFLOAT3 eye = GetCamera()->GetPosition();
+	snapshot.EyePosition = XMFLOAT4(eye.x, eye.y, eye.z, 1.0f);
+
+	// Both scene passes draw from the main camera, so one visible list does for both
+	XMMATRIX viewProjection = XMLoadFloat4x4(&snapshot.View) * XMLoadFloat4x4(&snapshot.Projection);
+	CullingFrustum frustum = CullingFrustum::FromViewProjection(viewProjection);
+
+	// Only the lights that are on and reach into the view are uploaded, with how far they reach filled in
+	for (const Light& light : m_lights)
 	{
-		m_lights[4].Position.x -= 2 * deltaTime;
+		if (!light.Enabled) continue;
+
+		Light visible = light;
+		visible.Range = light.LightType == DirectionalLight ? FLT_MAX : LightClusterGrid::ComputeLightRange(light);
+		if (visible.Range <= 0.0f) continue;
+
+		BoundingSphere bounds;
+		if (light.LightType != DirectionalLight && visible.Range != FLT_MAX &&
+			(!LightClusterGrid::ComputeLightBounds(light, visible.Range, bounds) || !frustum.IsVisible(bounds))) continue;
+
+		snapshot.Lights.push_back(visible);
 	}
+	m_visibleLightCount = static_cast<UINT>(snapshot.Lights.size());
 
-	UpdateLightBuffer();
+	m_lightClusters.Build(snapshot.Lights, XMLoadFloat4x4(&snapshot.View), XMLoadFloat4x4(&snapshot.Projection), m_clusteredLighting);
+	snapshot.LightClusterRanges = m_lightClusters.GetRanges();
+	snapshot.LightClusterIndices = m_lightClusters.GetLightIndices();
+	snapshot.GlobalLightCount = m_lightClusters.GetGlobalLightCount();
+	snapshot.ClusterDepthScale = m_lightClusters.GetDepthScale();
+	snapshot.ClusterDepthBias = m_lightClusters.GetDepthBias();
 
-	if (m_playCameraSplineAnimation)
+	// Which pass an object goes in depends on which render texture it samples. A headless scene has none
+	auto findRenderTexture = [this](std::string_view name) -> const ID3D11ShaderResourceView*
+		{
+			for (const auto& texturePair : m_textureMap)
+			{
+				if (texturePair.first == name) return texturePair.second.Get();
+			}
+			return nullptr;
+		};
+	const ID3D11ShaderResourceView* renderTexturePass0 = findRenderTexture("RenderTargetViewPass0");
+	const ID3D11ShaderResourceView* renderTexturePass1 = findRenderTexture("RenderTargetViewPass1");
+	const ID3D11ShaderResourceView* renderTexturePass2 = findRenderTexture("RenderTargetViewPass2");
+
+	snapshot.RenderItems.resize(m_gameObjects.Size());
+	m_itemBounds.resize(m_gameObjects.Size());
+	m_occluderCandidates.clear();
+	m_culler.Clear();
+	if (!m_cullWithObjectTree) m_culler.Reserve(m_gameObjects.Size());
+
+	const size_t slotCount = m_gameObjects.GetSlotCount();
+	m_objectProxies.resize(slotCount, DynamicAabbTree::NULL_NODE);
+	m_slotItems.resize(slotCount);
+
+	// Walked by slot rather than with ForEach so objects that were destroyed come out of the tree too
+	UINT itemIndex = 0;
+	for (size_t slot = 0; slot < slotCount; ++slot)
 	{
-		m_pCamera->CameraSplineAnimation(deltaTime, m_controlPoints, m_totalSplineAnimation);
+		GameObject* object = m_gameObjects.GetAt(slot);
+		int& proxy = m_objectProxies[slot];
+		if (object == nullptr)
+		{
+			if (proxy != DynamicAabbTree::NULL_NODE) m_objectTree.DestroyProxy(proxy);
+			proxy = DynamicAabbTree::NULL_NODE;
+			continue;
+		}
+
+		m_slotItems[slot] = itemIndex;
+		RenderItem& item = snapshot.RenderItems[itemIndex++];
+		object->SyncMaterial(m_materials);
+		object->BuildRenderItem(item);
+
+		// The tree is kept up to date either way, the picking queries use it
+		const BoundingBox& bounds = object->GetWorldBounds();
+		if (proxy == DynamicAabbTree::NULL_NODE) proxy = m_objectTree.CreateProxy(bounds, static_cast<uint32_t>(slot));
+		else m_objectTree.MoveProxy(proxy, bounds);
+		if (!m_cullWithObjectTree) m_culler.Add(bounds);
+		m_itemBounds[m_slotItems[slot]] = bounds;
+
+		// Occluders are ranked by how big they look, radius over distance squared
+		if (m_occlusionCulling && object->m_occluder && object->m_meshData.Occluder && frustum.IsVisible(bounds))
+		{
+			float radiusSquared = XMVectorGetX(XMVector3LengthSq(XMLoadFloat3(&bounds.Extents)));
+			float distanceSquared = XMVectorGetX(XMVector3LengthSq(XMLoadFloat3(&bounds.Center) - XMLoadFloat4(&snapshot.EyePosition)));
+			m_occluderCandidates.push_back({ radiusSquared / (std::max)(distanceSquared, 0.0001f), static_cast<UINT>(slot) });
+		}
+
+		const ID3D11ShaderResourceView* texture = item.Texture;
+		item.PassMask = 0;
+		if (texture == nullptr || (texture != renderTexturePass0 && texture != renderTexturePass1)) item.PassMask |= RENDER_PASS_SCENE;
+		if (texture != nullptr && texture == renderTexturePass2) item.PassMask |= RENDER_PASS_RENDER_TEXTURE;
 	}
 
-	for (unsigned int i = 0; i < m_vecDrawables.size(); i++)
+	if (m_cullWithObjectTree)
 	{
-		if (m_vecDrawables[i]->GetObjectName() == "Skybox")
+		snapshot.VisibleItems.clear();
+		m_cullStats = m_objectTree.QueryFrustum(frustum, [&](uint32_t slot) { snapshot.VisibleItems.push_back(m_slotItems[slot]); });
+
+		// The tree hands them back in its own order, drawing goes in pool order like the linear cull
+		std::sort(snapshot.VisibleItems.begin(), snapshot.VisibleItems.end());
+	}
+	else
+	{
+		m_culler.Cull(frustum, snapshot.VisibleItems);
+		m_cullStats = DynamicAabbTree::QueryStats();
+		m_cullStats.LeavesTested = m_culler.GetCount();
+		m_cullStats.Results = static_cast<UINT>(snapshot.VisibleItems.size());
+	}
+
+	if (m_occlusionCulling)
+	{
+		// Biggest first, so the triangle budget goes on whatever hides the most
+		std::sort(m_occluderCandidates.begin(), m_occluderCandidates.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+
+		m_occlusionCuller.BeginFrame(viewProjection);
+		for (const auto& [score, slot] : m_occluderCandidates)
 		{
-			m_vecDrawables[i]->SetPosition(GetCamera()->GetPosition());
+			const GameObject* object = m_gameObjects.GetAt(slot);
+			m_occlusionCuller.AddOccluder(*object->m_meshData.Occluder, XMLoadFloat4x4(object->GetTransform()));
 		}
-		m_vecDrawables[i]->Update(deltaTime, m_pImmediateContext.Get());
+		m_occlusionCuller.Rasterize();
+		m_occlusionCuller.Cull(m_itemBounds, snapshot.VisibleItems);
 	}
+	m_visibleObjectCount = static_cast<UINT>(snapshot.VisibleItems.size());
+
+	m_renderQueue.Build(snapshot, m_sortDraws, m_instanceDraws);
+
+	// Only entries that were added or edited go across to the render thread
+	snapshot.MaterialCount = m_materials.GetCount();
+	m_materials.TakeUpdates(snapshot.MaterialUpdates);
 }
 
-void Scene::Draw(int renderPass)
+GameObjectHandle Scene::PickObject(const XMFLOAT3& origin, const XMFLOAT3& direction, float* distance) const
 {
-	for (unsigned int i = 0; i < m_vecDrawables.size(); i++)
-	{
-		if (renderPass == 0 && m_vecDrawables[i]->GetTextureResourceView() == GetTexture(m_textureMap, "RenderTargetViewPass0").Get() || m_vecDrawables[i]->GetTextureResourceView() == GetTexture(m_textureMap, "RenderTargetViewPass1").Get())
+	GameObjectHandle nearest;
+	float nearestDistance = FLT_MAX;
+
+	const XMVECTOR worldOrigin = XMLoadFloat3(&origin);
+	const XMVECTOR worldDirection = XMLoadFloat3(&direction);
+
+	m_objectTree.RayCast(origin, direction, FLT_MAX, [&](uint32_t slot, float entry)
 		{
-			continue;
-		}
-		if (renderPass == 1 && m_vecDrawables[i]->GetTextureResourceView() != GetTexture(m_textureMap, "RenderTargetViewPass2").Get())
+			GameObjectHandle handle = m_gameObjects.GetHandleAt(slot);
+			const GameObject* object = m_gameObjects.GetAt(slot);
+			if (handle == m_skyboxHandle || object == nullptr) return nearestDistance;
+
+			const MeshBvh* bvh = object->m_meshData.PickingBvh.get();
+			if (bvh == nullptr)
+			{
+				nearestDistance = entry;
+				nearest = handle;
+				return entry;
+			}
+
+			// Into the mesh's space. The direction isn't renormalised, so a distance along the local ray is the same
+			// multiple of direction as it is in the world
+			XMVECTOR determinant;
+			XMMATRIX inverseWorld = XMMatrixInverse(&determinant, XMLoadFloat4x4(object->GetTransform()));
+			if (XMVectorGetX(determinant) == 0.0f) return nearestDistance;
+
+			XMFLOAT3 localOrigin, localDirection;
+			XMStoreFloat3(&localOrigin, XMVector3TransformCoord(worldOrigin, inverseWorld));
+			XMStoreFloat3(&localDirection, XMVector3TransformNormal(worldDirection, inverseWorld));
+
+			MeshBvh::Hit hit;
+			if (!bvh->RayCast(localOrigin, localDirection, nearestDistance, hit)) return nearestDistance;
+
+			nearestDistance = hit.Distance;
+			nearest = handle;
+			return hit.Distance;
+		});
+
+	if (distance != nullptr) *distance = nearestDistance;
+	return nearest;
+}
+
+void Scene::QueryObjectsInBox(const BoundingBox& box, std::vector<GameObjectHandle>& objects) const
+{
+	objects.clear();
+	m_objectTree.QueryOverlap(box, [&](uint32_t slot)
 		{
-			continue;
+			objects.push_back(m_gameObjects.GetHandleAt(slot));
+			return true;
+		});
+}
+
+void Scene::CommitSnapshot(StateTrackingContext& context, const RenderSnapshot& snapshot)
+{
+	// The camera is the same for every pass, so it is written once here rather than with every draw
+	FrameConstantBuffer frame;
+	frame.mView = XMMatrixTranspose(XMLoadFloat4x4(&snapshot.View));
+	frame.mProjection = XMMatrixTranspose(XMLoadFloat4x4(&snapshot.Projection));
+	frame.EyePosition = snapshot.EyePosition;
+	context.Get()->UpdateSubresource(m_pFrameConstantBuffer.Get(), 0, nullptr, &frame, 0, 0);
+	m_constantBytesUploaded = sizeof(FrameConstantBuffer);
+	m_deferredContexts.ResetCounts();
+
+	UpdateLightBuffer(context, snapshot);
+
+	m_materialBuffer.Apply(m_pd3dDevice.Get(), m_pImmediateContext.Get(), snapshot.MaterialCount, snapshot.MaterialUpdates);
+
+	if (snapshot.Instanced) m_instanceBuffer.Apply(m_pd3dDevice.Get(), m_pImmediateContext.Get(), snapshot.Instances);
+}
+
+void Scene::Draw(StateTrackingContext& context, const RenderSnapshot& snapshot, int renderPass, bool gbuffer)
+{
+	const auto [first, last] = RenderQueue::FindPass(snapshot.DrawQueue, renderPass == 0 ? 0 : 1);
+
+	// Same buffers for every object, so bind them once per pass rather than per draw
+	context.VSSetConstantBuffer(FRAME_CONSTANT_SLOT, m_pFrameConstantBuffer.Get());
+	context.PSSetConstantBuffer(FRAME_CONSTANT_SLOT, m_pFrameConstantBuffer.Get());
+	context.PSSetShaderResource(MaterialBuffer::SHADER_SLOT, m_materialBuffer.GetShaderResourceView());
+
+	// Only a handful of shaders, a linear search is cheaper than hashing. Anything without a G-buffer
+	// version is left out rather than drawing forward shaded colour into the wrong targets
+	auto findGBufferShader = [this](const RenderItem& item) -> ID3D11PixelShader*
+		{
+			for (const auto& [forward, deferred] : m_gbufferPixelShaders)
+			{
+				if (forward == item.PixelShader) return deferred.Get();
+			}
+			// Otherwise a variant ShaderPermutations picked for the item's material
+			return ShaderPermutations::Get().GetGBufferVariant(item.PixelShader);
+		};
+
+	// A long pass is split into command lists recorded on the job system's threads. Emulated lists cost more than
+	// drawing serially, so without the driver's own the draws go straight to the context
+	ICommandListTarget<StateTrackingContext>* commandLists = m_parallelSubmission && m_deferredContexts.IsNative() ? &m_deferredContexts : nullptr;
+
+	if (snapshot.Instanced)
+	{
+		// The world matrices and materials come from the instance buffer, there are no object constants
+		context.IASetVertexBuffer(InstanceBuffer::VERTEX_SLOT, m_instanceBuffer.GetBuffer(), sizeof(InstanceData), 0);
+
+		const auto [firstBatch, lastBatch] = RenderQueue::FindBatches(snapshot.DrawBatches, first, last);
+		const UINT listCount = CommandListRecorder::Record(commandLists, context, lastBatch - firstBatch, [&](StateTrackingContext& target, size_t begin, size_t end)
+			{
+				for (size_t batch = firstBatch + begin; batch < firstBatch + end; ++batch)
+				{
+					const DrawBatch& drawBatch = snapshot.DrawBatches[batch];
+					const RenderItem& item = snapshot.RenderItems[snapshot.DrawQueue[drawBatch.First].Item];
+
+					ID3D11PixelShader* pixelShader = gbuffer ? findGBufferShader(item) : nullptr;
+					if (gbuffer && pixelShader == nullptr) continue;
+
+					IRenderable::DrawInstanced(target, item, drawBatch.First, drawBatch.Count, pixelShader);
+				}
+			});
+		CommandListRecorder::Execute(commandLists, listCount);
+		return;
+	}
+
+	// Every draw's constants go into the ring with one map, then each draw binds its own slot
+	const UINT drawCount = static_cast<UINT>(last - first);
+	UINT firstSlot = 0;
+	BYTE* slots = m_objectConstants.Map(m_pd3dDevice.Get(), context.Get(), drawCount, firstSlot);
+	if (slots == nullptr)
+	{
+		for (size_t draw = first; draw < last; ++draw)
+		{
+			const RenderItem& item = snapshot.RenderItems[snapshot.DrawQueue[draw].Item];
+
+			ID3D11PixelShader* pixelShader = gbuffer ? findGBufferShader(item) : nullptr;
+			if (gbuffer && pixelShader == nullptr) continue;
+
+			ObjectConstantBuffer constants;
+			IRenderable::FillObjectConstants(item, constants);
+			context.Get()->UpdateSubresource(m_pObjectConstantBuffer.Get(), 0, nullptr, &constants, 0, 0);
+			context.VSSetConstantBuffer(OBJECT_CONSTANT_SLOT, m_pObjectConstantBuffer.Get());
+			m_constantBytesUploaded += sizeof(ObjectConstantBuffer);
+
+			IRenderable::Draw(context, item, pixelShader);
 		}
-		m_vecDrawables[i]->Draw(m_pImmediateContext.Get(), GetCamera(), m_pConstantBuffer.Get());
+		return;
 	}
-}
\ No newline at end of file
+
+	auto fillConstants = [&](size_t begin, size_t end)
+		{
+			ObjectConstantBuffer constants;
+			for (size_t draw = first + begin; draw < first + end; ++draw)
+			{
+				IRenderable::FillObjectConstants(snapshot.RenderItems[snapshot.DrawQueue[draw].Item], constants);
+				memcpy(slots + (draw - first) * ConstantRingBuffer::SLOT_SIZE, &constants, sizeof(ObjectConstantBuffer));
+			}
+		};
+	if (commandLists != nullptr) JobSystem::Get().ParallelFor(drawCount, OBJECT_CONSTANT_FILL_CHUNK_SIZE, fillConstants);
+	else fillConstants(0, drawCount);
+
+	// Unmapped before anything is drawn or recorded with it
+	m_objectConstants.Unmap(context.Get());
+	m_constantBytesUploaded += drawCount * sizeof(ObjectConstantBuffer);
+
+	const UINT listCount = CommandListRecorder::Record(commandLists, context, drawCount, [&](StateTrackingContext& target, size_t begin, size_t end)
+		{
+			for (size_t draw = first + begin; draw < first + end; ++draw)
+			{
+				const RenderItem& item = snapshot.RenderItems[snapshot.DrawQueue[draw].Item];
+
+				ID3D11PixelShader* pixelShader = gbuffer ? findGBufferShader(item) : nullptr;
+				if (gbuffer && pixelShader == nullptr) continue;
+
+				const UINT slot = firstSlot + static_cast<UINT>(draw - first);
+				target.VSSetConstantBuffer1(OBJECT_CONSTANT_SLOT, m_objectConstants.GetBuffer(), slot * ConstantRingBuffer::SLOT_CONSTANTS, ConstantRingBuffer::SLOT_CONSTANTS);
+				IRenderable::Draw(target, item, pixelShader);
+			}
+		});
+	CommandListRecorder::Execute(commandLists, listCount);
+}
@@ -19,10 +19,27 @@
 #include "Camera.h"
 #include <d3d11_1.h>
 #include "GameObject.h"
+#include "ClusteredLights.h"
+#include "DeferredContextPool.h"
+#include "ConstantRingBuffer.h"
+#include "DynamicAabbTree.h"
+#include "FrustumCuller.h"
+#include "LightBuffer.h"
+#include "MaterialTable.h"
+#include "OcclusionCuller.h"
+#include "ObjectPool.h"
+#include "RenderQueue.h"
+#include "RenderSnapshot.h"
+#include "StateTrackingContext.h"
+#include "StressTest.h"
 #include <vector>
+#include <mutex>
+#include <string_view>
 #include  <filesystem>
 #include <map>
 
+typedef PoolHandle GameObjectHandle;
+
 class Scene
 {
 public:
@@ -30,35 +47,110 @@ public:
 	~Scene() = default;
 
 	HRESULT		Init(HWND hwnd, const Microsoft::WRL::ComPtr<ID3D11Device>& device, const Microsoft::WRL::ComPtr<ID3D11DeviceContext>& context);
+
+	// Just the camera, for running the CPU side without a device. Nothing can be drawn or committed
+	void		InitHeadless(UINT width, UINT height);
 	void LoadTextures();
 	void LoadModels();
 	void CreateGameObjects();
 	void		CleanUp();
 	Camera* GetCamera() { return m_pCamera; }
 
+	// Saves the objects, lights and camera path to a binary scene file, or replaces them with the ones in it
+	static constexpr const wchar_t* DEFAULT_SCENE_FILE = L"scene.scene";
+	bool		SaveToFile(const std::wstring& fileName);
+	bool		LoadFromFile(const std::wstring& fileName);
+
+	// Replaces the scene with randomly placed objects using every loaded mesh and texture, and sets the camera flying round them
+	void		CreateStressScene(const StressTest::Settings& settings);
+
+	// Update and BuildSnapshot only touch CPU data and can run on the simulation thread,
+	// CommitSnapshot and Draw issue the D3D calls and have to run on the render thread
 	void		Update(const float deltaTime);
-	void		Draw(int renderPass);
+	void		BuildSnapshot(RenderSnapshot& snapshot);
+	void		CommitSnapshot(StateTrackingContext& context, const RenderSnapshot& snapshot);
+	// gbuffer draws with each pixel shader's G-buffer counterpart, for the deferred path
+	void		Draw(StateTrackingContext& context, const RenderSnapshot& snapshot, int renderPass, bool gbuffer = false);
 
-	void PushBackPixelShaders(string name, Microsoft::WRL::ComPtr <ID3D11PixelShader>& pixelShader) { m_pixelShadersMap.push_back({ name, pixelShader }); }
+	// Held by whichever thread is reading or changing the scene (simulation, input or ImGui)
+	std::mutex& GetMutex() { return m_sceneMutex; }
+
+	void PushBackPixelShaders(string name, Microsoft::WRL::ComPtr <ID3D11PixelShader>& pixelShader, Microsoft::WRL::ComPtr <ID3D11PixelShader> gbufferPixelShader = nullptr)
+	{
+		m_pixelShadersMap.push_back({ name, pixelShader });
+		m_gbufferPixelShaders.push_back({ pixelShader.Get(), gbufferPixelShader });
+	}
 	MeshData GetModelData(const string& modelToFind);
 	MeshData InitCubeMesh(ID3D11Device* pd3dDevice, ID3D11DeviceContext* pContext);
 	MeshData LoadOBJMesh(ID3D11Device* device, const std::string& filename);
 
 	Microsoft::WRL::ComPtr <ID3D11PixelShader>& GetPixelShader(const string& shaderToFind);
 	LightPropertiesConstantBuffer& getLightProperties() { return m_lightProperties; }
-	Microsoft::WRL::ComPtr < ID3D11ShaderResourceView>& GetTexture(vector<std::pair<string, Microsoft::WRL::ComPtr < ID3D11ShaderResourceView>>>& mapToCheck, const string& textureToFind);
+	Microsoft::WRL::ComPtr < ID3D11ShaderResourceView>& GetTexture(vector<std::pair<string, Microsoft::WRL::ComPtr < ID3D11ShaderResourceView>>>& mapToCheck, std::string_view textureToFind);
 
 	void SetupLightProperties();
-	void UpdateLightBuffer();
+	void UpdateLightBuffer(StateTrackingContext& context, const RenderSnapshot& snapshot);
 	std::vector<Light>& GetLights() { return m_lights; }
 	void AddLight();
-	vector<GameObject*>		m_vecDrawables;
+
+	const MaterialTable& GetMaterialTable() const { return m_materials; }
+	const MaterialBuffer& GetMaterialBuffer() const { return m_materialBuffer; }
+	UINT GetVisibleObjectCount() const { return m_visibleObjectCount; }
+	UINT GetVisibleLightCount() const { return m_visibleLightCount; }
+	const DynamicAabbTree& GetObjectTree() const { return m_objectTree; }
+	const DynamicAabbTree::QueryStats& GetCullStats() const { return m_cullStats; }
+	const OcclusionCuller& GetOcclusionCuller() const { return m_occlusionCuller; }
+	const LightClusterGrid& GetLightClusters() const { return m_lightClusters; }
+	const LightBuffer& GetLightBuffer() const { return m_lightBuffer; }
+	const RenderQueue& GetRenderQueue() const { return m_renderQueue; }
+	const InstanceBuffer& GetInstanceBuffer() const { return m_instanceBuffer; }
+	const ConstantRingBuffer& GetObjectConstants() const { return m_objectConstants; }
+	const DeferredContextPool& GetDeferredContexts() const { return m_deferredContexts; }
+
+	// The frame's constants are bound to both stages, the object's only to the vertex shader
+	static constexpr UINT FRAME_CONSTANT_SLOT = 0;
+	static constexpr UINT OBJECT_CONSTANT_SLOT = 3;
+
+	// Constant buffer bytes written last frame
+	UINT GetConstantBytesUploaded() const { return m_constantBytesUploaded; }
+
+	// Spatial queries against the object tree, which holds the bounds as of the last snapshot.
+	// The ray finds the nearest object whose triangles it hits, going through the tree to find the boxes worth
+	// testing and then each mesh's own tree. Meshes without one count as hit where the ray enters their box.
+	// The skybox is left out, distance comes back in multiples of direction
+	GameObjectHandle PickObject(const XMFLOAT3& origin, const XMFLOAT3& direction, float* distance = nullptr) const;
+	void QueryObjectsInBox(const BoundingBox& box, std::vector<GameObjectHandle>& objects) const;
+
+	// Objects live in the pool, anything holding on to one between frames keeps a handle
+	GameObject* GetGameObject(GameObjectHandle handle) { return m_gameObjects.Get(handle); }
+	ObjectPool<GameObject>	m_gameObjects;
 	vector<std::pair<string, MeshData>> m_models;
 
 	vector<std::pair<string, Microsoft::WRL::ComPtr < ID3D11PixelShader>>> m_pixelShadersMap;
+
+	// The shader each pixel shader is swapped for when drawing the G-buffer
+	vector<std::pair<ID3D11PixelShader*, Microsoft::WRL::ComPtr < ID3D11PixelShader>>> m_gbufferPixelShaders;
 	vector<std::pair<string, Microsoft::WRL::ComPtr < ID3D11ShaderResourceView>>> m_textureMap;
 	vector<std::pair<string, Microsoft::WRL::ComPtr < ID3D11ShaderResourceView>>> m_normalMapTextureMap;
 	bool m_playCameraSplineAnimation = false;
+
+	// Off goes back to testing every object's box against the frustum
+	bool m_cullWithObjectTree = true;
+
+	// Hides objects behind the ones marked as occluders
+	bool m_occlusionCulling = true;
+
+	// Off lights every pixel with every light, the way it was before the clusters
+	bool m_clusteredLighting = true;
+
+	// Off draws in the order the objects are visible rather than grouped by what they bind
+	bool m_sortDraws = true;
+
+	// Draws runs of objects sharing a mesh, shader and textures with one instanced draw each
+	bool m_instanceDraws = true;
+
+	// Records long passes on the job system's threads into deferred contexts, if the driver has its own command lists
+	bool m_parallelSubmission = true;
 	float m_totalSplineAnimation = 3.0f;
 	std::vector<XMVECTOR> m_controlPoints = {
 XMVectorSet(0.0f, 0.0f, 0.0f, 0.0f),  // Initial velocity
@@ -67,14 +159,60 @@ XMVectorSet(5.0f,  0.0f, 5.0f, 0.0f),
 XMVectorSet(0.0f, 0.0f, 0.0f, 0.0f)   // Final velocity
 	};
 private:
-	Camera* m_pCamera;
+	// Throws away every object, ready for a new set to be created
+	void		ClearGameObjects();
+
+	Camera* m_pCamera = nullptr;
 
 	Microsoft::WRL::ComPtr <ID3D11Device>			m_pd3dDevice;
 	Microsoft::WRL::ComPtr <ID3D11DeviceContext>	m_pImmediateContext;
-	Microsoft::WRL::ComPtr <ID3D11Buffer>			m_pConstantBuffer;
+	Microsoft::WRL::ComPtr <ID3D11Buffer>			m_pFrameConstantBuffer;
+
+	// Each draw's world matrix and material in its own slot. Without D3D 11.1 every draw rewrites the single buffer instead
+	ConstantRingBuffer								m_objectConstants;
+	Microsoft::WRL::ComPtr <ID3D11Buffer>			m_pObjectConstantBuffer;
+	UINT											m_constantBytesUploaded = 0;
+
+	// Only touched on the render thread, and the workers it hands a pass's lists to
+	DeferredContextPool								m_deferredContexts;
 	Microsoft::WRL::ComPtr <ID3D11Buffer>			m_pLightConstantBuffer;
-	Microsoft::WRL::ComPtr<ID3D11Buffer> m_lightStructuredBuffer;
-	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> m_lightSRV;
 	std::vector<Light> m_lights;
+
+	// Last values written to the light constant buffer, it is only written again when they change
 	LightPropertiesConstantBuffer m_lightProperties;
+	bool m_lightPropertiesUploaded = false;
+
+	// Only touched on the render thread
+	LightBuffer m_lightBuffer;
+
+	// Grid is built with the snapshot, the buffer is only touched on the render thread
+	LightClusterGrid m_lightClusters;
+	LightClusterBuffer m_lightClusterBuffer;
+	UINT m_visibleLightCount = 0;
+
+	// Table is simulation side, the buffer is only touched on the render thread
+	MaterialTable m_materials;
+	MaterialBuffer m_materialBuffer;
+
+	// Filled and run while building each snapshot
+	FrustumCuller m_culler;
+	UINT m_visibleObjectCount = 0;
+
+	// Every object's bounds, kept in step with the pool while building each snapshot. Proxies and
+	// render item indices are both looked up by pool slot
+	DynamicAabbTree m_objectTree;
+	std::vector<int> m_objectProxies;
+	std::vector<UINT> m_slotItems;
+	DynamicAabbTree::QueryStats m_cullStats;
+
+	// Each render item's world bounds, and the occluders in view with how big they look
+	OcclusionCuller m_occlusionCuller;
+	std::vector<BoundingBox> m_itemBounds;
+	std::vector<std::pair<float, UINT>> m_occluderCandidates;
+
+	// Orders the visible items into the snapshot's draw queue, the buffer is only touched on the render thread
+	RenderQueue m_renderQueue;
+	InstanceBuffer m_instanceBuffer;
+	std::mutex m_sceneMutex;
+	GameObjectHandle m_skyboxHandle;
 };
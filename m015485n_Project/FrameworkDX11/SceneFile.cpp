@@ -0,0 +1,182 @@
+#include "SceneFile.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <type_traits>
+
+namespace
+{
+	// Everything is copied in and out as raw bytes
+	static_assert(std::is_trivially_copyable<SceneFile::Header>::value, "Header has to be plain data");
+	static_assert(std::is_trivially_copyable<SceneFile::ObjectRecord>::value, "ObjectRecord has to be plain data");
+	static_assert(std::is_trivially_copyable<Light>::value, "Light has to be plain data");
+
+	uint64_t AlignUp(uint64_t value)
+	{
+		return (value + SceneFile::SECTION_ALIGNMENT - 1) & ~(SceneFile::SECTION_ALIGNMENT - 1);
+	}
+
+	// True if count elements of elementSize starting at offset fit in a file of fileSize bytes
+	bool SectionFits(uint64_t offset, uint64_t count, uint64_t elementSize, uint64_t fileSize)
+	{
+		if (offset % SceneFile::SECTION_ALIGNMENT != 0 || offset > fileSize) return false;
+		return count <= (fileSize - offset) / elementSize;
+	}
+}
+
+namespace SceneFile
+{
+	uint32_t SceneData::AddString(std::string_view text)
+	{
+		auto existing = m_stringIds.find(std::string(text));
+		if (existing != m_stringIds.end()) return existing->second;
+
+		uint32_t id = static_cast<uint32_t>(Strings.size());
+		Strings.emplace_back(text);
+		m_stringIds.emplace(Strings.back(), id);
+		return id;
+	}
+
+	bool Write(const std::wstring& fileName, const SceneData& scene)
+	{
+		Header header = {};
+		header.Magic = MAGIC;
+		header.Version = VERSION;
+		header.HeaderSize = sizeof(Header);
+		header.ObjectRecordSize = sizeof(ObjectRecord);
+		header.LightRecordSize = sizeof(Light);
+		header.ObjectCount = static_cast<uint32_t>(scene.Objects.size());
+		header.LightCount = static_cast<uint32_t>(scene.Lights.size());
+		header.SplinePointCount = static_cast<uint32_t>(scene.SplinePoints.size());
+		header.StringCount = static_cast<uint32_t>(scene.Strings.size());
+		header.SplineDuration = scene.SplineDuration;
+
+		std::vector<StringEntry> stringEntries;
+		stringEntries.reserve(scene.Strings.size());
+		uint32_t stringDataSize = 0;
+		for (const std::string& text : scene.Strings)
+		{
+			stringEntries.push_back({ stringDataSize, static_cast<uint32_t>(text.size()) });
+			stringDataSize += static_cast<uint32_t>(text.size());
+		}
+
+		header.ObjectsOffset = AlignUp(sizeof(Header));
+		header.LightsOffset = AlignUp(header.ObjectsOffset + sizeof(ObjectRecord) * scene.Objects.size());
+		header.SplinePointsOffset = AlignUp(header.LightsOffset + sizeof(Light) * scene.Lights.size());
+		header.StringsOffset = AlignUp(header.SplinePointsOffset + sizeof(DirectX::XMFLOAT4) * scene.SplinePoints.size());
+		header.StringDataOffset = AlignUp(header.StringsOffset + sizeof(StringEntry) * stringEntries.size());
+		header.StringDataSize = stringDataSize;
+		header.FileSize = header.StringDataOffset + stringDataSize;
+
+		// Built in memory and written in one go
+		std::vector<unsigned char> file(static_cast<size_t>(header.FileSize), 0);
+		auto copySection = [&file](uint64_t offset, const void* data, size_t size)
+			{
+				if (size > 0) memcpy(file.data() + offset, data, size);
+			};
+
+		copySection(0, &header, sizeof(Header));
+		copySection(header.ObjectsOffset, scene.Objects.data(), sizeof(ObjectRecord) * scene.Objects.size());
+		copySection(header.LightsOffset, scene.Lights.data(), sizeof(Light) * scene.Lights.size());
+		copySection(header.SplinePointsOffset, scene.SplinePoints.data(), sizeof(DirectX::XMFLOAT4) * scene.SplinePoints.size());
+		copySection(header.StringsOffset, stringEntries.data(), sizeof(StringEntry) * stringEntries.size());
+		for (size_t i = 0; i < scene.Strings.size(); ++i)
+		{
+			copySection(header.StringDataOffset + stringEntries[i].Offset, scene.Strings[i].data(), scene.Strings[i].size());
+		}
+
+		std::ofstream out(std::filesystem::path(fileName), std::ios::binary | std::ios::trunc);
+		if (!out) return false;
+
+		out.write(reinterpret_cast<const char*>(file.data()), static_cast<std::streamsize>(file.size()));
+		return out.good();
+	}
+
+	bool MappedFile::Open(const std::wstring& fileName)
+	{
+		Close();
+
+		m_file = CreateFileW(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (m_file == INVALID_HANDLE_VALUE) return false;
+
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(m_file, &size) || size.QuadPart < static_cast<LONGLONG>(sizeof(Header)))
+		{
+			Close();
+			return false;
+		}
+		m_size = static_cast<uint64_t>(size.QuadPart);
+
+		m_mapping = CreateFileMappingW(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (m_mapping == nullptr)
+		{
+			Close();
+			return false;
+		}
+
+		m_data = static_cast<const unsigned char*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+		if (m_data == nullptr || !Validate())
+		{
+			Close();
+			return false;
+		}
+
+		return true;
+	}
+
+	void MappedFile::Close()
+	{
+		if (m_data != nullptr) UnmapViewOfFile(m_data);
+		if (m_mapping != nullptr) CloseHandle(m_mapping);
+		if (m_file != INVALID_HANDLE_VALUE) CloseHandle(m_file);
+
+		m_data = nullptr;
+		m_mapping = nullptr;
+		m_file = INVALID_HANDLE_VALUE;
+		m_size = 0;
+	}
+
+	bool MappedFile::Validate() const
+	{
+		const Header& header = GetHeader();
+
+		if (header.Magic != MAGIC || header.Version != VERSION) return false;
+		if (header.HeaderSize != sizeof(Header) || header.ObjectRecordSize != sizeof(ObjectRecord) || header.LightRecordSize != sizeof(Light)) return false;
+		if (header.FileSize != m_size) return false;
+
+		if (!SectionFits(header.ObjectsOffset, header.ObjectCount, sizeof(ObjectRecord), m_size)) return false;
+		if (!SectionFits(header.LightsOffset, header.LightCount, sizeof(Light), m_size)) return false;
+		if (!SectionFits(header.SplinePointsOffset, header.SplinePointCount, sizeof(DirectX::XMFLOAT4), m_size)) return false;
+		if (!SectionFits(header.StringsOffset, header.StringCount, sizeof(StringEntry), m_size)) return false;
+		if (header.StringDataOffset > m_size || header.StringDataSize > m_size - header.StringDataOffset) return false;
+
+		const StringEntry* strings = reinterpret_cast<const StringEntry*>(m_data + header.StringsOffset);
+		for (uint32_t i = 0; i < header.StringCount; ++i)
+		{
+			if (strings[i].Offset > header.StringDataSize || strings[i].Length > header.StringDataSize - strings[i].Offset) return false;
+		}
+
+		// Every string an object refers to has to exist
+		const ObjectRecord* objects = GetObjects();
+		for (uint32_t i = 0; i < header.ObjectCount; ++i)
+		{
+			const ObjectRecord& object = objects[i];
+			for (uint32_t id : { object.Name, object.Model, object.Texture, object.NormalMap, object.PixelShader })
+			{
+				if (id != NO_STRING && id >= header.StringCount) return false;
+			}
+		}
+
+		return true;
+	}
+
+	std::string_view MappedFile::GetString(uint32_t id) const
+	{
+		if (id == NO_STRING) return {};
+
+		const Header& header = GetHeader();
+		const StringEntry& entry = reinterpret_cast<const StringEntry*>(m_data + header.StringsOffset)[id];
+		return std::string_view(reinterpret_cast<const char*>(m_data + header.StringDataOffset + entry.Offset), entry.Length);
+	}
+}
@@ -0,0 +1,149 @@
+// Versioned binary scene files, laid out as flat arrays so they can be mapped and read in place
+
+#pragma once
+
+#include <windows.h>
+#include <DirectXMath.h>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "structures.h"
+
+namespace SceneFile
+{
+	constexpr uint32_t MAGIC = 'S' | ('C' << 8) | ('N' << 16) | ('B' << 24);
+	constexpr uint32_t VERSION = 1;
+
+	// Sections start on this boundary so every array can be read straight out of the mapping
+	constexpr uint64_t SECTION_ALIGNMENT = 16;
+
+	// String id for an object that has no texture / normal map etc.
+	constexpr uint32_t NO_STRING = UINT32_MAX;
+
+	enum ObjectFlags : uint32_t
+	{
+		OBJECT_AUTO_ROTATE_X = 1 << 0,
+		OBJECT_AUTO_ROTATE_Y = 1 << 1,
+		OBJECT_AUTO_ROTATE_Z = 1 << 2,
+		OBJECT_RENDER_TEXTURE = 1 << 3,
+		OBJECT_SKYBOX = 1 << 4,
+		OBJECT_OCCLUDER = 1 << 5
+	};
+
+	/// <summary>
+	/// Start of the file. The record sizes are stored so a file written with a different layout is rejected
+	/// rather than misread.
+	/// </summary>
+	struct Header
+	{
+		uint32_t	Magic;
+		uint32_t	Version;
+		uint32_t	HeaderSize;
+		uint32_t	ObjectRecordSize;
+		uint32_t	LightRecordSize;
+
+		uint32_t	ObjectCount;
+		uint32_t	LightCount;
+		uint32_t	SplinePointCount;
+		uint32_t	StringCount;
+		float		SplineDuration;
+
+		uint64_t	ObjectsOffset;
+		uint64_t	LightsOffset;
+		uint64_t	SplinePointsOffset;
+		uint64_t	StringsOffset;
+		uint64_t	StringDataOffset;
+		uint64_t	StringDataSize;
+		uint64_t	FileSize;
+	};
+
+	/// Where a string lives in the string data, strings aren't null terminated.
+	struct StringEntry
+	{
+		uint32_t	Offset;
+		uint32_t	Length;
+	};
+
+	/// <summary>
+	/// One game object. Meshes, textures and shaders are stored by name (an index into the string table)
+	/// and looked up in the scene's resources when loading.
+	/// </summary>
+	struct ObjectRecord
+	{
+		DirectX::XMFLOAT3	Position;
+		DirectX::XMFLOAT4	Rotation;
+		DirectX::XMFLOAT3	Scale;
+		DirectX::XMFLOAT3	OriginalPosition;
+		DirectX::XMFLOAT4	OriginalRotation;
+		DirectX::XMFLOAT3	OriginalScale;
+
+		_Material			Material;
+		_Material			OriginalMaterial;
+
+		float				AutoRotationSpeed;
+		uint32_t			Flags;
+
+		uint32_t			Name;
+		uint32_t			Model;
+		uint32_t			Texture;
+		uint32_t			NormalMap;
+		uint32_t			PixelShader;
+	};
+
+	/// <summary>
+	/// A whole scene as plain arrays, what gets written out.
+	/// </summary>
+	struct SceneData
+	{
+		std::vector<ObjectRecord>		Objects;
+		std::vector<Light>				Lights;
+		std::vector<DirectX::XMFLOAT4>	SplinePoints;
+		float							SplineDuration = 0.0f;
+		std::vector<std::string>		Strings;
+
+		/// Gets the id of a string, adding it the first time it is seen.
+		uint32_t AddString(std::string_view text);
+
+	private:
+		std::unordered_map<std::string, uint32_t>	m_stringIds;
+	};
+
+	/// Writes the scene out, replacing the file if it already exists.
+	bool Write(const std::wstring& fileName, const SceneData& scene);
+
+	/// <summary>
+	/// A scene file mapped read only. Open checks every section lies inside the file, after that the arrays
+	/// point straight into the mapping and stay valid until Close.
+	/// </summary>
+	class MappedFile
+	{
+	public:
+		MappedFile() = default;
+		~MappedFile() { Close(); }
+
+		bool Open(const std::wstring& fileName);
+		void Close();
+
+		const Header&				GetHeader() const { return *reinterpret_cast<const Header*>(m_data); }
+		const ObjectRecord*			GetObjects() const { return reinterpret_cast<const ObjectRecord*>(m_data + GetHeader().ObjectsOffset); }
+		const Light*				GetLights() const { return reinterpret_cast<const Light*>(m_data + GetHeader().LightsOffset); }
+		const DirectX::XMFLOAT4*	GetSplinePoints() const { return reinterpret_cast<const DirectX::XMFLOAT4*>(m_data + GetHeader().SplinePointsOffset); }
+
+		/// Gets a string from the string table, NO_STRING gives an empty string.
+		std::string_view			GetString(uint32_t id) const;
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+	private:
+		bool Validate() const;
+
+		HANDLE					m_file = INVALID_HANDLE_VALUE;
+		HANDLE					m_mapping = nullptr;
+		const unsigned char*	m_data = nullptr;
+		uint64_t				m_size = 0;
+	};
+}
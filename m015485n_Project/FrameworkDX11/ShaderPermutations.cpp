@@ -0,0 +1,263 @@
+#include "ShaderPermutations.h"
+
+#include <chrono>
+#include <d3dcompiler.h>
+#include <d3d11shader.h>
+#include <filesystem>
+
+namespace
+{
+	const char* FEATURE_KEYWORDS[SHADER_FEATURE_COUNT] = { "USE_TEXTURE", "USE_NORMAL_MAP" };
+
+	// Debug builds compile without optimisation, their bytecode is kept apart
+#ifdef _DEBUG
+	const wchar_t* CACHE_SUFFIX = L"_debug.cso";
+#else
+	const wchar_t* CACHE_SUFFIX = L".cso";
+#endif
+
+	UINT CountFeatures(UINT features)
+	{
+		UINT count = 0;
+		for (UINT i = 0; i < SHADER_FEATURE_COUNT; ++i)
+		{
+			if ((features & (1u << i)) != 0) ++count;
+		}
+		return count;
+	}
+
+	UINT CountInstructions(ID3DBlob* bytecode)
+	{
+		Microsoft::WRL::ComPtr<ID3D11ShaderReflection> reflection;
+		if (FAILED(D3DReflect(bytecode->GetBufferPointer(), bytecode->GetBufferSize(), IID_ID3D11ShaderReflection, reinterpret_cast<void**>(reflection.GetAddressOf()))))
+			return 0;
+
+		D3D11_SHADER_DESC desc = {};
+		reflection->GetDesc(&desc);
+		return desc.InstructionCount;
+	}
+}
+
+ShaderPermutations& ShaderPermutations::Get()
+{
+	static ShaderPermutations permutations;
+	return permutations;
+}
+
+void ShaderPermutations::Init(ID3D11Device* device, const std::wstring& fileName, const std::wstring& cacheDirectory)
+{
+	Clear();
+	m_device = device;
+	m_fileName = fileName;
+	m_cacheDirectory = cacheDirectory;
+}
+
+void ShaderPermutations::Clear()
+{
+	std::lock_guard<std::mutex> lock(m_compileMutex);
+
+	const UINT count = m_variantCount.load(std::memory_order_relaxed);
+	for (UINT i = 0; i < count; ++i) m_variants[i] = Variant();
+	m_variantCount.store(0, std::memory_order_release);
+	m_shaders.clear();
+	m_device.Reset();
+}
+
+const char* ShaderPermutations::GetKeyword(UINT featureIndex)
+{
+	return featureIndex < SHADER_FEATURE_COUNT ? FEATURE_KEYWORDS[featureIndex] : "";
+}
+
+UINT ShaderPermutations::GetFeatures(const _Material& material)
+{
+	UINT features = 0;
+	if (material.UseTexture) features |= SHADER_FEATURE_TEXTURE;
+	if (material.UseNormalMap) features |= SHADER_FEATURE_NORMAL_MAP;
+	return features;
+}
+
+HRESULT ShaderPermutations::AddShader(LPCSTR entryPoint, LPCSTR gbufferEntryPoint, UINT features, UINT& shader)
+{
+	features &= SHADER_FEATURES_ALL;
+	if (GetPossibleVariantCount() + (1u << CountFeatures(features)) > VARIANT_BUDGET)
+		return E_OVER_BUDGET;
+
+	Shader added;
+	added.EntryPoint = entryPoint;
+	added.GBufferEntryPoint = gbufferEntryPoint != nullptr ? gbufferEntryPoint : "";
+	added.Features = features;
+	m_shaders.push_back(added);
+	shader = static_cast<UINT>(m_shaders.size() - 1);
+
+	const Variant* allFeatures = GetVariant(shader, features);
+	if (allFeatures == nullptr)
+	{
+		m_shaders.pop_back();
+		return E_FAIL;
+	}
+
+	m_shaders.back().AllFeatures = allFeatures->PixelShader.Get();
+	return S_OK;
+}
+
+const ShaderPermutations::Variant* ShaderPermutations::GetVariant(UINT shader, UINT features)
+{
+	if (shader >= m_shaders.size()) return nullptr;
+	features &= m_shaders[shader].Features;
+
+	UINT index = FindVariant(shader, features);
+	if (index != VARIANT_BUDGET) return &m_variants[index];
+
+	// Looked for again, another thread may have compiled it while this one waited
+	std::lock_guard<std::mutex> lock(m_compileMutex);
+	index = FindVariant(shader, features);
+	if (index != VARIANT_BUDGET) return &m_variants[index];
+
+	// Can't be full, AddShader keeps every possible variant inside the budget
+	const UINT count = m_variantCount.load(std::memory_order_relaxed);
+	if (count == VARIANT_BUDGET) return nullptr;
+
+	Variant& variant = m_variants[count];
+	variant.Shader = shader;
+	variant.Features = features;
+	if (FAILED(LoadVariant(variant)))
+	{
+		variant = Variant();
+		return nullptr;
+	}
+
+	m_variantCount.store(count + 1, std::memory_order_release);
+	return &variant;
+}
+
+ID3D11PixelShader* ShaderPermutations::Select(ID3D11PixelShader* shader, UINT features)
+{
+	if (shader == nullptr) return shader;
+
+	for (UINT i = 0; i < m_shaders.size(); ++i)
+	{
+		if (m_shaders[i].AllFeatures != shader) continue;
+
+		const Variant* variant = GetVariant(i, features);
+		return variant != nullptr ? variant->PixelShader.Get() : shader;
+	}
+	return shader;
+}
+
+ID3D11PixelShader* ShaderPermutations::GetGBufferVariant(ID3D11PixelShader* variant) const
+{
+	const UINT count = GetVariantCount();
+	for (UINT i = 0; i < count; ++i)
+	{
+		if (m_variants[i].PixelShader.Get() == variant) return m_variants[i].GBufferPixelShader.Get();
+	}
+	return nullptr;
+}
+
+UINT ShaderPermutations::GetPossibleVariantCount() const
+{
+	UINT count = 0;
+	for (const Shader& shader : m_shaders) count += 1u << CountFeatures(shader.Features);
+	return count;
+}
+
+UINT ShaderPermutations::FindVariant(UINT shader, UINT features) const
+{
+	const UINT count = GetVariantCount();
+	for (UINT i = 0; i < count; ++i)
+	{
+		if (m_variants[i].Shader == shader && m_variants[i].Features == features) return i;
+	}
+	return VARIANT_BUDGET;
+}
+
+HRESULT ShaderPermutations::LoadBytecode(const std::string& entryPoint, UINT features, Microsoft::WRL::ComPtr<ID3DBlob>& bytecode, bool& fromCache) const
+{
+	// Bytecode newer than the shader file is still good
+	std::wstring cacheFile;
+	if (!m_cacheDirectory.empty())
+	{
+		cacheFile = m_cacheDirectory + L"/" + std::wstring(entryPoint.begin(), entryPoint.end()) + L"_" + std::to_wstring(features) + CACHE_SUFFIX;
+
+		std::error_code sourceError;
+		std::error_code cacheError;
+		const auto sourceTime = std::filesystem::last_write_time(m_fileName, sourceError);
+		const auto cacheTime = std::filesystem::last_write_time(cacheFile, cacheError);
+		if (!sourceError && !cacheError && cacheTime >= sourceTime && SUCCEEDED(D3DReadFileToBlob(cacheFile.c_str(), bytecode.ReleaseAndGetAddressOf())))
+		{
+			fromCache = true;
+			return S_OK;
+		}
+	}
+
+	// Every keyword is defined, to 1 or 0, so the shader tests them with #if
+	D3D_SHADER_MACRO defines[SHADER_FEATURE_COUNT + 1] = {};
+	for (UINT i = 0; i < SHADER_FEATURE_COUNT; ++i)
+	{
+		defines[i].Name = FEATURE_KEYWORDS[i];
+		defines[i].Definition = (features & (1u << i)) != 0 ? "1" : "0";
+	}
+
+	DWORD shaderFlags = D3DCOMPILE_ENABLE_STRICTNESS;
+#ifdef _DEBUG
+	shaderFlags |= D3DCOMPILE_DEBUG | D3DCOMPILE_SKIP_OPTIMIZATION;
+#endif
+
+	Microsoft::WRL::ComPtr<ID3DBlob> errors;
+	HRESULT hr = D3DCompileFromFile(m_fileName.c_str(), defines, nullptr, entryPoint.c_str(), "ps_4_0", shaderFlags, 0, bytecode.ReleaseAndGetAddressOf(), &errors);
+	if (FAILED(hr))
+	{
+		if (errors != nullptr) OutputDebugStringA(static_cast<const char*>(errors->GetBufferPointer()));
+		return hr;
+	}
+
+	// A cache that can't be written only means compiling again next run
+	fromCache = false;
+	if (!cacheFile.empty())
+	{
+		std::error_code error;
+		std::filesystem::create_directories(m_cacheDirectory, error);
+		D3DWriteBlobToFile(bytecode.Get(), cacheFile.c_str(), TRUE);
+	}
+	return S_OK;
+}
+
+HRESULT ShaderPermutations::LoadVariant(Variant& variant) const
+{
+	const Shader& shader = m_shaders[variant.Shader];
+	const auto start = std::chrono::steady_clock::now();
+
+	Microsoft::WRL::ComPtr<ID3DBlob> bytecode;
+	bool fromCache = false;
+	HRESULT hr = LoadBytecode(shader.EntryPoint, variant.Features, bytecode, fromCache);
+	if (FAILED(hr))
+		return hr;
+
+	variant.Instructions = CountInstructions(bytecode.Get());
+	variant.FromCache = fromCache;
+	if (m_device != nullptr)
+	{
+		hr = m_device->CreatePixelShader(bytecode->GetBufferPointer(), bytecode->GetBufferSize(), nullptr, &variant.PixelShader);
+		if (FAILED(hr))
+			return hr;
+	}
+
+	if (!shader.GBufferEntryPoint.empty())
+	{
+		hr = LoadBytecode(shader.GBufferEntryPoint, variant.Features, bytecode, fromCache);
+		if (FAILED(hr))
+			return hr;
+
+		variant.GBufferInstructions = CountInstructions(bytecode.Get());
+		variant.FromCache = variant.FromCache && fromCache;
+		if (m_device != nullptr)
+		{
+			hr = m_device->CreatePixelShader(bytecode->GetBufferPointer(), bytecode->GetBufferSize(), nullptr, &variant.GBufferPixelShader);
+			if (FAILED(hr))
+				return hr;
+		}
+	}
+
+	variant.LoadMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+	return S_OK;
+}
@@ -0,0 +1,135 @@
+// Pixel shaders compiled once per combination of the material features they use, and only once something needs one
+
+#pragma once
+
+#include <d3d11_1.h>
+#include <wrl/client.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "structures.h"
+
+/// Material features a pixel shader can be compiled with or without, one bit each. The shader sees each one's
+/// keyword defined to 1 or 0 rather than branching on the material's flag.
+enum ShaderFeature : UINT
+{
+	SHADER_FEATURE_TEXTURE		= 1 << 0,	// USE_TEXTURE
+	SHADER_FEATURE_NORMAL_MAP	= 1 << 1,	// USE_NORMAL_MAP
+};
+
+constexpr UINT SHADER_FEATURE_COUNT = 2;
+constexpr UINT SHADER_FEATURES_ALL = (1u << SHADER_FEATURE_COUNT) - 1;
+
+/// <summary>
+/// Each added shader is an entry point, with a G-buffer counterpart if it has one, and the features it reads. A
+/// variant is compiled the first time an object's material asks for it, its bytecode kept on disk so the next run
+/// only reads it back, and the compiler's instruction counts kept for the stats window.
+///
+/// Objects and scene files keep naming a shader by the variant with all its features on, which AddShader hands
+/// back, and Select swaps that for the variant a material needs. Every variant the added shaders could have has to
+/// fit in VARIANT_BUDGET, so a new feature that would double them all is caught where it is added.
+///
+/// Shaders are added on the render thread while loading. Select can compile from the simulation thread, the
+/// variants are never moved or removed so reading one needs no lock.
+/// </summary>
+class ShaderPermutations
+{
+public:
+	static constexpr UINT VARIANT_BUDGET = 16;
+
+	/// What AddShader returns for a shader whose variants don't fit in what is left of the budget.
+	static constexpr HRESULT E_OVER_BUDGET = MAKE_HRESULT(SEVERITY_ERROR, FACILITY_ITF, 0x200);
+	static_assert((1u << SHADER_FEATURE_COUNT) <= VARIANT_BUDGET, "one shader reading every feature has to fit the budget");
+
+	/// Gets the shared set.
+	static ShaderPermutations& Get();
+
+	/// @param device nullptr compiles and counts instructions without creating shaders, for measuring.
+	/// @param cacheDirectory Where bytecode is kept between runs, empty compiles every time.
+	void	Init(ID3D11Device* device, const std::wstring& fileName, const std::wstring& cacheDirectory);
+
+	/// Releases every shader, call before the device goes away.
+	void	Clear();
+
+	static const char*	GetKeyword(UINT featureIndex);
+
+	/// The features a material's flags turn on.
+	static UINT			GetFeatures(const _Material& material);
+
+	/// Adds an entry point compiled once per combination of the features it reads, and compiles the variant with
+	/// all of them on straight away.
+	/// @param gbufferEntryPoint The deferred path's version, compiled with the same features. nullptr if none.
+	/// @param shader Set to the index to ask for its variants with.
+	/// @return E_OVER_BUDGET if its variants don't fit in what is left of the budget, E_FAIL if it doesn't compile.
+	HRESULT	AddShader(LPCSTR entryPoint, LPCSTR gbufferEntryPoint, UINT features, UINT& shader);
+
+	struct Variant
+	{
+		UINT											Shader = 0;
+		UINT											Features = 0;
+		Microsoft::WRL::ComPtr<ID3D11PixelShader>		PixelShader;
+		Microsoft::WRL::ComPtr<ID3D11PixelShader>		GBufferPixelShader;
+
+		// From the compiler's reflection, 0 for a G-buffer version that doesn't exist
+		UINT											Instructions = 0;
+		UINT											GBufferInstructions = 0;
+
+		// Compiling or reading back both versions, and whether both came from the disk cache
+		float											LoadMs = 0.0f;
+		bool											FromCache = false;
+	};
+
+	/// The variant of shader for features, left out features it doesn't read. Compiled if no one has asked for it yet.
+	/// @return nullptr if it doesn't compile.
+	const Variant*	GetVariant(UINT shader, UINT features);
+
+	/// The pixel shader to draw a material with for a shader AddShader handed back. Anything else, and variants
+	/// that don't compile, come back as they are.
+	ID3D11PixelShader*	Select(ID3D11PixelShader* shader, UINT features);
+
+	/// The G-buffer version of a pixel shader Select returned, nullptr if it isn't one or has none.
+	ID3D11PixelShader*	GetGBufferVariant(ID3D11PixelShader* variant) const;
+
+	/// The variants compiled so far, in the order they were first asked for.
+	UINT			GetVariantCount() const { return m_variantCount.load(std::memory_order_acquire); }
+	const Variant&	GetVariantAt(UINT index) const { return m_variants[index]; }
+
+	/// Every variant the added shaders could have between them.
+	UINT		GetPossibleVariantCount() const;
+	const char*	GetEntryPoint(UINT shader) const { return m_shaders[shader].EntryPoint.c_str(); }
+
+	ShaderPermutations(const ShaderPermutations&) = delete;
+	ShaderPermutations& operator=(const ShaderPermutations&) = delete;
+
+private:
+	ShaderPermutations() = default;
+
+	struct Shader
+	{
+		std::string		EntryPoint;
+		std::string		GBufferEntryPoint;
+		UINT			Features = 0;
+
+		// The variant with every feature on, what objects hold
+		ID3D11PixelShader*	AllFeatures = nullptr;
+	};
+
+	/// The index of a compiled variant, VARIANT_BUDGET if there isn't one.
+	UINT	FindVariant(UINT shader, UINT features) const;
+
+	/// Compiles, or reads back from the cache, entryPoint with features' keywords defined.
+	HRESULT	LoadBytecode(const std::string& entryPoint, UINT features, Microsoft::WRL::ComPtr<ID3DBlob>& bytecode, bool& fromCache) const;
+	HRESULT	LoadVariant(Variant& variant) const;
+
+	Microsoft::WRL::ComPtr<ID3D11Device>	m_device;
+	std::wstring							m_fileName;
+	std::wstring							m_cacheDirectory;
+	std::vector<Shader>						m_shaders;
+
+	// Filled in order and never moved, m_variantCount is only raised once the variant is complete
+	Variant									m_variants[VARIANT_BUDGET];
+	std::atomic<UINT>						m_variantCount{ 0 };
+	std::mutex								m_compileMutex;
+};
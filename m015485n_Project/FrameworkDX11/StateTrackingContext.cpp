@@ -0,0 +1,241 @@
+#include "StateTrackingContext.h"
+
+void StateTrackingContext::Init(ID3D11DeviceContext* context, ID3D11DeviceContext1* context1)
+{
+	m_context = context;
+	m_context1 = context1;
+	Invalidate();
+	ResetCounts();
+}
+
+void StateTrackingContext::Invalidate()
+{
+	m_vertexShader.Known = false;
+	m_pixelShader.Known = false;
+	m_inputLayout.Known = false;
+	m_topology.Known = false;
+	for (auto& binding : m_vertexBuffers) binding.Known = false;
+	m_indexBuffer.Known = false;
+	for (auto& binding : m_vsConstantBuffers) binding.Known = false;
+	for (auto& binding : m_psConstantBuffers) binding.Known = false;
+	for (auto& binding : m_shaderResources) binding.Known = false;
+	for (auto& binding : m_samplers) binding.Known = false;
+	m_rasterizerState.Known = false;
+	m_blendState.Known = false;
+	m_depthStencilState.Known = false;
+	m_renderTargets.Known = false;
+}
+
+void StateTrackingContext::Inherit(const StateTrackingContext& source)
+{
+	Invalidate();
+
+	// Render targets first, binding them forgets the shader resources
+	if (source.m_renderTargets.Known)
+	{
+		const RenderTargetBinding& targets = source.m_renderTargets.Value;
+		OMSetRenderTargets(targets.Count, targets.RenderTargets, targets.DepthStencil);
+	}
+
+	if (source.m_vertexShader.Known) VSSetShader(source.m_vertexShader.Value);
+	if (source.m_pixelShader.Known) PSSetShader(source.m_pixelShader.Value);
+	if (source.m_inputLayout.Known) IASetInputLayout(source.m_inputLayout.Value);
+	if (source.m_topology.Known) IASetPrimitiveTopology(source.m_topology.Value);
+	for (UINT slot = 0; slot < VERTEX_BUFFER_SLOTS; ++slot)
+	{
+		const Binding<VertexBufferBinding>& binding = source.m_vertexBuffers[slot];
+		if (binding.Known) IASetVertexBuffer(slot, binding.Value.Buffer, binding.Value.Stride, binding.Value.Offset);
+	}
+	if (source.m_indexBuffer.Known) IASetIndexBuffer(source.m_indexBuffer.Value.Buffer, source.m_indexBuffer.Value.Format, source.m_indexBuffer.Value.Offset);
+
+	for (UINT slot = 0; slot < CONSTANT_BUFFER_SLOTS; ++slot)
+	{
+		const Binding<ConstantBufferBinding>& binding = source.m_vsConstantBuffers[slot];
+		if (!binding.Known) continue;
+		if (binding.Value.NumConstants == 0) VSSetConstantBuffer(slot, binding.Value.Buffer);
+		else VSSetConstantBuffer1(slot, binding.Value.Buffer, binding.Value.FirstConstant, binding.Value.NumConstants);
+	}
+	for (UINT slot = 0; slot < CONSTANT_BUFFER_SLOTS; ++slot)
+	{
+		if (source.m_psConstantBuffers[slot].Known) PSSetConstantBuffer(slot, source.m_psConstantBuffers[slot].Value);
+	}
+	for (UINT slot = 0; slot < SHADER_RESOURCE_SLOTS; ++slot)
+	{
+		if (source.m_shaderResources[slot].Known) PSSetShaderResource(slot, source.m_shaderResources[slot].Value);
+	}
+	for (UINT slot = 0; slot < SAMPLER_SLOTS; ++slot)
+	{
+		if (source.m_samplers[slot].Known) PSSetSampler(slot, source.m_samplers[slot].Value);
+	}
+
+	if (source.m_rasterizerState.Known) RSSetState(source.m_rasterizerState.Value);
+	if (source.m_blendState.Known) OMSetBlendState(static_cast<ID3D11BlendState*>(source.m_blendState.Value.State), source.m_blendState.Value.Value);
+	if (source.m_depthStencilState.Known) OMSetDepthStencilState(static_cast<ID3D11DepthStencilState*>(source.m_depthStencilState.Value.State), source.m_depthStencilState.Value.Value);
+}
+
+template <typename T>
+bool StateTrackingContext::Change(CallType type, Binding<T>& binding, const T& value)
+{
+	if (binding.Known && binding.Value == value)
+	{
+		++m_counts[type].Elided;
+		return false;
+	}
+
+	binding.Value = value;
+	binding.Known = true;
+	++m_counts[type].Issued;
+	return m_context != nullptr;
+}
+
+bool StateTrackingContext::Untracked(CallType type)
+{
+	++m_counts[type].Issued;
+	return m_context != nullptr;
+}
+
+void StateTrackingContext::VSSetShader(ID3D11VertexShader* shader)
+{
+	if (Change(CALL_SHADER, m_vertexShader, shader)) m_context->VSSetShader(shader, nullptr, 0);
+}
+
+void StateTrackingContext::PSSetShader(ID3D11PixelShader* shader)
+{
+	if (Change(CALL_SHADER, m_pixelShader, shader)) m_context->PSSetShader(shader, nullptr, 0);
+}
+
+void StateTrackingContext::IASetInputLayout(ID3D11InputLayout* layout)
+{
+	if (Change(CALL_INPUT_LAYOUT, m_inputLayout, layout)) m_context->IASetInputLayout(layout);
+}
+
+void StateTrackingContext::IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY topology)
+{
+	if (Change(CALL_TOPOLOGY, m_topology, topology)) m_context->IASetPrimitiveTopology(topology);
+}
+
+void StateTrackingContext::IASetVertexBuffer(UINT slot, ID3D11Buffer* buffer, UINT stride, UINT offset)
+{
+	if (slot < VERTEX_BUFFER_SLOTS ? Change(CALL_VERTEX_BUFFER, m_vertexBuffers[slot], VertexBufferBinding{ buffer, stride, offset }) : Untracked(CALL_VERTEX_BUFFER))
+	{
+		m_context->IASetVertexBuffers(slot, 1, &buffer, &stride, &offset);
+	}
+}
+
+void StateTrackingContext::IASetIndexBuffer(ID3D11Buffer* buffer, DXGI_FORMAT format, UINT offset)
+{
+	if (Change(CALL_INDEX_BUFFER, m_indexBuffer, { buffer, format, offset })) m_context->IASetIndexBuffer(buffer, format, offset);
+}
+
+void StateTrackingContext::VSSetConstantBuffer(UINT slot, ID3D11Buffer* buffer)
+{
+	if (slot < CONSTANT_BUFFER_SLOTS ? Change(CALL_CONSTANT_BUFFER, m_vsConstantBuffers[slot], { buffer, 0, 0 }) : Untracked(CALL_CONSTANT_BUFFER)) m_context->VSSetConstantBuffers(slot, 1, &buffer);
+}
+
+void StateTrackingContext::VSSetConstantBuffer1(UINT slot, ID3D11Buffer* buffer, UINT firstConstant, UINT numConstants)
+{
+	if (slot < CONSTANT_BUFFER_SLOTS ? Change(CALL_CONSTANT_BUFFER, m_vsConstantBuffers[slot], { buffer, firstConstant, numConstants }) : Untracked(CALL_CONSTANT_BUFFER))
+	{
+		m_context1->VSSetConstantBuffers1(slot, 1, &buffer, &firstConstant, &numConstants);
+	}
+}
+
+void StateTrackingContext::PSSetConstantBuffer(UINT slot, ID3D11Buffer* buffer)
+{
+	if (slot < CONSTANT_BUFFER_SLOTS ? Change(CALL_CONSTANT_BUFFER, m_psConstantBuffers[slot], buffer) : Untracked(CALL_CONSTANT_BUFFER)) m_context->PSSetConstantBuffers(slot, 1, &buffer);
+}
+
+void StateTrackingContext::PSSetShaderResource(UINT slot, ID3D11ShaderResourceView* view)
+{
+	if (slot < SHADER_RESOURCE_SLOTS ? Change(CALL_SHADER_RESOURCE, m_shaderResources[slot], view) : Untracked(CALL_SHADER_RESOURCE)) m_context->PSSetShaderResources(slot, 1, &view);
+}
+
+void StateTrackingContext::PSSetSampler(UINT slot, ID3D11SamplerState* sampler)
+{
+	if (slot < SAMPLER_SLOTS ? Change(CALL_SAMPLER, m_samplers[slot], sampler) : Untracked(CALL_SAMPLER)) m_context->PSSetSamplers(slot, 1, &sampler);
+}
+
+void StateTrackingContext::RSSetState(ID3D11RasterizerState* state)
+{
+	if (Change(CALL_STATE, m_rasterizerState, state)) m_context->RSSetState(state);
+}
+
+void StateTrackingContext::OMSetBlendState(ID3D11BlendState* state, UINT sampleMask)
+{
+	if (Change(CALL_STATE, m_blendState, { state, sampleMask })) m_context->OMSetBlendState(state, nullptr, sampleMask);
+}
+
+void StateTrackingContext::OMSetDepthStencilState(ID3D11DepthStencilState* state, UINT stencilRef)
+{
+	if (Change(CALL_STATE, m_depthStencilState, { state, stencilRef })) m_context->OMSetDepthStencilState(state, stencilRef);
+}
+
+void StateTrackingContext::OMSetRenderTargets(UINT count, ID3D11RenderTargetView* const* renderTargets, ID3D11DepthStencilView* depthStencil)
+{
+	RenderTargetBinding binding = {};
+	binding.Count = count < D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT ? count : D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT;
+	for (UINT i = 0; i < binding.Count; ++i) binding.RenderTargets[i] = renderTargets[i];
+	binding.DepthStencil = depthStencil;
+
+	const bool changed = !m_renderTargets.Known || !(m_renderTargets.Value == binding);
+	if (Change(CALL_RENDER_TARGETS, m_renderTargets, binding)) m_context->OMSetRenderTargets(binding.Count, binding.RenderTargets, depthStencil);
+
+	// D3D quietly unbinds views of the new targets, the copy can't tell which ones they were
+	if (changed)
+	{
+		for (auto& shaderResource : m_shaderResources) shaderResource.Known = false;
+	}
+}
+
+bool StateTrackingContext::RenderTargetBinding::operator==(const RenderTargetBinding& other) const
+{
+	if (Count != other.Count || DepthStencil != other.DepthStencil) return false;
+	for (UINT i = 0; i < Count; ++i)
+	{
+		if (RenderTargets[i] != other.RenderTargets[i]) return false;
+	}
+	return true;
+}
+
+const char* StateTrackingContext::GetCallName(CallType type)
+{
+	switch (type)
+	{
+	case CALL_SHADER:				return "Shaders";
+	case CALL_INPUT_LAYOUT:			return "Input Layouts";
+	case CALL_TOPOLOGY:				return "Topologies";
+	case CALL_VERTEX_BUFFER:		return "Vertex Buffers";
+	case CALL_INDEX_BUFFER:			return "Index Buffers";
+	case CALL_CONSTANT_BUFFER:		return "Constant Buffers";
+	case CALL_SHADER_RESOURCE:		return "Shader Resources";
+	case CALL_SAMPLER:				return "Samplers";
+	case CALL_STATE:				return "States";
+	case CALL_RENDER_TARGETS:		return "Render Targets";
+	default:						return "";
+	}
+}
+
+StateTrackingContext::CallCounts StateTrackingContext::GetTotalCounts() const
+{
+	CallCounts total;
+	for (const CallCounts& counts : m_counts)
+	{
+		total.Issued += counts.Issued;
+		total.Elided += counts.Elided;
+	}
+	return total;
+}
+
+void StateTrackingContext::ResetCounts()
+{
+	for (CallCounts& counts : m_counts) counts = CallCounts();
+}
+
+void StateTrackingContext::AddCounts(const StateTrackingContext& other)
+{
+	for (int type = 0; type < CALL_TYPE_COUNT; ++type)
+	{
+		m_counts[type].Issued += other.m_counts[type].Issued;
+		m_counts[type].Elided += other.m_counts[type].Elided;
+	}
+}
@@ -0,0 +1,178 @@
+// Sits in front of a device context and drops bind calls that would set what is already bound
+
+#pragma once
+
+#include <windows.h>
+#include <d3d11_1.h>
+#include <cstdint>
+
+/// <summary>
+/// Keeps a copy of what has been bound through it, shaders, input assembler, constant buffers, shader resources,
+/// samplers, the fixed function states and the render targets, and only passes a call on to the context when it
+/// changes something. Draws, clears and buffer updates go straight to the context from Get.
+///
+/// Anything that binds behind its back, ImGui's backend or code using the context directly, leaves the copy wrong,
+/// so call Invalidate after it and the next call of each kind goes through. Setting render targets forgets the shader
+/// resources as well, since D3D unbinds any view of a texture that becomes a target. Only the low slots the shaders
+/// use are tracked, calls past them always go through.
+///
+/// Like the context itself it is only used from one thread.
+/// </summary>
+class StateTrackingContext
+{
+public:
+	static constexpr UINT VERTEX_BUFFER_SLOTS = 4;
+	static constexpr UINT CONSTANT_BUFFER_SLOTS = 8;
+	static constexpr UINT SHADER_RESOURCE_SLOTS = 16;
+	static constexpr UINT SAMPLER_SLOTS = 4;
+
+	/// @param context nullptr only counts the calls, for measuring without a device.
+	/// @param context1 The same context's 11.1 interface if it has one, needed for VSSetConstantBuffer1.
+	void	Init(ID3D11DeviceContext* context, ID3D11DeviceContext1* context1 = nullptr);
+
+	/// The context itself, for anything that isn't a bind.
+	ID3D11DeviceContext*	Get() const { return m_context; }
+
+	/// Forgets everything that is bound.
+	void	Invalidate();
+
+	/// Forgets everything, then binds what source knows is bound, for a deferred context to start where the
+	/// immediate context is. Only reads source, several contexts can inherit from it at once.
+	void	Inherit(const StateTrackingContext& source);
+
+	void	VSSetShader(ID3D11VertexShader* shader);
+	void	PSSetShader(ID3D11PixelShader* shader);
+
+	void	IASetInputLayout(ID3D11InputLayout* layout);
+	void	IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY topology);
+	void	IASetVertexBuffer(UINT slot, ID3D11Buffer* buffer, UINT stride, UINT offset);
+	void	IASetIndexBuffer(ID3D11Buffer* buffer, DXGI_FORMAT format, UINT offset);
+
+	void	VSSetConstantBuffer(UINT slot, ID3D11Buffer* buffer);
+
+	/// Binds numConstants 16 byte constants of the buffer from firstConstant on, both multiples of 16. Needs context1.
+	void	VSSetConstantBuffer1(UINT slot, ID3D11Buffer* buffer, UINT firstConstant, UINT numConstants);
+	void	PSSetConstantBuffer(UINT slot, ID3D11Buffer* buffer);
+	void	PSSetShaderResource(UINT slot, ID3D11ShaderResourceView* view);
+	void	PSSetSampler(UINT slot, ID3D11SamplerState* sampler);
+
+	void	RSSetState(ID3D11RasterizerState* state);
+
+	/// Blend factor is always the default, all ones.
+	void	OMSetBlendState(ID3D11BlendState* state, UINT sampleMask = 0xffffffff);
+	void	OMSetDepthStencilState(ID3D11DepthStencilState* state, UINT stencilRef = 0);
+	void	OMSetRenderTargets(UINT count, ID3D11RenderTargetView* const* renderTargets, ID3D11DepthStencilView* depthStencil);
+
+	/// The kinds of call counted apart.
+	enum CallType
+	{
+		CALL_SHADER,
+		CALL_INPUT_LAYOUT,
+		CALL_TOPOLOGY,
+		CALL_VERTEX_BUFFER,
+		CALL_INDEX_BUFFER,
+		CALL_CONSTANT_BUFFER,
+		CALL_SHADER_RESOURCE,
+		CALL_SAMPLER,
+		CALL_STATE,
+		CALL_RENDER_TARGETS,
+		CALL_TYPE_COUNT
+	};
+
+	static const char*	GetCallName(CallType type);
+
+	struct CallCounts
+	{
+		uint64_t	Issued = 0;
+		uint64_t	Elided = 0;
+	};
+
+	/// Since the last ResetCounts.
+	const CallCounts&	GetCounts(CallType type) const { return m_counts[type]; }
+	CallCounts			GetTotalCounts() const;
+	void				ResetCounts();
+
+	/// Adds other's counts to these, a deferred context's once its list is played.
+	void				AddCounts(const StateTrackingContext& other);
+
+private:
+	template <typename T>
+	struct Binding
+	{
+		T		Value = T();
+		bool	Known = false;
+	};
+
+	struct VertexBufferBinding
+	{
+		ID3D11Buffer*	Buffer;
+		UINT			Stride;
+		UINT			Offset;
+
+		bool operator==(const VertexBufferBinding& other) const { return Buffer == other.Buffer && Stride == other.Stride && Offset == other.Offset; }
+	};
+
+	struct IndexBufferBinding
+	{
+		ID3D11Buffer*	Buffer;
+		DXGI_FORMAT		Format;
+		UINT			Offset;
+
+		bool operator==(const IndexBufferBinding& other) const { return Buffer == other.Buffer && Format == other.Format && Offset == other.Offset; }
+	};
+
+	// A whole buffer is bound with 0 constants
+	struct ConstantBufferBinding
+	{
+		ID3D11Buffer*	Buffer;
+		UINT			FirstConstant;
+		UINT			NumConstants;
+
+		bool operator==(const ConstantBufferBinding& other) const { return Buffer == other.Buffer && FirstConstant == other.FirstConstant && NumConstants == other.NumConstants; }
+	};
+
+	struct StateBinding
+	{
+		void*	State;
+		UINT	Value;
+
+		bool operator==(const StateBinding& other) const { return State == other.State && Value == other.Value; }
+	};
+
+	struct RenderTargetBinding
+	{
+		UINT						Count;
+		ID3D11RenderTargetView*		RenderTargets[D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT];
+		ID3D11DepthStencilView*		DepthStencil;
+
+		bool operator==(const RenderTargetBinding& other) const;
+	};
+
+	/// Records value as bound and counts the call.
+	/// @return True if it changes what was bound and there is a context to send it to.
+	template <typename T>
+	bool	Change(CallType type, Binding<T>& binding, const T& value);
+
+	/// A call to a slot that isn't tracked, always issued.
+	bool	Untracked(CallType type);
+
+	ID3D11DeviceContext*				m_context = nullptr;
+	ID3D11DeviceContext1*				m_context1 = nullptr;
+
+	Binding<ID3D11VertexShader*>		m_vertexShader;
+	Binding<ID3D11PixelShader*>			m_pixelShader;
+	Binding<ID3D11InputLayout*>			m_inputLayout;
+	Binding<D3D11_PRIMITIVE_TOPOLOGY>	m_topology;
+	Binding<VertexBufferBinding>		m_vertexBuffers[VERTEX_BUFFER_SLOTS];
+	Binding<IndexBufferBinding>			m_indexBuffer;
+	Binding<ConstantBufferBinding>		m_vsConstantBuffers[CONSTANT_BUFFER_SLOTS];
+	Binding<ID3D11Buffer*>				m_psConstantBuffers[CONSTANT_BUFFER_SLOTS];
+	Binding<ID3D11ShaderResourceView*>	m_shaderResources[SHADER_RESOURCE_SLOTS];
+	Binding<ID3D11SamplerState*>		m_samplers[SAMPLER_SLOTS];
+	Binding<ID3D11RasterizerState*>		m_rasterizerState;
+	Binding<StateBinding>				m_blendState;
+	Binding<StateBinding>				m_depthStencilState;
+	Binding<RenderTargetBinding>		m_renderTargets;
+
+	CallCounts							m_counts[CALL_TYPE_COUNT];
+};
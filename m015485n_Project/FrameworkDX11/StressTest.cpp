@@ -0,0 +1,259 @@
+#include "StressTest.h"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+#include "FrameArena.h"
+#include "RenderSnapshot.h"
+#include "Scene.h"
+#include "globals.h"
+
+namespace
+{
+	const char* PHASE_NAMES[StressTest::PHASE_COUNT] =
+	{
+		"update",
+		"build_snapshot",
+		"commit",
+		"draw",
+		"imgui",
+		"present"
+	};
+
+	// Same size as the window, so the projection matches the rendered run
+	constexpr UINT HEADLESS_VIEW_WIDTH = 1280;
+	constexpr UINT HEADLESS_VIEW_HEIGHT = 720;
+
+	typedef std::chrono::steady_clock Clock;
+
+	float MillisecondsSince(Clock::time_point start)
+	{
+		return std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+	}
+
+	std::string Narrow(const std::wstring& text)
+	{
+		std::string narrow;
+		for (wchar_t c : text) narrow.push_back(static_cast<char>(c));
+		return narrow;
+	}
+
+	// Nearest rank on an already sorted list
+	float Percentile(const std::vector<float>& sorted, float percentile)
+	{
+		if (sorted.empty()) return 0.0f;
+
+		size_t rank = static_cast<size_t>(percentile / 100.0f * static_cast<float>(sorted.size()));
+		return sorted[(std::min)(rank, sorted.size() - 1)];
+	}
+}
+
+namespace StressTest
+{
+	Settings::Settings()
+		: ObjectCount(static_cast<UINT>(g_cube_count))
+	{
+	}
+
+	bool ParseCommandLine(const wchar_t* commandLine, Settings& settings)
+	{
+		if (commandLine == nullptr) return false;
+
+		std::wistringstream arguments(commandLine);
+		std::wstring argument;
+		bool stressMode = false;
+
+		while (arguments >> argument)
+		{
+			if (argument == L"-stress") stressMode = true;
+			else if (argument == L"-headless") settings.Headless = true;
+			else if (argument == L"-pipelined") settings.Pipelined = true;
+			else if (argument == L"-serial-submission") settings.ParallelSubmission = false;
+			else if (argument == L"-objects") arguments >> settings.ObjectCount;
+			else if (argument == L"-lights") arguments >> settings.LightCount;
+			else if (argument == L"-frames") arguments >> settings.FrameCount;
+			else if (argument == L"-warmup") arguments >> settings.WarmupFrames;
+			else if (argument == L"-seed") arguments >> settings.Seed;
+			else if (argument == L"-report") arguments >> settings.ReportName;
+		}
+
+		return stressMode;
+	}
+
+	Recorder::Recorder(const Settings& settings)
+		: m_settings(settings)
+	{
+		m_frames.reserve(settings.FrameCount);
+	}
+
+	void Recorder::AddPhase(Phase phase, float milliseconds)
+	{
+		m_current.PhaseMs[phase] += milliseconds;
+		m_recordedPhases |= 1u << phase;
+	}
+
+	void Recorder::SetCommandLists(UINT listsExecuted, bool driverCommandLists)
+	{
+		m_current.CommandLists = listsExecuted;
+		m_recordedCommandLists = true;
+		m_driverCommandLists = driverCommandLists;
+	}
+
+	void Recorder::EndFrame(float frameMs, float latencyMs)
+	{
+		m_current.FrameMs = frameMs;
+		m_current.LatencyMs = latencyMs;
+		if (latencyMs > 0.0f) m_recordedLatency = true;
+
+		if (m_framesSeen >= m_settings.WarmupFrames && !IsFinished()) m_frames.push_back(m_current);
+
+		++m_framesSeen;
+		m_current = Frame();
+	}
+
+	Recorder::Summary Recorder::Summarise(Phase phase) const
+	{
+		std::vector<float> times;
+		times.reserve(m_frames.size());
+		for (const Frame& frame : m_frames)
+		{
+			times.push_back(phase == PHASE_COUNT ? frame.FrameMs : frame.PhaseMs[phase]);
+		}
+		return Summarise(times);
+	}
+
+	Recorder::Summary Recorder::SummariseLatency() const
+	{
+		std::vector<float> times;
+		times.reserve(m_frames.size());
+		for (const Frame& frame : m_frames) times.push_back(frame.LatencyMs);
+		return Summarise(times);
+	}
+
+	Recorder::Summary Recorder::Summarise(std::vector<float>& times)
+	{
+		Summary summary;
+		if (times.empty()) return summary;
+
+		std::sort(times.begin(), times.end());
+
+		double total = 0.0;
+		for (float time : times) total += time;
+
+		summary.Mean = static_cast<float>(total / times.size());
+		summary.P50 = Percentile(times, 50.0f);
+		summary.P95 = Percentile(times, 95.0f);
+		summary.P99 = Percentile(times, 99.0f);
+		summary.Max = times.back();
+		return summary;
+	}
+
+	bool Recorder::WriteReports() const
+	{
+		auto writeSummary = [](std::ostream& out, const Summary& summary)
+			{
+				out << "{ \"mean\": " << summary.Mean << ", \"p50\": " << summary.P50 << ", \"p95\": " << summary.P95
+					<< ", \"p99\": " << summary.P99 << ", \"max\": " << summary.Max << " }";
+			};
+
+		std::ofstream json(std::filesystem::path(m_settings.ReportName + L".json"));
+		json << "{\n";
+		json << "  \"mode\": \"" << (m_settings.Headless ? "headless" : "rendered") << "\",\n";
+		json << "  \"pipelined\": " << (m_settings.Pipelined ? "true" : "false") << ",\n";
+		json << "  \"parallel_submission\": " << (m_settings.ParallelSubmission ? "true" : "false") << ",\n";
+		json << "  \"objects\": " << m_settings.ObjectCount << ",\n";
+		json << "  \"lights\": " << m_settings.LightCount << ",\n";
+		json << "  \"seed\": " << m_settings.Seed << ",\n";
+		json << "  \"warmup_frames\": " << m_settings.WarmupFrames << ",\n";
+		json << "  \"frames\": " << m_frames.size() << ",\n";
+		json << "  \"phases_ms\": {\n";
+
+		bool first = true;
+		for (int phase = 0; phase < PHASE_COUNT; ++phase)
+		{
+			if (!(m_recordedPhases & (1u << phase))) continue;
+
+			json << (first ? "" : ",\n") << "    \"" << PHASE_NAMES[phase] << "\": ";
+			writeSummary(json, Summarise(static_cast<Phase>(phase)));
+			first = false;
+		}
+
+		json << "\n  },\n";
+		json << "  \"frame_ms\": ";
+		writeSummary(json, Summarise(PHASE_COUNT));
+		if (m_recordedLatency)
+		{
+			json << ",\n  \"latency_ms\": ";
+			writeSummary(json, SummariseLatency());
+		}
+		if (m_recordedCommandLists)
+		{
+			double lists = 0.0;
+			for (const Frame& frame : m_frames) lists += frame.CommandLists;
+			json << ",\n  \"driver_command_lists\": " << (m_driverCommandLists ? "true" : "false");
+			json << ",\n  \"command_lists_per_frame\": " << (m_frames.empty() ? 0.0 : lists / m_frames.size());
+		}
+		json << "\n}\n";
+
+		std::ofstream csv(std::filesystem::path(m_settings.ReportName + L".csv"));
+		csv << "frame";
+		for (int phase = 0; phase < PHASE_COUNT; ++phase)
+		{
+			if (m_recordedPhases & (1u << phase)) csv << "," << PHASE_NAMES[phase] << "_ms";
+		}
+		csv << ",frame_ms" << (m_recordedLatency ? ",latency_ms" : "") << (m_recordedCommandLists ? ",command_lists\n" : "\n");
+
+		for (size_t i = 0; i < m_frames.size(); ++i)
+		{
+			csv << i;
+			for (int phase = 0; phase < PHASE_COUNT; ++phase)
+			{
+				if (m_recordedPhases & (1u << phase)) csv << "," << m_frames[i].PhaseMs[phase];
+			}
+			csv << "," << m_frames[i].FrameMs;
+			if (m_recordedLatency) csv << "," << m_frames[i].LatencyMs;
+			if (m_recordedCommandLists) csv << "," << m_frames[i].CommandLists;
+			csv << "\n";
+		}
+
+		OutputDebugStringA(("Stress test report written to " + Narrow(m_settings.ReportName) + ".json / .csv\n").c_str());
+
+		return json.good() && csv.good();
+	}
+
+	bool RunHeadless(const Settings& settings)
+	{
+		Settings headlessSettings = settings;
+		headlessSettings.Headless = true;
+
+		Scene scene;
+		scene.InitHeadless(HEADLESS_VIEW_WIDTH, HEADLESS_VIEW_HEIGHT);
+		scene.CreateStressScene(headlessSettings);
+
+		Recorder recorder(headlessSettings);
+		RenderSnapshot snapshot;
+
+		// The same two phases the simulation stage runs each frame, on this thread
+		while (!recorder.IsFinished())
+		{
+			auto frameStart = Clock::now();
+			FrameArena::ThreadArena().Reset();
+
+			scene.Update(headlessSettings.DeltaTime);
+			recorder.AddPhase(PHASE_UPDATE, MillisecondsSince(frameStart));
+
+			auto buildStart = Clock::now();
+			scene.BuildSnapshot(snapshot);
+			recorder.AddPhase(PHASE_BUILD_SNAPSHOT, MillisecondsSince(buildStart));
+
+			recorder.EndFrame(MillisecondsSince(frameStart));
+		}
+
+		bool written = recorder.WriteReports();
+		scene.CleanUp();
+		return written;
+	}
+}
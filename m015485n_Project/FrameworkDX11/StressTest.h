@@ -0,0 +1,129 @@
+// Procedurally generated stress scenes, flown through on a fixed camera path while the per phase CPU times are recorded
+
+#pragma once
+
+#include <windows.h>
+#include <string>
+#include <vector>
+
+namespace StressTest
+{
+	/// <summary>
+	/// What to spawn and how long to run for. Everything random comes from Seed, so two runs with the
+	/// same settings build the same scene and fly the same path.
+	/// </summary>
+	struct Settings
+	{
+		UINT			ObjectCount;
+		UINT			LightCount = 32;
+		UINT			WarmupFrames = 60;
+		UINT			FrameCount = 1000;
+		UINT			Seed = 1234;
+
+		// Fixed step so the camera is in the same place on the same frame every run
+		float			DeltaTime = 1.0f / 60.0f;
+
+		// Only the CPU phases, no window or device
+		bool			Headless = false;
+
+		// Simulates the next frame while the current one is submitted, see FramePipeline. Run once with and once
+		// without to compare the frame time gained against the latency added
+		bool			Pipelined = false;
+
+		// Records long passes into command lists on the job system's threads, see Scene::m_parallelSubmission. Off
+		// draws every pass on the immediate context, for comparing the draw phase with a real driver behind it
+		bool			ParallelSubmission = true;
+
+		// Written as <name>.json (summary) and <name>.csv (every frame)
+		std::wstring	ReportName = L"stress_report";
+
+		Settings();
+	};
+
+	/// Reads "-stress [-headless] [-pipelined] [-serial-submission] [-objects N] [-lights N] [-frames N] [-warmup N] [-seed N] [-report name]".
+	/// Comparing the two frame modes takes two rendered runs of the same scene, for example
+	/// "-stress -objects 50000 -report serial" and "-stress -pipelined -objects 50000 -report pipelined", then
+	/// frame_ms and latency_ms from the two reports. "-serial-submission" against the default compares the draw phase
+	/// with and without command lists the same way.
+	/// @return True if the command line asked for a stress run.
+	bool ParseCommandLine(const wchar_t* commandLine, Settings& settings);
+
+	enum Phase
+	{
+		PHASE_UPDATE,
+		PHASE_BUILD_SNAPSHOT,
+		PHASE_COMMIT,
+		PHASE_DRAW,
+		PHASE_IMGUI,
+		PHASE_PRESENT,
+		PHASE_COUNT
+	};
+
+	/// <summary>
+	/// Collects the phase times for each measured frame and writes the reports once the run is over.
+	/// Warmup frames are counted but not kept.
+	/// </summary>
+	class Recorder
+	{
+	public:
+		explicit Recorder(const Settings& settings);
+
+		/// Adds a phase's time to the frame currently being recorded.
+		void	AddPhase(Phase phase, float milliseconds);
+
+		/// Command lists the frame currently being recorded played.
+		/// @param driverCommandLists False if the runtime emulates them, when none are recorded.
+		void	SetCommandLists(UINT listsExecuted, bool driverCommandLists);
+
+		/// Finishes the current frame. @param frameMs Wall clock time of the whole frame.
+		/// @param latencyMs From the frame's simulation starting to it being presented, 0 when nothing is presented.
+		void	EndFrame(float frameMs, float latencyMs = 0.0f);
+
+		bool	IsFinished() const { return m_framesSeen >= m_settings.WarmupFrames + m_settings.FrameCount; }
+		const Settings& GetSettings() const { return m_settings; }
+		UINT	GetFrameCount() const { return static_cast<UINT>(m_frames.size()); }
+
+		/// Writes <name>.json and <name>.csv. @return False if either file couldn't be written.
+		bool	WriteReports() const;
+
+		struct Summary
+		{
+			float	Mean = 0.0f;
+			float	P50 = 0.0f;
+			float	P95 = 0.0f;
+			float	P99 = 0.0f;
+			float	Max = 0.0f;
+		};
+
+		/// Percentiles of one phase across the measured frames, PHASE_COUNT gives the whole frame.
+		Summary	Summarise(Phase phase) const;
+		Summary	SummariseLatency() const;
+
+	private:
+		struct Frame
+		{
+			float	PhaseMs[PHASE_COUNT] = {};
+			float	FrameMs = 0.0f;
+			float	LatencyMs = 0.0f;
+			UINT	CommandLists = 0;
+		};
+
+		/// Sorts times in place.
+		static Summary	Summarise(std::vector<float>& times);
+
+		Settings			m_settings;
+		std::vector<Frame>	m_frames;
+		Frame				m_current;
+		UINT				m_framesSeen = 0;
+
+		// Phases that were recorded at least once, the headless run never sees the GPU ones
+		UINT				m_recordedPhases = 0;
+		bool				m_recordedLatency = false;
+		bool				m_recordedCommandLists = false;
+		bool				m_driverCommandLists = false;
+	};
+
+	/// Runs the CPU side of the stress scene (scene update and snapshot building) without a device.
+	/// @return True if the reports were written.
+	bool RunHeadless(const Settings& settings);
+}
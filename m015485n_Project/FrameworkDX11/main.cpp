@@ -9,6 +9,8 @@
 #include "Camera.h"
 #include "DX11App.h"
 #include "DX11Setup.h"
+#include "Benchmarks.h"
+#include "StressTest.h"
 
 DX11App app;
 
@@ -19,12 +21,22 @@ DX11App app;
 int WINAPI wWinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance, _In_ LPWSTR lpCmdLine, _In_ int nCmdShow)
 {
 	UNREFERENCED_PARAMETER(hPrevInstance);
-	UNREFERENCED_PARAMETER(lpCmdLine);
+
+	// "-benchmark <name>" runs a benchmark and exits without opening the window
+	int benchmarkExitCode = 0;
+	if (Benchmarks::RunFromCommandLine(lpCmdLine, benchmarkExitCode))
+		return benchmarkExitCode;
+
+	// "-stress" flies through a generated scene and writes out the frame times, "-stress -headless" does it without a window
+	StressTest::Settings stressTest;
+	bool stressMode = StressTest::ParseCommandLine(lpCmdLine, stressTest);
+	if (stressMode && stressTest.Headless)
+		return StressTest::RunHeadless(stressTest) ? 0 : 1;
 
 	if (FAILED(app.initWindow(hInstance, nCmdShow)))
 		return 0;
 
-	if (FAILED(app.init()))
+	if (FAILED(app.init(stressMode ? &stressTest : nullptr)))
 	{
 		app.cleanUp();
 		return 0;
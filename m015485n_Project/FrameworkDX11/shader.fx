@@ -1,18 +1,35 @@
 //--------------------------------------------------------------------------------------
 // Constant Buffer Variables
 //--------------------------------------------------------------------------------------
-cbuffer ConstantBuffer : register(b0)
+// The camera, written once a frame and bound to both stages
+cbuffer FrameConstants : register(b0)
 {
-    matrix World;
     matrix View;
     matrix Projection;
-    float4 vOutputColor;
+    float4 EyePosition;
+};
+
+// One object, each draw binds its own copy out of the constant ring. Instanced draws read the instance instead
+cbuffer ObjectConstants : register(b3)
+{
+    matrix World;
+    uint MaterialIndex;
+    uint3 _Padding0;
 };
 
 Texture2D txDiffuse : register(t0);
 Texture2D txNormalMap : register(t1);
 SamplerState samLinear : register(s0);
 
+// Material features, each variant of a pixel shader is compiled with these defined to 1 or 0 by
+// ShaderPermutations. Compiled on its own, a shader gets none of them
+#ifndef USE_TEXTURE
+#define USE_TEXTURE 0
+#endif
+#ifndef USE_NORMAL_MAP
+#define USE_NORMAL_MAP 0
+#endif
+
 // Light types.
 #define DIRECTIONAL_LIGHT 0
 #define POINT_LIGHT 1
@@ -35,10 +52,11 @@ struct _Material
 //----------------------------------- (16 byte boundary)
 }; // Total: // 80 bytes ( 5 * 16 )
 
-cbuffer MaterialProperties : register(b1)
-{
-    _Material Material;
-};
+// Every material in the scene, deduplicated, the draw picks its own with MaterialIndex, passed on by the vertex shader
+StructuredBuffer<_Material> Materials : register(t3);
+
+// Filled in at the start of the pixel shaders so the lighting functions can keep reading it
+static _Material Material;
 
 struct Light
 {
@@ -55,22 +73,93 @@ struct Light
 //----------------------------------- (16 byte boundary)
     int LightType; // 4 bytes
     bool Enabled; // 4 bytes
-    int2 Padding; // 8 bytes
+    float Range; // 4 bytes, past this the light adds nothing
+    int Padding; // 4 bytes
 //----------------------------------- (16 byte boundary)
 }; // Total: // 80 bytes (5 * 16)
 
 cbuffer LightProperties : register(b2)
 {
-    float4 EyePosition; // 16 bytes
-//----------------------------------- (16 byte boundary)
     float4 GlobalAmbient; // 16 bytes
 //----------------------------------- (16 byte boundary)
     uint LightCount;
-    float3 _Padding; // align to 16 bytes
+    uint GlobalLightCount;
+    float ClusterDepthScale;
+    float ClusterDepthBias;
+//----------------------------------- (16 byte boundary)
+    float2 ClusterTileScale; // clusters per pixel
+    float2 _Padding; // align to 16 bytes
 };
 
 StructuredBuffer<Light> Lights : register(t2); // Put the lights in a structured buffer so I can make them at runtime.
 
+// Clustered lighting, built on the CPU by LightClusterGrid. The view is split into a grid of clusters and each one
+// has a range of the index list holding the lights that reach it. The first GlobalLightCount indices are the lights
+// that reach everywhere and come before every cluster's own. Disabled lights are never in the list
+#define CLUSTERS_X 16
+#define CLUSTERS_Y 9
+#define CLUSTERS_Z 24
+
+StructuredBuffer<uint2> ClusterLightRanges : register(t4); // offset, count
+StructuredBuffer<uint> ClusterLightIndices : register(t5);
+
+uint2 GetClusterLights(float2 pixel, float viewDepth)
+{
+    uint2 tile = min(uint2(pixel * ClusterTileScale), uint2(CLUSTERS_X - 1, CLUSTERS_Y - 1));
+    uint slice = (uint) clamp(log2(viewDepth) * ClusterDepthScale + ClusterDepthBias, 0, CLUSTERS_Z - 1);
+    return ClusterLightRanges[tile.x + (tile.y + slice * CLUSTERS_Y) * CLUSTERS_X];
+}
+
+// The i'th light for a pixel in the cluster, global lights first
+uint GetClusterLightIndex(uint2 clusterLights, uint i)
+{
+    return ClusterLightIndices[i < GlobalLightCount ? i : clusterLights.x + i - GlobalLightCount];
+}
+
+// Deferred shading. The G-buffer pass writes the light independent part of the colour (emissive and ambient, or
+// the whole colour for unlit objects) straight to the scene, and packs what lighting needs into two 32 bit targets:
+//   GBufferAlbedo  R8G8B8A8_UNORM     rgb diffuse colour, a specular power as log2(power) / SPECULAR_POWER_LOG2_RANGE
+//   GBufferNormal  R10G10B10A2_UNORM  rg octahedral world normal, b specular intensity, a 1 if lit
+// The lighting pass works the position back out from the depth buffer. GBufferEncoding does the same on the CPU
+#define SPECULAR_POWER_LOG2_RANGE 10.0f
+
+cbuffer DeferredProperties : register(b1)
+{
+    matrix InverseViewProjection;
+    matrix DeferredView;
+};
+
+Texture2D GBufferAlbedo : register(t6);
+Texture2D GBufferNormal : register(t7);
+Texture2D<float> GBufferDepth : register(t8);
+
+float2 EncodeNormal(float3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    if (n.z < 0.0f)
+        n.xy = (1.0f - abs(n.yx)) * (n.xy >= 0.0f ? 1.0f : -1.0f);
+    return n.xy * 0.5f + 0.5f;
+}
+
+float3 DecodeNormal(float2 encoded)
+{
+    float2 f = encoded * 2.0f - 1.0f;
+    float3 n = float3(f, 1.0f - abs(f.x) - abs(f.y));
+    float t = saturate(-n.z);
+    n.xy += n.xy >= 0.0f ? -t : t;
+    return normalize(n);
+}
+
+float EncodeSpecularPower(float power)
+{
+    return saturate(log2(max(power, 1.0f)) / SPECULAR_POWER_LOG2_RANGE);
+}
+
+float DecodeSpecularPower(float encoded)
+{
+    return exp2(encoded * SPECULAR_POWER_LOG2_RANGE);
+}
+
 //--------------------------------------------------------------------------------------
 struct VS_INPUT
 {
@@ -91,6 +180,18 @@ struct PS_INPUT
     float3 EyeWorldSpaceVector : EyeWorldSpaceVector;
     float3 EyeTangentVector : EyeTangentVector;
     float3x3 TBN_Inv : MATRIX;
+    float ViewDepth : VIEWDEPTH;
+    nointerpolation uint MaterialIndex : MATERIAL;
+};
+
+// One row of the per instance stream in slot 1, see InstanceData
+struct INSTANCE_INPUT
+{
+    float4 World0 : WORLD0;
+    float4 World1 : WORLD1;
+    float4 World2 : WORLD2;
+    float4 World3 : WORLD3;
+    uint MaterialIndex : MATERIAL;
 };
 
 float3 VectorToTangentSpace(float3 vectorV, float3x3 TBN_Inv)
@@ -150,67 +251,36 @@ LightingResult DoPointLight(Light light, float3 pixelToLightVectorNormalised, fl
 
 }
 
-LightingResult DoDirectionalLightNoNormalMap(Light light,float3 pixelToEyeVectorNormalised,float3 N)
+// Normal mapped variants light in tangent space, the rest in world space. TBN_Inv is only read by the former
+float3 ToShadingSpace(float3 vectorV, float3x3 TBN_Inv)
 {
-    LightingResult result;
-
-    float3 L = normalize(-light.Direction.xyz);
-
-    result.Diffuse = DoDiffuse(light, L, N);
-    result.Specular = DoSpecular(light, pixelToEyeVectorNormalised, L, N);
-
-    return result;
+#if USE_NORMAL_MAP
+    return VectorToTangentSpace(vectorV, TBN_Inv);
+#else
+    return normalize(vectorV);
+#endif
 }
 
-LightingResult DoDirectionalLightNormalMap(Light light, float3 pixelToEyeVectorNormalised, float3 N,float3x3 TBN_Inv)
+LightingResult DoDirectionalLight(Light light, float3 pixelToEyeVectorNormalised, float3 N, float3x3 TBN_Inv)
 {
     LightingResult result;
 
-    float3 L_TS = VectorToTangentSpace(-light.Direction.xyz, TBN_Inv);
-    result.Diffuse = DoDiffuse(light, L_TS, N);
-    result.Specular = DoSpecular(light, pixelToEyeVectorNormalised, L_TS, N);
-
+    float3 L = ToShadingSpace(-light.Direction.xyz, TBN_Inv);
+    result.Diffuse = DoDiffuse(light, L, N);
+    result.Specular = DoSpecular(light, pixelToEyeVectorNormalised, L, N);
 
     return result;
 }
 
-LightingResult DoSpotLightNoNormalMap(Light light,float3 pixelToLightVector,float3 pixelToEyeVectorNormalised,float distanceFromPixelToLight,float3 N)
+LightingResult DoSpotLight(Light light, float3 L, float3 pixelToEyeVectorNormalised, float distanceFromPixelToLight, float3 N, float3x3 TBN_Inv)
 {
     LightingResult result;
     result.Diffuse = float4(0, 0, 0, 0);
     result.Specular = float4(0, 0, 0, 0);
 
-    float3 L = normalize(pixelToLightVector);
-
-    float3 spotDir = normalize(-light.Direction.xyz);
-
+    float3 spotDir = ToShadingSpace(-light.Direction.xyz, TBN_Inv);
     float spotFactor = dot(L, spotDir);
 
-    if (spotFactor > light.SpotAngle)
-    {
-        float attenuation = DoAttenuation(light, distanceFromPixelToLight);
-        float spotIntensity = saturate((spotFactor - light.SpotAngle) / (1.0f - light.SpotAngle));
-
-        result.Diffuse =DoDiffuse(light, L, N) * attenuation * spotIntensity;
-
-        result.Specular =DoSpecular(light, pixelToEyeVectorNormalised, L, N) * attenuation * spotIntensity;
-    }
-
-    return result;
-}
-
-LightingResult DoSpotLightNormalMap(Light light, float3 pixelToLightVector, float3 pixelToEyeVectorNormalised, float distanceFromPixelToLight, float3 N, float3x3 TBN_Inv)
-{
-    LightingResult result;
-    result.Diffuse = float4(0, 0, 0, 0);
-    result.Specular = float4(0, 0, 0, 0);
-
-    float3 L = normalize(pixelToLightVector);
-
-    float3 spotDirTS = VectorToTangentSpace(-light.Direction.xyz, TBN_Inv);
-    float spotFactor = dot(L, spotDirTS);
-
-
     if (spotFactor > light.SpotAngle)
     {
         float attenuation = DoAttenuation(light, distanceFromPixelToLight);
@@ -224,86 +294,41 @@ LightingResult DoSpotLightNormalMap(Light light, float3 pixelToLightVector, floa
     return result;
 }
 
-
-
-LightingResult ComputeLightingNormalMap(float4 worldPos,float3 N,float3 pixelToEyeVectorNormalised,float3x3 TBN_Inv)
-{
-    LightingResult totalResult;
-    totalResult.Diffuse = float4(0, 0, 0, 0);
-    totalResult.Specular = float4(0, 0, 0, 0);
-
-    for (uint i = 0; i < LightCount; ++i)
-    {
-        if (!Lights[i].Enabled)
-            continue;
-
-        LightingResult result;
-        result.Diffuse = float4(0, 0, 0, 0);
-        result.Specular = float4(0, 0, 0, 0);
-
-        if (Lights[i].LightType == DIRECTIONAL_LIGHT)
-        {
-            result = DoDirectionalLightNormalMap(Lights[i],pixelToEyeVectorNormalised,N,TBN_Inv);
-        }
-        else
-        {
-            float3 pixelToLight = Lights[i].Position.xyz - worldPos.xyz;
-            float distanceToLight = length(pixelToLight);
-
-            float3 pixelToLightTS = VectorToTangentSpace(pixelToLight, TBN_Inv);
-
-            if (Lights[i].LightType == POINT_LIGHT)
-            {
-                result = DoPointLight(Lights[i],normalize(pixelToLightTS),pixelToEyeVectorNormalised,distanceToLight,N);
-            }
-            else if (Lights[i].LightType == SPOT_LIGHT)
-            {
-                result = DoSpotLightNormalMap(Lights[i],pixelToLightTS,pixelToEyeVectorNormalised,distanceToLight,N,TBN_Inv);
-            }
-        }
-
-        totalResult.Diffuse += result.Diffuse;
-        totalResult.Specular += result.Specular;
-    }
-
-    totalResult.Diffuse = saturate(totalResult.Diffuse);
-    totalResult.Specular = saturate(totalResult.Specular);
-
-    return totalResult;
-}
-
-LightingResult ComputeLightingNoNormalMap(float4 worldPos, float3 N, float3 pixelToEyeVectorNormalised)
+// A cluster's lights are of every type, so the type stays a branch per light rather than a variant
+LightingResult ComputeLighting(float4 worldPos, float3 N, float3 pixelToEyeVectorNormalised, float3x3 TBN_Inv, uint2 clusterLights)
 {
     LightingResult totalResult;
     totalResult.Diffuse = float4(0, 0, 0, 0);
     totalResult.Specular = float4(0, 0, 0, 0);
 
-    for (uint i = 0; i < LightCount; ++i)
+    for (uint i = 0; i < GlobalLightCount + clusterLights.y; ++i)
     {
-        if (!Lights[i].Enabled)
-            continue;
+        Light light = Lights[GetClusterLightIndex(clusterLights, i)];
 
         LightingResult result;
         result.Diffuse = float4(0, 0, 0, 0);
         result.Specular = float4(0, 0, 0, 0);
 
-        if (Lights[i].LightType == DIRECTIONAL_LIGHT)
+        if (light.LightType == DIRECTIONAL_LIGHT)
         {
-            result = DoDirectionalLightNoNormalMap(Lights[i], pixelToEyeVectorNormalised, N);
+            result = DoDirectionalLight(light, pixelToEyeVectorNormalised, N, TBN_Inv);
         }
         else
         {
-            float3 pixelToLight = Lights[i].Position.xyz - worldPos.xyz;
+            float3 pixelToLight = light.Position.xyz - worldPos.xyz;
             float distanceToLight = length(pixelToLight);
+            if (distanceToLight > light.Range)
+                continue;
 
+            float3 L = ToShadingSpace(pixelToLight, TBN_Inv);
 
-            if (Lights[i].LightType == POINT_LIGHT)
+            if (light.LightType == POINT_LIGHT)
             {
-                result = DoPointLight(Lights[i], normalize(pixelToLight), pixelToEyeVectorNormalised, distanceToLight, N);
+                result = DoPointLight(light, L, pixelToEyeVectorNormalised, distanceToLight, N);
             }
-            else if (Lights[i].LightType == SPOT_LIGHT)
+            else if (light.LightType == SPOT_LIGHT)
             {
-                result = DoSpotLightNoNormalMap(Lights[i], pixelToLight, pixelToEyeVectorNormalised, distanceToLight, N);
+                result = DoSpotLight(light, L, pixelToEyeVectorNormalised, distanceToLight, N, TBN_Inv);
             }
         }
 
@@ -322,26 +347,28 @@ LightingResult ComputeLightingNoNormalMap(float4 worldPos, float3 N, float3 pixe
 //--------------------------------------------------------------------------------------
 // Vertex Shader
 //--------------------------------------------------------------------------------------
-PS_INPUT VS(VS_INPUT input)
+PS_INPUT TransformVertex(VS_INPUT input, matrix world, uint materialIndex)
 {
     PS_INPUT output = (PS_INPUT) 0;
-    output.Pos = mul(input.Pos, World);
+    output.MaterialIndex = materialIndex;
+    output.Pos = mul(input.Pos, world);
     output.worldPos = output.Pos;
     output.Pos = mul(output.Pos, View);
+    output.ViewDepth = output.Pos.z;
     output.Pos = mul(output.Pos, Projection);
 
     output.Tex = input.Tex;
 
 
     // multiply the normal by the world transform (to go from model space to world space)
-    output.Norm = mul(float4(input.Norm, 0), World).xyz;
+    output.Norm = mul(float4(input.Norm, 0), world).xyz;
 
     float3 vertexToEye = EyePosition.xyz - output.worldPos.xyz;
 
 
-    float3 T = normalize(mul(input.Tangent, (float3x3)World));
-    float3 B = normalize(mul(input.BiNormal, (float3x3) World));
-    float3 N = normalize(mul(input.Norm, (float3x3) World));
+    float3 T = normalize(mul(input.Tangent, (float3x3)world));
+    float3 B = normalize(mul(input.BiNormal, (float3x3) world));
+    float3 N = normalize(mul(input.Norm, (float3x3) world));
 
     float3x3 TBN = float3x3(T, B, N);
     float3x3 TBN_Inv = transpose(TBN);
@@ -357,25 +384,38 @@ PS_INPUT VS(VS_INPUT input)
 
 }
 
+PS_INPUT VS(VS_INPUT input)
+{
+    return TransformVertex(input, World, MaterialIndex);
+}
+
+// The world matrix and material come from the instance instead of the constant buffer. The rows are the
+// CPU's XMFLOAT4X4 as it is, so unlike World it isn't transposed
+PS_INPUT VSInstanced(VS_INPUT input, INSTANCE_INPUT instance)
+{
+    matrix world = float4x4(instance.World0, instance.World1, instance.World2, instance.World3);
+    return TransformVertex(input, world, instance.MaterialIndex);
+}
+
 //--------------------------------------------------------------------------------------
 // Pixel Shader
 //--------------------------------------------------------------------------------------
 
 float4 PS(PS_INPUT IN) : SV_TARGET
 {
+    Material = Materials[IN.MaterialIndex];
+
     LightingResult lit;
+    uint2 clusterLights = GetClusterLights(IN.Pos.xy, IN.ViewDepth);
     
-    if (Material.UseNormalMap)
-    {
-        float4 bumpMap = txNormalMap.Sample(samLinear, IN.Tex);
-        bumpMap = (bumpMap * 2.0f) - 1.0f;
-        bumpMap = float4(normalize(bumpMap.xyz), 1);
-        lit = ComputeLightingNormalMap(IN.worldPos, bumpMap.xyz,  normalize(IN.EyeTangentVector),IN.TBN_Inv);
-    }
-    else
-    {
-        lit = ComputeLightingNoNormalMap(IN.worldPos, normalize(IN.Norm),  normalize(IN.EyeWorldSpaceVector));
-    }
+#if USE_NORMAL_MAP
+    float4 bumpMap = txNormalMap.Sample(samLinear, IN.Tex);
+    bumpMap = (bumpMap * 2.0f) - 1.0f;
+    bumpMap = float4(normalize(bumpMap.xyz), 1);
+    lit = ComputeLighting(IN.worldPos, bumpMap.xyz, normalize(IN.EyeTangentVector), IN.TBN_Inv, clusterLights);
+#else
+    lit = ComputeLighting(IN.worldPos, normalize(IN.Norm), normalize(IN.EyeWorldSpaceVector), IN.TBN_Inv, clusterLights);
+#endif
 
 
     float4 texColor = float4(1, 1, 1, 1);
@@ -386,11 +426,10 @@ float4 PS(PS_INPUT IN) : SV_TARGET
     float4 specular = Material.Specular * lit.Specular;
     
     float4 finalColor = emissive + ambient + diffuse + specular;
-    if (Material.UseTexture)
-    {
-    	texColor = txDiffuse.Sample(samLinear, IN.Tex);
-        finalColor *= texColor;
-    }
+#if USE_TEXTURE
+    texColor = txDiffuse.Sample(samLinear, IN.Tex);
+    finalColor *= texColor;
+#endif
 
 
     return finalColor;
@@ -399,16 +438,15 @@ float4 PS(PS_INPUT IN) : SV_TARGET
 }
 float4 PSTextureUnLit(PS_INPUT IN) : SV_TARGET
 {
+    Material = Materials[IN.MaterialIndex];
+
     float4 finalColor;
-    if (Material.UseTexture)
-    {
-        float4 texColor = txDiffuse.Sample(samLinear, IN.Tex);
-        finalColor = texColor;
-    }
-    else
-    {
-        finalColor = float4(0.2, 0.2, 0.2, 1.0f);
-    }
+#if USE_TEXTURE
+    float4 texColor = txDiffuse.Sample(samLinear, IN.Tex);
+    finalColor = texColor;
+#else
+    finalColor = float4(0.2, 0.2, 0.2, 1.0f);
+#endif
 
     return finalColor;
 
@@ -425,6 +463,60 @@ float4 PSSolid(PS_INPUT input) : SV_Target
     return vOutputColor;
 }
 
+//--------------------------------------------------------------------------------------
+// G-buffer versions of the pixel shaders above, for the deferred path
+//--------------------------------------------------------------------------------------
+struct GBUFFER_OUTPUT
+{
+    float4 Colour : SV_Target0;
+    float4 Albedo : SV_Target1;
+    float4 Normal : SV_Target2;
+};
+
+// Left black and flagged unlit, so the lighting pass adds nothing to the colour written here
+GBUFFER_OUTPUT UnlitGBufferOutput(float4 colour)
+{
+    GBUFFER_OUTPUT output;
+    output.Colour = colour;
+    output.Albedo = float4(0, 0, 0, 0);
+    output.Normal = float4(0.5f, 0.5f, 0, 0);
+    return output;
+}
+
+GBUFFER_OUTPUT PSGBuffer(PS_INPUT IN)
+{
+    Material = Materials[IN.MaterialIndex];
+
+    float3 N = normalize(IN.Norm);
+#if USE_NORMAL_MAP
+    float3 bumpMap = normalize(txNormalMap.Sample(samLinear, IN.Tex).xyz * 2.0f - 1.0f);
+    // TBN_Inv takes world space to tangent space, its transpose takes the map back
+    N = normalize(mul(bumpMap, transpose(IN.TBN_Inv)));
+#endif
+
+    float4 texColor = float4(1, 1, 1, 1);
+#if USE_TEXTURE
+    texColor = txDiffuse.Sample(samLinear, IN.Tex);
+#endif
+
+    // Same terms as PS, the specular colour is kept as its average
+    GBUFFER_OUTPUT output;
+    output.Colour = (Material.Emissive + Material.Ambient * GlobalAmbient) * texColor;
+    output.Albedo = float4((Material.Diffuse * texColor).rgb, EncodeSpecularPower(Material.SpecularPower));
+    output.Normal = float4(EncodeNormal(N), dot((Material.Specular * texColor).rgb, 1.0f / 3.0f), 1.0f);
+    return output;
+}
+
+GBUFFER_OUTPUT PSGBufferTextureUnLit(PS_INPUT IN)
+{
+    return UnlitGBufferOutput(PSTextureUnLit(IN));
+}
+
+GBUFFER_OUTPUT PSGBufferSolid(PS_INPUT IN)
+{
+    return UnlitGBufferOutput(PSSolid(IN));
+}
+
 struct QuadVS_Input
 {
     float4 Pos : POSITION;
@@ -454,3 +546,30 @@ float4 QuadPS(QuadVS_Output Input) : SV_TARGET
 
     return vColor;
 }
+
+//--------------------------------------------------------------------------------------
+// Deferred lighting, a full screen quad added over the colour the G-buffer pass wrote
+//--------------------------------------------------------------------------------------
+float4 PSDeferredLighting(QuadVS_Output IN) : SV_TARGET
+{
+    int3 pixel = int3(IN.Pos.xy, 0);
+    float4 normalSample = GBufferNormal.Load(pixel);
+    if (normalSample.a < 0.5f)
+        return float4(0, 0, 0, 0);
+
+    float4 albedoSample = GBufferAlbedo.Load(pixel);
+
+    // Back from the depth buffer to world space, y flips between texture and clip space
+    float2 clipXY = float2(IN.Tex.x * 2.0f - 1.0f, 1.0f - IN.Tex.y * 2.0f);
+    float4 worldPos = mul(float4(clipXY, GBufferDepth.Load(pixel), 1.0f), InverseViewProjection);
+    worldPos /= worldPos.w;
+
+    uint2 clusterLights = GetClusterLights(IN.Pos.xy, mul(worldPos, DeferredView).z);
+
+    // The lighting functions read the power from the material. The G-buffer's normals are in world space, which is
+    // what this is compiled for without USE_NORMAL_MAP
+    Material.SpecularPower = DecodeSpecularPower(albedoSample.a);
+    LightingResult lit = ComputeLighting(worldPos, DecodeNormal(normalSample.rg), normalize(EyePosition.xyz - worldPos.xyz), (float3x3)0, clusterLights);
+
+    return float4(albedoSample.rgb * lit.Diffuse.rgb + normalSample.b * lit.Specular.rgb, 0.0f);
+}
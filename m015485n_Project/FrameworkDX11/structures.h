@@ -1,6 +1,8 @@
 #pragma once
 #include <d3d11.h>
 #include <DirectXMath.h>
+#include <DirectXCollision.h>
+#include <memory>
 #include <vector>
 #include <wrl/client.h>
 
@@ -19,6 +21,15 @@ struct SimpleVertex
 	XMFLOAT3 Tangent;
 	XMFLOAT3 BiNormal;
 };
+// A mesh's positions and triangles kept on the CPU, for the occlusion culler to rasterize
+struct OccluderMesh
+{
+	std::vector<XMFLOAT3> Positions;
+	std::vector<UINT> Indices;
+};
+
+class MeshBvh;
+
 struct MeshData
 {
 	Microsoft::WRL::ComPtr<ID3D11Buffer> VertexBuffer;
@@ -27,6 +38,15 @@ struct MeshData
 	UINT VBOffset;
 	UINT IndexCount;
 	UINT VertexCount;
+
+	// Local space, transformed into each object's world bounds for culling
+	DirectX::BoundingBox Bounds;
+
+	// Shared by every object using the mesh, only rasterized for objects marked as occluders
+	std::shared_ptr<const OccluderMesh> Occluder;
+
+	// Triangle tree over the same positions, for picking. Built once per mesh when it is loaded
+	std::shared_ptr<const MeshBvh> PickingBvh;
 };
 
 struct SCREEN_VERTEX
@@ -237,12 +257,30 @@ inline void CalculateModelVectorsSharedVertices(vector<SimpleVertex>& vertices,
 	}
 }
 
-struct ConstantBuffer
+// The camera, b0 in both stages. Written once a frame
+struct FrameConstantBuffer
 {
-	XMMATRIX mWorld;
 	XMMATRIX mView;
 	XMMATRIX mProjection;
-	XMFLOAT4 vOutputColor;
+	XMFLOAT4 EyePosition;
+};
+
+// One object, b3 in the vertex shader. Each draw gets its own copy in the scene's ConstantRingBuffer
+struct ObjectConstantBuffer
+{
+	XMMATRIX mWorld;
+	UINT MaterialIndex;
+	UINT Padding[3];
+};
+
+// What every draw wrote when the camera and object constants were one buffer, to compare the uploads against
+constexpr UINT UNSPLIT_CONSTANT_BUFFER_SIZE = sizeof(FrameConstantBuffer) + sizeof(ObjectConstantBuffer);
+
+// Read by the deferred lighting pass to work each pixel's position back out from depth
+struct DeferredConstantBuffer
+{
+	XMMATRIX mInverseViewProjection;
+	XMMATRIX mView;
 };
 
 struct _Material
@@ -302,6 +340,8 @@ struct Light
 		, QuadraticAttenuation(0.0f)
 		, LightType(DirectionalLight)
 		, Enabled(0)
+		, Range(0.0f)
+		, Padding(0)
 	{
 	}
 
@@ -318,23 +358,29 @@ struct Light
 	//----------------------------------- (16 byte boundary)
 	int         LightType;
 	int         Enabled;
+	// How far the light reaches, filled in for the lights that are uploaded, see LightClusterGrid::ComputeLightRange
+	float       Range;
 	// Add some padding to make this struct size a multiple of 16 bytes.
-	int         Padding[2];
+	int         Padding;
 	//----------------------------------- (16 byte boundary)
 };  // Total:                              80 bytes ( 5 * 16 )
 
 struct LightPropertiesConstantBuffer
 {
 	LightPropertiesConstantBuffer()
-		: EyePosition(0, 0, 0, 1)
-		, GlobalAmbient(0.2f, 0.2f, 0.8f, 1.0f)
+		: GlobalAmbient(0.2f, 0.2f, 0.8f, 1.0f)
 	{
 	}
 
-	DirectX::XMFLOAT4   EyePosition;
-	//----------------------------------- (16 byte boundary)
+	// The eye is in FrameConstantBuffer, so this only changes with the lights
 	DirectX::XMFLOAT4   GlobalAmbient;
 	//----------------------------------- (16 byte boundary)
 	int LightCount;
-	DirectX::XMFLOAT3 Padding; // align to 16 bytes
-};  // Total:                                  672 bytes (42 * 16)
\ No newline at end of file
+	// Lights come from the cluster each pixel is in, these find it, see LightClusterGrid
+	UINT GlobalLightCount;
+	float ClusterDepthScale;
+	float ClusterDepthBias;
+	//----------------------------------- (16 byte boundary)
+	DirectX::XMFLOAT2 ClusterTileScale; // clusters per pixel
+	DirectX::XMFLOAT2 Padding; // align to 16 bytes
+};  // Total:                                  48 bytes (3 * 16)
\ No newline at end of file